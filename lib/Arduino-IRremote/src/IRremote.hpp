@@ -204,7 +204,7 @@
 #define SEND_PWM_BY_TIMER       // the best and default method for ESP32 etc.
 #warning INFO: For ESP32, RP2040, mbed and particle boards SEND_PWM_BY_TIMER is enabled by default. If this is not intended, deactivate the line in IRremote.hpp over this warning message in file IRremote.hpp.
 #  endif
-#else
+#elif !defined(ESP8266) // the ESP8266 waveform generator drives any pin, so IrSender.sendPin stays selectable
 #  if defined(SEND_PWM_BY_TIMER)
 #    if defined(IR_SEND_PIN)
 #undef IR_SEND_PIN // to avoid warning 3 lines later
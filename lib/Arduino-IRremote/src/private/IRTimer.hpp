@@ -1330,7 +1330,48 @@ void timerConfigForSend(uint16_t aFrequencyKHz) {
 
 #elif defined(ESP8266)
 #  if defined(SEND_PWM_BY_TIMER)
-#error "No support for hardware PWM generation for ESP8266"
+/*
+ * The PWM is generated by the core waveform generator, which is driven by the hardware timer1 NMI.
+ * Since receive also uses timer1, sending and receiving at the same time is not possible.
+ * Call IrReceiver.stop() before and IrReceiver.start() after sending, if receive is used too.
+ */
+#include <core_esp8266_waveform.h>
+
+uint32_t sESP8266PWMOnMicros; // set by timerConfigForSend()
+uint32_t sESP8266PWMOffMicros;
+
+void enableSendPWMByTimer() {
+#    if defined(IR_SEND_PIN)
+    startWaveform(IR_SEND_PIN, sESP8266PWMOnMicros, sESP8266PWMOffMicros, 0);
+#    else
+    startWaveform(IrSender.sendPin, sESP8266PWMOnMicros, sESP8266PWMOffMicros, 0);
+#    endif
+}
+void disableSendPWMByTimer() {
+#    if defined(IR_SEND_PIN)
+    stopWaveform(IR_SEND_PIN);
+    digitalWrite(IR_SEND_PIN, LOW);
+#    else
+    stopWaveform(IrSender.sendPin);
+    digitalWrite(IrSender.sendPin, LOW);
+#    endif
+}
+
+/*
+ * timerConfigForSend() is used exclusively by IRsend::enableIROut()
+ * We do not call timerDisableReceiveInterrupt() here, since timer1_detachInterrupt() would also disable the running waveform generator.
+ */
+void timerConfigForSend(uint16_t aFrequencyKHz) {
+#    if defined(IR_SEND_PIN)
+    pinMode(IR_SEND_PIN, OUTPUT);
+#    else
+    pinMode(IrSender.sendPin, OUTPUT);
+#    endif
+
+    uint32_t tPeriodMicros = (1000U + (aFrequencyKHz / 2)) / aFrequencyKHz; // rounded value -> 26 for 38.46 kHz
+    sESP8266PWMOnMicros = ((tPeriodMicros * IR_SEND_DUTY_CYCLE_PERCENT) + 50) / 100U;
+    sESP8266PWMOffMicros = tPeriodMicros - sESP8266PWMOnMicros;
+}
 #  endif // defined(SEND_PWM_BY_TIMER)
 
 // Undefine ISR, because we register/call the plain function IRReceiveTimerInterruptHandler()
@@ -0,0 +1,56 @@
+# Compresses the static web files and embeds them as PROGMEM arrays in src/webassets.h.
+# Runs before every PlatformIO build (extra_scripts), can also be run directly: python scripts/embed_web.py
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.getcwd()
+
+# (source file, C identifier)
+ASSETS = [
+    ("web/style.css", "STYLE_CSS"),
+]
+
+OUTPUT = os.path.join(PROJECT_DIR, "src", "webassets.h")
+
+
+def embed(path, name):
+    with open(os.path.join(PROJECT_DIR, path), "rb") as f:
+        data = f.read()
+    packed = gzip.compress(data, compresslevel=9, mtime=0)
+    etag = hashlib.sha1(data).hexdigest()[:16]
+    lines = ["// %s, %d bytes, %d bytes gzipped" % (path, len(data), len(packed))]
+    lines.append('const char %s_ETAG[] = "\\"%s\\"";' % (name, etag))
+    lines.append("const size_t %s_GZ_LENGTH = %d;" % (name, len(packed)))
+    lines.append("const uint8_t %s_GZ[] PROGMEM = {" % name)
+    for i in range(0, len(packed), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+content = "\n".join([
+    "#include <Arduino.h>",
+    "#ifndef webassets_h",
+    "#define webassets_h",
+    "",
+    "// Generated by scripts/embed_web.py from web/, do not edit",
+    "",
+    "\n\n".join(embed(path, name) for path, name in ASSETS),
+    "",
+    "#endif",
+    "",
+])
+
+# Only touch the header if something changed, so it doesn't trigger a rebuild every time
+old = None
+if os.path.exists(OUTPUT):
+    with open(OUTPUT) as f:
+        old = f.read()
+if content != old:
+    with open(OUTPUT, "w") as f:
+        f.write(content)
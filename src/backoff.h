@@ -0,0 +1,77 @@
+#include <Arduino.h>
+#ifndef backoff_h
+#define backoff_h
+
+/*
+ * Exponential backoff with jitter. The delay doubles after every failure up to maxDelay and is then
+ * randomized to 50-100 %. With a per device seed (e.g. from the MAC) many devices that lost the same
+ * server don't retry in lockstep.
+ */
+class Backoff
+{
+public:
+    Backoff(unsigned long minDelay, unsigned long maxDelay) : minDelay(minDelay), maxDelay(maxDelay) {}
+
+    void seed(const uint8_t *data, size_t length)
+    {
+        // FNV-1a
+        state = 2166136261UL;
+        for (size_t i = 0; i < length; i++)
+        {
+            state = (state ^ data[i]) * 16777619UL;
+        }
+        if (state == 0)
+        {
+            state = 1;
+        }
+    }
+
+    // True if no attempt failed yet or the delay after the last failure is over
+    bool due() const
+    {
+        return failureCount == 0 || (millis() - lastFailure) >= currentDelay;
+    }
+
+    void failed()
+    {
+        unsigned long base = minDelay;
+        for (uint8_t i = 0; i < failureCount && base < maxDelay; i++)
+        {
+            base *= 2;
+        }
+        if (base > maxDelay)
+        {
+            base = maxDelay;
+        }
+        currentDelay = base / 2 + next() % (base / 2 + 1);
+        lastFailure = millis();
+        if (failureCount < 0xFF)
+        {
+            failureCount++;
+        }
+    }
+
+    void reset() { failureCount = 0; }
+
+    unsigned long delay() const { return currentDelay; } // delay after the last failure (in ms)
+    uint8_t failures() const { return failureCount; }   // failures since last reset()
+
+private:
+    // xorshift32
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    unsigned long minDelay;
+    unsigned long maxDelay;
+    unsigned long currentDelay = 0;
+    unsigned long lastFailure = 0;
+    uint32_t state = 1;
+    uint8_t failureCount = 0;
+};
+
+#endif
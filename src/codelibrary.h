@@ -0,0 +1,359 @@
+#include <Arduino.h>
+#ifndef codelibrary_h
+#define codelibrary_h
+
+#include <FS.h>
+
+const uint8_t CODE_NAME_SIZE = 48;              // max. name length + 1
+const uint32_t CODE_LIBRARY_MAGIC = 0x4C435249; // "IRCL"
+const uint32_t CODE_LIBRARY_VERSION = 2; // 2: rawUnit
+const char CODE_LIBRARY_PATH[] = "/codes.bin";
+const char CODE_LIBRARY_TEMP_PATH[] = "/codes.tmp";
+
+// Stored code, also the fixed part of a record on flash (little endian, packed)
+typedef struct __attribute__((packed))
+{
+    uint8_t protocol;
+    uint16_t address;
+    uint16_t command;
+    uint8_t repeats;
+    uint8_t khz;          // raw codes only
+    uint16_t rawLength;   // number of raw timings, 0 for protocol codes
+    uint16_t repeatStart; // first raw timing played for repeats
+    uint8_t rawUnit;      // 0: raw timings stored as uint16_t in us, else as uint8_t in units of rawUnit us (learned codes)
+} irCode_t;
+
+// Size of the stored raw timings
+uint32_t codeRawSize(const irCode_t &code)
+{
+    return code.rawLength * (code.rawUnit == 0 ? sizeof(uint16_t) : sizeof(uint8_t));
+}
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+} codeLibraryHeader_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t hash; // FNV-1a of the name, index is sorted by it
+    uint32_t offset;
+} codeIndexEntry_t;
+
+// Names are used in topics and acknowledgments, so only a safe charset is allowed
+bool isValidCodeName(const char *name, uint16_t length)
+{
+    if (length == 0 || length >= CODE_NAME_SIZE)
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < length; i++)
+    {
+        char c = name[i];
+        if (!isalnum(c) && c != '-' && c != '_' && c != '.' && c != ':' && c != '/')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Named IR codes in one file:
+ *   header | index: count x {hash, offset}, sorted by hash | records: {nameLength, name, irCode_t, raw timings}
+ * Lookups binary search the index directly in the file, so only a few entries are read and nothing is kept in RAM.
+ * Changes rewrite the file to a temporary file in two sequential passes (index, then records) and rename it,
+ * so a power loss keeps the old library. Records of removed or replaced codes are dropped on the way.
+ */
+class CodeLibrary
+{
+public:
+    bool begin(fs::FS &fs)
+    {
+        this->fs = &fs;
+        return open();
+    }
+
+    uint32_t count() const { return entries; }
+
+    // Look up a code by name. Raw timings are read into timings (in us) if the code has them, false if more than maxTimings.
+    bool find(const char *name, uint8_t nameLength, irCode_t &code, uint16_t *timings, uint16_t maxTimings)
+    {
+        uint32_t offset;
+        if (!locate(name, nameLength, nullptr, &offset))
+        {
+            return false;
+        }
+        if (!file.seek(offset + 1 + nameLength) || file.read((uint8_t *)&code, sizeof(code)) != sizeof(code))
+        {
+            return false;
+        }
+        if (code.rawLength > 0)
+        {
+            if (code.rawLength > maxTimings || timings == nullptr)
+            {
+                return false;
+            }
+            size_t size = codeRawSize(code);
+            if (code.rawUnit == 0)
+            {
+                return file.read((uint8_t *)timings, size) == size;
+            }
+            // Expand in place: the bytes are read behind the first rawLength bytes, entry i only overwrites bytes already expanded
+            uint8_t *units = (uint8_t *)timings + code.rawLength;
+            if (file.read(units, size) != size)
+            {
+                return false;
+            }
+            for (uint16_t i = 0; i < code.rawLength; i++)
+            {
+                timings[i] = units[i] * code.rawUnit;
+            }
+        }
+        return true;
+    }
+
+    // Add or replace a code, timings in the format given by code.rawUnit
+    bool store(const char *name, uint8_t nameLength, const irCode_t &code, const void *timings)
+    {
+        if (!isValidCodeName(name, nameLength))
+        {
+            return false;
+        }
+        return rewrite(name, nameLength, &code, timings);
+    }
+
+    bool remove(const char *name, uint8_t nameLength)
+    {
+        uint32_t position;
+        if (!locate(name, nameLength, &position, nullptr))
+        {
+            return false;
+        }
+        return rewrite(name, nameLength, nullptr, nullptr);
+    }
+
+    // Name of the code at index position (hash order), name needs CODE_NAME_SIZE bytes
+    bool nameAt(uint32_t position, char *name)
+    {
+        codeIndexEntry_t entry;
+        uint8_t length;
+        if (!readEntry(position, entry) || !file.seek(entry.offset) || file.read(&length, 1) != 1 ||
+            length >= CODE_NAME_SIZE || file.read((uint8_t *)name, length) != length)
+        {
+            return false;
+        }
+        name[length] = '\0';
+        return true;
+    }
+
+    static uint32_t hash(const char *name, uint8_t length)
+    {
+        // FNV-1a
+        uint32_t value = 2166136261UL;
+        for (uint8_t i = 0; i < length; i++)
+        {
+            value = (value ^ (uint8_t)name[i]) * 16777619UL;
+        }
+        return value;
+    }
+
+private:
+    bool open()
+    {
+        codeLibraryHeader_t header;
+        entries = 0;
+        if (file)
+        {
+            file.close();
+        }
+        if (!fs->exists(CODE_LIBRARY_PATH))
+        {
+            if (!fs->exists(CODE_LIBRARY_TEMP_PATH) || !fs->rename(CODE_LIBRARY_TEMP_PATH, CODE_LIBRARY_PATH))
+            {
+                return true; // empty library
+            }
+        }
+        file = fs->open(CODE_LIBRARY_PATH, "r");
+        if (!file || file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.magic != CODE_LIBRARY_MAGIC ||
+            header.version != CODE_LIBRARY_VERSION || sizeof(header) + header.count * sizeof(codeIndexEntry_t) > file.size())
+        {
+            file.close();
+            return false;
+        }
+        entries = header.count;
+        return true;
+    }
+
+    bool readEntry(uint32_t position, codeIndexEntry_t &entry)
+    {
+        return position < entries && file.seek(sizeof(codeLibraryHeader_t) + position * sizeof(codeIndexEntry_t)) &&
+               file.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry);
+    }
+
+    // First index position with hash >= value
+    uint32_t lowerBound(uint32_t value)
+    {
+        uint32_t low = 0;
+        uint32_t high = entries;
+        codeIndexEntry_t entry;
+        while (low < high)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            if (!readEntry(middle, entry))
+            {
+                return entries;
+            }
+            if (entry.hash < value)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    // Index position and record offset of name, names with the same hash are compared one by one
+    bool locate(const char *name, uint8_t nameLength, uint32_t *position, uint32_t *offset)
+    {
+        uint32_t value = hash(name, nameLength);
+        codeIndexEntry_t entry;
+        for (uint32_t i = lowerBound(value); readEntry(i, entry) && entry.hash == value; i++)
+        {
+            char stored[CODE_NAME_SIZE];
+            uint8_t length;
+            if (file.seek(entry.offset) && file.read(&length, 1) == 1 && length == nameLength &&
+                file.read((uint8_t *)stored, length) == length && memcmp(stored, name, length) == 0)
+            {
+                if (position != nullptr)
+                    *position = i;
+                if (offset != nullptr)
+                    *offset = entry.offset;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t recordSize(uint32_t offset)
+    {
+        uint8_t nameLength;
+        irCode_t code;
+        if (!file.seek(offset) || file.read(&nameLength, 1) != 1 || !file.seek(offset + 1 + nameLength) ||
+            file.read((uint8_t *)&code, sizeof(code)) != sizeof(code))
+        {
+            return 0;
+        }
+        return 1 + nameLength + sizeof(code) + codeRawSize(code);
+    }
+
+    bool copyRecord(fs::File &out, uint32_t offset, uint32_t size)
+    {
+        uint8_t chunk[64];
+        if (!file.seek(offset))
+        {
+            return false;
+        }
+        while (size > 0)
+        {
+            size_t length = min((uint32_t)sizeof(chunk), size);
+            if (file.read(chunk, length) != length || out.write(chunk, length) != length)
+            {
+                return false;
+            }
+            size -= length;
+        }
+        return true;
+    }
+
+    // code == nullptr: remove name
+    bool rewrite(const char *name, uint8_t nameLength, const irCode_t *code, const void *timings)
+    {
+        uint32_t value = hash(name, nameLength);
+        uint32_t replaced;
+        bool exists = locate(name, nameLength, &replaced, nullptr);
+        uint32_t insertAt = exists ? replaced : lowerBound(value);
+        uint32_t newSize = (code == nullptr) ? 0 : 1 + nameLength + sizeof(irCode_t) + codeRawSize(*code);
+
+        codeLibraryHeader_t header;
+        header.magic = CODE_LIBRARY_MAGIC;
+        header.version = CODE_LIBRARY_VERSION;
+        header.count = entries - (exists ? 1 : 0) + (code != nullptr ? 1 : 0);
+
+        fs::File out = fs->open(CODE_LIBRARY_TEMP_PATH, "w");
+        if (!out || out.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+        {
+            return false;
+        }
+
+        // Pass 0 writes the index with the new offsets, pass 1 the records in the same order
+        bool ok = true;
+        for (uint8_t pass = 0; pass < 2 && ok; pass++)
+        {
+            uint32_t offset = sizeof(header) + header.count * sizeof(codeIndexEntry_t);
+            for (uint32_t i = 0; i <= entries && ok; i++)
+            {
+                if (i == insertAt && code != nullptr)
+                {
+                    if (pass == 0)
+                    {
+                        codeIndexEntry_t entry = {value, offset};
+                        ok = out.write((const uint8_t *)&entry, sizeof(entry)) == sizeof(entry);
+                    }
+                    else
+                    {
+                        size_t rawSize = codeRawSize(*code);
+                        ok = out.write(&nameLength, 1) == 1 && out.write((const uint8_t *)name, nameLength) == nameLength &&
+                             out.write((const uint8_t *)code, sizeof(irCode_t)) == sizeof(irCode_t) &&
+                             (rawSize == 0 || out.write((const uint8_t *)timings, rawSize) == rawSize);
+                    }
+                    offset += newSize;
+                }
+                codeIndexEntry_t entry;
+                if (i == entries || (exists && i == replaced))
+                {
+                    continue;
+                }
+                uint32_t size = 0;
+                ok = ok && readEntry(i, entry) && (size = recordSize(entry.offset)) != 0;
+                if (ok && pass == 0)
+                {
+                    codeIndexEntry_t moved = {entry.hash, offset};
+                    ok = out.write((const uint8_t *)&moved, sizeof(moved)) == sizeof(moved);
+                }
+                else if (ok)
+                {
+                    ok = copyRecord(out, entry.offset, size);
+                }
+                offset += size;
+            }
+        }
+        out.close();
+
+        if (!ok)
+        {
+            fs->remove(CODE_LIBRARY_TEMP_PATH);
+            return false;
+        }
+        file.close();
+        if (!fs->rename(CODE_LIBRARY_TEMP_PATH, CODE_LIBRARY_PATH))
+        {
+            // FS without atomic replace, open() recovers the temporary file after a power loss here
+            fs->remove(CODE_LIBRARY_PATH);
+            if (!fs->rename(CODE_LIBRARY_TEMP_PATH, CODE_LIBRARY_PATH))
+            {
+                return false;
+            }
+        }
+        return open();
+    }
+
+    fs::FS *fs = nullptr;
+    fs::File file;
+    uint32_t entries = 0;
+};
+
+CodeLibrary codeLibrary;
+
+#endif
@@ -0,0 +1,302 @@
+#include <Arduino.h>
+#ifndef commandreader_h
+#define commandreader_h
+
+// Max. nesting of skipped JSON values
+const uint8_t COMMAND_READER_MAX_DEPTH = 8;
+
+/*
+ * Minimal in-place JSON reader. Works directly on the (not null terminated) payload buffer,
+ * never allocates and touches every character only once, so malformed input is rejected in bounded time.
+ * Strings are returned as pointer and length into the buffer, escapes are not decoded.
+ */
+class CommandReader
+{
+public:
+    CommandReader(const char *data, unsigned int length) : pos(data), end(data + length), lastOpen(nullptr) {}
+
+    bool beginObject() { return expect('{'); }
+
+    // Starts an array if the next character is '['. Does not fail otherwise.
+    bool beginArray()
+    {
+        skipWhitespace();
+        return (pos < end && *pos == '[') ? expect('[') : false;
+    }
+
+    // Moves to the next element of the current array. Returns false at the end of the array or on error.
+    bool nextElement() { return nextItem(']'); }
+
+    // Reads the next member key of the current object. Returns false at the end of the object or on error.
+    bool nextMember(const char *&key, uint16_t &keyLength)
+    {
+        if (!nextItem('}'))
+        {
+            return false;
+        }
+        if (!readString(key, keyLength))
+        {
+            return false;
+        }
+        return expect(':');
+    }
+
+    // Reads a string (without quotes) or a number/literal as text
+    bool readToken(const char *&value, uint16_t &valueLength)
+    {
+        skipWhitespace();
+        if (pos < end && *pos == '"')
+        {
+            return readString(value, valueLength);
+        }
+        value = pos;
+        while (pos < end && isTokenChar(*pos))
+        {
+            pos++;
+        }
+        valueLength = pos - value;
+        if (valueLength == 0)
+        {
+            return fail(PSTR("value expected"));
+        }
+        return true;
+    }
+
+    // Skips any value including nested objects and arrays (iterative, no recursion)
+    bool skipValue()
+    {
+        skipWhitespace();
+        if (pos >= end)
+        {
+            return fail(PSTR("value expected"));
+        }
+        if (*pos != '{' && *pos != '[')
+        {
+            const char *value;
+            uint16_t valueLength;
+            return readToken(value, valueLength);
+        }
+
+        uint8_t depth = 0;
+        while (pos < end)
+        {
+            char c = *pos;
+            if (c == '"')
+            {
+                const char *value;
+                uint16_t valueLength;
+                if (!readString(value, valueLength))
+                {
+                    return false;
+                }
+                continue;
+            }
+            pos++;
+            if (c == '{' || c == '[')
+            {
+                if (++depth > COMMAND_READER_MAX_DEPTH)
+                {
+                    return fail(PSTR("nesting too deep"));
+                }
+            }
+            else if (c == '}' || c == ']')
+            {
+                if (--depth == 0)
+                {
+                    return true;
+                }
+            }
+        }
+        return fail(PSTR("unexpected end"));
+    }
+
+    // True if only whitespace is left
+    bool atEnd()
+    {
+        skipWhitespace();
+        return pos >= end;
+    }
+
+    bool failed() const { return error != nullptr; }
+    PGM_P errorMessage() const { return error; }
+
+    bool fail(PGM_P message)
+    {
+        if (error == nullptr)
+        {
+            error = message;
+        }
+        return false;
+    }
+
+protected:
+    // Handles the separator before the next item of an object or array. Returns false at the closing character.
+    bool nextItem(char closing)
+    {
+        if (failed())
+        {
+            return false;
+        }
+        skipWhitespace();
+        if (pos < end && *pos == closing)
+        {
+            pos++;
+            return false;
+        }
+        if (pos != lastOpen)
+        {
+            if (!expect(','))
+            {
+                return false;
+            }
+            skipWhitespace();
+        }
+        return true;
+    }
+
+    bool expect(char c)
+    {
+        skipWhitespace();
+        if (pos >= end || *pos != c)
+        {
+            return fail(PSTR("unexpected character"));
+        }
+        pos++;
+        if (c == '{' || c == '[')
+        {
+            skipWhitespace();
+            lastOpen = pos;
+        }
+        return true;
+    }
+
+    bool readString(const char *&value, uint16_t &valueLength)
+    {
+        skipWhitespace();
+        if (pos >= end || *pos != '"')
+        {
+            return fail(PSTR("string expected"));
+        }
+        pos++;
+        value = pos;
+        while (pos < end && *pos != '"')
+        {
+            if ((uint8_t)*pos < 0x20)
+            {
+                return fail(PSTR("control character in string"));
+            }
+            if (*pos == '\\')
+            {
+                pos++;
+            }
+            pos++;
+        }
+        if (pos >= end)
+        {
+            return fail(PSTR("unterminated string"));
+        }
+        valueLength = pos - value;
+        pos++;
+        return true;
+    }
+
+    void skipWhitespace()
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n'))
+        {
+            pos++;
+        }
+    }
+
+    static bool isTokenChar(char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '-' || c == '+';
+    }
+
+    const char *pos;
+    const char *end;
+    const char *lastOpen; // position right after the last '{' or '['
+    PGM_P error = nullptr;
+};
+
+bool tokenEquals(const char *token, uint16_t length, const char *literal)
+{
+    return strlen(literal) == length && strncmp(token, literal, length) == 0;
+}
+
+// Parse hex value like strtoull(..., 16), optionally prefixed with 0x. Fails on empty input, junk or overflow.
+bool parseHex(const char *token, uint16_t length, uint32_t max, uint32_t &value)
+{
+    if (length > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+    {
+        token += 2;
+        length -= 2;
+    }
+    if (length == 0)
+    {
+        return false;
+    }
+    value = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        char c = token[i];
+        uint8_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        value = (value << 4) | digit;
+        if (value > max)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseDec(const char *token, uint16_t length, uint32_t max, uint32_t &value)
+{
+    if (length == 0)
+    {
+        return false;
+    }
+    value = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (token[i] - '0');
+        if (value > max)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decimal up to 15 digits, e.g. epoch ms
+bool parseDec64(const char *token, uint16_t length, uint64_t &value)
+{
+    if (length == 0 || length > 15)
+    {
+        return false;
+    }
+    value = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (token[i] - '0');
+    }
+    return true;
+}
+
+#endif
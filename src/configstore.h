@@ -0,0 +1,314 @@
+#include <Arduino.h>
+#ifndef configstore_h
+#define configstore_h
+
+const uint32_t CONFIG_STORE_SECTOR_SIZE = 4096;
+const uint32_t CONFIG_STORE_MAGIC = 0x47464349; // "ICFG"
+const uint16_t CONFIG_STORE_MAX_VALUE = 64;     // max. size of one value (in bytes)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence; // incremented on every rotation, highest valid sector is the active one
+    uint32_t crc;      // over magic and sequence
+} configSectorHeader_t;
+
+typedef struct
+{
+    uint16_t key; // 0xFFFF: erased, end of log
+    uint16_t length;
+    uint32_t crc; // over key, length and value
+} configRecordHeader_t;
+
+// CRC-32 (IEEE), bitwise to save the table
+uint32_t configCRC32(const void *data, size_t length, uint32_t crc = 0xFFFFFFFF)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= bytes[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+// Flash access of the ESP8266 core. Addresses and sizes are multiples of 4.
+class ESPConfigFlash
+{
+public:
+    bool read(uint32_t address, uint32_t *data, size_t size) { return ESP.flashRead(address, data, size); }
+    bool write(uint32_t address, const uint32_t *data, size_t size) { return ESP.flashWrite(address, data, size); }
+    bool erase(uint32_t sector) { return ESP.flashEraseSector(sector); }
+};
+
+/*
+ * Log-structured key/value store in a ring of flash sectors. Every write appends one record
+ * (header with CRC + value) to the active sector, the last valid record of a key wins. Records
+ * with a wrong CRC (torn writes) are skipped. If the active sector is full, the latest record of
+ * every key is copied to the next sector of the ring, which becomes active when its header is
+ * written as the very last step. So a power loss at any time keeps either the old or the new state,
+ * and erases are spread over all sectors.
+ * Flash is a template parameter, so the store can run against a simulated flash on the host.
+ */
+template <class Flash>
+class ConfigStore
+{
+public:
+    // sectors: at least 2, the next sector is erased before the active one is given up
+    ConfigStore(Flash &flash, uint32_t firstSector, uint8_t sectors) : flash(flash), firstSector(firstSector), sectors(sectors) {}
+
+    // Find the active sector, returns false if the store is empty (no valid sector)
+    bool begin()
+    {
+        configSectorHeader_t header;
+        bool found = false;
+        for (uint8_t i = 0; i < sectors; i++)
+        {
+            if (readHeader(i, header) && (!found || (int32_t)(header.sequence - sequence) > 0))
+            {
+                found = true;
+                active = i;
+                sequence = header.sequence;
+            }
+        }
+        if (!found)
+        {
+            active = NO_SECTOR;
+            return false;
+        }
+        position = scan(active, NO_KEY, nullptr, nullptr);
+        return true;
+    }
+
+    // Read the latest value of key, false if not found or size differs
+    bool read(uint16_t key, void *data, uint16_t size)
+    {
+        uint32_t address;
+        uint16_t length;
+        if (active == NO_SECTOR)
+        {
+            return false;
+        }
+        scan(active, key, &address, &length);
+        if (address == 0 || length != size)
+        {
+            return false;
+        }
+        uint32_t value[CONFIG_STORE_MAX_VALUE / 4];
+        if (!flash.read(address + sizeof(configRecordHeader_t), value, padded(length)))
+        {
+            return false;
+        }
+        memcpy(data, value, size);
+        return true;
+    }
+
+    bool write(uint16_t key, const void *data, uint16_t size)
+    {
+        if (size > CONFIG_STORE_MAX_VALUE || key == NO_KEY)
+        {
+            return false;
+        }
+        if (active == NO_SECTOR)
+        {
+            // Empty store, start with a fresh sector
+            if (!flash.erase(firstSector) || !writeHeader(0, sequence + 1))
+            {
+                return false;
+            }
+            active = 0;
+            sequence++;
+            position = sizeof(configSectorHeader_t);
+        }
+        if (position + sizeof(configRecordHeader_t) + padded(size) > CONFIG_STORE_SECTOR_SIZE)
+        {
+            return rotate(key, data, size);
+        }
+        return append(sectorAddress(active), key, data, size);
+    }
+
+    // Erase all sectors
+    bool format()
+    {
+        for (uint8_t i = 0; i < sectors; i++)
+        {
+            if (!flash.erase(firstSector + i))
+            {
+                return false;
+            }
+        }
+        active = NO_SECTOR;
+        return true;
+    }
+
+    uint32_t rotations() const { return sequence; }
+    uint32_t used() const { return (active == NO_SECTOR) ? 0 : position; } // bytes used in active sector
+
+private:
+    static const uint8_t NO_SECTOR = 0xFF;
+    static const uint16_t NO_KEY = 0xFFFF;
+
+    static uint16_t padded(uint16_t length) { return (length + 3) & ~3; }
+    uint32_t sectorAddress(uint8_t sector) const { return (firstSector + sector) * CONFIG_STORE_SECTOR_SIZE; }
+
+    bool readHeader(uint8_t sector, configSectorHeader_t &header)
+    {
+        if (!flash.read(sectorAddress(sector), (uint32_t *)&header, sizeof(header)))
+        {
+            return false;
+        }
+        return header.magic == CONFIG_STORE_MAGIC && header.crc == configCRC32(&header, offsetof(configSectorHeader_t, crc));
+    }
+
+    bool writeHeader(uint8_t sector, uint32_t newSequence)
+    {
+        configSectorHeader_t header;
+        header.magic = CONFIG_STORE_MAGIC;
+        header.sequence = newSequence;
+        header.crc = configCRC32(&header, offsetof(configSectorHeader_t, crc));
+        return flash.write(sectorAddress(sector), (const uint32_t *)&header, sizeof(header));
+    }
+
+    // CRC check of the record at address
+    bool validRecord(uint32_t address, const configRecordHeader_t &header)
+    {
+        uint32_t value[CONFIG_STORE_MAX_VALUE / 4];
+        if (!flash.read(address + sizeof(header), value, padded(header.length)))
+        {
+            return false;
+        }
+        uint32_t crc = configCRC32(&header, offsetof(configRecordHeader_t, crc));
+        return header.crc == configCRC32(value, header.length, crc);
+    }
+
+    /*
+     * Walk the log of a sector. Returns the offset of the first free byte. If key is given, address/length
+     * of its latest valid record are returned (address 0 if none). A header that can't be a record ends the
+     * log, the rest of the sector is treated as full then.
+     */
+    uint32_t scan(uint8_t sector, uint16_t key, uint32_t *address, uint16_t *length)
+    {
+        uint32_t offset = sizeof(configSectorHeader_t);
+        if (address != nullptr)
+        {
+            *address = 0;
+        }
+        while (offset + sizeof(configRecordHeader_t) <= CONFIG_STORE_SECTOR_SIZE)
+        {
+            configRecordHeader_t header;
+            uint32_t recordAddress = sectorAddress(sector) + offset;
+            if (!flash.read(recordAddress, (uint32_t *)&header, sizeof(header)))
+            {
+                return CONFIG_STORE_SECTOR_SIZE;
+            }
+            if (header.key == NO_KEY && header.length == 0xFFFF)
+            {
+                return offset; // erased
+            }
+            if (header.length > CONFIG_STORE_MAX_VALUE || offset + sizeof(header) + padded(header.length) > CONFIG_STORE_SECTOR_SIZE)
+            {
+                return CONFIG_STORE_SECTOR_SIZE; // garbage, no more appends here
+            }
+            if (key != NO_KEY && header.key == key && validRecord(recordAddress, header))
+            {
+                *address = recordAddress;
+                *length = header.length;
+            }
+            offset += sizeof(header) + padded(header.length);
+        }
+        return offset;
+    }
+
+    bool append(uint32_t sectorStart, uint16_t key, const void *data, uint16_t size)
+    {
+        uint32_t record[(sizeof(configRecordHeader_t) + CONFIG_STORE_MAX_VALUE) / 4];
+        configRecordHeader_t *header = (configRecordHeader_t *)record;
+        memset(record, 0xFF, sizeof(record));
+        header->key = key;
+        header->length = size;
+        header->crc = configCRC32(data, size, configCRC32(header, offsetof(configRecordHeader_t, crc)));
+        memcpy(header + 1, data, size);
+        uint16_t recordSize = sizeof(configRecordHeader_t) + padded(size);
+        if (position + recordSize > CONFIG_STORE_SECTOR_SIZE || !flash.write(sectorStart + position, record, recordSize))
+        {
+            return false;
+        }
+        position += recordSize;
+        return true;
+    }
+
+    // Copy the latest record of every key (except the one written now) to the next sector and append the new value
+    bool rotate(uint16_t key, const void *data, uint16_t size)
+    {
+        uint32_t oldPosition = position;
+        if (!copyLatest(key, data, size))
+        {
+            position = oldPosition; // old sector stays active
+            return false;
+        }
+        return true;
+    }
+
+    bool copyLatest(uint16_t key, const void *data, uint16_t size)
+    {
+        uint8_t next = (active + 1) % sectors;
+        uint32_t nextStart = sectorAddress(next);
+        uint32_t oldStart = sectorAddress(active);
+        if (!flash.erase(firstSector + next))
+        {
+            return false;
+        }
+
+        position = sizeof(configSectorHeader_t);
+        uint32_t offset = sizeof(configSectorHeader_t);
+        while (offset + sizeof(configRecordHeader_t) <= CONFIG_STORE_SECTOR_SIZE)
+        {
+            configRecordHeader_t header;
+            if (!flash.read(oldStart + offset, (uint32_t *)&header, sizeof(header)) || header.key == NO_KEY ||
+                header.length > CONFIG_STORE_MAX_VALUE || offset + sizeof(header) + padded(header.length) > CONFIG_STORE_SECTOR_SIZE)
+            {
+                break;
+            }
+            if (header.key != key)
+            {
+                uint32_t latest;
+                uint16_t length;
+                scan(active, header.key, &latest, &length);
+                if (latest == oldStart + offset)
+                {
+                    uint32_t value[CONFIG_STORE_MAX_VALUE / 4];
+                    if (!flash.read(latest + sizeof(header), value, padded(length)) || !append(nextStart, header.key, value, length))
+                    {
+                        return false;
+                    }
+                }
+            }
+            offset += sizeof(header) + padded(header.length);
+        }
+        if (!append(nextStart, key, data, size))
+        {
+            return false;
+        }
+
+        // Commit: the new sector is valid from now on
+        if (!writeHeader(next, sequence + 1))
+        {
+            return false;
+        }
+        sequence++;
+        active = next;
+        return true;
+    }
+
+    Flash &flash;
+    uint32_t firstSector;
+    uint8_t sectors;
+    uint8_t active = NO_SECTOR;
+    uint32_t sequence = 0;
+    uint32_t position = 0; // first free byte in active sector
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#ifndef htmlwriter_h
+#define htmlwriter_h
+
+#include <ESP8266WebServer.h>
+
+/*
+ * Streams a HTML page (or JSON document) as chunked response while it is written, so it never has to fit into RAM.
+ * Small pieces are collected in a fixed buffer and sent as one chunk, PROGMEM fragments larger than
+ * the buffer are sent directly from flash with sendContent_P().
+ */
+template <size_t BUFFER_SIZE>
+class HTMLWriter
+{
+public:
+    explicit HTMLWriter(ESP8266WebServer &server) : server(server) {}
+
+    // Called after every chunk, e.g. to keep time critical work going during a long response. The data of a
+    // write is always copied or sent before, so it may be changed by the handler.
+    void setIdleHandler(void (*handler)()) { idleHandler = handler; }
+
+    // Send the response header, the content length is unknown until end()
+    void begin(int code, const char *contentType = "text/html")
+    {
+        length = 0;
+        sentBytes = 0;
+        startTime = millis();
+        heapStart = ESP.getFreeHeap();
+        heapMin = heapStart;
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(code, contentType, "");
+    }
+
+    // Send the rest of the buffer and the last chunk
+    void end()
+    {
+        flush();
+        server.sendContent("");
+        Serial.printf_P(PSTR("HTTP %s: %u bytes in %lu ms, max. heap used %u bytes\n"), server.uri().c_str(), sentBytes, millis() - startTime, heapUsed());
+    }
+
+    void write(const char *data, size_t size)
+    {
+        sampleHeap();
+        if (size >= BUFFER_SIZE)
+        {
+            sendBuffer();
+            server.sendContent(data, size);
+            sentBytes += size;
+            idle();
+            return;
+        }
+        // Fill the buffer, the rest starts the next chunk
+        size_t part = min(size, BUFFER_SIZE - length);
+        memcpy(buffer + length, data, part);
+        length += part;
+        if (part < size)
+        {
+            sendBuffer();
+            memcpy(buffer, data + part, size - part);
+            length = size - part;
+            idle();
+        }
+    }
+
+    void write_P(PGM_P data, size_t size)
+    {
+        if (size >= BUFFER_SIZE)
+        {
+            sendBuffer();
+            server.sendContent_P(data, size);
+            sentBytes += size;
+            idle();
+            return;
+        }
+        size_t part = min(size, BUFFER_SIZE - length);
+        memcpy_P(buffer + length, data, part);
+        length += part;
+        if (part < size)
+        {
+            sendBuffer();
+            memcpy_P(buffer, data + part, size - part);
+            length = size - part;
+            idle();
+        }
+    }
+
+    HTMLWriter &operator+=(const __FlashStringHelper *text)
+    {
+        PGM_P data = reinterpret_cast<PGM_P>(text);
+        write_P(data, strlen_P(data));
+        return *this;
+    }
+
+    HTMLWriter &operator+=(const char *text)
+    {
+        write(text, strlen(text));
+        return *this;
+    }
+
+    HTMLWriter &operator+=(const String &text)
+    {
+        write(text.c_str(), text.length());
+        return *this;
+    }
+
+    HTMLWriter &operator+=(long number)
+    {
+        char text[12];
+        write(text, snprintf(text, sizeof(text), "%ld", number));
+        return *this;
+    }
+
+    HTMLWriter &operator+=(unsigned long number)
+    {
+        char text[12];
+        write(text, snprintf(text, sizeof(text), "%lu", number));
+        return *this;
+    }
+
+    // Quoted and escaped JSON string
+    void jsonString(const char *text)
+    {
+        write("\"", 1);
+        for (const char *start = text;; text++)
+        {
+            if (*text == '\0' || *text == '"' || *text == '\\' || (uint8_t)*text < 0x20)
+            {
+                write(start, text - start);
+                if (*text == '\0')
+                    break;
+                char escaped[7];
+                write(escaped, snprintf(escaped, sizeof(escaped), (*text == '"' || *text == '\\') ? "\\%c" : "\\u%04x", *text));
+                start = text + 1;
+            }
+        }
+        write("\"", 1);
+    }
+
+    HTMLWriter &operator+=(int number) { return *this += (long)number; }
+    HTMLWriter &operator+=(unsigned int number) { return *this += (unsigned long)number; }
+
+    // Max. heap used while the last page was sent (free heap at begin() minus lowest free heap)
+    uint32_t heapUsed() const { return heapStart - heapMin; }
+
+private:
+    void sampleHeap()
+    {
+        uint32_t heap = ESP.getFreeHeap();
+        if (heap < heapMin)
+        {
+            heapMin = heap;
+        }
+    }
+
+    void flush()
+    {
+        if (sendBuffer())
+        {
+            idle();
+        }
+    }
+
+    bool sendBuffer()
+    {
+        sampleHeap();
+        if (length == 0)
+        {
+            return false;
+        }
+        server.sendContent(buffer, length);
+        sentBytes += length;
+        length = 0;
+        return true;
+    }
+
+    void idle()
+    {
+        if (idleHandler != nullptr)
+        {
+            idleHandler();
+        }
+    }
+
+    ESP8266WebServer &server;
+    void (*idleHandler)() = nullptr;
+    char buffer[BUFFER_SIZE];
+    size_t length = 0;
+    size_t sentBytes = 0;
+    unsigned long startTime = 0;
+    uint32_t heapStart = 0;
+    uint32_t heapMin = 0;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <Arduino.h>
+#ifndef ircache_h
+#define ircache_h
+
+#include "irframe.h"
+
+// Number of expanded frames kept in RAM (about 210 bytes each)
+const uint8_t IR_CACHE_SIZE = 16;
+
+typedef struct
+{
+    bool used;
+    uint8_t protocol;
+    uint16_t address;
+    uint16_t command;
+    uint32_t lastUsed; // LRU tick
+    irFrame_t frame;
+} irCacheEntry_t;
+
+// LRU cache of expanded IR frames, so frequently used codes are encoded only once.
+// Repeats are not part of the key, since repeat frames are generated separately.
+class IRFrameCache
+{
+public:
+    // Returns the cached frame or nullptr on a miss
+    irFrame_t *get(uint8_t protocol, uint16_t address, uint16_t command)
+    {
+        for (uint8_t i = 0; i < IR_CACHE_SIZE; i++)
+        {
+            irCacheEntry_t &entry = entries[i];
+            if (entry.used && entry.protocol == protocol && entry.address == address && entry.command == command)
+            {
+                entry.lastUsed = ++tick;
+                hitCount++;
+                return &entry.frame;
+            }
+        }
+        missCount++;
+        return nullptr;
+    }
+
+    // Returns a free or the least recently used entry for the caller to encode into
+    irFrame_t *insert(uint8_t protocol, uint16_t address, uint16_t command)
+    {
+        uint8_t slot = 0;
+        for (uint8_t i = 0; i < IR_CACHE_SIZE; i++)
+        {
+            if (!entries[i].used)
+            {
+                slot = i;
+                break;
+            }
+            if (entries[i].lastUsed < entries[slot].lastUsed)
+            {
+                slot = i;
+            }
+        }
+
+        irCacheEntry_t &entry = entries[slot];
+        if (entry.used)
+        {
+            evictCount++;
+        }
+        entry.used = true;
+        entry.protocol = protocol;
+        entry.address = address;
+        entry.command = command;
+        entry.lastUsed = ++tick;
+        entry.frame.length = 0;
+        return &entry.frame;
+    }
+
+    void clear()
+    {
+        for (uint8_t i = 0; i < IR_CACHE_SIZE; i++)
+        {
+            entries[i].used = false;
+        }
+    }
+
+    uint32_t hits() const { return hitCount; }
+    uint32_t misses() const { return missCount; }
+    uint32_t evictions() const { return evictCount; }
+
+private:
+    irCacheEntry_t entries[IR_CACHE_SIZE] = {};
+    uint32_t tick = 0;
+    uint32_t hitCount = 0;
+    uint32_t missCount = 0;
+    uint32_t evictCount = 0;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#ifndef ircoalesce_h
+#define ircoalesce_h
+
+#include "irqueue.h"
+#include "irframe.h"
+#include "irprotocols.h"
+
+const uint8_t IR_RATE_BUCKETS = 8;       // targets (emitter, address) tracked at the same time
+const uint8_t IR_RATE_BURST = 10;        // commands a target accepts at once
+const uint8_t IR_RATE_PER_SECOND = 5;    // commands per second a target accepts on average
+const uint16_t IR_RATE_TOKEN = 1000;     // one command in bucket units, refill is IR_RATE_PER_SECOND units per ms
+
+/*
+ * Merge command into target if it repeats the same NEC code on the same emitter: every merged command becomes
+ * 1 + repeats NEC repeat frames of target instead of full frames. Only NEC has a repeat frame. target must not have
+ * a delay (it would come between the commands), and only one of both may have an id (the acknowledgment is sent
+ * after the last merged frame).
+ */
+bool coalesceCommand(irCommand_t &target, const irCommand_t &command)
+{
+    uint16_t repeats = target.repeats + 1 + command.repeats;
+    if (target.protocol != NEC || command.protocol != NEC || target.emitter != command.emitter || target.address != command.address ||
+        target.command != command.command || target.delay != 0 || (target.id[0] != '\0' && command.id[0] != '\0') || repeats > 0xFF)
+    {
+        return false;
+    }
+    target.repeats = repeats;
+    target.delay = command.delay;
+    if (command.id[0] != '\0')
+    {
+        strcpy(target.id, command.id);
+    }
+    return true;
+}
+
+// Airtime saved by sending command as repeat frames instead of full frames (in us)
+uint32_t coalescedAirtime(const irCommand_t &command, const irFrame_t &repeatFrame)
+{
+    return frameDurationNEC(command.address, command.command) - frameDuration(repeatFrame);
+}
+
+typedef struct
+{
+    bool used;
+    uint8_t emitter;
+    uint16_t address;
+    uint32_t tokens;       // in 1/IR_RATE_TOKEN commands
+    unsigned long updated; // millis() of last refill
+} irRateBucket_t;
+
+/*
+ * Token buckets per target, so a UI flooding one device can't fill the queue for all others. A target not seen
+ * for a while has a full bucket, so only recently used targets need an entry and the fullest one is reused.
+ */
+class IRRateLimiter
+{
+public:
+    // Takes a token of the target, false if the command exceeds the rate
+    bool take(uint8_t emitter, uint16_t address, unsigned long now)
+    {
+        irRateBucket_t *bucket = nullptr;
+        irRateBucket_t *fullest = &buckets[0];
+        for (uint8_t i = 0; i < IR_RATE_BUCKETS; i++)
+        {
+            irRateBucket_t &entry = buckets[i];
+            refill(entry, now);
+            if (entry.used && entry.emitter == emitter && entry.address == address)
+            {
+                bucket = &entry;
+                break;
+            }
+            if (!entry.used || (fullest->used && entry.tokens > fullest->tokens))
+            {
+                fullest = &entry;
+            }
+        }
+        if (bucket == nullptr)
+        {
+            bucket = fullest;
+            bucket->used = true;
+            bucket->emitter = emitter;
+            bucket->address = address;
+            bucket->tokens = IR_RATE_BURST * IR_RATE_TOKEN;
+            bucket->updated = now;
+        }
+        if (bucket->tokens < IR_RATE_TOKEN)
+        {
+            limitedCount++;
+            return false;
+        }
+        bucket->tokens -= IR_RATE_TOKEN;
+        return true;
+    }
+
+    uint32_t limited() const { return limitedCount; }
+
+private:
+    static void refill(irRateBucket_t &bucket, unsigned long now)
+    {
+        if (!bucket.used)
+        {
+            return;
+        }
+        uint32_t elapsed = now - bucket.updated;
+        uint32_t max = IR_RATE_BURST * IR_RATE_TOKEN;
+        bucket.tokens = (elapsed >= max / IR_RATE_PER_SECOND) ? max : min(max, bucket.tokens + elapsed * IR_RATE_PER_SECOND);
+        bucket.updated = now;
+    }
+
+    irRateBucket_t buckets[IR_RATE_BUCKETS] = {};
+    uint32_t limitedCount = 0;
+};
+
+#endif
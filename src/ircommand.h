@@ -0,0 +1,476 @@
+#include <Arduino.h>
+#ifndef ircommand_h
+#define ircommand_h
+
+#include "commandreader.h"
+#include "irqueue.h"
+#include "irprotocols.h"
+#include "irraw.h"
+#include "codelibrary.h"
+#include "iremitter.h"
+
+// Command ids are echoed in acknowledgments without escaping, so only a safe charset is allowed
+bool isValidId(const char *token, uint16_t length)
+{
+    if (length == 0 || length >= IR_COMMAND_ID_SIZE)
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < length; i++)
+    {
+        char c = token[i];
+        if (!isalnum(c) && c != '-' && c != '_' && c != '.' && c != ':')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fill command from the code library, raw codes are read into irRawFrame. Returns true for a raw code.
+bool loadNamedCode(const char *name, uint16_t nameLength, irCommand_t &command, bool hasRepeats, PGM_P &error)
+{
+    irCode_t code;
+    if (irRawFrame.used)
+    {
+        // a raw code would overwrite the pending frame
+        error = PSTR("raw frame busy");
+        return false;
+    }
+    if (!codeLibrary.find(name, nameLength, code, irRawFrame.timings, IR_RAW_ARENA_SIZE))
+    {
+        error = PSTR("unknown name");
+        return false;
+    }
+    if (!hasRepeats)
+    {
+        command.repeats = code.repeats;
+    }
+    if (code.rawLength > 0)
+    {
+        irRawFrame.length = code.rawLength;
+        irRawFrame.repeatStart = code.repeatStart;
+        irRawFrame.khz = code.khz;
+        return true;
+    }
+    if (findProtocol(code.protocol) == nullptr)
+    {
+        // stored by a firmware with more protocols enabled
+        error = PSTR("proto not enabled");
+        return false;
+    }
+    command.protocol = code.protocol;
+    command.address = code.address;
+    command.command = code.command;
+    return false;
+}
+
+/*
+ * Parse one command object {"proto":"<name>","adr":"<hex>","cmd":"<hex>","rpt":<dec>,"dly":<ms>}
+ * or raw command {"raw":[<us>,...],"khz":<dec>} / {"pronto":"<hex words>"}, optionally with "id":"<id>".
+ * {"name":"<name>"} sends a code of the code library, "rpt" overrides its repeats.
+ * "at":<epoch ms> schedules the command, it is checked against the clock when queued. Raw commands can't be
+ * scheduled, they would hold irRawFrame until their time.
+ * "emitter":"<name>" selects the IR LED, commands without "proto" use its default protocol.
+ * Unknown members are skipped.
+ * Invalid values are reported in error, but the object is read completely so a following item can still be parsed.
+ * Raw timings are decoded into irRawFrame, which stays reserved if the command is valid.
+ */
+bool parseCommandObject(CommandReader &reader, irCommand_t &command, PGM_P &error)
+{
+    const char *key;
+    const char *value;
+    uint16_t keyLength;
+    uint16_t valueLength;
+    uint32_t number;
+    bool hasAddress = false;
+    bool hasCommand = false;
+    bool hasRaw = false;
+    bool hasRepeats = false;
+    bool hasProtocol = false;
+    const char *name = nullptr;
+    uint16_t nameLength = 0;
+    uint8_t khz = 0;
+
+    command.protocol = IR_PROTOCOLS[0].protocol;
+    command.address = 0;
+    command.command = 0;
+    command.repeats = 0;
+    command.emitter = 0;
+    command.delay = 0;
+    command.at = 0;
+    command.id[0] = '\0';
+    error = nullptr;
+
+    if (!reader.beginObject())
+    {
+        error = reader.errorMessage();
+        return false;
+    }
+    while (reader.nextMember(key, keyLength))
+    {
+        if (tokenEquals(key, keyLength, "adr"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (parseHex(value, valueLength, 0xFFFF, number))
+                command.address = number;
+            else if (error == nullptr)
+                error = PSTR("invalid adr");
+            hasAddress = true;
+        }
+        else if (tokenEquals(key, keyLength, "proto"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            const irProtocol_t *protocol = findProtocol(value, valueLength);
+            if (protocol != nullptr)
+                command.protocol = protocol->protocol;
+            else if (error == nullptr)
+                error = PSTR("unknown proto");
+            hasProtocol = true;
+        }
+        else if (tokenEquals(key, keyLength, "cmd"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (parseHex(value, valueLength, 0xFFFF, number))
+                command.command = number;
+            else if (error == nullptr)
+                error = PSTR("invalid cmd");
+            hasCommand = true;
+        }
+        else if (tokenEquals(key, keyLength, "rpt"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (parseDec(value, valueLength, 0xFF, number))
+                command.repeats = number;
+            else if (error == nullptr)
+                error = PSTR("invalid rpt");
+            hasRepeats = true;
+        }
+        else if (tokenEquals(key, keyLength, "raw") || tokenEquals(key, keyLength, "pronto"))
+        {
+            if (irRawFrame.used || hasRaw)
+            {
+                if (error == nullptr)
+                    error = PSTR("raw frame busy");
+                if (!reader.skipValue())
+                    break;
+            }
+            else if (key[0] == 'r')
+            {
+                irRawFrame.khz = 38;
+                if (!parseRawArray(reader, error))
+                    break;
+            }
+            else
+            {
+                if (!reader.readToken(value, valueLength))
+                    break;
+                PGM_P prontoError = nullptr;
+                if (!parsePronto(value, valueLength, prontoError) && error == nullptr)
+                    error = prontoError;
+            }
+            hasRaw = true;
+        }
+        else if (tokenEquals(key, keyLength, "khz"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (parseDec(value, valueLength, 100, number) && number >= 20)
+                khz = number;
+            else if (error == nullptr)
+                error = PSTR("invalid khz");
+        }
+        else if (tokenEquals(key, keyLength, "id"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (isValidId(value, valueLength))
+            {
+                memcpy(command.id, value, valueLength);
+                command.id[valueLength] = '\0';
+            }
+            else if (error == nullptr)
+                error = PSTR("invalid id");
+        }
+        else if (tokenEquals(key, keyLength, "name"))
+        {
+            if (!reader.readToken(name, nameLength))
+                break;
+            if (!isValidCodeName(name, nameLength) && error == nullptr)
+                error = PSTR("invalid name");
+        }
+        else if (tokenEquals(key, keyLength, "emitter"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            int8_t emitter = irEmitters.find(value, valueLength);
+            if (emitter >= 0)
+                command.emitter = emitter;
+            else if (error == nullptr)
+                error = PSTR("unknown emitter");
+        }
+        else if (tokenEquals(key, keyLength, "dly"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (parseDec(value, valueLength, 0xFFFF, number))
+                command.delay = number;
+            else if (error == nullptr)
+                error = PSTR("invalid dly");
+        }
+        else if (tokenEquals(key, keyLength, "at"))
+        {
+            if (!reader.readToken(value, valueLength))
+                break;
+            if (!parseDec64(value, valueLength, command.at) && error == nullptr)
+                error = PSTR("invalid at");
+        }
+        else if (!reader.skipValue())
+        {
+            break;
+        }
+    }
+    if (reader.failed())
+    {
+        error = reader.errorMessage();
+        return false;
+    }
+    if (name != nullptr && error == nullptr)
+    {
+        if (hasRaw || hasAddress || hasCommand)
+        {
+            error = PSTR("name and code given");
+        }
+        else
+        {
+            hasRaw = loadNamedCode(name, nameLength, command, hasRepeats, error);
+            hasAddress = hasCommand = true;
+        }
+    }
+    if (hasRaw)
+    {
+        if (error == nullptr && command.at != 0)
+        {
+            error = PSTR("at not supported for raw");
+        }
+        if (error != nullptr)
+        {
+            return false;
+        }
+        command.protocol = IR_PROTOCOL_RAW;
+        if (khz != 0)
+        {
+            irRawFrame.khz = khz;
+        }
+        irRawFrame.used = true;
+        return true;
+    }
+    if (error == nullptr && (!hasAddress || !hasCommand))
+    {
+        error = PSTR("adr and cmd required");
+    }
+    if (!hasProtocol && name == nullptr)
+    {
+        command.protocol = irEmitters[command.emitter].protocol;
+    }
+    return error == nullptr;
+}
+
+// Parse compact form "<adr>,<cmd>[,<rpt>[,<dly>]]" (hex, hex, decimal, decimal ms)
+bool parseCommandCompact(const char *data, unsigned int length, irCommand_t &command, PGM_P &error)
+{
+    const char *fields[4];
+    uint16_t lengths[4];
+    uint8_t count = 0;
+    const char *start = data;
+
+    for (unsigned int i = 0; i <= length; i++)
+    {
+        if (i == length || data[i] == ',')
+        {
+            if (count >= 4)
+            {
+                error = PSTR("too many fields");
+                return false;
+            }
+            // trim
+            const char *fieldEnd = data + i;
+            while (start < fieldEnd && (*start == ' ' || *start == '\t'))
+                start++;
+            while (fieldEnd > start && (fieldEnd[-1] == ' ' || fieldEnd[-1] == '\t' || fieldEnd[-1] == '\r' || fieldEnd[-1] == '\n'))
+                fieldEnd--;
+            fields[count] = start;
+            lengths[count] = fieldEnd - start;
+            count++;
+            start = data + i + 1;
+        }
+    }
+
+    uint32_t address;
+    uint32_t cmd;
+    uint32_t repeats = 0;
+    uint32_t delay = 0;
+    if (count < 2 || !parseHex(fields[0], lengths[0], 0xFFFF, address) || !parseHex(fields[1], lengths[1], 0xFFFF, cmd) ||
+        (count >= 3 && !parseDec(fields[2], lengths[2], 0xFF, repeats)) ||
+        (count == 4 && !parseDec(fields[3], lengths[3], 0xFFFF, delay)))
+    {
+        error = PSTR("invalid compact command");
+        return false;
+    }
+    command.protocol = irEmitters[0].protocol;
+    command.address = address;
+    command.command = cmd;
+    command.repeats = repeats;
+    command.emitter = 0;
+    command.delay = delay;
+    command.at = 0;
+    command.id[0] = '\0';
+    error = nullptr;
+    return true;
+}
+
+// Parse a single command, either JSON object or compact form
+bool parseCommand(const char *data, unsigned int length, irCommand_t &command, PGM_P &error)
+{
+    CommandReader reader(data, length);
+    error = nullptr;
+
+    if (reader.atEnd())
+    {
+        error = PSTR("empty payload");
+        return false;
+    }
+    if (memchr(data, '{', length) == nullptr)
+    {
+        return parseCommandCompact(data, length, command, error);
+    }
+    if (!parseCommandObject(reader, command, error))
+    {
+        return false;
+    }
+    if (!reader.atEnd())
+    {
+        if (command.protocol == IR_PROTOCOL_RAW)
+        {
+            irRawFrame.used = false;
+        }
+        error = PSTR("trailing characters");
+        return false;
+    }
+    return true;
+}
+
+// Max. number of commands in one payload
+const uint8_t IR_BATCH_SIZE = IR_QUEUE_SIZE;
+
+typedef struct
+{
+    irCommand_t commands[IR_BATCH_SIZE];
+    PGM_P errors[IR_BATCH_SIZE]; // nullptr if command is valid
+    uint8_t count;
+    bool isList; // payload was a JSON array or newline delimited list
+} irBatch_t;
+
+// Reject a payload as a whole, the raw frame arena taken by one of its commands is released again
+bool rejectBatch(irBatch_t &batch, PGM_P &error, PGM_P message)
+{
+    for (uint8_t i = 0; i < batch.count; i++)
+    {
+        if (batch.errors[i] == nullptr && batch.commands[i].protocol == IR_PROTOCOL_RAW)
+        {
+            irRawFrame.used = false;
+        }
+    }
+    batch.count = 0;
+    error = message;
+    return false;
+}
+
+/*
+ * Parse a payload with one or more commands:
+ * - a single command (JSON object or compact form), a JSON object may span several lines
+ * - a JSON array of command objects
+ * - newline delimited commands (JSON object or compact form per line), if the payload isn't a single command
+ * Returns false only if the payload as a whole could not be parsed, item errors are stored in batch.errors. A rejected
+ * payload keeps no raw frame.
+ */
+bool parseBatch(const char *data, unsigned int length, irBatch_t &batch, PGM_P &error)
+{
+    CommandReader reader(data, length);
+    batch.count = 0;
+    batch.isList = false;
+    error = nullptr;
+
+    if (reader.atEnd())
+    {
+        error = PSTR("empty payload");
+        return false;
+    }
+
+    // JSON array
+    if (reader.beginArray())
+    {
+        batch.isList = true;
+        while (reader.nextElement())
+        {
+            if (batch.count >= IR_BATCH_SIZE)
+            {
+                return rejectBatch(batch, error, PSTR("too many commands"));
+            }
+            parseCommandObject(reader, batch.commands[batch.count], batch.errors[batch.count]);
+            if (reader.failed())
+            {
+                break;
+            }
+            batch.count++;
+        }
+        if (reader.failed() || !reader.atEnd())
+        {
+            return rejectBatch(batch, error, reader.failed() ? reader.errorMessage() : PSTR("trailing characters"));
+        }
+        return true;
+    }
+
+    // Single command, trailing whitespace (e.g. a newline) doesn't make it a list
+    while (length > 0 && isspace((unsigned char)data[length - 1]))
+    {
+        length--;
+    }
+    const char *end = data + length;
+    if (parseCommand(data, length, batch.commands[0], batch.errors[0]) || memchr(data, '\n', length) == nullptr)
+    {
+        batch.count = 1;
+        return true;
+    }
+
+    // Newline delimited list
+    batch.isList = true;
+    const char *line = data;
+    while (line < end)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (lineEnd == nullptr)
+        {
+            lineEnd = end;
+        }
+
+        CommandReader lineReader(line, lineEnd - line);
+        if (!lineReader.atEnd())
+        {
+            if (batch.count >= IR_BATCH_SIZE)
+            {
+                return rejectBatch(batch, error, PSTR("too many commands"));
+            }
+            parseCommand(line, lineEnd - line, batch.commands[batch.count], batch.errors[batch.count]);
+            batch.count++;
+        }
+        line = lineEnd + 1;
+    }
+    return true;
+}
+
+#endif
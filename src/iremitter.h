@@ -0,0 +1,185 @@
+#include <Arduino.h>
+#ifndef iremitter_h
+#define iremitter_h
+
+#include "irprotocols.h"
+
+const uint8_t IR_EMITTERS_MAX = 8;         // channels of the timer1 player
+const uint8_t IR_EMITTER_NAME_SIZE = 12;   // max. name length + 1
+const uint8_t IR_EMITTER_DEFAULT_PIN = 14; // D5
+
+// GPIO of the NodeMCU/Wemos pin names D0-D8
+const uint8_t IR_EMITTER_DPINS[] = {16, 5, 4, 0, 2, 14, 12, 13, 15};
+
+typedef struct
+{
+    char name[IR_EMITTER_NAME_SIZE];
+    uint8_t pin;      // GPIO 0-15
+    uint8_t protocol; // used for commands without "proto"
+} irEmitter_t;
+
+/*
+ * IR LEDs of the bridge, configured as "<name>=<pin>[:<proto>],..." e.g. "tv=D5,amp=D1:Sony".
+ * Pins are GPIO numbers or D1-D8. Commands select an emitter with "emitter":"<name>", the first one is the default.
+ * An empty config gives one emitter "ir" on D5 with NEC.
+ */
+class IREmitterTable
+{
+public:
+    IREmitterTable() { clear(); }
+
+    // Parse the config, the table is left unchanged on errors. reservedPin: used otherwise (IR receiver)
+    bool parse(const char *config, uint8_t reservedPin, PGM_P &error)
+    {
+        irEmitter_t parsed[IR_EMITTERS_MAX];
+        uint8_t parsedCount = 0;
+        const char *position = config;
+        error = nullptr;
+
+        while (*position != '\0')
+        {
+            const char *end = position;
+            while (*end != '\0' && *end != ',')
+                end++;
+            const char *equals = (const char *)memchr(position, '=', end - position);
+            if (parsedCount >= IR_EMITTERS_MAX)
+            {
+                error = PSTR("too many emitters");
+                return false;
+            }
+            if (equals == nullptr || !validName(position, equals - position))
+            {
+                error = PSTR("invalid emitter name");
+                return false;
+            }
+            irEmitter_t &emitter = parsed[parsedCount];
+            memcpy(emitter.name, position, equals - position);
+            emitter.name[equals - position] = '\0';
+
+            const char *colon = (const char *)memchr(equals, ':', end - equals);
+            const char *pinEnd = (colon != nullptr) ? colon : end;
+            if (!parsePin(equals + 1, pinEnd - equals - 1, emitter.pin) || emitter.pin == reservedPin)
+            {
+                error = PSTR("invalid emitter pin");
+                return false;
+            }
+            emitter.protocol = IR_PROTOCOLS[0].protocol;
+            if (colon != nullptr)
+            {
+                const irProtocol_t *protocol = findProtocol(colon + 1, end - colon - 1);
+                if (protocol == nullptr)
+                {
+                    error = PSTR("unknown emitter proto");
+                    return false;
+                }
+                emitter.protocol = protocol->protocol;
+            }
+            for (uint8_t i = 0; i < parsedCount; i++)
+            {
+                if (parsed[i].pin == emitter.pin || strcmp(parsed[i].name, emitter.name) == 0)
+                {
+                    error = PSTR("duplicate emitter");
+                    return false;
+                }
+            }
+            parsedCount++;
+            position = (*end == ',') ? end + 1 : end;
+        }
+
+        if (parsedCount == 0)
+        {
+            clear();
+            return true;
+        }
+        memcpy(emitters, parsed, sizeof(parsed));
+        count = parsedCount;
+        return true;
+    }
+
+    // Index of the emitter, -1 if unknown
+    int8_t find(const char *name, uint16_t length) const
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (strlen(emitters[i].name) == length && memcmp(emitters[i].name, name, length) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    uint8_t size() const { return count; }
+    const irEmitter_t &operator[](uint8_t index) const { return emitters[index]; }
+
+private:
+    void clear()
+    {
+        strcpy(emitters[0].name, "ir");
+        emitters[0].pin = IR_EMITTER_DEFAULT_PIN;
+        emitters[0].protocol = IR_PROTOCOLS[0].protocol;
+        count = 1;
+    }
+
+    // Names are used in JSON without escaping
+    static bool validName(const char *name, uint16_t length)
+    {
+        if (length == 0 || length >= IR_EMITTER_NAME_SIZE)
+        {
+            return false;
+        }
+        for (uint16_t i = 0; i < length; i++)
+        {
+            if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool parsePin(const char *text, uint16_t length, uint8_t &pin)
+    {
+        uint32_t number = 0;
+        bool named = (length == 2 && (text[0] == 'D' || text[0] == 'd'));
+        if (named)
+        {
+            text++;
+            length--;
+        }
+        if (length == 0 || length > 2)
+        {
+            return false;
+        }
+        for (uint16_t i = 0; i < length; i++)
+        {
+            if (!isdigit(text[i]))
+            {
+                return false;
+            }
+            number = number * 10 + (text[i] - '0');
+        }
+        if (named)
+        {
+            if (number >= sizeof(IR_EMITTER_DPINS))
+            {
+                return false;
+            }
+            number = IR_EMITTER_DPINS[number];
+        }
+        // GPIO 1 and 3 are the serial port, 6-11 the flash, 16 (D0) can't be set with GPOS/GPOC
+        if (number > 15 || number == 1 || number == 3 || (number >= 6 && number <= 11))
+        {
+            return false;
+        }
+        pin = number;
+        return true;
+    }
+
+    irEmitter_t emitters[IR_EMITTERS_MAX];
+    uint8_t count;
+};
+
+IREmitterTable irEmitters;
+
+#endif
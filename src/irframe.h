@@ -0,0 +1,91 @@
+#include <Arduino.h>
+#ifndef irframe_h
+#define irframe_h
+
+#include "TinyIR.h" // NEC protocol timings
+
+// Max. number of mark/space entries of one IR frame. NEC needs 67 (header + 32 bits + stop bit).
+const uint16_t IR_FRAME_MAX_ENTRIES = 100;
+
+// One IR frame as alternating mark and space durations in us, starting with a mark (like IRsend::sendRaw())
+typedef struct
+{
+    uint16_t timings[IR_FRAME_MAX_ENTRIES];
+    uint16_t length; // number of used entries
+    uint8_t khz;     // carrier frequency
+} irFrame_t;
+
+// 32 data bits of a NEC frame. 8 bit address/command is sent with inverted byte, 16 bit as is (like sendNEC()).
+uint32_t dataNEC(uint16_t address, uint16_t command)
+{
+    uint32_t data;
+    if (address > 0xFF)
+    {
+        data = address;
+    }
+    else
+    {
+        data = (uint32_t)(address & 0xFF) | ((uint32_t)(~address & 0xFF) << 8);
+    }
+    if (command > 0xFF)
+    {
+        data |= (uint32_t)command << 16;
+    }
+    else
+    {
+        data |= ((uint32_t)(command & 0xFF) << 16) | ((uint32_t)(~command & 0xFF) << 24);
+    }
+    return data;
+}
+
+// Expand a NEC frame
+void encodeNEC(irFrame_t &frame, uint16_t address, uint16_t command)
+{
+    uint32_t data = dataNEC(address, command);
+    frame.khz = 38;
+    frame.length = 0;
+    frame.timings[frame.length++] = NEC_HEADER_MARK;
+    frame.timings[frame.length++] = NEC_HEADER_SPACE;
+    for (uint8_t i = 0; i < NEC_BITS; i++)
+    {
+        frame.timings[frame.length++] = NEC_BIT_MARK;
+        frame.timings[frame.length++] = (data & 1) ? NEC_ONE_SPACE : NEC_ZERO_SPACE; // LSB first
+        data >>= 1;
+    }
+    frame.timings[frame.length++] = NEC_BIT_MARK; // stop bit
+}
+
+// Expand the NEC special repeat frame
+void encodeNECRepeat(irFrame_t &frame)
+{
+    frame.khz = 38;
+    frame.length = 0;
+    frame.timings[frame.length++] = NEC_HEADER_MARK;
+    frame.timings[frame.length++] = NEC_REPEAT_HEADER_SPACE;
+    frame.timings[frame.length++] = NEC_BIT_MARK;
+}
+
+// Total duration of a frame in us
+uint32_t frameDuration(const uint16_t *timings, uint16_t length)
+{
+    uint32_t duration = 0;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        duration += timings[i];
+    }
+    return duration;
+}
+
+uint32_t frameDuration(const irFrame_t &frame)
+{
+    return frameDuration(frame.timings, frame.length);
+}
+
+// Duration of a NEC frame without expanding it
+uint32_t frameDurationNEC(uint16_t address, uint16_t command)
+{
+    uint8_t ones = __builtin_popcount(dataNEC(address, command));
+    return NEC_HEADER_MARK + NEC_HEADER_SPACE + (NEC_BITS + 1) * NEC_BIT_MARK + ones * NEC_ONE_SPACE + (NEC_BITS - ones) * NEC_ZERO_SPACE;
+}
+
+#endif
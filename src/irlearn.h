@@ -0,0 +1,132 @@
+#include <Arduino.h>
+#ifndef irlearn_h
+#define irlearn_h
+
+#include "irprotocols.h"
+#include "codelibrary.h"
+
+const unsigned long IR_LEARN_TIMEOUT = 15000; // max. time to wait for a frame after arming (in ms)
+
+enum class LearnState
+{
+    IDLE,
+    ARMED, // receiver running, IR transmit paused
+};
+
+typedef struct
+{
+    char name[CODE_NAME_SIZE];
+    PGM_P result;            // "stored", "timeout", ... nullptr if nothing learned yet
+    irCode_t code;           // learned code if stored
+    unsigned long storeTime; // from decoded frame to code stored (in us)
+} irLearnResult_t;
+
+/*
+ * Learns one code with IrReceiver and stores it in the code library. The receiver samples with timer1 like the
+ * IR player, so transmitting is paused while armed and the receiver is stopped again after one frame or the timeout.
+ * Frames of a protocol that can be sent are stored as protocol, address and command, all others as raw timings
+ * in receiver ticks (one byte per entry).
+ */
+class IRLearner
+{
+public:
+    // Caller has to make sure that timer1 is idle
+    PGM_P arm(const char *name, uint16_t nameLength, uint8_t pin)
+    {
+        if (state == LearnState::ARMED)
+        {
+            return PSTR("already learning");
+        }
+        if (!isValidCodeName(name, nameLength))
+        {
+            return PSTR("invalid name");
+        }
+        memcpy(learned.name, name, nameLength);
+        learned.name[nameLength] = '\0';
+        learned.result = nullptr;
+        armedAt = millis();
+        state = LearnState::ARMED;
+        IrReceiver.begin(pin);
+        Serial.printf_P(PSTR("Learning '%s'\n"), learned.name);
+        return nullptr;
+    }
+
+    bool active() const { return state == LearnState::ARMED; }
+    const irLearnResult_t &result() const { return learned; }
+
+    // Returns true once when learning is finished, see result()
+    bool handle()
+    {
+        if (state != LearnState::ARMED)
+        {
+            return false;
+        }
+        if ((millis() - armedAt) >= IR_LEARN_TIMEOUT)
+        {
+            finish(PSTR("timeout"));
+            return true;
+        }
+        if (!IrReceiver.decode())
+        {
+            return false;
+        }
+        unsigned long captured = micros();
+        IRData &data = IrReceiver.decodedIRData;
+        if (data.flags & IRDATA_FLAGS_IS_REPEAT)
+        {
+            // NEC repeat or similar, wait for a full frame
+            IrReceiver.resume();
+            return false;
+        }
+        if (data.flags & IRDATA_FLAGS_WAS_OVERFLOW)
+        {
+            finish(PSTR("frame too long"));
+            return true;
+        }
+
+        const void *timings = nullptr;
+        const irProtocol_t *protocol = (data.flags & (IRDATA_FLAGS_PARITY_FAILED | IRDATA_FLAGS_EXTRA_INFO)) ? nullptr : findProtocol(data.protocol);
+        memset(&learned.code, 0, sizeof(learned.code));
+        if (protocol != nullptr)
+        {
+            learned.code.protocol = protocol->protocol;
+            learned.code.address = data.address;
+            learned.code.command = data.command;
+        }
+        else
+        {
+            // Leading gap is not stored, marks are shortened and spaces extended by MARK_EXCESS_MICROS
+            IrReceiver.compensateAndStoreIRResultInArray(rawTicks);
+            learned.code.protocol = IR_PROTOCOL_RAW;
+            learned.code.khz = 38; // a demodulating receiver can't measure the carrier
+            learned.code.rawLength = data.rawDataPtr->rawlen - 1;
+            learned.code.rawUnit = MICROS_PER_TICK;
+            timings = rawTicks;
+        }
+        IrReceiver.stop();
+        state = LearnState::IDLE;
+
+        bool stored = codeLibrary.store(learned.name, strlen(learned.name), learned.code, timings);
+        learned.storeTime = micros() - captured;
+        learned.result = stored ? PSTR("stored") : PSTR("store failed");
+        Serial.printf_P(PSTR("Learned '%s': %s %S in %lu us\n"), learned.name, protocolName(learned.code.protocol), learned.result, learned.storeTime);
+        return true;
+    }
+
+private:
+    void finish(PGM_P result)
+    {
+        IrReceiver.stop();
+        state = LearnState::IDLE;
+        learned.result = result;
+        learned.storeTime = 0;
+        Serial.printf_P(PSTR("Learning '%s': %S\n"), learned.name, result);
+    }
+
+    LearnState state = LearnState::IDLE;
+    unsigned long armedAt = 0;
+    irLearnResult_t learned = {};
+    uint8_t rawTicks[RAW_BUFFER_LENGTH];
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include <Arduino.h>
+#ifndef irprotocols_h
+#define irprotocols_h
+
+/*
+ * Protocols available for sending besides NEC. NEC is always available and sent by the timer1 player.
+ * All other protocols are sent by IrSender. Only the send functions of the protocols enabled here are
+ * referenced, so the linker drops all others. Comment out what you don't need to save flash.
+ */
+#define SEND_PROTOCOL_SONY
+#define SEND_PROTOCOL_RC5
+#define SEND_PROTOCOL_RC6
+#define SEND_PROTOCOL_SAMSUNG
+#define SEND_PROTOCOL_LG
+#define SEND_PROTOCOL_JVC
+#define SEND_PROTOCOL_DENON
+#define SEND_PROTOCOL_PANASONIC
+#define SEND_PROTOCOL_KASEIKYO_DENON
+#define SEND_PROTOCOL_ONKYO
+//#define SEND_PROTOCOL_NEC2
+//#define SEND_PROTOCOL_APPLE
+//#define SEND_PROTOCOL_SHARP
+
+// IRremote config, must be defined before including IRremote.hpp
+#define SEND_PWM_BY_TIMER // carrier by timer1 waveform generator
+#define NO_LED_FEEDBACK_CODE
+#define EXCLUDE_EXOTIC_PROTOCOLS
+#define RAW_BUFFER_LENGTH 400 // learning of long (AC) frames, 2 bytes RAM per entry
+#include <IRremote.hpp>
+
+// Sends one frame, repeat: the repeat frame of the protocol (e.g. without header) instead of the first frame.
+// Repeats are counted by the caller, so no call blocks for more than one frame.
+typedef void (*irSendFunction_t)(uint16_t address, uint16_t command, bool repeat);
+
+typedef struct
+{
+    const char *name;
+    decode_type_t protocol;
+    irSendFunction_t send; // nullptr: sent by timer1 player
+    uint8_t period;        // distance of frames, start to start (in ms)
+} irProtocol_t;
+
+// IrSender sends the special repeat frame of the protocol for a negative number of repeats, a plain frame if there is none
+const int_fast8_t IR_SEND_REPEAT_FRAME = -1;
+
+#if defined(SEND_PROTOCOL_SONY)
+void sendProtocolSony(uint16_t address, uint16_t command, bool repeat) { IrSender.sendSony(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_RC5)
+// Repeats keep the toggle bit of the first frame, IrSender flips it on every call
+void sendProtocolRC5(uint16_t address, uint16_t command, bool repeat)
+{
+    if (repeat)
+    {
+        sLastSendToggleValue ^= 1;
+    }
+    IrSender.sendRC5(address, command, 0);
+}
+#endif
+#if defined(SEND_PROTOCOL_RC6)
+// Repeats keep the toggle bit of the first frame, IrSender flips it on every call
+void sendProtocolRC6(uint16_t address, uint16_t command, bool repeat)
+{
+    if (repeat)
+    {
+        sLastSendToggleValue ^= 1;
+    }
+    IrSender.sendRC6(address, command, 0);
+}
+#endif
+#if defined(SEND_PROTOCOL_SAMSUNG)
+void sendProtocolSamsung(uint16_t address, uint16_t command, bool repeat) { IrSender.sendSamsung(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_LG)
+void sendProtocolLG(uint16_t address, uint16_t command, bool repeat) { IrSender.sendLG(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_JVC)
+// The 8 bit values select sendJVC(address, command, repeats), else the deprecated sendJVC(data, bits, repeat) is taken
+void sendProtocolJVC(uint16_t address, uint16_t command, bool repeat) { IrSender.sendJVC((uint8_t)address, (uint8_t)command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_DENON)
+// Every frame is followed by its inverted frame, a repeat is the same pair. IrSender sends nothing for negative repeats.
+void sendProtocolDenon(uint16_t address, uint16_t command, bool /*repeat*/) { IrSender.sendDenon(address, command, 0); }
+#endif
+#if defined(SEND_PROTOCOL_PANASONIC)
+void sendProtocolPanasonic(uint16_t address, uint16_t command, bool repeat) { IrSender.sendPanasonic(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_KASEIKYO_DENON)
+void sendProtocolKaseikyoDenon(uint16_t address, uint16_t command, bool repeat) { IrSender.sendKaseikyo_Denon(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_ONKYO)
+void sendProtocolOnkyo(uint16_t address, uint16_t command, bool repeat) { IrSender.sendOnkyo(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_NEC2)
+void sendProtocolNEC2(uint16_t address, uint16_t command, bool repeat) { IrSender.sendNEC2(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_APPLE)
+void sendProtocolApple(uint16_t address, uint16_t command, bool repeat) { IrSender.sendApple(address, command, repeat ? IR_SEND_REPEAT_FRAME : 0); }
+#endif
+#if defined(SEND_PROTOCOL_SHARP)
+// Every frame is followed by its inverted frame, a repeat is the same pair. IrSender sends nothing for negative repeats.
+void sendProtocolSharp(uint16_t address, uint16_t command, bool /*repeat*/) { IrSender.sendSharp(address, command, 0); }
+#endif
+
+// Dispatch table, first entry is the default protocol
+const irProtocol_t IR_PROTOCOLS[] = {
+    {"NEC", NEC, nullptr, NEC_REPEAT_PERIOD / 1000},
+#if defined(SEND_PROTOCOL_SONY)
+    {"Sony", SONY, sendProtocolSony, SONY_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_RC5)
+    {"RC5", RC5, sendProtocolRC5, RC5_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_RC6)
+    {"RC6", RC6, sendProtocolRC6, RC5_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_SAMSUNG)
+    {"Samsung", SAMSUNG, sendProtocolSamsung, SAMSUNG_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_LG)
+    {"LG", LG, sendProtocolLG, LG_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_JVC)
+    {"JVC", JVC, sendProtocolJVC, JVC_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_DENON)
+    {"Denon", DENON, sendProtocolDenon, DENON_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_PANASONIC)
+    {"Panasonic", PANASONIC, sendProtocolPanasonic, KASEIKYO_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_KASEIKYO_DENON)
+    {"Kaseikyo_Denon", KASEIKYO_DENON, sendProtocolKaseikyoDenon, KASEIKYO_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_ONKYO)
+    {"Onkyo", ONKYO, sendProtocolOnkyo, NEC_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_NEC2)
+    {"NEC2", NEC2, sendProtocolNEC2, NEC_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_APPLE)
+    {"Apple", APPLE, sendProtocolApple, NEC_REPEAT_PERIOD / 1000},
+#endif
+#if defined(SEND_PROTOCOL_SHARP)
+    {"Sharp", SHARP, sendProtocolSharp, DENON_REPEAT_PERIOD / 1000},
+#endif
+};
+const uint8_t IR_PROTOCOL_COUNT = sizeof(IR_PROTOCOLS) / sizeof(*IR_PROTOCOLS);
+
+// Raw timings from irRawFrame, not part of the dispatch table
+const uint8_t IR_PROTOCOL_RAW = UNKNOWN;
+
+// Find protocol by name (case insensitive), nullptr if not enabled
+const irProtocol_t *findProtocol(const char *name, uint16_t length)
+{
+    for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+    {
+        if (strlen(IR_PROTOCOLS[i].name) == length && strncasecmp(IR_PROTOCOLS[i].name, name, length) == 0)
+        {
+            return &IR_PROTOCOLS[i];
+        }
+    }
+    return nullptr;
+}
+
+const irProtocol_t *findProtocol(uint8_t protocol)
+{
+    for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+    {
+        if (IR_PROTOCOLS[i].protocol == protocol)
+        {
+            return &IR_PROTOCOLS[i];
+        }
+    }
+    return nullptr;
+}
+
+// Name for logging, also for raw commands
+const char *protocolName(uint8_t protocol)
+{
+    if (protocol == IR_PROTOCOL_RAW)
+    {
+        return "raw";
+    }
+    const irProtocol_t *entry = findProtocol(protocol);
+    return (entry != nullptr) ? entry->name : "?";
+}
+
+#endif
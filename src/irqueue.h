@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#ifndef irqueue_h
+#define irqueue_h
+
+// Max. number of IR commands waiting for transmission
+const uint8_t IR_QUEUE_SIZE = 16;
+
+// Max. length of a command id (plus terminator)
+const uint8_t IR_COMMAND_ID_SIZE = 17;
+
+typedef struct
+{
+    uint8_t protocol; // decode_type_t
+    uint16_t address;
+    uint16_t command;
+    uint8_t repeats;
+    uint8_t emitter;             // index into irEmitters
+    uint16_t delay;              // additional pause after this command (in ms)
+    uint64_t at;                 // start time (epoch ms), 0: at once
+    unsigned long enqueued;      // millis() when command was queued
+    unsigned long received;      // micros() when command was received
+    char id[IR_COMMAND_ID_SIZE]; // optional, a transmit acknowledgment is published if set
+} irCommand_t;
+
+// Bounded FIFO for IR commands. Commands are dropped (and counted) if the queue is full.
+class IRQueue
+{
+public:
+    bool push(const irCommand_t &command)
+    {
+        if (count >= IR_QUEUE_SIZE)
+        {
+            droppedCount++;
+            return false;
+        }
+        items[(head + count) % IR_QUEUE_SIZE] = command;
+        count++;
+        if (count > maxDepth)
+        {
+            maxDepth = count;
+        }
+        return true;
+    }
+
+    bool pop(irCommand_t &command)
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+        command = items[head];
+        head = (head + 1) % IR_QUEUE_SIZE;
+        count--;
+        return true;
+    }
+
+    // Remove the oldest command accepted by ready(command). Commands behind it keep their order, so every
+    // emitter still gets its commands in order while another emitter is busy.
+    template <class Ready>
+    bool popFirst(irCommand_t &command, Ready ready)
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (!ready(items[(head + i) % IR_QUEUE_SIZE]))
+            {
+                continue;
+            }
+            command = items[(head + i) % IR_QUEUE_SIZE];
+            for (uint8_t j = i; j > 0; j--)
+            {
+                items[(head + j) % IR_QUEUE_SIZE] = items[(head + j - 1) % IR_QUEUE_SIZE];
+            }
+            head = (head + 1) % IR_QUEUE_SIZE;
+            count--;
+            return true;
+        }
+        return false;
+    }
+
+    // Newest command accepted by match(command), nullptr if none
+    template <class Match>
+    irCommand_t *newest(Match match)
+    {
+        for (uint8_t i = count; i > 0; i--)
+        {
+            irCommand_t &command = items[(head + i - 1) % IR_QUEUE_SIZE];
+            if (match(command))
+            {
+                return &command;
+            }
+        }
+        return nullptr;
+    }
+
+    // Oldest command, nullptr if empty
+    const irCommand_t *peek() const
+    {
+        return (count == 0) ? nullptr : &items[head];
+    }
+
+    // Count commands dropped by the caller without trying to push them
+    void reject(uint8_t commands)
+    {
+        droppedCount += commands;
+    }
+
+    uint8_t depth() const { return count; }
+    uint8_t space() const { return IR_QUEUE_SIZE - count; }
+    uint8_t highWater() const { return maxDepth; }
+    uint32_t dropped() const { return droppedCount; }
+
+private:
+    irCommand_t items[IR_QUEUE_SIZE];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    uint8_t maxDepth = 0;
+    uint32_t droppedCount = 0;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#ifndef irraw_h
+#define irraw_h
+
+#include "commandreader.h"
+
+// Max. number of mark/space entries of a raw or Pronto frame (AC remotes need up to ~700)
+const uint16_t IR_RAW_ARENA_SIZE = 1024;
+
+// Raw timings are decoded straight from the payload into this arena and played back from there by timer1.
+// Only one raw command can be pending at a time.
+typedef struct
+{
+    uint16_t timings[IR_RAW_ARENA_SIZE];
+    uint16_t length;      // number of used entries
+    uint16_t repeatStart; // first entry played for repeats (Pronto repeat sequence)
+    uint8_t khz;
+    bool used; // reserved by a queued command
+} irRawFrame_t;
+
+irRawFrame_t irRawFrame;
+
+// Read {"raw":[9000,4500,...]} array into the arena
+bool parseRawArray(CommandReader &reader, PGM_P &error)
+{
+    const char *value;
+    uint16_t valueLength;
+    uint32_t number;
+
+    irRawFrame.length = 0;
+    irRawFrame.repeatStart = 0;
+    if (!reader.beginArray())
+    {
+        return reader.fail(PSTR("array expected"));
+    }
+    while (reader.nextElement())
+    {
+        if (!reader.readToken(value, valueLength))
+        {
+            return false;
+        }
+        if (irRawFrame.length >= IR_RAW_ARENA_SIZE)
+        {
+            // read the rest to keep the reader in sync
+            if (error == nullptr)
+                error = PSTR("raw frame too long");
+            continue;
+        }
+        if (!parseDec(value, valueLength, 0xFFFF, number) || number == 0)
+        {
+            if (error == nullptr)
+                error = PSTR("invalid raw timing");
+            continue;
+        }
+        irRawFrame.timings[irRawFrame.length++] = number;
+    }
+    if (reader.failed())
+    {
+        return false;
+    }
+    if (irRawFrame.length == 0 && error == nullptr)
+    {
+        error = PSTR("empty raw frame");
+    }
+    return true;
+}
+
+/*
+ * Decode a Pronto hex string "0000 006D 0022 0002 0155 00AA ..." into the arena.
+ * Word 0: 0000 (learned code), word 1: carrier frequency code, word 2/3: number of once/repeat burst pairs,
+ * followed by the burst pairs in carrier periods.
+ */
+bool parsePronto(const char *text, uint16_t length, PGM_P &error)
+{
+    uint16_t frequencyCode = 0;
+    uint16_t onceEntries = 0;
+    uint16_t repeatEntries = 0;
+    uint16_t word = 0;
+    uint32_t number;
+
+    irRawFrame.length = 0;
+    irRawFrame.repeatStart = 0;
+
+    const char *end = text + length;
+    while (text < end)
+    {
+        while (text < end && *text == ' ')
+            text++;
+        if (text >= end)
+            break;
+        const char *token = text;
+        while (text < end && *text != ' ')
+            text++;
+        if (!parseHex(token, text - token, 0xFFFF, number))
+        {
+            error = PSTR("invalid pronto word");
+            return false;
+        }
+
+        switch (word)
+        {
+        case 0:
+            if (number != 0)
+            {
+                error = PSTR("unsupported pronto type");
+                return false;
+            }
+            break;
+        case 1:
+            if (number == 0)
+            {
+                error = PSTR("invalid pronto frequency");
+                return false;
+            }
+            frequencyCode = number;
+            break;
+        case 2:
+            onceEntries = number * 2;
+            break;
+        case 3:
+            repeatEntries = number * 2;
+            if (onceEntries + repeatEntries > IR_RAW_ARENA_SIZE)
+            {
+                error = PSTR("raw frame too long");
+                return false;
+            }
+            break;
+        default:
+        {
+            if (irRawFrame.length >= onceEntries + repeatEntries)
+            {
+                error = PSTR("pronto too long");
+                return false;
+            }
+            // duration = periods * frequency code * 0.241246 us
+            uint32_t duration = ((uint64_t)number * frequencyCode * 241246) / 1000000;
+            irRawFrame.timings[irRawFrame.length++] = (duration > 0xFFFF) ? 0xFFFF : duration;
+            break;
+        }
+        }
+        word++;
+    }
+
+    if (word < 4 || irRawFrame.length != onceEntries + repeatEntries || irRawFrame.length == 0)
+    {
+        error = PSTR("pronto length mismatch");
+        return false;
+    }
+    irRawFrame.khz = ((4145146UL / frequencyCode) + 500) / 1000;
+    irRawFrame.repeatStart = (repeatEntries > 0) ? onceEntries : 0;
+    return true;
+}
+
+#endif
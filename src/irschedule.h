@@ -0,0 +1,107 @@
+#include <Arduino.h>
+#ifndef irschedule_h
+#define irschedule_h
+
+#include "irqueue.h"
+
+const uint8_t IR_SCHEDULE_SIZE = 32;                // max. number of commands waiting for their time
+const uint32_t IR_SCHEDULE_WINDOW = 86400000UL;     // max. time between now and "at", also in the past (in ms)
+
+typedef struct
+{
+    uint32_t sequence; // order of commands with the same time
+    irCommand_t command;
+} irScheduled_t;
+
+/*
+ * Commands with a start time ("at", epoch ms), kept in a binary min-heap ordered by time and arrival, so the
+ * next due command is always at the top. Push and pop take O(log n) moves of an entry.
+ */
+class IRSchedule
+{
+public:
+    bool push(const irCommand_t &command)
+    {
+        if (count >= IR_SCHEDULE_SIZE)
+        {
+            droppedCount++;
+            return false;
+        }
+        uint8_t index = count++;
+        irScheduled_t entry = {nextSequence++, command};
+        // Move parents down until the place of the entry is found
+        while (index > 0)
+        {
+            uint8_t parent = (index - 1) / 2;
+            if (!before(entry, entries[parent]))
+            {
+                break;
+            }
+            entries[index] = entries[parent];
+            index = parent;
+        }
+        entries[index] = entry;
+        return true;
+    }
+
+    // Remove the earliest command if it is due at now (epoch us)
+    bool pop(uint64_t now, irCommand_t &command)
+    {
+        if (count == 0 || entries[0].command.at * 1000 > now)
+        {
+            return false;
+        }
+        command = entries[0].command;
+        count--;
+        if (count == 0)
+        {
+            return true;
+        }
+        // Move children of the free root up until the place of the last entry is found
+        const irScheduled_t &last = entries[count];
+        uint8_t index = 0;
+        while (true)
+        {
+            uint8_t child = index * 2 + 1;
+            if (child >= count)
+            {
+                break;
+            }
+            if (child + 1 < count && before(entries[child + 1], entries[child]))
+            {
+                child++;
+            }
+            if (!before(entries[child], last))
+            {
+                break;
+            }
+            entries[index] = entries[child];
+            index = child;
+        }
+        entries[index] = last;
+        return true;
+    }
+
+    // Earliest command, nullptr if empty
+    const irCommand_t *peek() const
+    {
+        return (count == 0) ? nullptr : &entries[0].command;
+    }
+
+    uint8_t size() const { return count; }
+    uint8_t space() const { return IR_SCHEDULE_SIZE - count; }
+    uint32_t dropped() const { return droppedCount; }
+
+private:
+    static bool before(const irScheduled_t &a, const irScheduled_t &b)
+    {
+        return a.command.at < b.command.at || (a.command.at == b.command.at && (int32_t)(a.sequence - b.sequence) < 0);
+    }
+
+    irScheduled_t entries[IR_SCHEDULE_SIZE];
+    uint8_t count = 0;
+    uint32_t nextSequence = 0;
+    uint32_t droppedCount = 0;
+};
+
+#endif
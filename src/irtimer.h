@@ -0,0 +1,225 @@
+#include <Arduino.h>
+#ifndef irtimer_h
+#define irtimer_h
+
+#include "irframe.h"
+
+// Timer1 runs with 80 MHz / 16 (TIM_DIV16) also if CPU runs at 160 MHz
+const uint32_t IR_TIMER_TICKS_PER_US = 5;
+const uint8_t IR_TIMER_DUTY_CYCLE = 30; // in percent
+const uint8_t IR_TIMER_CHANNELS = 8;    // frames played at the same time, one per pin
+const uint16_t IR_TIMER_MAX_SKIP = 40;  // max. carrier periods between two edges while all channels are in a space,
+                                        // bounds the delay until a new frame starts (~1 ms at 38 kHz)
+const uint32_t IR_TIMER_MIN_TICKS = 10; // shortest timer1 interval if the ISR is behind its schedule (2 us)
+
+// One frame in playback. Entries are counted in carrier periods, so all channels share the carrier edges.
+typedef struct
+{
+    const uint16_t *timings;
+    uint16_t length;
+    uint16_t index;              // current entry, even: mark, odd: space
+    uint16_t left;               // carrier periods left in the current entry
+    uint16_t fraction;           // rounding remainder of the entries so far (1/65536 periods), keeps edges from drifting
+    uint32_t pinMask;
+    volatile bool busy;          // set by IRtimerSend(), cleared by the ISR after the last entry
+    volatile bool starting;      // set by IRtimerSend(), the ISR starts the frame at the next period boundary
+    volatile uint32_t startTime; // micros() at start of the last frame
+    volatile uint32_t endTime;   // micros() at end of the last frame
+} irTimerChannel_t;
+
+// Playback state, only touched by IRtimerISR() while running (and IRtimerSend() with interrupts disabled)
+irTimerChannel_t irTimerChannels[IR_TIMER_CHANNELS];
+volatile bool irTimerRunning = false;
+volatile bool irTimerCarrierOn = false;
+uint32_t irTimerMarkMask = 0;     // pins with the carrier high
+uint16_t irTimerStep = 1;         // carrier periods since the last boundary
+uint8_t irTimerKhz = 0;           // carrier of all running channels
+uint32_t irTimerPeriodsPerUs = 0; // carrier periods per us << 16
+uint32_t irTimerHighTicks = 0;
+uint32_t irTimerLowTicks = 0;
+uint32_t irTimerPeriodTicks = 0;
+uint32_t irTimerDeadline = 0;     // ESP.getCycleCount() of the next edge
+uint8_t irTimerCycleShift = 4;    // CPU cycles per timer tick = 1 << shift (16 at 80 MHz, 32 at 160 MHz)
+
+// Duration of the next timing entry of a channel in carrier periods, at least one.
+// Multiplication only, the ESP8266 has no divider.
+uint16_t IRAM_ATTR IRtimerPeriods(irTimerChannel_t &channel, uint16_t us)
+{
+    uint32_t scaled = (uint32_t)us * irTimerPeriodsPerUs + channel.fraction;
+    channel.fraction = scaled & 0xFFFF;
+    return (scaled < 0x10000) ? 1 : (scaled >> 16);
+}
+
+// Arm timer1 for the edge ticks after the last one. The edges are scheduled on the CPU cycle counter, so the
+// interrupt latency and the runtime of the ISR before this call don't add up over the periods of a frame.
+void IRAM_ATTR IRtimerArm(uint32_t ticks)
+{
+    irTimerDeadline += ticks << irTimerCycleShift;
+    int32_t left = (int32_t)(irTimerDeadline - ESP.getCycleCount()) >> irTimerCycleShift;
+    timer1_write((left < (int32_t)IR_TIMER_MIN_TICKS) ? IR_TIMER_MIN_TICKS : left);
+}
+
+void IRAM_ATTR IRtimerStop()
+{
+    timer1_disable();
+    timer1_detachInterrupt();
+    irTimerCarrierOn = false;
+    irTimerRunning = false;
+}
+
+/*
+ * One edge schedule for all channels: a carrier pulse starts at every period boundary on the pins of the channels
+ * in a mark, so the timer interrupt fires twice per carrier period while any channel sends a mark. While all
+ * channels are in a space, the timer skips to the next boundary where a channel changes.
+ */
+void IRAM_ATTR IRtimerISR()
+{
+    if (irTimerCarrierOn)
+    {
+        // Falling edge of a carrier pulse
+        GPOC = irTimerMarkMask;
+        irTimerCarrierOn = false;
+        IRtimerArm(irTimerLowTicks);
+        return;
+    }
+
+    // Period boundary: advance all channels
+    uint32_t marks = 0;
+    uint16_t next = IR_TIMER_MAX_SKIP;
+    bool running = false;
+    for (uint8_t i = 0; i < IR_TIMER_CHANNELS; i++)
+    {
+        irTimerChannel_t &channel = irTimerChannels[i];
+        if (!channel.busy)
+        {
+            continue;
+        }
+        if (channel.starting)
+        {
+            channel.starting = false;
+            channel.index = 0;
+            channel.fraction = 0x8000;
+            channel.left = IRtimerPeriods(channel, channel.timings[0]);
+            channel.startTime = micros();
+        }
+        else
+        {
+            channel.left -= irTimerStep; // step is never longer than the entry of a channel
+            while (channel.left == 0)
+            {
+                if (++channel.index >= channel.length)
+                {
+                    channel.busy = false;
+                    channel.endTime = micros();
+                    break;
+                }
+                channel.left = IRtimerPeriods(channel, channel.timings[channel.index]);
+            }
+            if (!channel.busy)
+            {
+                continue;
+            }
+        }
+        running = true;
+        if ((channel.index & 1) == 0)
+        {
+            marks |= channel.pinMask;
+        }
+        else if (channel.left < next)
+        {
+            next = channel.left;
+        }
+    }
+
+    if (!running)
+    {
+        IRtimerStop();
+        return;
+    }
+    if (marks != 0)
+    {
+        // Rising edge of a carrier pulse
+        GPOS = marks;
+        irTimerMarkMask = marks;
+        irTimerCarrierOn = true;
+        irTimerStep = 1;
+        IRtimerArm(irTimerHighTicks);
+        return;
+    }
+    irTimerStep = next;
+    IRtimerArm(next * irTimerPeriodTicks);
+}
+
+// Start playback of mark/space timings (in us) on a channel in background. Frames on other channels keep running,
+// but need the same carrier frequency. The timings must not be changed until IRtimerIsBusy(channel) returns false.
+// Entries are rounded to carrier periods. Only GPIO0-15 are supported.
+bool IRtimerSend(uint8_t channel, uint8_t pin, const uint16_t *timings, uint16_t length, uint8_t khz)
+{
+    if (channel >= IR_TIMER_CHANNELS || irTimerChannels[channel].busy || length == 0 || khz == 0 || pin > 15)
+    {
+        return false;
+    }
+    if (irTimerRunning && khz != irTimerKhz)
+    {
+        return false;
+    }
+
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+
+    irTimerChannel_t &entry = irTimerChannels[channel];
+    noInterrupts();
+    entry.timings = timings;
+    entry.length = length;
+    entry.pinMask = (1 << pin);
+    entry.starting = true;
+    entry.busy = true;
+    if (!irTimerRunning)
+    {
+        irTimerKhz = khz;
+        irTimerPeriodTicks = (1000 * IR_TIMER_TICKS_PER_US + (khz / 2)) / khz;
+        irTimerHighTicks = (irTimerPeriodTicks * IR_TIMER_DUTY_CYCLE + 50) / 100;
+        irTimerLowTicks = irTimerPeriodTicks - irTimerHighTicks;
+        irTimerPeriodsPerUs = ((IR_TIMER_TICKS_PER_US << 16) + irTimerPeriodTicks / 2) / irTimerPeriodTicks; // of the real period
+        irTimerCarrierOn = false;
+        irTimerStep = 1;
+        irTimerRunning = true;
+        irTimerCycleShift = (ESP.getCpuFreqMHz() == 160) ? 5 : 4;
+
+        timer1_isr_init();
+        timer1_attachInterrupt(IRtimerISR);
+        timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+        irTimerDeadline = ESP.getCycleCount();
+        IRtimerArm(irTimerLowTicks); // first boundary
+    }
+    interrupts();
+    return true;
+}
+
+bool IRtimerSend(uint8_t channel, uint8_t pin, const irFrame_t &frame)
+{
+    return IRtimerSend(channel, pin, frame.timings, frame.length, frame.khz);
+}
+
+bool IRtimerIsBusy(uint8_t channel)
+{
+    return irTimerChannels[channel].busy;
+}
+
+// True while any channel plays a frame
+bool IRtimerIsBusy()
+{
+    return irTimerRunning;
+}
+
+uint32_t IRtimerStartTime(uint8_t channel)
+{
+    return irTimerChannels[channel].startTime;
+}
+
+uint32_t IRtimerEndTime(uint8_t channel)
+{
+    return irTimerChannels[channel].endTime;
+}
+
+#endif
@@ -0,0 +1,568 @@
+#include <Arduino.h>
+#ifndef macro_h
+#define macro_h
+
+#include <FS.h>
+#include "ircommand.h"
+
+const uint16_t MACRO_SIZE = 512;         // max. size of a compiled macro (in bytes)
+const uint8_t MACRO_MAX_DEPTH = 4;       // max. nesting of loop/if_rpt blocks
+const uint8_t MACRO_STEPS_PER_CALL = 16; // steps executed per handle() at most, keeps loop() short
+const char MACRO_PATH[] = "/%08x.mac";   // file per macro, named by the hash of the macro name
+
+// Compiled steps, operands little endian
+enum MacroOp : uint8_t
+{
+    MACRO_SEND = 1,      // protocol, address (2), command (2), repeats
+    MACRO_SEND_NAME = 2, // repeats (0xFF: stored), name length, name; code library lookup when the step runs
+    MACRO_WAIT = 3,      // ms (2)
+    MACRO_LOOP = 4,      // count (0: repeats of the trigger), body length (2), body
+    MACRO_IF_RPT = 5,    // min. repeats of the trigger, body length (2), body
+    MACRO_EMITTER = 6,   // name length, name; emitter of the next send step, looked up when the step runs
+};
+
+const uint8_t MACRO_REPEATS_STORED = 0xFF;
+
+class MacroWriter
+{
+public:
+    MacroWriter(uint8_t *code) : code(code) {}
+
+    bool put(uint8_t value)
+    {
+        if (length >= MACRO_SIZE)
+        {
+            return false;
+        }
+        code[length++] = value;
+        return true;
+    }
+
+    bool put16(uint16_t value) { return put(value & 0xFF) && put(value >> 8); }
+
+    // Length byte and text
+    bool putString(const char *text, uint8_t textLength)
+    {
+        bool ok = put(textLength);
+        for (uint8_t i = 0; i < textLength && ok; i++)
+        {
+            ok = put(text[i]);
+        }
+        return ok;
+    }
+
+    void patch16(uint16_t position, uint16_t value)
+    {
+        code[position] = value & 0xFF;
+        code[position + 1] = value >> 8;
+    }
+
+    uint8_t *code;
+    uint16_t length = 0;
+};
+
+/*
+ * Compile one step object:
+ *   {"proto":"<name>","adr":"<hex>","cmd":"<hex>","rpt":<dec>}  send a command
+ *   {"name":"<code name>","rpt":<dec>}                          send a code of the code library
+ *   "emitter":"<name>"                                          IR LED of a send step (default: first emitter)
+ *   {"wait":<ms>}                                               pause, may be combined with a command (sent first)
+ *   {"loop":<count>,"steps":[...]}                              repeat steps, count 0: repeats of the trigger
+ *   {"if_rpt":<min>,"steps":[...]}                              steps only if the trigger has at least min repeats
+ */
+bool compileMacroStep(CommandReader &reader, MacroWriter &out, uint8_t depth)
+{
+    const char *key;
+    const char *value;
+    uint16_t keyLength;
+    uint16_t valueLength;
+    uint32_t number;
+    const char *name = nullptr;
+    uint16_t nameLength = 0;
+    const char *emitter = nullptr;
+    uint16_t emitterLength = 0;
+    int16_t protocol = -1; // default protocol of the emitter
+    uint16_t address = 0;
+    uint16_t command = 0;
+    uint8_t repeats = MACRO_REPEATS_STORED;
+    bool hasAddress = false;
+    bool hasCommand = false;
+    int32_t wait = -1;
+    int16_t loop = -1;
+    int16_t ifRepeats = -1;
+    int32_t block = -1; // position of the block header
+
+    if (!reader.beginObject())
+    {
+        return false;
+    }
+    while (reader.nextMember(key, keyLength))
+    {
+        if (tokenEquals(key, keyLength, "steps"))
+        {
+            if (block >= 0 || depth > MACRO_MAX_DEPTH)
+            {
+                return reader.fail(PSTR("steps nested too deep"));
+            }
+            block = out.length;
+            if (!out.put(0) || !out.put(0) || !out.put16(0))
+            {
+                return reader.fail(PSTR("macro too long"));
+            }
+            if (!reader.beginArray())
+            {
+                return reader.fail(PSTR("array expected"));
+            }
+            while (reader.nextElement())
+            {
+                if (!compileMacroStep(reader, out, depth + 1))
+                {
+                    return false;
+                }
+            }
+            out.patch16(block + 2, out.length - block - 4);
+            continue;
+        }
+        if (!reader.readToken(value, valueLength))
+        {
+            return false;
+        }
+        if (tokenEquals(key, keyLength, "name"))
+        {
+            if (!isValidCodeName(value, valueLength))
+                return reader.fail(PSTR("invalid name"));
+            name = value;
+            nameLength = valueLength;
+        }
+        else if (tokenEquals(key, keyLength, "emitter"))
+        {
+            if (irEmitters.find(value, valueLength) < 0)
+                return reader.fail(PSTR("unknown emitter"));
+            emitter = value;
+            emitterLength = valueLength;
+        }
+        else if (tokenEquals(key, keyLength, "proto"))
+        {
+            const irProtocol_t *entry = findProtocol(value, valueLength);
+            if (entry == nullptr)
+                return reader.fail(PSTR("unknown proto"));
+            protocol = entry->protocol;
+        }
+        else if (tokenEquals(key, keyLength, "adr") && parseHex(value, valueLength, 0xFFFF, number))
+        {
+            address = number;
+            hasAddress = true;
+        }
+        else if (tokenEquals(key, keyLength, "cmd") && parseHex(value, valueLength, 0xFFFF, number))
+        {
+            command = number;
+            hasCommand = true;
+        }
+        else if (tokenEquals(key, keyLength, "rpt") && parseDec(value, valueLength, 0xFE, number))
+        {
+            repeats = number;
+        }
+        else if (tokenEquals(key, keyLength, "wait") && parseDec(value, valueLength, 0xFFFF, number))
+        {
+            wait = number;
+        }
+        else if (tokenEquals(key, keyLength, "loop") && parseDec(value, valueLength, 0xFF, number))
+        {
+            loop = number;
+        }
+        else if (tokenEquals(key, keyLength, "if_rpt") && parseDec(value, valueLength, 0xFF, number))
+        {
+            ifRepeats = number;
+        }
+        else
+        {
+            return reader.fail(PSTR("invalid step member"));
+        }
+    }
+    if (reader.failed())
+    {
+        return false;
+    }
+
+    bool ok = true;
+    if (block >= 0)
+    {
+        if ((loop >= 0) == (ifRepeats >= 0) || name != nullptr || hasAddress || hasCommand || emitter != nullptr)
+        {
+            return reader.fail(PSTR("steps need loop or if_rpt"));
+        }
+        out.code[block] = (loop >= 0) ? MACRO_LOOP : MACRO_IF_RPT;
+        out.code[block + 1] = (loop >= 0) ? loop : ifRepeats;
+    }
+    else if (loop >= 0 || ifRepeats >= 0)
+    {
+        return reader.fail(PSTR("steps missing"));
+    }
+    else if (name != nullptr)
+    {
+        ok = (emitter == nullptr || (out.put(MACRO_EMITTER) && out.putString(emitter, emitterLength))) &&
+             out.put(MACRO_SEND_NAME) && out.put(repeats) && out.putString(name, nameLength);
+    }
+    else if (hasAddress && hasCommand)
+    {
+        if (protocol < 0)
+        {
+            protocol = irEmitters[(emitter != nullptr) ? irEmitters.find(emitter, emitterLength) : 0].protocol;
+        }
+        ok = (emitter == nullptr || (out.put(MACRO_EMITTER) && out.putString(emitter, emitterLength))) &&
+             out.put(MACRO_SEND) && out.put(protocol) && out.put16(address) && out.put16(command) &&
+             out.put(repeats == MACRO_REPEATS_STORED ? 0 : repeats);
+    }
+    else if (hasAddress || hasCommand || emitter != nullptr || wait < 0)
+    {
+        return reader.fail(PSTR("incomplete step"));
+    }
+    if (ok && wait >= 0)
+    {
+        ok = out.put(MACRO_WAIT) && out.put16(wait);
+    }
+    return ok || reader.fail(PSTR("macro too long"));
+}
+
+// Compile {"steps":[...]} into code (MACRO_SIZE bytes)
+bool compileMacro(const char *data, unsigned int length, uint8_t *code, uint16_t &codeLength, PGM_P &error)
+{
+    CommandReader reader(data, length);
+    MacroWriter out(code);
+    const char *key;
+    uint16_t keyLength;
+    bool hasSteps = false;
+
+    if (reader.beginObject())
+    {
+        while (reader.nextMember(key, keyLength))
+        {
+            if (!tokenEquals(key, keyLength, "steps") || hasSteps || !reader.beginArray())
+            {
+                reader.fail(PSTR("steps expected"));
+                break;
+            }
+            hasSteps = true;
+            while (reader.nextElement())
+            {
+                if (!compileMacroStep(reader, out, 1))
+                {
+                    break;
+                }
+            }
+        }
+    }
+    error = nullptr;
+    if (reader.failed() || !hasSteps || !reader.atEnd())
+    {
+        error = reader.failed() ? reader.errorMessage() : PSTR("steps expected");
+    }
+    codeLength = out.length;
+    return error == nullptr;
+}
+
+typedef struct
+{
+    uint16_t start; // first step of the body
+    uint16_t end;   // first step after the body
+    uint8_t remaining;
+} macroLoop_t;
+
+/*
+ * Runs one macro at a time from loop(). Waits are absolute deadlines from the start of the macro, so the time
+ * a command needs to be queued or a late loop() doesn't add up over the steps.
+ */
+class MacroRunner
+{
+public:
+    // Starts a macro, a running one is stopped
+    bool start(const char *name, const uint8_t *code, uint16_t length, uint8_t repeats)
+    {
+        if (length > MACRO_SIZE)
+        {
+            return false;
+        }
+        memcpy(this->code, code, length);
+        strncpy(this->name, name, sizeof(this->name) - 1);
+        this->name[sizeof(this->name) - 1] = '\0';
+        this->length = length;
+        this->repeats = repeats;
+        pc = 0;
+        depth = 0;
+        emitter = 0;
+        due = millis();
+        running = true;
+        return true;
+    }
+
+    void stop() { running = false; }
+    bool active() const { return running; }
+    const char *current() const { return name; }
+
+    /*
+     * Execute the steps that are due. Commands are passed to send(irCommand_t &), which returns false if the command
+     * can't be queued now (e.g. queue full). The step is retried on the next call then.
+     * idle: called from within another task, a step with a named code stops there, the code library may be in use.
+     * Returns true once when the macro has finished.
+     */
+    template <class Send>
+    bool handle(Send send, bool idle = false)
+    {
+        if (!running || (long)(millis() - due) < 0)
+        {
+            return false;
+        }
+        for (uint8_t step = 0; step < MACRO_STEPS_PER_CALL; step++)
+        {
+            // End of a loop body
+            if (depth > 0 && pc >= loops[depth - 1].end)
+            {
+                macroLoop_t &loop = loops[depth - 1];
+                if (--loop.remaining > 0)
+                    pc = loop.start;
+                else
+                    depth--;
+                continue;
+            }
+            if (pc >= length)
+            {
+                running = false;
+                return true;
+            }
+
+            irCommand_t command;
+            command.emitter = (emitter > 0) ? emitter : 0;
+            command.delay = 0;
+            command.at = 0;
+            command.id[0] = '\0';
+            command.received = micros();
+            switch (code[pc])
+            {
+            case MACRO_EMITTER:
+                emitter = irEmitters.find((const char *)code + pc + 2, code[pc + 1]);
+                if (emitter < 0)
+                {
+                    Serial.printf_P(PSTR("Macro '%s': unknown emitter '%.*s', next step skipped\n"), name, code[pc + 1], code + pc + 2);
+                }
+                pc += 2 + code[pc + 1];
+                break;
+
+            case MACRO_SEND:
+                if (emitter < 0)
+                {
+                    emitter = 0;
+                    pc += 7;
+                    break;
+                }
+                command.protocol = code[pc + 1];
+                command.address = read16(pc + 2);
+                command.command = read16(pc + 4);
+                command.repeats = code[pc + 6];
+                if (!send(command))
+                {
+                    return false;
+                }
+                emitter = 0;
+                pc += 7;
+                break;
+
+            case MACRO_SEND_NAME:
+            {
+                if (idle)
+                {
+                    return false;
+                }
+                PGM_P error = nullptr;
+                bool storedRepeats = (code[pc + 1] == MACRO_REPEATS_STORED);
+                command.repeats = code[pc + 1];
+                uint16_t next = pc + 3 + code[pc + 2];
+                if (emitter < 0)
+                {
+                    emitter = 0;
+                    pc = next;
+                    break;
+                }
+                bool raw = loadNamedCode((const char *)code + pc + 3, code[pc + 2], command, !storedRepeats, error);
+                if (error != nullptr)
+                {
+                    if (irRawFrame.used)
+                    {
+                        return false; // previous raw command still playing
+                    }
+                    Serial.printf_P(PSTR("Macro '%s': %S, step skipped\n"), name, error);
+                    pc = next;
+                    break;
+                }
+                if (raw)
+                {
+                    command.protocol = IR_PROTOCOL_RAW;
+                    irRawFrame.used = true;
+                }
+                if (!send(command))
+                {
+                    if (command.protocol == IR_PROTOCOL_RAW)
+                    {
+                        irRawFrame.used = false;
+                    }
+                    return false;
+                }
+                emitter = 0;
+                pc = next;
+                break;
+            }
+
+            case MACRO_WAIT:
+                due += read16(pc + 1);
+                pc += 3;
+                if ((long)(millis() - due) < 0)
+                {
+                    return false;
+                }
+                break;
+
+            case MACRO_LOOP:
+            {
+                uint8_t count = code[pc + 1] != 0 ? code[pc + 1] : repeats;
+                uint16_t end = pc + 4 + read16(pc + 2);
+                if (count == 0 || depth >= MACRO_MAX_DEPTH)
+                {
+                    pc = end;
+                    break;
+                }
+                loops[depth++] = {(uint16_t)(pc + 4), end, count};
+                pc += 4;
+                break;
+            }
+
+            case MACRO_IF_RPT:
+                pc += 4 + ((repeats >= code[pc + 1]) ? 0 : read16(pc + 2));
+                break;
+
+            default:
+                Serial.printf_P(PSTR("Macro '%s': invalid step at %u\n"), name, pc);
+                running = false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    uint16_t read16(uint16_t position) const { return code[position] | (code[position + 1] << 8); }
+
+    uint8_t code[MACRO_SIZE];
+    uint16_t length = 0;
+    char name[CODE_NAME_SIZE] = "";
+    uint16_t pc = 0;
+    uint8_t repeats = 0;
+    int8_t emitter = 0; // of the next send step, -1: unknown, step is skipped
+    macroLoop_t loops[MACRO_MAX_DEPTH];
+    uint8_t depth = 0;
+    unsigned long due = 0; // millis() when the next step is due
+    bool running = false;
+};
+
+// Compiled macros on the FS, one file per macro: name length, name, code
+class MacroLibrary
+{
+public:
+    void begin(fs::FS &fs) { this->fs = &fs; }
+
+    bool store(const char *name, uint8_t nameLength, const uint8_t *code, uint16_t length)
+    {
+        char path[16];
+        char stored[CODE_NAME_SIZE];
+        if (fs == nullptr || !isValidCodeName(name, nameLength))
+        {
+            return false;
+        }
+        // Another macro with the same hash would be overwritten
+        readName(name, nameLength, path, stored);
+        if (stored[0] != '\0' && !sameName(stored, name, nameLength))
+        {
+            return false;
+        }
+        fs::File file = fs->open(path, "w");
+        bool ok = file && file.write(&nameLength, 1) == 1 && file.write((const uint8_t *)name, nameLength) == nameLength &&
+                  file.write(code, length) == length;
+        file.close();
+        return ok;
+    }
+
+    // Returns the code length, 0 if not found
+    uint16_t load(const char *name, uint8_t nameLength, uint8_t *code)
+    {
+        char path[16];
+        char stored[CODE_NAME_SIZE];
+        readName(name, nameLength, path, stored);
+        if (!sameName(stored, name, nameLength))
+        {
+            return 0;
+        }
+        fs::File file = fs->open(path, "r");
+        uint16_t length = 0;
+        if (file && file.seek(1 + nameLength))
+        {
+            length = file.read(code, MACRO_SIZE);
+        }
+        file.close();
+        return length;
+    }
+
+    bool remove(const char *name, uint8_t nameLength)
+    {
+        char path[16];
+        char stored[CODE_NAME_SIZE];
+        readName(name, nameLength, path, stored);
+        return sameName(stored, name, nameLength) && fs->remove(path);
+    }
+
+    // Calls found(name) for every stored macro
+    template <class Found>
+    void list(Found found)
+    {
+        char name[CODE_NAME_SIZE];
+        uint8_t length;
+        fs::Dir dir = fs->openDir("/");
+        while (dir.next())
+        {
+            if (!dir.fileName().endsWith(F(".mac")))
+            {
+                continue;
+            }
+            fs::File file = dir.openFile("r");
+            if (file.read(&length, 1) == 1 && length < CODE_NAME_SIZE && file.read((uint8_t *)name, length) == length)
+            {
+                name[length] = '\0';
+                found(name);
+            }
+            file.close();
+        }
+    }
+
+private:
+    static bool sameName(const char *stored, const char *name, uint8_t nameLength)
+    {
+        return strlen(stored) == nameLength && memcmp(stored, name, nameLength) == 0;
+    }
+
+    // Path of name and the name stored in that file ("" if there is none)
+    void readName(const char *name, uint8_t nameLength, char *path, char *stored)
+    {
+        uint8_t length = 0;
+        snprintf(path, 16, MACRO_PATH, CodeLibrary::hash(name, nameLength));
+        stored[0] = '\0';
+        if (fs == nullptr || !fs->exists(path))
+        {
+            return;
+        }
+        fs::File file = fs->open(path, "r");
+        bool ok = file && file.read(&length, 1) == 1 && length < CODE_NAME_SIZE && file.read((uint8_t *)stored, length) == length;
+        file.close();
+        stored[ok ? length : 0] = '\0';
+    }
+
+    fs::FS *fs = nullptr;
+};
+
+#endif
@@ -1,15 +1,29 @@
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
-#include <NTPClient.h>
-#include <WiFiUdp.h> // needed by NTPClient.h
 #include <ESP8266WebServer.h>
 #include <ESP8266mDNS.h>
 #include <ESP8266HTTPUpdateServer.h>
 #include <PubSubClient.h> // API Doc: https://pubsubclient.knolleary.net/api.html
-#include <ArduinoJson.h>  // API Doc: https://arduinojson.org/v6/doc/
-#include <EEPROM.h>
-#include "TinyIRSender.hpp"
+#include <EEPROM.h> // only read to migrate the config of older firmware
+#include <flash_hal.h>
+#include <LittleFS.h>
 #include "settings.h"
+#include "configstore.h"
+#include "wificonnection.h"
+#include "backoff.h"
+#include "irqueue.h"
+#include "irtimer.h"
+#include "ircache.h"
+#include "ircoalesce.h"
+#include "irschedule.h"
+#include "ircommand.h"
+#include "irlearn.h"
+#include "macro.h"
+#include "timeservice.h"
+#include "htmlwriter.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "webassets.h"
 
 // ++++++++++++++++++++++++++++++++++++++++
 //
@@ -20,11 +34,11 @@
 // Constants - Misc
 const char FIRMWARE_VERSION[] = "1.0";
 const char COMPILE_DATE[] = __DATE__ " " __TIME__;
-const int CURRENT_CONFIG_VERSION = 1;
+const int CURRENT_CONFIG_VERSION = 2;
 const int HTTP_PORT = 80;
 
-// Constants - HW pins
-const int HWPIN_IR_LED = D5;
+// Constants - HW pins (IR LEDs are configured in the settings, see iremitter.h)
+const int HWPIN_IR_RECEIVER = D6; // demodulating receiver (e.g. TSOP4838) for learning
 // const int HWPIN_PUSHBUTTON = D2;
 // const int HWPIN_LED = D4;
 
@@ -32,22 +46,51 @@ const int HWPIN_IR_LED = D5;
 const int LED_MQTT_MIN_TIME = 500;
 const int LED_WEB_MIN_TIME = 500;
 const int TIME_BUTTON_LONGPRESS = 10000;
-const int MQTT_RECONNECT_INTERVAL = 2000;
+const unsigned long MQTT_BACKOFF_MIN = 2000;   // reconnect delay after the first failure (randomized to 50-100 %)
+const unsigned long MQTT_BACKOFF_MAX = 120000; // max. reconnect delay
+const unsigned long MQTT_STATUS_INTERVAL = 60000;
+const unsigned long METRICS_SAMPLE_INTERVAL = 1000;   // heap and RSSI sampling
+const unsigned long METRICS_PUBLISH_INTERVAL = 60000;
+const unsigned long IR_FRAME_PERIOD = NEC_REPEAT_PERIOD / 1000; // start to start distance of two IR frames
 
 // Constants - MQTT
 const char MQTT_SUBSCRIBE_CMD_TOPIC1[] = "%scmd";                // Subscribe patter without hostname
 const char MQTT_SUBSCRIBE_CMD_TOPIC2[] = "%s%s/cmd";             // Subscribe patter with hostname
 const char MQTT_PUBLISH_STATUS_TOPIC[] = "%s%s/status";          // Public pattern for status (normal and LWT) with hostname
+const char MQTT_PUBLISH_ACK_TOPIC[] = "%s%s/ack";                // Public pattern for command list acknowledgments with hostname
+const char MQTT_PUBLISH_METRICS_TOPIC[] = "%s%s/metrics";        // Public pattern for metrics with hostname
+const char MQTT_SUBSCRIBE_LEARN_TOPIC[] = "%s%s/learn";          // Subscribe pattern for learning (payload: name) with hostname
+const char MQTT_PUBLISH_LEARN_TOPIC[] = "%s%s/learn/result";     // Public pattern for learning results with hostname
+const char MQTT_SUBSCRIBE_MACRO_TOPIC[] = "%s%s/macro";          // Subscribe pattern for starting macros with hostname
 const char MQTT_LWT_MESSAGE[] = "{\"bridge\":\"disconnected\"}"; // LWT message
+const uint16_t MQTT_BUFFER_SIZE = 4096;                          // max. MQTT packet size (command lists, raw frames)
+const size_t IR_ACK_SIZE = 512;                                  // max. size of a command list acknowledgment
+const size_t MQTT_STATUS_SIZE = 512;                             // max. size of the status message
+const size_t MQTT_METRICS_SIZE = 1024;                           // max. size of the metrics message
 
 // Constants - NTP
 const char NTP_SERVER[] = "europe.pool.ntp.org";
-const long NTP_TIME_OFFSET = 0;                  // in s
-const unsigned long NTP_UPDATE_INTERVAL = 60000; // in ms
+const unsigned long NTP_UPDATE_INTERVAL = 64000; // in ms
 
 // Constants - Serial
 const int HWSERIAL_BAUD = 9600;
 
+// Constants - HTML (static page fragments, streamed from flash; style sheet in web/style.css)
+const char HTML_MENU[] PROGMEM = R"(<ul>
+<li><a href='/'>Home</a></li>
+<li><a href='/send'>Send</a></li>
+<li><a href='/settings'>Settings</a></li>
+<li><a href='/wifiscan'>WiFi Scan</a></li>
+<li><a href='/fwupdate'>FW Update</a></li>
+<li><a href='/reboot'>Reboot</a></li>
+</ul>
+<div id='main'>)";
+const size_t HTML_BUFFER_SIZE = 256; // chunk size of streamed pages
+
+// Constants - Config store (last flash sectors of the FS region)
+const uint8_t CONFIG_STORE_SECTORS = 4;
+const uint8_t CODE_FS_MAX_OPEN_FILES = 4; // code library file and temporary file while it is rewritten
+
 // ++++++++++++++++++++++++++++++++++++++++
 //
 // ENUMS
@@ -71,8 +114,13 @@ enum class LedColor
 
 // Webserver
 ESP8266WebServer server(HTTP_PORT);
+HTMLWriter<HTML_BUFFER_SIZE> html(server);
+
+// Tasks of loop()
+Scheduler scheduler;
 
 // Wifi Client
+WiFiConnection wifiConnection;
 WiFiClient espClient;
 
 // MQTT Client
@@ -81,9 +129,15 @@ PubSubClient client(espClient);
 // OTA Updater
 ESP8266HTTPUpdateServer httpUpdater;
 
-// NTP Client
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, NTP_SERVER, NTP_TIME_OFFSET, NTP_UPDATE_INTERVAL);
+// Config store
+ESPConfigFlash configFlash;
+ConfigStore<ESPConfigFlash> configStore(configFlash, (FS_PHYS_ADDR + FS_PHYS_SIZE) / SPI_FLASH_SEC_SIZE - CONFIG_STORE_SECTORS, CONFIG_STORE_SECTORS);
+
+// Code library on LittleFS, the FS region without the config store sectors
+FS codeFS(FSImplPtr(new littlefs_impl::LittleFSImpl(FS_PHYS_ADDR, FS_PHYS_SIZE - CONFIG_STORE_SECTORS * SPI_FLASH_SEC_SIZE, FS_PHYS_PAGE, FS_PHYS_BLOCK, CODE_FS_MAX_OPEN_FILES)));
+
+// SNTP clock
+TimeService timeService;
 
 // LED RGBW
 // Adafruit_NeoPixel led(1, HWPIN_LED, NEO_GRB + NEO_KHZ800);
@@ -95,13 +149,13 @@ NTPClient timeClient(ntpUDP, NTP_SERVER, NTP_TIME_OFFSET, NTP_UPDATE_INTERVAL);
 // ++++++++++++++++++++++++++++++++++++++++
 
 // Buffers
-String html;
-char buff[255];
+char buff[255]; // MQTT topics and payloads, not used by HTTP handlers
 
 // Config
-uint16_t cfgStart = 0;        // Start address in EEPROM for structure 'cfg'
+uint16_t cfgStart = 0;        // Start address in EEPROM for structure 'cfg' of older firmware
 configData_t cfg;             // Instance 'cfg' is a global variable with 'configData_t' structure now
-bool configIsDefault = false; // true if no valid config found in eeprom and defaults settings loaded
+configData_t cfgStored;       // will store the config as it is in the config store, to write only changed fields
+bool configIsDefault = false; // true if no valid config found in config store and defaults settings loaded
 
 // Runtime default config values
 int ledBrightness = PWMRANGE;
@@ -116,11 +170,88 @@ unsigned long lastDevicePollTime = 0;       // will store last beamer state time
 unsigned long lastPublishTime = 0;          // will store last publish time
 unsigned long ledOneTime = 0;               // will store last time LED was updated
 unsigned long ledTwoTime = 0;               // will store last time LED was updated
-unsigned long mqttLastReconnectAttempt = 0; // will store last time reconnect to mqtt broker
+Backoff mqttBackoff(MQTT_BACKOFF_MIN, MQTT_BACKOFF_MAX);
+bool mqttWasConnected = false;              // true until a lost connection is detected
+unsigned long mqttOutageStart = 0;          // will store time when connection to mqtt broker was lost
+unsigned long mqttLastOutage = 0;           // will store duration of last outage (in ms)
+unsigned long mqttMaxOutage = 0;            // will store duration of longest outage (in ms)
+uint32_t mqttConnectAttempts = 0;           // will store number of connect attempts
+uint32_t mqttReconnects = 0;                // will store number of successful reconnects after an outage
+unsigned long bootMDNSTime = 0;             // will store uptime when MDNS was started
+unsigned long bootMQTTTime = 0;             // will store uptime of first MQTT connect
 bool previousButtonState = 1;               // will store last Button state. 1 = unpressed, 0 = pressed
 unsigned long buttonTimer = 0;              // will store how long button was pressed
 
-void HTMLHeader(const char section[], unsigned int refresh = 0, const char url[] = "/");
+// Transmit state of one emitter
+typedef struct
+{
+  irCommand_t current;         // command currently transmitted
+  uint8_t repeatsLeft;         // repeat frames left for current
+  bool active;                 // true while current has frames left
+  bool rawPlaying;             // true while current plays irRawFrame
+  bool ackPending;             // true until the acknowledgment of current is published
+  bool startPending;           // true until the start time of the first frame is read from the timer
+  const irProtocol_t *sender;  // protocol of current if sent by IrSender, nullptr if played by timer1
+  uint32_t txStart;            // will store micros() at start of first frame of current
+  uint32_t txEnd;              // will store micros() at end of last frame sent by IrSender
+  unsigned long lastFrameTime; // will store start time of last IR frame
+} irEmitterState_t;
+
+// Frames are played from the cache. A frame started on one emitter stays in the cache until it is done,
+// since every other emitter starts at most one new frame while it is played.
+static_assert(IR_CACHE_SIZE > IR_EMITTERS_MAX, "cache entries could be evicted while played");
+static_assert(IR_EMITTERS_MAX <= IR_TIMER_CHANNELS, "one timer channel per emitter");
+
+// IR transmit queue and state machine
+IRQueue irQueue;
+IRSchedule irSchedule;                 // commands with "at" until they are due
+irEmitterState_t irEmitterStates[IR_EMITTERS_MAX] = {};
+IRFrameCache irCache;                  // expanded frames of recently used commands
+IRRateLimiter irRateLimiter;           // per target limit of commands from MQTT and the HTTP API
+irFrame_t irRepeatFrame;               // NEC repeat frame, encoded once in setup()
+IRLearner irLearner;                   // pauses IR transmission while armed
+MacroLibrary macroLibrary;
+MacroRunner macroRunner;
+unsigned long irLastFrameDuration = 0; // will store duration of last IR frame (in us)
+unsigned long irLastWaitTime = 0;      // will store queue wait time of last command
+unsigned long irMaxWaitTime = 0;       // will store max. queue wait time
+uint32_t irSentCount = 0;              // will store number of transmitted commands
+uint32_t irCoalescedCount = 0;         // will store number of commands merged into repeat frames
+uint64_t irAirtimeSaved = 0;           // will store airtime saved by merged commands (in us)
+int32_t irScheduleSpreadLast = 0;      // will store start of the last scheduled command - "at" (in us)
+uint32_t irScheduleSpreadMax = 0;      // will store max. deviation of scheduled commands from "at" (in us)
+
+// Metrics
+Histogram metricLoopTime;
+Histogram metricParseTime;
+Histogram metricIRSendTime;
+Histogram metricHTTPTime;
+Histogram metricAPITime;
+Histogram metricHeapFree;
+Histogram metricHeapFragmentation;
+Histogram metricHeapMaxBlock;
+Histogram metricRSSI;
+const metric_t METRICS[] = {
+    {"irbridge_loop_us", "loop() iteration time", &metricLoopTime},
+    {"irbridge_parse_us", "MQTT payload parse time", &metricParseTime},
+    {"irbridge_ir_send_us", "CPU time to start an IR frame (whole frame for IrSender protocols)", &metricIRSendTime},
+    {"irbridge_http_us", "HTTP request handling time of the pages", &metricHTTPTime},
+    {"irbridge_api_us", "HTTP request handling time of /api/", &metricAPITime},
+    {"irbridge_heap_free_bytes", "Free heap, sampled every second", &metricHeapFree},
+    {"irbridge_heap_fragmentation_percent", "Heap fragmentation, sampled every second", &metricHeapFragmentation},
+    {"irbridge_heap_max_block_bytes", "Largest free heap block, sampled every second", &metricHeapMaxBlock},
+    {"irbridge_wifi_rssi_neg_dbm", "Negated WiFi RSSI, sampled every second", &metricRSSI},
+};
+const uint8_t METRICS_COUNT = sizeof(METRICS) / sizeof(*METRICS);
+unsigned long metricsLastPublish = 0; // will store last publish time of metrics
+bool httpRequestSeen = false;         // set by server hook if handleClient() handles a request
+bool httpRequestAPI = false;          // the request seen was to /api/
+
+void HTMLHeader(const char section[], unsigned int refresh = 0, const char url[] = "/", int code = 200);
+void applyConfig(uint8_t apply);
+void applyMQTTPrefix();
+void applyLedBrightness();
+void MQTTpublishCommandAck(const irCommand_t &command, uint32_t txStart, uint32_t txEnd);
 
 // ++++++++++++++++++++++++++++++++++++++++
 //
@@ -128,7 +259,7 @@ void HTMLHeader(const char section[], unsigned int refresh = 0, const char url[]
 //
 // ++++++++++++++++++++++++++++++++++++++++
 
-void HTMLHeader(const char *section, unsigned int refresh, const char *url)
+void HTMLHeader(const char *section, unsigned int refresh, const char *url, int code)
 {
 
   char title[50];
@@ -136,140 +267,42 @@ void HTMLHeader(const char *section, unsigned int refresh, const char *url)
   WiFi.hostname().toCharArray(hostname, 50);
   snprintf(title, 50, "IRBridge@%s - %s", hostname, section);
 
-  html = "<!DOCTYPE html>";
-  html += "<html>\n";
-  html += "<head>\n";
-  html += "<meta name='viewport' content='width=600' />\n";
+  html.begin(code);
+  html += F("<!DOCTYPE html>");
+  html += F("<html>\n");
+  html += F("<head>\n");
+  html += F("<meta name='viewport' content='width=600' />\n");
   if (refresh != 0)
   {
-    html += "<META http-equiv='refresh' content='";
+    html += F("<META http-equiv='refresh' content='");
     html += refresh;
-    html += ";URL=";
+    html += F(";URL=");
     html += url;
-    html += "'>\n";
+    html += F("'>\n");
   }
-  html += "<title>";
+  html += F("<title>");
   html += title;
-  html += "</title>\n";
-  html += "<style>\n";
-  html += "body {\n";
-  html += " background-color: #EDEDED;\n";
-  html += " font-family: Arial, Helvetica, Sans-Serif;\n";
-  html += " Color: #333;\n";
-  html += "}\n";
-  html += "\n";
-  html += "h1 {\n";
-  html += "  background-color: #333;\n";
-  html += "  display: table-cell;\n";
-  html += "  margin: 20px;\n";
-  html += "  padding: 20px;\n";
-  html += "  color: white;\n";
-  html += "  border-radius: 10px 10px 0 0;\n";
-  html += "  font-size: 20px;\n";
-  html += "}\n";
-  html += "\n";
-  html += "ul {\n";
-  html += "  list-style-type: none;\n";
-  html += "  margin: 0;\n";
-  html += "  padding: 0;\n";
-  html += "  overflow: hidden;\n";
-  html += "  background-color: #333;\n";
-  html += "  border-radius: 0 10px 10px 10px;";
-  html += "}\n";
-  html += "\n";
-  html += "li {\n";
-  html += "  float: left;\n";
-  html += "}\n";
-  html += "\n";
-  html += "li a {\n";
-  html += "  display: block;\n";
-  html += "  color: #FFF;\n";
-  html += "  text-align: center;\n";
-  html += "  padding: 16px;\n";
-  html += "  text-decoration: none;\n";
-  html += "}\n";
-  html += "\n";
-  html += "li a:hover {\n";
-  html += "  background-color: #111;\n";
-  html += "}\n";
-  html += "\n";
-  html += "#main {\n";
-  html += "  padding: 20px;\n";
-  html += "  background-color: #FFF;\n";
-  html += "  border-radius: 10px;\n";
-  html += "  margin: 10px 0;\n";
-  html += "}\n";
-  html += "\n";
-  html += "#footer {\n";
-  html += "  border-radius: 10px;\n";
-  html += "  background-color: #333;\n";
-  html += "  padding: 10px;\n";
-  html += "  color: #FFF;\n";
-  html += "  font-size: 12px;\n";
-  html += "  text-align: center;\n";
-  html += "}\n";
-
-  html += "table  {\n";
-  html += "border-spacing: 0;\n";
-  html += "}\n";
-
-  html += "table td, table th {\n";
-  html += "padding: 5px;\n";
-  html += "}\n";
-
-  html += "table tr:nth-child(even) {\n";
-  html += "background: #EDEDED;\n";
-  html += "}";
-
-  html += "input[type=\"submit\"] {\n";
-  html += "background-color: #333;\n";
-  html += "border: none;\n";
-  html += "color: white;\n";
-  html += "padding: 5px 25px;\n";
-  html += "text-align: center;\n";
-  html += "text-decoration: none;\n";
-  html += "display: inline-block;\n";
-  html += "font-size: 16px;\n";
-  html += "margin: 4px 2px;\n";
-  html += "cursor: pointer;\n";
-  html += "}\n";
-
-  html += "input[type=\"submit\"]:hover {\n";
-  html += "background-color:#4e4e4e;\n";
-  html += "}\n";
-
-  html += "input[type=\"submit\"]:disabled {\n";
-  html += "opacity: 0.6;\n";
-  html += "cursor: not-allowed;\n";
-  html += "}\n";
-
-  html += "</style>\n";
-  html += "</head>\n";
-  html += "<body>\n";
-  html += "<h1>";
+  html += F("</title>\n");
+  html += F("<link rel='stylesheet' href='/style.css'>\n");
+  html += F("</head>\n");
+  html += F("<body>\n");
+  html += F("<h1>");
   html += title;
-  html += "</h1>\n";
-  html += "<ul>\n";
-  html += "<li><a href='/'>Home</a></li>\n";
-  html += "<li><a href='/send'>Send</a></li>\n";
-  html += "<li><a href='/settings'>Settings</a></li>\n";
-  html += "<li><a href='/wifiscan'>WiFi Scan</a></li>\n";
-  html += "<li><a href='/fwupdate'>FW Update</a></li>\n";
-  html += "<li><a href='/reboot'>Reboot</a></li>\n";
-  html += "</ul>\n";
-  html += "<div id='main'>";
+  html += F("</h1>\n");
+  html.write_P(HTML_MENU, sizeof(HTML_MENU) - 1);
 }
 
 void HTMLFooter()
 {
-  html += "</div>";
-  html += "<div id='footer'>&copy; 2022 Fabian Otto - Firmware v";
+  html += F("</div>");
+  html += F("<div id='footer'>&copy; 2022 Fabian Otto - Firmware v");
   html += FIRMWARE_VERSION;
-  html += " - Compiled at ";
+  html += F(" - Compiled at ");
   html += COMPILE_DATE;
-  html += "</div>\n";
-  html += "</body>\n";
-  html += "</html>\n";
+  html += F("</div>\n");
+  html += F("</body>\n");
+  html += F("</html>\n");
+  html.end();
 }
 
 void setLed(LedColor color)
@@ -326,18 +359,57 @@ void showWEBAction()
   // ledOneTime = millis();
 }
 
+bool configStoreAvailable()
+{
+  return FS_PHYS_SIZE >= CONFIG_STORE_SECTORS * SPI_FLASH_SEC_SIZE;
+}
+
+// Append all fields that changed since the last load/save to the config store
 void saveConfig()
 {
-  EEPROM.begin(512);
-  EEPROM.put(cfgStart, cfg);
-  delay(200);
-  EEPROM.commit(); // Only needed for ESP8266 to get data written
-  EEPROM.end();
+  if (!configStoreAvailable())
+  {
+    Serial.println(F("No flash for config store, check the FS size of the flash layout"));
+    return;
+  }
+  uint8_t written = 0;
+  for (const configField_t &field : CONFIG_FIELDS)
+  {
+    const uint8_t *value = (const uint8_t *)&cfg + field.offset;
+    uint8_t *stored = (uint8_t *)&cfgStored + field.offset;
+    if (memcmp(value, stored, field.size) != 0)
+    {
+      if (!configStore.write(field.key, value, field.size))
+      {
+        Serial.printf_P(PSTR("Config store write of field %u failed\n"), field.key);
+        return;
+      }
+      memcpy(stored, value, field.size);
+      written++;
+    }
+  }
+  Serial.printf_P(PSTR("Config saved, %u fields written, %u bytes used in sector\n"), written, configStore.used());
+}
+
+// How the fields changed since the last load/save have to be applied (CONFIG_REBOOT, CONFIG_MQTT, ...)
+uint8_t changedConfig()
+{
+  uint8_t apply = 0;
+  for (const configField_t &field : CONFIG_FIELDS)
+  {
+    if (memcmp((const uint8_t *)&cfg + field.offset, (const uint8_t *)&cfgStored + field.offset, field.size) != 0)
+    {
+      apply |= field.apply;
+    }
+  }
+  return apply;
 }
 
 void eraseConfig()
 {
-  Serial.print(F("Erase EEPROM config..."));
+  Serial.print(F("Erase config..."));
+  configStore.format();
+  // Also the config of older firmware, else it would be migrated again
   EEPROM.begin(512);
   for (uint16_t i = cfgStart; i < sizeof(cfg); i++)
   {
@@ -350,6 +422,26 @@ void eraseConfig()
   Serial.print(F("done\n"));
 }
 
+// IP address from settings form, 0 if empty or invalid
+uint32_t parseIPAddress(const String &value)
+{
+  IPAddress address;
+  if (value.length() == 0 || !address.fromString(value))
+  {
+    return 0;
+  }
+  return (uint32_t)address;
+}
+
+String formatIPAddress(uint32_t address)
+{
+  if (address == 0)
+  {
+    return String();
+  }
+  return IPAddress(address).toString();
+}
+
 void toHex(char *buffer, uint32_t *value)
 {
   char *pEnd;
@@ -361,11 +453,408 @@ void toHex(char *buffer, uint32_t *value)
   *value = temp;
 }
 
-void sendIR(uint8_t sAddress, uint8_t sCommand, uint_fast8_t sRepeats)
+// Merge command into the newest queued command of its emitter, or into the command in transmission if no other
+// command of the emitter is queued and its next frame isn't due yet (repeat frames have to follow without a pause)
+bool coalesceIR(const irCommand_t &command)
+{
+  uint8_t emitter = command.emitter;
+  irCommand_t *newest = irQueue.newest([emitter](const irCommand_t &queued) { return queued.emitter == emitter; });
+  if (newest != nullptr)
+  {
+    return coalesceCommand(*newest, command);
+  }
+
+  irEmitterState_t &state = irEmitterStates[emitter];
+  if (state.lastFrameTime == 0 || (!state.active && (millis() - state.lastFrameTime) >= IR_FRAME_PERIOD))
+  {
+    return false;
+  }
+  uint8_t repeats = state.current.repeats;
+  if (!coalesceCommand(state.current, command))
+  {
+    return false;
+  }
+  state.repeatsLeft += state.current.repeats - repeats;
+  state.active = true;
+  if (command.id[0] != '\0')
+  {
+    state.ackPending = true;
+  }
+  return true;
+}
+
+bool queueIR(irCommand_t &command)
+{
+  command.enqueued = millis();
+
+  if (coalesceIR(command))
+  {
+    irCoalescedCount++;
+    irAirtimeSaved += coalescedAirtime(command, irRepeatFrame);
+    Serial.printf_P(PSTR("Coalesced IR adr: 0x%02x cmd: 0x%02x into repeat frames (%u merged)\n"), command.address, command.command, irCoalescedCount);
+    return true;
+  }
+
+  if (!irQueue.push(command))
+  {
+    Serial.printf_P(PSTR("IR queue full, dropped adr: 0x%02x cmd: 0x%02x\n"), command.address, command.command);
+    return false;
+  }
+
+  Serial.printf_P(PSTR("Queued IR\nproto: %s adr: 0x%02x cmd: 0x%02x rpt:%d dly:%u (queue: %d)\n"), protocolName(command.protocol), command.address, command.command, command.repeats, command.delay, irQueue.depth());
+  return true;
+}
+
+// Hold a command with "at" until it is due
+bool scheduleIR(irCommand_t &command)
+{
+  if (!irSchedule.push(command))
+  {
+    Serial.printf_P(PSTR("IR schedule full, dropped adr: 0x%02x cmd: 0x%02x\n"), command.address, command.command);
+    return false;
+  }
+  Serial.printf_P(PSTR("Scheduled IR adr: 0x%02x cmd: 0x%02x at %lu.%03lu (scheduled: %u)\n"), command.address, command.command,
+                  (unsigned long)(command.at / 1000), (unsigned long)(command.at % 1000), irSchedule.size());
+  return true;
+}
+
+// Move due commands into the queue, as long as it has space. They are not merged with queued commands.
+void handleSchedule()
+{
+  uint64_t now = timeService.nowEpochMicros();
+  irCommand_t command;
+  while (irQueue.space() > 0 && irSchedule.pop(now, command))
+  {
+    command.enqueued = millis();
+    irQueue.push(command);
+  }
+}
+
+// Deviation of the first frame of a scheduled command from its "at" (in us)
+int32_t scheduleSpread(const irCommand_t &command, uint32_t txStart)
+{
+  int64_t spread = (int64_t)timeService.epochMicrosAt(txStart) - (int64_t)(command.at * 1000);
+  return (spread > INT32_MAX) ? INT32_MAX : (spread < INT32_MIN) ? INT32_MIN : (int32_t)spread;
+}
+
+void recordScheduleSpread(const irCommand_t &command, uint32_t txStart)
+{
+  if (command.at == 0)
+  {
+    return;
+  }
+  irScheduleSpreadLast = scheduleSpread(command, txStart);
+  uint32_t deviation = abs(irScheduleSpreadLast);
+  if (deviation > irScheduleSpreadMax)
+  {
+    irScheduleSpreadMax = deviation;
+  }
+}
+
+bool sendIR(uint8_t sEmitter, uint8_t sProtocol, uint16_t sAddress, uint16_t sCommand, uint_fast8_t sRepeats)
+{
+  irCommand_t command;
+  command.emitter = sEmitter;
+  command.protocol = sProtocol;
+  command.address = sAddress;
+  command.command = sCommand;
+  command.repeats = sRepeats;
+  command.delay = 0;
+  command.at = 0;
+  command.id[0] = '\0';
+  command.received = micros();
+
+  return queueIR(command);
+}
+
+// Play a frame on an emitter
+void sendFrame(uint8_t emitter, const uint16_t *timings, uint16_t length, uint8_t khz)
+{
+  irEmitterState_t &state = irEmitterStates[emitter];
+  state.lastFrameTime = millis();
+  IRtimerSend(emitter, irEmitters[emitter].pin, timings, length, khz);
+  state.active = (state.repeatsLeft > 0);
+  irLastFrameDuration = frameDuration(timings, length);
+}
+
+// Send a frame of current by IrSender, which returns at the end of the frame. The carrier is generated by timer1.
+void sendProtocolFrame(uint8_t emitter, bool repeat)
+{
+  irEmitterState_t &state = irEmitterStates[emitter];
+  state.lastFrameTime = millis();
+  IrSender.setSendPin(irEmitters[emitter].pin);
+  uint32_t frameStart = micros();
+  state.sender->send(state.current.address, state.current.command, repeat);
+  state.txEnd = micros();
+  irLastFrameDuration = state.txEnd - frameStart;
+  state.active = (state.repeatsLeft > 0);
+  if (!repeat)
+  {
+    state.txStart = frameStart;
+    recordScheduleSpread(state.current, frameStart);
+  }
+}
+
+// Timer1 can play the first frame of command now. Frames played at the same time need the same carrier,
+// IrSender protocols need timer1 alone. Commands of unknown protocols are ready to be taken and dropped.
+bool IRtimerReady(const irCommand_t &command)
+{
+  uint8_t khz = 38;
+  const irProtocol_t *protocol = findProtocol(command.protocol);
+  if (command.protocol == IR_PROTOCOL_RAW)
+  {
+    khz = irRawFrame.khz;
+  }
+  else if (protocol == nullptr)
+  {
+    return true;
+  }
+  else if (protocol->send != nullptr)
+  {
+    return !IRtimerIsBusy();
+  }
+  return !IRtimerIsBusy() || khz == irTimerKhz;
+}
+
+// Transmit state machine of one emitter. Starts at most one IR frame (command or repeat) per call, returns true if it did.
+// takeNew: a new command may be taken from the queue
+// publish: the acknowledgment may be published, else the emitter waits with it for a call that may
+bool handleEmitterTransmit(uint8_t emitter, bool takeNew, bool publish)
+{
+  irEmitterState_t &state = irEmitterStates[emitter];
+  if (IRtimerIsBusy(emitter))
+  {
+    return false;
+  }
+
+  // The timer sets the start time when the frame really starts
+  if (state.startPending)
+  {
+    state.startPending = false;
+    state.txStart = IRtimerStartTime(emitter);
+    recordScheduleSpread(state.current, state.txStart);
+  }
+
+  // Last raw frame is done, the arena can take the next raw command
+  if (state.rawPlaying && state.repeatsLeft == 0)
+  {
+    state.rawPlaying = false;
+    irRawFrame.used = false;
+  }
+
+  // Last frame of current is done
+  if (state.ackPending && state.repeatsLeft == 0)
+  {
+    if (!publish)
+    {
+      return false;
+    }
+    state.ackPending = false;
+    MQTTpublishCommandAck(state.current, state.txStart, (state.sender != nullptr) ? state.txEnd : IRtimerEndTime(emitter));
+  }
+
+  // Keep frame period of the protocol between all frames and the delay requested after the last command
+  unsigned long gap = ((state.sender != nullptr) ? state.sender->period : IR_FRAME_PERIOD) + (state.active ? 0 : state.current.delay);
+  if (state.lastFrameTime != 0 && (millis() - state.lastFrameTime) < gap)
+  {
+    return false;
+  }
+
+  if (state.active && state.repeatsLeft > 0)
+  {
+    if (!IRtimerReady(state.current))
+    {
+      return false;
+    }
+    state.repeatsLeft--;
+    if (state.sender != nullptr)
+    {
+      sendProtocolFrame(emitter, true);
+    }
+    else if (state.rawPlaying)
+    {
+      sendFrame(emitter, irRawFrame.timings + irRawFrame.repeatStart, irRawFrame.length - irRawFrame.repeatStart, irRawFrame.khz);
+    }
+    else
+    {
+      sendFrame(emitter, irRepeatFrame.timings, irRepeatFrame.length, irRepeatFrame.khz);
+    }
+    return true;
+  }
+  state.active = false;
+
+  // Oldest command of this emitter, if timer1 can play it now
+  bool found = false;
+  auto next = [emitter, &found](const irCommand_t &command) {
+    if (found || command.emitter != emitter)
+    {
+      return false;
+    }
+    found = true;
+    return IRtimerReady(command);
+  };
+  if (!takeNew || !irQueue.popFirst(state.current, next))
+  {
+    return false;
+  }
+
+  irCommand_t &current = state.current;
+  if (current.protocol != IR_PROTOCOL_RAW && findProtocol(current.protocol) == nullptr)
+  {
+    Serial.printf_P(PSTR("Dropped IR command on %s: protocol %u not enabled\n"), irEmitters[emitter].name, current.protocol);
+    return false;
+  }
+  irLastWaitTime = millis() - current.enqueued;
+  if (irLastWaitTime > irMaxWaitTime)
+  {
+    irMaxWaitTime = irLastWaitTime;
+  }
+  irSentCount++;
+  state.ackPending = (current.id[0] != '\0');
+  state.repeatsLeft = current.repeats;
+  state.startPending = true;
+  state.sender = nullptr;
+  if (current.protocol == IR_PROTOCOL_RAW)
+  {
+    Serial.printf_P(PSTR("Sending IR on %s\nraw: %u entries @ %u kHz rpt:%d (waited %lu ms)\n"), irEmitters[emitter].name, irRawFrame.length, irRawFrame.khz, current.repeats, irLastWaitTime);
+    state.rawPlaying = true;
+    sendFrame(emitter, irRawFrame.timings, irRawFrame.length, irRawFrame.khz);
+    return true;
+  }
+
+  const irProtocol_t *protocol = findProtocol(current.protocol);
+  Serial.printf_P(PSTR("Sending IR on %s\nproto: %s adr: 0x%02x cmd: 0x%02x rpt:%d (waited %lu ms)\n"), irEmitters[emitter].name, protocol->name, current.address, current.command, current.repeats, irLastWaitTime);
+
+  if (protocol->send != nullptr)
+  {
+    // Other protocols are sent by IrSender, one frame per call like the frames of the timer1 player
+    state.sender = protocol;
+    state.startPending = false;
+    sendProtocolFrame(emitter, false);
+    return true;
+  }
+
+  irFrame_t *frame = irCache.get(NEC, current.address, current.command);
+  if (frame == nullptr)
+  {
+    frame = irCache.insert(NEC, current.address, current.command);
+    encodeNEC(*frame, current.address, current.command);
+  }
+  sendFrame(emitter, frame->timings, frame->length, frame->khz);
+  return true;
+}
+
+// Transmit state machine of all emitters, frames on different emitters are played at the same time.
+// Returns true if a frame was started.
+bool handleIRTransmit(bool publish)
+{
+  // The oldest command waits for timer1 (other carrier or IrSender protocol): only repeats are started until
+  // the running frames are done, so it isn't held back by the other emitters forever.
+  const irCommand_t *oldest = irQueue.peek();
+  bool takeNew = (oldest == nullptr || IRtimerReady(*oldest));
+
+  bool started = false;
+  for (uint8_t emitter = 0; emitter < irEmitters.size(); emitter++)
+  {
+    started |= handleEmitterTransmit(emitter, takeNew, publish);
+  }
+  return started;
+}
+
+// Queue all valid commands of a list as one batch or none of them, queued[i] is set for every queued command.
+// received: micros() when the payload was received
+void queueBatch(irBatch_t &batch, bool *queued, unsigned long received)
+{
+  uint8_t valid = 0;
+  uint8_t scheduled = 0;
+  uint64_t now = timeService.nowEpochMicros() / 1000;
+  for (uint8_t i = 0; i < batch.count; i++)
+  {
+    queued[i] = false;
+    irCommand_t &command = batch.commands[i];
+    if (batch.errors[i] == nullptr && command.at != 0)
+    {
+      if (now == 0)
+      {
+        batch.errors[i] = PSTR("clock not synced");
+      }
+      else if (command.at > now + IR_SCHEDULE_WINDOW || command.at + IR_SCHEDULE_WINDOW < now)
+      {
+        batch.errors[i] = PSTR("invalid at");
+      }
+    }
+    if (batch.errors[i] == nullptr)
+    {
+      if (command.at != 0)
+        scheduled++;
+      else
+        valid++;
+    }
+    else
+    {
+      Serial.print(F("Invalid command: "));
+      Serial.println(FPSTR(batch.errors[i]));
+    }
+  }
+
+  if (valid <= irQueue.space() && scheduled <= irSchedule.space())
+  {
+    for (uint8_t i = 0; i < batch.count; i++)
+    {
+      if (batch.errors[i] == nullptr)
+      {
+        irCommand_t &command = batch.commands[i];
+        command.received = received;
+        Serial.printf_P(PSTR("Command: proto: %s, adr: %02X, cmd: %02X, rpt: %d\n"), protocolName(command.protocol), command.address, command.command, command.repeats);
+        if (command.protocol != IR_PROTOCOL_RAW && !irRateLimiter.take(command.emitter, command.address, millis()))
+        {
+          Serial.printf_P(PSTR("Rate limit of adr: 0x%02x exceeded\n"), command.address);
+          batch.errors[i] = PSTR("rate limited");
+          continue;
+        }
+        queued[i] = (command.at != 0) ? scheduleIR(command) : queueIR(command);
+      }
+    }
+  }
+  else
+  {
+    Serial.printf_P(PSTR("IR queue full, dropped %u commands\n"), valid + scheduled);
+    irQueue.reject(valid + scheduled);
+  }
+
+  // Release the raw arena again if its command was not queued
+  for (uint8_t i = 0; i < batch.count; i++)
+  {
+    if (batch.errors[i] == nullptr && !queued[i] && batch.commands[i].protocol == IR_PROTOCOL_RAW)
+    {
+      irRawFrame.used = false;
+    }
+  }
+}
+
+// Acknowledgment with the status of every item: {"items":3,"queued":3,"status":["queued",...]}
+void formatBatchAck(char *ack, size_t size, const irBatch_t &batch, const bool *queued)
 {
-  Serial.printf("Sending IR\nadr: 0x%02x cmd: 0x%02x rpt:%d\n", sAddress, sCommand, sRepeats);
+  uint8_t queuedCount = 0;
+
+  for (uint8_t i = 0; i < batch.count; i++)
+  {
+    if (queued[i])
+    {
+      queuedCount++;
+    }
+  }
 
-  sendNEC(HWPIN_IR_LED, sAddress, sCommand, sRepeats);
+  int len = snprintf_P(ack, size, PSTR("{\"items\":%u,\"queued\":%u,\"status\":["), batch.count, queuedCount);
+  for (uint8_t i = 0; i < batch.count && len < (int)size; i++)
+  {
+    len += snprintf_P(ack + len, size - len, PSTR("%s\"%S\""), (i > 0 ? "," : ""),
+                      (queued[i] ? PSTR("queued") : (batch.errors[i] != nullptr ? batch.errors[i] : PSTR("queue full"))));
+  }
+  if (len < (int)size)
+  {
+    snprintf_P(ack + len, size - len, PSTR("]}"));
+  }
 }
 
 void handleSend()
@@ -384,12 +873,28 @@ void handleSend()
 
     if (server.method() == HTTP_POST)
     {
-      uint32_t hexaddress;
-      uint32_t hexcommand;
+      uint8_t emitter = 0;
+      const irProtocol_t *protocol = nullptr; // emitter default
+      uint32_t hexaddress = 0;
+      uint32_t hexcommand = 0;
       uint8_t repeats = 0;
 
       for (uint8_t i = 0; i < server.args(); i++)
       {
+        if (server.argName(i) == "protocol")
+        {
+          value = server.arg(i);
+          protocol = findProtocol(value.c_str(), value.length());
+        }
+        if (server.argName(i) == "emitter")
+        {
+          value = server.arg(i);
+          int8_t index = irEmitters.find(value.c_str(), value.length());
+          if (index >= 0)
+          {
+            emitter = index;
+          }
+        }
         if (server.argName(i) == "address")
         {
           value = server.arg(i);
@@ -405,27 +910,43 @@ void handleSend()
         if (server.argName(i) == "repeats")
         {
           value = server.arg(i);
-          repeats = value.toInt();
+          repeats = constrain(value.toInt(), 0, 0xFF);
         }
       }
 
       if (hexaddress != 0 && hexcommand != 0)
       {
-        sendIR(hexaddress, hexcommand, repeats);
+        sendIR(emitter, (protocol != nullptr) ? protocol->protocol : irEmitters[emitter].protocol, hexaddress, hexcommand, repeats);
       }
     }
   }
 
   HTMLHeader("Send");
-  html += "<form method='POST' action='/send'>";
-  html += "<input type='input' name='address' placeholder='address'><br />";
-  html += "<input type='input' name='command' placeholder='command'><br />";
-  html += "<input type='input' name='repeats' placeholder='repeats'><br />";
-  html += "<input type='submit' name='cmd' value='Send'>";
-  html += "</form>";
+  html += F("<form method='POST' action='/send'>");
+  html += F("<select name='emitter'>");
+  for (uint8_t i = 0; i < irEmitters.size(); i++)
+  {
+    html += F("<option>");
+    html += irEmitters[i].name;
+    html += F("</option>");
+  }
+  html += F("</select><br />");
+  html += F("<select name='protocol'>");
+  html += F("<option value=''>emitter default</option>");
+  for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+  {
+    html += F("<option>");
+    html += IR_PROTOCOLS[i].name;
+    html += F("</option>");
+  }
+  html += F("</select><br />");
+  html += F("<input type='input' name='address' placeholder='address'><br />");
+  html += F("<input type='input' name='command' placeholder='command'><br />");
+  html += F("<input type='input' name='repeats' placeholder='repeats'><br />");
+  html += F("<input type='submit' name='cmd' value='Send'>");
+  html += F("</form>");
 
   HTMLFooter();
-  server.send(200, "text/html", html);
 }
 
 void handleFWUpdate()
@@ -439,47 +960,66 @@ void handleFWUpdate()
   {
     HTMLHeader("Firmware Update");
 
-    html += "<form method='POST' action='/dofwupdate' enctype='multipart/form-data'>\n";
-    html += "<table>\n";
-    html += "<tr>\n";
-    html += "<td>Current version</td>\n";
-    html += String("<td>") + FIRMWARE_VERSION + String("</td>\n");
-    html += "</tr>\n";
-    html += "<tr>\n";
-    html += "<td>Compiled</td>\n";
-    html += String("<td>") + COMPILE_DATE + String("</td>\n");
-    html += "</tr>\n";
-    html += "<tr>\n";
-    html += "<td>Firmware file</td>\n";
-    html += "<td><input type='file' name='update'></td>\n";
-    html += "</tr>\n";
-    html += "</table>\n";
-    html += "<br />";
-    html += "<input type='submit' value='Update'>";
-    html += "</form>";
+    html += F("<form method='POST' action='/dofwupdate' enctype='multipart/form-data'>\n");
+    html += F("<table>\n");
+    html += F("<tr>\n");
+    html += F("<td>Current version</td>\n");
+    html += F("<td>");
+    html += FIRMWARE_VERSION;
+    html += F("</td>\n");
+    html += F("</tr>\n");
+    html += F("<tr>\n");
+    html += F("<td>Compiled</td>\n");
+    html += F("<td>");
+    html += COMPILE_DATE;
+    html += F("</td>\n");
+    html += F("</tr>\n");
+    html += F("<tr>\n");
+    html += F("<td>Firmware file</td>\n");
+    html += F("<td><input type='file' name='update'></td>\n");
+    html += F("</tr>\n");
+    html += F("</table>\n");
+    html += F("<br />");
+    html += F("<input type='submit' value='Update'>");
+    html += F("</form>");
     HTMLFooter();
-    server.send(200, "text/html", html);
   }
 }
 
+// Style sheet, gzipped at build time. Browsers revalidate it with the ETag and get 304 until the firmware changes it.
+void handleStyle()
+{
+  server.sendHeader(F("ETag"), STYLE_CSS_ETAG);
+  server.sendHeader(F("Cache-Control"), F("no-cache"));
+  if (server.header(F("If-None-Match")) == STYLE_CSS_ETAG)
+  {
+    server.send(304);
+    return;
+  }
+  server.sendHeader(F("Content-Encoding"), F("gzip"));
+  server.send_P(200, PSTR("text/css"), (PGM_P)STYLE_CSS_GZ, STYLE_CSS_GZ_LENGTH);
+}
+
 void handleNotFound()
 {
   showWEBAction();
-  HTMLHeader("File Not Found");
-  html += "URI: ";
+  HTMLHeader("File Not Found", 0, "/", 404);
+  html += F("URI: ");
   html += server.uri();
-  html += "<br />\nMethod: ";
-  html += (server.method() == HTTP_GET) ? "GET" : "POST";
-  html += "<br />\nArguments: ";
+  html += F("<br />\nMethod: ");
+  html += (server.method() == HTTP_GET) ? F("GET") : F("POST");
+  html += F("<br />\nArguments: ");
   html += server.args();
-  html += "<br />\n";
-  HTMLFooter();
+  html += F("<br />\n");
   for (uint8_t i = 0; i < server.args(); i++)
   {
-    html += " " + server.argName(i) + ": " + server.arg(i) + "<br />\n";
+    html += F(" ");
+    html += server.argName(i);
+    html += F(": ");
+    html += server.arg(i);
+    html += F("<br />\n");
   }
-
-  server.send(404, "text/html", html);
+  HTMLFooter();
 }
 
 void handleWiFiScan()
@@ -497,74 +1037,77 @@ void handleWiFiScan()
     int n = WiFi.scanNetworks();
     if (n == 0)
     {
-      html += "No networks found.\n";
+      html += F("No networks found.\n");
     }
     else
     {
-      html += "<table>\n";
-      html += "<tr>\n";
-      html += "<th>#</th>\n";
-      html += "<th>SSID</th>\n";
-      html += "<th>Channel</th>\n";
-      html += "<th>Signal</th>\n";
-      html += "<th>RSSI</th>\n";
-      html += "<th>Encryption</th>\n";
-      html += "<th>BSSID</th>\n";
-      html += "</tr>\n";
+      html += F("<table>\n");
+      html += F("<tr>\n");
+      html += F("<th>#</th>\n");
+      html += F("<th>SSID</th>\n");
+      html += F("<th>Channel</th>\n");
+      html += F("<th>Signal</th>\n");
+      html += F("<th>RSSI</th>\n");
+      html += F("<th>Encryption</th>\n");
+      html += F("<th>BSSID</th>\n");
+      html += F("</tr>\n");
       for (int i = 0; i < n; ++i)
       {
-        html += "<tr>\n";
-        snprintf(buff, sizeof(buff), "%02d", (i + 1));
-        html += String("<td>") + buff + String("</td>");
-        html += "<td>\n";
+        html += F("<tr>\n");
+        html += F("<td>");
+        if (i < 9)
+        {
+          html += F("0");
+        }
+        html += i + 1;
+        html += F("</td>");
+        html += F("<td>\n");
         if (WiFi.isHidden(i))
         {
-          html += "[hidden SSID]";
+          html += F("[hidden SSID]");
         }
         else
         {
-          html += "<a href='/settings?ssid=";
+          html += F("<a href='/settings?ssid=");
           html += WiFi.SSID(i).c_str();
-          html += "'>";
+          html += F("'>");
           html += WiFi.SSID(i).c_str();
-          html += "</a>";
+          html += F("</a>");
         }
-        html += "</td>\n<td>";
+        html += F("</td>\n<td>");
         html += WiFi.channel(i);
-        html += "</td>\n<td>";
+        html += F("</td>\n<td>");
         html += dBm2Quality(WiFi.RSSI(i));
-        html += "%</td>\n<td>";
+        html += F("%</td>\n<td>");
         html += WiFi.RSSI(i);
-        html += "dBm</td>\n<td>";
+        html += F("dBm</td>\n<td>");
         switch (WiFi.encryptionType(i))
         {
         case ENC_TYPE_WEP: // 5
-          html += "WEP";
+          html += F("WEP");
           break;
         case ENC_TYPE_TKIP: // 2
-          html += "WPA TKIP";
+          html += F("WPA TKIP");
           break;
         case ENC_TYPE_CCMP: // 4
-          html += "WPA2 CCMP";
+          html += F("WPA2 CCMP");
           break;
         case ENC_TYPE_NONE: // 7
-          html += "OPEN";
+          html += F("OPEN");
           break;
         case ENC_TYPE_AUTO: // 8
-          html += "WPA";
+          html += F("WPA");
           break;
         }
-        html += "</td>\n<td>";
+        html += F("</td>\n<td>");
         html += WiFi.BSSIDstr(i).c_str();
-        html += "</td>\n";
-        html += "</tr>\n";
+        html += F("</td>\n");
+        html += F("</tr>\n");
       }
-      html += "</table>";
+      html += F("</table>");
     }
 
     HTMLFooter();
-
-    server.send(200, "text/html", html);
   }
 }
 
@@ -581,20 +1124,18 @@ void handleReboot()
     if (server.method() == HTTP_POST)
     {
       HTMLHeader("Reboot", 10, "/");
-      html += "Reboot in progress...";
+      html += F("Reboot in progress...");
       reboot = true;
     }
     else
     {
       HTMLHeader("Reboot");
-      html += "<form method='POST' action='/reboot'>";
-      html += "<input type='submit' value='Reboot'>";
-      html += "</form>";
+      html += F("<form method='POST' action='/reboot'>");
+      html += F("<input type='submit' value='Reboot'>");
+      html += F("</form>");
     }
     HTMLFooter();
 
-    server.send(200, "text/html", html);
-
     if (reboot)
     {
       delay(200);
@@ -609,7 +1150,7 @@ void handleRoot()
 
   HTMLHeader("Main");
 
-  html += "<table>\n";
+  html += F("<table>\n");
 
   char timebuf[20];
   int sec = millis() / 1000;
@@ -618,82 +1159,144 @@ void handleRoot()
   int days = hr / 24;
   snprintf(timebuf, 20, " %02d:%02d:%02d:%02d", days, hr % 24, min % 60, sec % 60);
 
-  html += "<tr>\n<td>Uptime:</td>\n<td>";
+  html += F("<tr>\n<td>Uptime:</td>\n<td>");
   html += timebuf;
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
+
+  char datebuf[32];
+  timeService.format(datebuf, sizeof(datebuf));
+  html += F("<tr>\n<td>Current time:</td>\n<td>");
+  html += datebuf;
+  html += F(" (UTC)</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Current time:</td>\n<td>";
-  html += timeClient.getFormattedDate();
-  html += " (UTC)</td>\n</tr>\n";
+  html += F("<tr>\n<td>NTP:</td>\n<td>");
+  if (timeService.synced())
+  {
+    html += F("offset ");
+    html += timeService.offset();
+    html += F(" us, delay ");
+    html += timeService.roundTrip();
+    html += F(" us, drift ");
+    html += timeService.drift();
+    html += F(" ppb");
+  }
+  else
+  {
+    html += F("not synced");
+  }
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Firmware:</td>\n<td>v";
+  html += F("<tr>\n<td>Firmware:</td>\n<td>v");
   html += FIRMWARE_VERSION;
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Compiled:</td>\n<td>";
+  html += F("<tr>\n<td>Compiled:</td>\n<td>");
   html += COMPILE_DATE;
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>MQTT state:</td>\n<td>";
+  html += F("<tr>\n<td>MQTT state:</td>\n<td>");
   if (client.connected())
   {
-    html += "Connected";
+    html += F("Connected");
   }
   else
   {
-    html += "Not Connected";
+    html += F("Not Connected");
   }
-  html += "</td>\n</tr>\n";
-
-  html += "<tr>\n<td>Note:</td>\n<td>";
+  html += F("</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>IR queue:</td>\n<td>");
+  html += irQueue.depth();
+  html += F("/");
+  html += IR_QUEUE_SIZE;
+  html += F(" (max. ");
+  html += irQueue.highWater();
+  html += F(", dropped ");
+  html += irQueue.dropped();
+  html += F(")</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>IR commands sent:</td>\n<td>");
+  html += irSentCount;
+  html += F(" (last wait ");
+  html += irLastWaitTime;
+  html += F(" ms, max. wait ");
+  html += irMaxWaitTime;
+  html += F(" ms)</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>IR frame cache:</td>\n<td>");
+  html += irCache.hits();
+  html += F(" hits, ");
+  html += irCache.misses();
+  html += F(" misses, ");
+  html += irCache.evictions();
+  html += F(" evictions</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>IR commands coalesced:</td>\n<td>");
+  html += irCoalescedCount;
+  html += F(" (");
+  html += (unsigned long)(irAirtimeSaved / 1000);
+  html += F(" ms airtime saved), ");
+  html += irRateLimiter.limited();
+  html += F(" rate limited</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>Note:</td>\n<td>");
   if (strcmp(cfg.note, "") == 0)
   {
-    html += "---";
+    html += F("---");
   }
   else
   {
     html += cfg.note;
   }
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Hostname:</td>\n<td>";
+  html += F("<tr>\n<td>Hostname:</td>\n<td>");
   html += WiFi.hostname().c_str();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>IP address:</td>\n<td>";
+  html += F("<tr>\n<td>IP address:</td>\n<td>");
   html += WiFi.localIP().toString();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Subnetmask:</td>\n<td>";
+  html += F("<tr>\n<td>Subnetmask:</td>\n<td>");
   html += WiFi.subnetMask().toString();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Gateway:</td>\n<td>";
+  html += F("<tr>\n<td>Gateway:</td>\n<td>");
   html += WiFi.gatewayIP().toString();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>DNS server:</td>\n<td>";
+  html += F("<tr>\n<td>DNS server:</td>\n<td>");
   html += WiFi.dnsIP().toString();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "<tr>\n<td>MAC address:</td>\n<td>";
+  html += F("<tr>\n<td>MAC address:</td>\n<td>");
   html += WiFi.macAddress().c_str();
-  html += "</td>\n</tr>\n";
-
-  html += "<tr>\n<td>Signal strength:</td>\n<td>";
+  html += F("</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>WiFi connection:</td>\n<td>first after ");
+  html += wifiConnection.firstConnectTime();
+  html += F(" ms, ");
+  html += wifiConnection.reconnects();
+  html += F(" reconnects, ");
+  html += wifiConnection.failures();
+  html += F(" failed attempts");
+  html += wifiConnection.accessPointActive() ? F(" (fallback AP active)") : F("");
+  html += F("</td>\n</tr>\n");
+
+  html += F("<tr>\n<td>Signal strength:</td>\n<td>");
   html += dBm2Quality(WiFi.RSSI());
-  html += "% (";
+  html += F("% (");
   html += WiFi.RSSI();
-  html += " dBm)</td>\n</tr>\n";
+  html += F(" dBm)</td>\n</tr>\n");
 
-  html += "<tr>\n<td>Client IP:</td>\n<td>";
+  html += F("<tr>\n<td>Client IP:</td>\n<td>");
   html += server.client().remoteIP().toString().c_str();
-  html += "</td>\n</tr>\n";
+  html += F("</td>\n</tr>\n");
 
-  html += "</table>\n";
+  html += F("</table>\n");
 
   HTMLFooter();
-  server.send(200, "text/html", html);
 }
 
 void handleSettings()
@@ -708,7 +1311,9 @@ void handleSettings()
   else
   {
     Serial.println(F("Auth okay!"));
-    boolean saveandreboot = false;
+    boolean save = false;
+    uint8_t apply = 0;
+    PGM_P emitterError = nullptr;
     String value;
     if (server.method() == HTTP_POST)
     { // Save Settings
@@ -737,6 +1342,10 @@ void handleSettings()
         } // WiFi SSID
         else if (server.argName(i) == "ssid")
         {
+          if (value != cfg.wifi_ssid)
+          {
+            cfg.wifi_channel = 0; // forget AP of old network
+          }
           value.toCharArray(cfg.wifi_ssid, sizeof(cfg.wifi_ssid) / sizeof(*cfg.wifi_ssid));
 
         } // WiFi PSK
@@ -778,39 +1387,84 @@ void handleSettings()
         else if (server.argName(i) == "led_brightness")
         {
           cfg.led_brightness = value.toInt();
+
+        } // Static IP config (empty for DHCP)
+        else if (server.argName(i) == "ip_address")
+        {
+          cfg.ip_address = parseIPAddress(value);
+        }
+        else if (server.argName(i) == "ip_gateway")
+        {
+          cfg.ip_gateway = parseIPAddress(value);
+        }
+        else if (server.argName(i) == "ip_subnet")
+        {
+          cfg.ip_subnet = parseIPAddress(value);
+        }
+        else if (server.argName(i) == "ip_dns")
+        {
+          cfg.ip_dns = parseIPAddress(value);
+
+        } // IR emitters, an invalid config keeps the old one
+        else if (server.argName(i) == "ir_emitters")
+        {
+          IREmitterTable emitters;
+          if (emitters.parse(value.c_str(), HWPIN_IR_RECEIVER, emitterError))
+          {
+            value.toCharArray(cfg.ir_emitters, sizeof(cfg.ir_emitters) / sizeof(*cfg.ir_emitters));
+          }
         }
 
-        saveandreboot = true;
+        save = true;
       }
+      // Without config the bridge runs as AP only, so the first config always needs a reboot
+      apply = configIsDefault ? CONFIG_REBOOT : changedConfig();
     }
 
-    if (saveandreboot)
+    if (save && (apply & CONFIG_REBOOT))
     {
       HTMLHeader("Settings", 10, "/settings");
-      html += ">>> New Settings saved! Device will be reboot <<< ";
+      html += F(">>> New Settings saved! Device will be reboot <<< ");
     }
-    else
+    else if (save && emitterError != nullptr)
     {
-      HTMLHeader("Settings");
-
-      html += "<form action='/settings' method='post'>\n";
-      html += "<table>\n";
-
-      html += "<tr>\n<td>\nSettings source:</td>\n";
-      html += "<td><input type='text' disabled value='";
-      html += (configIsDefault ? "Default settings" : "EEPROM");
-      html += "'></td>\n</tr>\n";
-
-      html += "<tr>\n";
-      html += "<td>Hostname:</td>\n";
-      html += "<td><input name='hostname' type='text' maxlength='30' autocapitalize='none' placeholder='";
+      HTMLHeader("Settings", 10, "/settings");
+      html += F(">>> New Settings saved and applied, IR emitters not changed: ");
+      html += FPSTR(emitterError);
+      html += F(" <<< ");
+    }
+    else if (save)
+    {
+      HTMLHeader("Settings", 3, "/settings");
+      html += F(">>> New Settings saved and applied");
+      if (apply & CONFIG_MQTT)
+      {
+        html += F(", MQTT reconnects");
+      }
+      html += F(" <<< ");
+    }
+    else
+    {
+      HTMLHeader("Settings");
+
+      html += F("<form action='/settings' method='post'>\n");
+      html += F("<table>\n");
+
+      html += F("<tr>\n<td>\nSettings source:</td>\n");
+      html += F("<td><input type='text' disabled value='");
+      html += (configIsDefault ? F("Default settings") : F("Flash"));
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n");
+      html += F("<td>Hostname:</td>\n");
+      html += F("<td><input name='hostname' type='text' maxlength='30' autocapitalize='none' placeholder='");
       html += WiFi.hostname().c_str();
-      html += "' value='";
+      html += F("' value='");
       html += cfg.hostname;
-      html += "'></td></tr>\n";
+      html += F("'></td></tr>\n");
 
-      html += "<tr>\n<td>\nSSID:</td>\n";
-      html += "<td><input name='ssid' type='text' autocapitalize='none' maxlength='30' value='";
+      html += F("<tr>\n<td>\nSSID:</td>\n");
+      html += F("<td><input name='ssid' type='text' autocapitalize='none' maxlength='30' value='");
       bool showssidfromcfg = true;
       if (server.method() == HTTP_GET)
       {
@@ -824,164 +1478,844 @@ void handleSettings()
       {
         html += cfg.wifi_ssid;
       }
-      html += "'> <a href='/wifiscan' onclick='return confirm(\"Go to scan site? Changes will be lost!\")'>Scan</a></td>\n</tr>\n";
+      html += F("'> <a href='/wifiscan' onclick='return confirm(\"Go to scan site? Changes will be lost!\")'>Scan</a></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nPSK:</td>\n";
-      html += "<td><input name='psk' type='password' maxlength='30' value='";
+      html += F("<tr>\n<td>\nPSK:</td>\n");
+      html += F("<td><input name='psk' type='password' maxlength='30' value='");
       html += cfg.wifi_psk;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nNote:</td>\n";
-      html += "<td><input name='note' type='text' maxlength='30' value='";
+      html += F("<tr>\n<td>\nNote:</td>\n");
+      html += F("<td><input name='note' type='text' maxlength='30' value='");
       html += cfg.note;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nAdmin username:</td>\n";
-      html += "<td><input name='admin_username' type='text' maxlength='30' autocapitalize='none' value='";
+      html += F("<tr>\n<td>\nAdmin username:</td>\n");
+      html += F("<td><input name='admin_username' type='text' maxlength='30' autocapitalize='none' value='");
       html += cfg.admin_username;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nAdmin password:</td>\n";
-      html += "<td><input name='admin_password' type='password' maxlength='30' value='";
+      html += F("<tr>\n<td>\nAdmin password:</td>\n");
+      html += F("<td><input name='admin_password' type='password' maxlength='30' value='");
       html += cfg.admin_password;
-      html += "'></td>\n</tr>\n";
-
-      html += "<tr>\n<td>LED brightness:</td>\n";
-      html += "<td><select name='led_brightness'>";
-      html += "<option value='5'";
-      html += (cfg.led_brightness == 5 ? " selected" : "");
-      html += ">5%</option>";
-      html += "<option value='10'";
-      html += (cfg.led_brightness == 10 ? " selected" : "");
-      html += ">10%</option>";
-      html += "<option value='15'";
-      html += (cfg.led_brightness == 15 ? " selected" : "");
-      html += ">15%</option>";
-      html += "<option value='25'";
-      html += (cfg.led_brightness == 25 ? " selected" : "");
-      html += ">25%</option>";
-      html += "<option value='50'";
-      html += (cfg.led_brightness == 50 ? " selected" : "");
-      html += ">50%</option>";
-      html += "<option value='75'";
-      html += (cfg.led_brightness == 75 ? " selected" : "");
-      html += ">75%</option>";
-      html += "<option value='100'";
-      html += (cfg.led_brightness == 100 ? " selected" : "");
-      html += ">100%</option>";
-      html += "</select>";
-      html += "</td>\n</tr>\n";
-
-      html += "<tr>\n<td>\nMQTT server:</td>\n";
-      html += "<td><input name='mqtt_server' type='text' maxlength='30' autocapitalize='none' value='";
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>LED brightness:</td>\n");
+      html += F("<td><select name='led_brightness'>");
+      html += F("<option value='5'");
+      html += (cfg.led_brightness == 5 ? F(" selected") : F(""));
+      html += F(">5%</option>");
+      html += F("<option value='10'");
+      html += (cfg.led_brightness == 10 ? F(" selected") : F(""));
+      html += F(">10%</option>");
+      html += F("<option value='15'");
+      html += (cfg.led_brightness == 15 ? F(" selected") : F(""));
+      html += F(">15%</option>");
+      html += F("<option value='25'");
+      html += (cfg.led_brightness == 25 ? F(" selected") : F(""));
+      html += F(">25%</option>");
+      html += F("<option value='50'");
+      html += (cfg.led_brightness == 50 ? F(" selected") : F(""));
+      html += F(">50%</option>");
+      html += F("<option value='75'");
+      html += (cfg.led_brightness == 75 ? F(" selected") : F(""));
+      html += F(">75%</option>");
+      html += F("<option value='100'");
+      html += (cfg.led_brightness == 100 ? F(" selected") : F(""));
+      html += F(">100%</option>");
+      html += F("</select>");
+      html += F("</td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nMQTT server:</td>\n");
+      html += F("<td><input name='mqtt_server' type='text' maxlength='30' autocapitalize='none' value='");
       html += cfg.mqtt_server;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nMQTT port:</td>\n";
-      html += "<td><input name='mqtt_port' type='text' maxlength='5' autocapitalize='none' value='";
+      html += F("<tr>\n<td>\nMQTT port:</td>\n");
+      html += F("<td><input name='mqtt_port' type='text' maxlength='5' autocapitalize='none' value='");
       html += cfg.mqtt_port;
-      html += "'> (Default 1883)</td>\n</tr>\n";
+      html += F("'> (Default 1883)</td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nMQTT username:</td>\n";
-      html += "<td><input name='mqtt_user' type='text' maxlength='50' autocapitalize='none' value='";
+      html += F("<tr>\n<td>\nMQTT username:</td>\n");
+      html += F("<td><input name='mqtt_user' type='text' maxlength='50' autocapitalize='none' value='");
       html += cfg.mqtt_user;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nMQTT password:</td>\n";
-      html += "<td><input name='mqtt_password' type='password' maxlength='50' autocapitalize='none' value='";
+      html += F("<tr>\n<td>\nMQTT password:</td>\n");
+      html += F("<td><input name='mqtt_password' type='password' maxlength='50' autocapitalize='none' value='");
       html += cfg.mqtt_password;
-      html += "'></td>\n</tr>\n";
+      html += F("'></td>\n</tr>\n");
 
-      html += "<tr>\n<td>\nMQTT prefix:</td>\n";
-      html += "<td><input name='mqtt_prefix' type='text' maxlength='30' autocapitalize='none' value='";
+      html += F("<tr>\n<td>\nMQTT prefix:</td>\n");
+      html += F("<td><input name='mqtt_prefix' type='text' maxlength='30' autocapitalize='none' value='");
       html += cfg.mqtt_prefix;
-      html += "'></td>\n</tr>\n";
-
-      html += "</table>\n";
-
-      html += "<br />\n";
-      html += "<input type='submit' value='Save'>\n";
-      html += "</form>\n";
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nStatic IP:</td>\n");
+      html += F("<td><input name='ip_address' type='text' maxlength='15' placeholder='DHCP' value='");
+      html += formatIPAddress(cfg.ip_address);
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nGateway:</td>\n");
+      html += F("<td><input name='ip_gateway' type='text' maxlength='15' value='");
+      html += formatIPAddress(cfg.ip_gateway);
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nSubnetmask:</td>\n");
+      html += F("<td><input name='ip_subnet' type='text' maxlength='15' value='");
+      html += formatIPAddress(cfg.ip_subnet);
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nDNS server:</td>\n");
+      html += F("<td><input name='ip_dns' type='text' maxlength='15' value='");
+      html += formatIPAddress(cfg.ip_dns);
+      html += F("'></td>\n</tr>\n");
+
+      html += F("<tr>\n<td>\nIR emitters:</td>\n");
+      html += F("<td><input name='ir_emitters' type='text' maxlength='63' autocapitalize='none' placeholder='ir=D5' value='");
+      html += cfg.ir_emitters;
+      html += F("'> (name=pin[:proto],...)</td>\n</tr>\n");
+
+      html += F("</table>\n");
+
+      html += F("<br />\n");
+      html += F("<input type='submit' value='Save'>\n");
+      html += F("</form>\n");
     }
     HTMLFooter();
-    server.send(200, "text/html", html);
 
-    if (saveandreboot)
+    if (save)
     {
       saveConfig();
-      ESP.reset();
+      if (apply & CONFIG_REBOOT)
+      {
+        ESP.reset();
+      }
+      applyConfig(apply);
     }
   }
 }
 
-void MQTTprocessCommand(JsonObject &json)
+void sampleMetrics()
 {
-  Serial.println(F("Processing incomming MQTT command"));
+  metricHeapFree.record(ESP.getFreeHeap());
+  metricHeapMaxBlock.record(ESP.getMaxFreeBlockSize());
+  metricHeapFragmentation.record(ESP.getHeapFragmentation());
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    metricRSSI.record(-WiFi.RSSI());
+  }
+}
 
-  char buffer[100];
+// Prometheus text format
+void handleMetrics()
+{
+  html.begin(200, "text/plain; version=0.0.4");
+  for (uint8_t i = 0; i < METRICS_COUNT; i++)
+  {
+    const metric_t &metric = METRICS[i];
+    const Histogram &histogram = *metric.histogram;
+    html += F("# HELP ");
+    html += metric.name;
+    html += F(" ");
+    html += metric.help;
+    html += F("\n# TYPE ");
+    html += metric.name;
+    html += F(" histogram\n");
+
+    uint32_t cumulative = 0;
+    for (uint8_t bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++)
+    {
+      cumulative += histogram.bucketCount(bucket);
+      html += metric.name;
+      html += F("_bucket{le=\"");
+      html += Histogram::bucketLimit(bucket);
+      html += F("\"} ");
+      html += cumulative;
+      html += F("\n");
+    }
+    html += metric.name;
+    html += F("_bucket{le=\"+Inf\"} ");
+    html += histogram.count();
+    html += F("\n");
+    html += metric.name;
+    html += F("_sum ");
+    html += String((double)histogram.sum(), 0);
+    html += F("\n");
+    html += metric.name;
+    html += F("_count ");
+    html += histogram.count();
+    html += F("\n");
+  }
+  html += F("# TYPE irbridge_uptime_seconds counter\nirbridge_uptime_seconds ");
+  html += millis() / 1000;
+  html += F("\n# TYPE irbridge_heap_free_current_bytes gauge\nirbridge_heap_free_current_bytes ");
+  html += ESP.getFreeHeap();
+  html += F("\n# TYPE irbridge_ir_sent_total counter\nirbridge_ir_sent_total ");
+  html += irSentCount;
+  html += F("\n# TYPE irbridge_ir_dropped_total counter\nirbridge_ir_dropped_total ");
+  html += irQueue.dropped();
+  html += F("\n# TYPE irbridge_task_runs_total counter\n");
+  for (uint8_t i = 0; i < scheduler.size(); i++)
+  {
+    html += F("irbridge_task_runs_total{task=\"");
+    html += scheduler[i].name;
+    html += F("\"} ");
+    html += scheduler[i].runs;
+    html += F("\n");
+  }
+  html += F("# TYPE irbridge_task_time_us_total counter\n");
+  for (uint8_t i = 0; i < scheduler.size(); i++)
+  {
+    html += F("irbridge_task_time_us_total{task=\"");
+    html += scheduler[i].name;
+    html += F("\"} ");
+    html += String((double)scheduler[i].totalTime, 0);
+    html += F("\n");
+  }
+  html += F("# TYPE irbridge_task_overruns_total counter\n");
+  for (uint8_t i = 0; i < scheduler.size(); i++)
+  {
+    html += F("irbridge_task_overruns_total{task=\"");
+    html += scheduler[i].name;
+    html += F("\"} ");
+    html += scheduler[i].overruns;
+    html += F("\n");
+  }
+  html.end();
+}
+
+// JSON API for machine clients, same data as the HTML pages
+
+void handleAPIStatus()
+{
+  showWEBAction();
+
+  html.begin(200, "application/json");
+  html += F("{\"uptime\":");
+  html += millis() / 1000;
+  html += F(",\"firmware\":");
+  html.jsonString(FIRMWARE_VERSION);
+  html += F(",\"hostname\":");
+  html.jsonString(WiFi.hostname().c_str());
+  html += F(",\"ip\":");
+  html.jsonString(WiFi.localIP().toString().c_str());
+  html += F(",\"rssi\":");
+  html += WiFi.RSSI();
+  html += F(",\"wifi_first_connect\":");
+  html += wifiConnection.firstConnectTime();
+  html += F(",\"wifi_reconnects\":");
+  html += wifiConnection.reconnects();
+  html += F(",\"wifi_failures\":");
+  html += wifiConnection.failures();
+  html += F(",\"mqtt\":");
+  html += client.connected() ? F("true") : F("false");
+  html += F(",\"mqtt_attempts\":");
+  html += mqttConnectAttempts;
+  html += F(",\"mqtt_reconnects\":");
+  html += mqttReconnects;
+  html += F(",\"mqtt_outage_last\":");
+  html += mqttLastOutage;
+  html += F(",\"mqtt_outage_max\":");
+  html += mqttMaxOutage;
+  html += F(",\"heap\":");
+  html += ESP.getFreeHeap();
+  html += F(",\"queue\":");
+  html += irQueue.depth();
+  html += F(",\"queue_max\":");
+  html += irQueue.highWater();
+  html += F(",\"dropped\":");
+  html += irQueue.dropped();
+  html += F(",\"sent\":");
+  html += irSentCount;
+  html += F(",\"wait_last\":");
+  html += irLastWaitTime;
+  html += F(",\"wait_max\":");
+  html += irMaxWaitTime;
+  html += F(",\"cache_hits\":");
+  html += irCache.hits();
+  html += F(",\"cache_misses\":");
+  html += irCache.misses();
+  html += F(",\"cache_evictions\":");
+  html += irCache.evictions();
+  html += F(",\"coalesced\":");
+  html += irCoalescedCount;
+  html += F(",\"airtime_saved_ms\":");
+  html += (unsigned long)(irAirtimeSaved / 1000);
+  html += F(",\"rate_limited\":");
+  html += irRateLimiter.limited();
+  html += F(",\"scheduled\":");
+  html += irSchedule.size();
+  html += F(",\"schedule_spread_last\":");
+  html += irScheduleSpreadLast;
+  html += F(",\"schedule_spread_max\":");
+  html += irScheduleSpreadMax;
+  html += F(",\"ntp_synced\":");
+  html += timeService.synced() ? F("true") : F("false");
+  html += F(",\"ntp_offset\":");
+  html += timeService.offset();
+  html += F(",\"ntp_delay\":");
+  html += timeService.roundTrip();
+  html += F(",\"ntp_drift_ppb\":");
+  html += timeService.drift();
+  html += F(",\"ntp_samples\":");
+  html += timeService.samples();
+  html += F(",\"ntp_rejected\":");
+  html += timeService.rejected();
+  html += F(",\"ntp_failures\":");
+  html += timeService.failures();
+  html += F("}");
+  html.end();
+}
+
+// Runtime of the scheduler tasks (in us)
+void handleAPITasks()
+{
+  showWEBAction();
+
+  html.begin(200, "application/json");
+  html += F("[");
+  for (uint8_t i = 0; i < scheduler.size(); i++)
+  {
+    const task_t &task = scheduler[i];
+    html += (i > 0) ? F(",{\"name\":") : F("{\"name\":");
+    html.jsonString(task.name);
+    html += F(",\"priority\":");
+    html += task.priority;
+    html += F(",\"period\":");
+    html += task.period;
+    html += F(",\"budget\":");
+    html += task.budget;
+    html += F(",\"runs\":");
+    html += task.runs;
+    html += F(",\"avg\":");
+    html += (unsigned long)((task.runs > 0) ? task.totalTime / task.runs : 0);
+    html += F(",\"last\":");
+    html += task.lastTime;
+    html += F(",\"max\":");
+    html += task.maxTime;
+    html += F(",\"overruns\":");
+    html += task.overruns;
+    html += F(",\"deferred\":");
+    html += task.deferred;
+    html += F("}");
+  }
+  html += F("]");
+  html.end();
+}
+
+// POST body with the same payload as the MQTT cmd topic, answered with the acknowledgment of all items
+void handleAPISend()
+{
+  showWEBAction();
+  if (!server.authenticate(cfg.admin_username, cfg.admin_password))
+  {
+    return server.requestAuthentication();
+  }
+  if (server.method() != HTTP_POST)
+  {
+    server.send(405, "application/json", F("{\"error\":\"POST required\"}"));
+    return;
+  }
+
+  unsigned long received = micros();
+  const String &body = server.arg(F("plain"));
+  static irBatch_t batch; // too large for the 4 KB stack of loop()
+  PGM_P error;
+  if (!parseBatch(body.c_str(), body.length(), batch, error))
+  {
+    char json[100];
+    snprintf_P(json, sizeof(json), PSTR("{\"error\":\"%S\"}"), error);
+    server.send(400, "application/json", json);
+    return;
+  }
+
+  static bool queued[IR_BATCH_SIZE];
+  static char ack[IR_ACK_SIZE];
+  queueBatch(batch, queued, received);
+  formatBatchAck(ack, sizeof(ack), batch, queued);
+  server.send(200, "application/json", ack);
+}
+
+// Current settings without passwords
+void handleAPIConfig()
+{
+  showWEBAction();
+  if (!server.authenticate(cfg.admin_username, cfg.admin_password))
+  {
+    return server.requestAuthentication();
+  }
+
+  html.begin(200, "application/json");
+  html += F("{\"default\":");
+  html += configIsDefault ? F("true") : F("false");
+  html += F(",\"hostname\":");
+  html.jsonString(cfg.hostname);
+  html += F(",\"note\":");
+  html.jsonString(cfg.note);
+  html += F(",\"wifi_ssid\":");
+  html.jsonString(cfg.wifi_ssid);
+  html += F(",\"admin_username\":");
+  html.jsonString(cfg.admin_username);
+  html += F(",\"mqtt_server\":");
+  html.jsonString(cfg.mqtt_server);
+  html += F(",\"mqtt_port\":");
+  html += cfg.mqtt_port;
+  html += F(",\"mqtt_user\":");
+  html.jsonString(cfg.mqtt_user);
+  html += F(",\"mqtt_prefix\":");
+  html.jsonString(cfg.mqtt_prefix);
+  html += F(",\"led_brightness\":");
+  html += cfg.led_brightness;
+  html += F(",\"ir_emitters\":");
+  html.jsonString(cfg.ir_emitters);
+  html += F("}");
+  html.end();
+}
+
+/*
+ * Code library:
+ * GET: list of names, POST ?name=<name>: store the command in the body (same format as cmd topic, single command),
+ * DELETE ?name=<name>: remove code
+ */
+void handleAPICodes()
+{
+  showWEBAction();
+  if (!server.authenticate(cfg.admin_username, cfg.admin_password))
+  {
+    return server.requestAuthentication();
+  }
+
+  if (server.method() == HTTP_GET)
+  {
+    char name[CODE_NAME_SIZE];
+    html.begin(200, "application/json");
+    html += F("{\"count\":");
+    html += codeLibrary.count();
+    html += F(",\"names\":[");
+    for (uint32_t i = 0; i < codeLibrary.count() && codeLibrary.nameAt(i, name); i++)
+    {
+      if (i > 0)
+      {
+        html += F(",");
+      }
+      html.jsonString(name);
+      yield();
+    }
+    html += F("]}");
+    html.end();
+    return;
+  }
+
+  const String &name = server.arg(F("name"));
+  if (!isValidCodeName(name.c_str(), name.length()))
+  {
+    server.send(400, "application/json", F("{\"error\":\"invalid name\"}"));
+    return;
+  }
+  if (server.method() == HTTP_DELETE)
+  {
+    if (codeLibrary.remove(name.c_str(), name.length()))
+    {
+      server.send(200, "application/json", F("{\"removed\":true}"));
+    }
+    else
+    {
+      server.send(404, "application/json", F("{\"error\":\"unknown name\"}"));
+    }
+    return;
+  }
+  if (server.method() != HTTP_POST)
+  {
+    server.send(405, "application/json", F("{\"error\":\"GET, POST or DELETE required\"}"));
+    return;
+  }
+
+  const String &body = server.arg(F("plain"));
+  irCommand_t command;
+  PGM_P error;
+  if (!parseCommand(body.c_str(), body.length(), command, error))
+  {
+    char json[100];
+    snprintf_P(json, sizeof(json), PSTR("{\"error\":\"%S\"}"), error);
+    server.send(400, "application/json", json);
+    return;
+  }
+
+  irCode_t code = {command.protocol, command.address, command.command, command.repeats, 0, 0, 0};
+  if (command.protocol == IR_PROTOCOL_RAW)
+  {
+    code.khz = irRawFrame.khz;
+    code.rawLength = irRawFrame.length;
+    code.repeatStart = irRawFrame.repeatStart;
+  }
+  bool stored = codeLibrary.store(name.c_str(), name.length(), code, irRawFrame.timings);
+  if (command.protocol == IR_PROTOCOL_RAW)
+  {
+    irRawFrame.used = false; // only parsed for storing
+  }
+  if (stored)
+  {
+    Serial.printf_P(PSTR("Code '%s' stored, %u codes\n"), name.c_str(), codeLibrary.count());
+    server.send(200, "application/json", F("{\"stored\":true}"));
+  }
+  else
+  {
+    server.send(500, "application/json", F("{\"error\":\"code library write failed\"}"));
+  }
+}
+
+// Arm the receiver to learn a code under name, nullptr if armed
+PGM_P startLearning(const char *name, uint16_t length)
+{
+  if (IRtimerIsBusy())
+  {
+    return PSTR("IR transmission running");
+  }
+  return irLearner.arm(name, length, HWPIN_IR_RECEIVER);
+}
+
+// {"name":"<name>","result":"stored","proto":"NEC","adr":"80","cmd":"1","store_us":1234}, raw codes with "raw":<entries>
+void formatLearnResult(char *result, size_t size)
+{
+  const irLearnResult_t &learned = irLearner.result();
+  if (irLearner.active() || learned.result == nullptr)
+  {
+    snprintf_P(result, size, PSTR("{\"name\":\"%s\",\"result\":\"%s\"}"), learned.name, irLearner.active() ? "armed" : "none");
+    return;
+  }
+  int len = snprintf_P(result, size, PSTR("{\"name\":\"%s\",\"result\":\"%S\""), learned.name, learned.result);
+  if (strcmp_P("stored", learned.result) == 0 && len < (int)size)
+  {
+    if (learned.code.protocol == IR_PROTOCOL_RAW)
+    {
+      len += snprintf_P(result + len, size - len, PSTR(",\"proto\":\"raw\",\"raw\":%u"), learned.code.rawLength);
+    }
+    else
+    {
+      len += snprintf_P(result + len, size - len, PSTR(",\"proto\":\"%s\",\"adr\":\"%X\",\"cmd\":\"%X\""),
+                        protocolName(learned.code.protocol), learned.code.address, learned.code.command);
+    }
+    if (len < (int)size)
+    {
+      len += snprintf_P(result + len, size - len, PSTR(",\"store_us\":%lu"), learned.storeTime);
+    }
+  }
+  if (len < (int)size)
+  {
+    snprintf_P(result + len, size - len, PSTR("}"));
+  }
+}
 
-  uint32_t hexaddress;
-  uint32_t hexcommand;
-  uint8_t repeats = 0;
+// ?name=<name>: arm the receiver, without name: result of the last learning
+void handleLearn()
+{
+  showWEBAction();
+  if (!server.authenticate(cfg.admin_username, cfg.admin_password))
+  {
+    return server.requestAuthentication();
+  }
 
-  if (json.containsKey("adr"))
+  char json[255];
+  const String &name = server.arg(F("name"));
+  if (name.length() > 0)
   {
-    String hexstr = json["adr"].as<String>();
-    hexstr.toCharArray(buffer, sizeof(buffer));
-    toHex(buffer, &hexaddress);
+    PGM_P error = startLearning(name.c_str(), name.length());
+    if (error != nullptr)
+    {
+      snprintf_P(json, sizeof(json), PSTR("{\"error\":\"%S\"}"), error);
+      server.send(409, "application/json", json);
+      return;
+    }
+    snprintf_P(json, sizeof(json), PSTR("{\"armed\":true,\"timeout\":%lu}"), IR_LEARN_TIMEOUT);
+    server.send(202, "application/json", json);
+    return;
   }
+  formatLearnResult(json, sizeof(json));
+  server.send(200, "application/json", json);
+}
 
-  if (json.containsKey("cmd"))
+/*
+ * Macros:
+ * GET: list of names, POST ?name=<name>: compile and store {"steps":[...]} from the body,
+ * DELETE ?name=<name>: remove macro
+ */
+void handleAPIMacros()
+{
+  showWEBAction();
+  if (!server.authenticate(cfg.admin_username, cfg.admin_password))
   {
-    String hexstr = json["cmd"].as<String>();
-    hexstr.toCharArray(buffer, sizeof(buffer));
-    toHex(buffer, &hexcommand);
+    return server.requestAuthentication();
   }
 
-  if (json.containsKey("rpt"))
+  if (server.method() == HTTP_GET)
   {
-    repeats = json["rpt"].as<uint8_t>();
+    bool first = true;
+    html.begin(200, "application/json");
+    html += F("{\"running\":");
+    if (macroRunner.active())
+    {
+      html.jsonString(macroRunner.current());
+    }
+    else
+    {
+      html += F("null");
+    }
+    html += F(",\"names\":[");
+    macroLibrary.list([&first](const char *name) {
+      if (!first)
+      {
+        html += F(",");
+      }
+      html.jsonString(name);
+      first = false;
+    });
+    html += F("]}");
+    html.end();
+    return;
   }
 
-  Serial.printf("MQTT command: adr: %02X, cmd: %02X, rpt: %d\n", hexaddress, hexcommand, repeats);
+  const String &name = server.arg(F("name"));
+  if (!isValidCodeName(name.c_str(), name.length()))
+  {
+    server.send(400, "application/json", F("{\"error\":\"invalid name\"}"));
+    return;
+  }
+  if (server.method() == HTTP_DELETE)
+  {
+    if (macroLibrary.remove(name.c_str(), name.length()))
+    {
+      server.send(200, "application/json", F("{\"removed\":true}"));
+    }
+    else
+    {
+      server.send(404, "application/json", F("{\"error\":\"unknown name\"}"));
+    }
+    return;
+  }
+  if (server.method() != HTTP_POST)
+  {
+    server.send(405, "application/json", F("{\"error\":\"GET, POST or DELETE required\"}"));
+    return;
+  }
 
-  if (hexaddress != 0 && hexcommand != 0)
+  const String &body = server.arg(F("plain"));
+  uint8_t code[MACRO_SIZE];
+  uint16_t length;
+  PGM_P error;
+  if (!compileMacro(body.c_str(), body.length(), code, length, error))
+  {
+    char json[100];
+    snprintf_P(json, sizeof(json), PSTR("{\"error\":\"%S\"}"), error);
+    server.send(400, "application/json", json);
+    return;
+  }
+  if (!macroLibrary.store(name.c_str(), name.length(), code, length))
   {
-    sendIR(hexaddress, hexcommand, repeats);
+    server.send(500, "application/json", F("{\"error\":\"macro write failed\"}"));
+    return;
   }
+  Serial.printf_P(PSTR("Macro '%s' stored, %u bytes\n"), name.c_str(), length);
+  char json[40];
+  snprintf_P(json, sizeof(json), PSTR("{\"stored\":true,\"size\":%u}"), length);
+  server.send(200, "application/json", json);
+}
+
+// Payload: <name> or {"name":"<name>","rpt":<dec>}, empty payload stops the running macro
+void startMacro(const char *payload, unsigned int length)
+{
+  const char *name = payload;
+  uint16_t nameLength = length;
+  uint32_t repeats = 0;
+  uint8_t code[MACRO_SIZE];
+
+  if (length == 0)
+  {
+    macroRunner.stop();
+    Serial.println(F("Macro stopped"));
+    return;
+  }
+  if (payload[0] == '{')
+  {
+    CommandReader reader(payload, length);
+    const char *key;
+    const char *value;
+    uint16_t keyLength;
+    uint16_t valueLength;
+    name = nullptr;
+    reader.beginObject();
+    while (reader.nextMember(key, keyLength) && reader.readToken(value, valueLength))
+    {
+      if (tokenEquals(key, keyLength, "name"))
+      {
+        name = value;
+        nameLength = valueLength;
+      }
+      else if (tokenEquals(key, keyLength, "rpt") && !parseDec(value, valueLength, 0xFF, repeats))
+      {
+        reader.fail(PSTR("invalid rpt"));
+      }
+    }
+    if (reader.failed() || name == nullptr)
+    {
+      Serial.println(F("Invalid macro trigger"));
+      return;
+    }
+  }
+
+  if (!isValidCodeName(name, nameLength))
+  {
+    Serial.println(F("Invalid macro name"));
+    return;
+  }
+  uint16_t codeLength = macroLibrary.load(name, nameLength, code);
+  if (codeLength == 0)
+  {
+    Serial.printf_P(PSTR("Unknown macro '%.*s'\n"), nameLength, name);
+    return;
+  }
+  char macroName[CODE_NAME_SIZE];
+  memcpy(macroName, name, nameLength);
+  macroName[nameLength] = '\0';
+  macroRunner.start(macroName, code, codeLength, repeats);
+  Serial.printf_P(PSTR("Macro '%s' started (rpt: %u)\n"), macroName, repeats);
+}
+
+void MQTTpublishLearnResult()
+{
+  char topic[100];
+  formatLearnResult(buff, sizeof(buff));
+  snprintf(topic, sizeof(topic), MQTT_PUBLISH_LEARN_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  client.publish(topic, buff);
+}
+
+void MQTTpublishBatchAck(const irBatch_t &batch, const bool *queued)
+{
+  char topic[100];
+  static char ack[IR_ACK_SIZE];
+
+  formatBatchAck(ack, sizeof(ack), batch, queued);
+  snprintf(topic, sizeof(topic), MQTT_PUBLISH_ACK_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  client.publish(topic, ack);
+}
+
+// Transmit acknowledgment of a command with id, all times are micros() of the bridge
+void MQTTpublishCommandAck(const irCommand_t &command, uint32_t txStart, uint32_t txEnd)
+{
+  if (!client.connected())
+  {
+    return;
+  }
+
+  char topic[100];
+  char ack[200];
+  int len = snprintf_P(ack, sizeof(ack), PSTR("{\"id\":\"%s\",\"rx\":%lu,\"tx_start\":%u,\"tx_end\":%u,\"wait\":%lu"),
+                       command.id, command.received, txStart, txEnd, (unsigned long)(txStart - command.received));
+  // Start of the first frame in UTC, comparable between bridges
+  uint64_t txEpoch = timeService.epochMicrosAt(txStart);
+  if (txEpoch != 0)
+  {
+    len += snprintf_P(ack + len, sizeof(ack) - len, PSTR(",\"tx_epoch\":%lu.%06lu"), (unsigned long)(txEpoch / 1000000), (unsigned long)(txEpoch % 1000000));
+  }
+  // Scheduled command: how far the first frame was from "at"
+  if (command.at != 0)
+  {
+    len += snprintf_P(ack + len, sizeof(ack) - len, PSTR(",\"at\":%lu%03lu,\"spread\":%ld"), (unsigned long)(command.at / 1000), (unsigned long)(command.at % 1000),
+                      (long)scheduleSpread(command, txStart));
+  }
+  snprintf_P(ack + len, sizeof(ack) - len, PSTR("}"));
+  snprintf(topic, sizeof(topic), MQTT_PUBLISH_ACK_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  client.publish(topic, ack);
+}
+
+// Summary of all histograms: {"<name>":[count,p50,p90,p99,max],...}
+void MQTTpublishMetrics()
+{
+  char topic[100];
+  char metrics[MQTT_METRICS_SIZE];
+  int len = snprintf_P(metrics, sizeof(metrics), PSTR("{"));
+  for (uint8_t i = 0; i < METRICS_COUNT && len < (int)sizeof(metrics); i++)
+  {
+    const Histogram &histogram = *METRICS[i].histogram;
+    len += snprintf_P(metrics + len, sizeof(metrics) - len, PSTR("%s\"%s\":[%u,%u,%u,%u,%u]"), (i > 0 ? "," : ""), METRICS[i].name + sizeof("irbridge_") - 1,
+                      histogram.count(), histogram.percentile(50), histogram.percentile(90), histogram.percentile(99), histogram.max());
+  }
+  if (len < (int)sizeof(metrics))
+  {
+    snprintf_P(metrics + len, sizeof(metrics) - len, PSTR("}"));
+  }
+  snprintf(topic, sizeof(topic), MQTT_PUBLISH_METRICS_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  client.publish(topic, metrics);
+  metricsLastPublish = millis();
 }
 
 void MQTTcallback(char *topic, byte *payload, unsigned int length)
 {
   showMQTTAction();
-  Serial.println(F("Neq MQTT message (MQTTcallback)"));
-  Serial.print(F("> Lenght: "));
+  Serial.println(F("New MQTT message (MQTTcallback)"));
+  Serial.print(F("> Length: "));
   Serial.println(length);
   Serial.print(F("> Topic: "));
   Serial.println(topic);
 
-  if (length)
+  // Learn topic, payload is the name
+  snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_LEARN_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  if (strcmp(topic, buff) == 0)
   {
-    StaticJsonDocument<256> jsondoc;
-    DeserializationError err = deserializeJson(jsondoc, payload);
-    if (err)
+    PGM_P error = startLearning((const char *)payload, length);
+    if (error != nullptr)
     {
-      Serial.print(F("deserializeJson() failed: "));
-      Serial.println(err.c_str());
+      Serial.print(F("Learning not started: "));
+      Serial.println(FPSTR(error));
     }
-    else
-    {
+    return;
+  }
 
-      Serial.print(F("> JSON: "));
-      serializeJsonPretty(jsondoc, Serial);
-      Serial.println();
+  // Macro topic
+  snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_MACRO_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  if (strcmp(topic, buff) == 0)
+  {
+    startMacro((const char *)payload, length);
+    return;
+  }
 
-      JsonObject object = jsondoc.as<JsonObject>();
-      MQTTprocessCommand(object);
-    }
+  unsigned long received = micros();
+  static irBatch_t batch; // too large for the 4 KB stack of loop()
+  PGM_P error;
+  bool parsed = parseBatch((const char *)payload, length, batch, error);
+  metricParseTime.record(micros() - received);
+  if (!parsed)
+  {
+    Serial.print(F("Invalid command: "));
+    Serial.println(FPSTR(error));
+    return;
+  }
+
+  static bool queued[IR_BATCH_SIZE];
+  queueBatch(batch, queued, received);
+
+  if (batch.isList)
+  {
+    MQTTpublishBatchAck(batch, queued);
   }
 }
 
+void MQTTpublishStatus()
+{
+  char topic[100];
+  char status[MQTT_STATUS_SIZE];
+  snprintf(topic, sizeof(topic), MQTT_PUBLISH_STATUS_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+  snprintf_P(status, sizeof(status), PSTR("{\"bridge\":\"connected\",\"queue\":%u,\"queue_max\":%u,\"dropped\":%u,\"sent\":%u,\"wait_max\":%lu,\"cache_hits\":%u,\"cache_misses\":%u,"
+                                             "\"coalesced\":%u,\"airtime_saved_ms\":%lu,\"rate_limited\":%u,\"wifi_reconnects\":%u,"
+                                             "\"mqtt_attempts\":%u,\"mqtt_reconnects\":%u,\"mqtt_outage_last\":%lu,\"mqtt_outage_max\":%lu,"
+                                             "\"boot\":{\"wifi_fast\":%s,\"associated\":%lu,\"ip\":%lu,\"mdns\":%lu,\"mqtt\":%lu}}"),
+             irQueue.depth(), irQueue.highWater(), irQueue.dropped(), irSentCount, irMaxWaitTime, irCache.hits(), irCache.misses(),
+             irCoalescedCount, (unsigned long)(irAirtimeSaved / 1000), irRateLimiter.limited(), wifiConnection.reconnects(), mqttConnectAttempts, mqttReconnects, mqttLastOutage, mqttMaxOutage,
+             (wifiConnection.lastConnectFast() ? "true" : "false"), wifiConnection.firstAssociateTime(), wifiConnection.firstConnectTime(), bootMDNSTime, bootMQTTTime);
+  client.publish(topic, status, true);
+  lastPublishTime = millis();
+}
+
 boolean MQTTreconnect()
 {
 
@@ -996,21 +2330,37 @@ boolean MQTTreconnect()
 
     client.setServer(cfg.mqtt_server, cfg.mqtt_port);
     client.setCallback(MQTTcallback);
+    client.setBufferSize(MQTT_BUFFER_SIZE);
 
     // last will and testament topic
     snprintf(buff, sizeof(buff), MQTT_PUBLISH_STATUS_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
 
-    if (client.connect(WiFi.hostname().c_str(), cfg.mqtt_user, cfg.mqtt_password, buff, 0, 1, MQTT_LWT_MESSAGE))
+    // Persistent session (cleanSession = false) and QoS 1 subscriptions, so the broker keeps commands sent during short outages
+    if (client.connect(WiFi.hostname().c_str(), cfg.mqtt_user, cfg.mqtt_password, buff, 0, 1, MQTT_LWT_MESSAGE, false))
     {
       Serial.println(F("connected!"));
+      if (bootMQTTTime == 0)
+      {
+        bootMQTTTime = millis();
+      }
 
       snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_CMD_TOPIC1, mqtt_prefix);
-      client.subscribe(buff);
+      client.subscribe(buff, 1);
       Serial.printf_P(PSTR("Subscribed to topic %s\n"), buff);
 
       snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_CMD_TOPIC2, mqtt_prefix, WiFi.hostname().c_str());
-      client.subscribe(buff);
+      client.subscribe(buff, 1);
+      Serial.printf_P(PSTR("Subscribed to topic %s\n"), buff);
+
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_LEARN_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+      client.subscribe(buff, 1);
       Serial.printf_P(PSTR("Subscribed to topic %s\n"), buff);
+
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_MACRO_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+      client.subscribe(buff, 1);
+      Serial.printf_P(PSTR("Subscribed to topic %s\n"), buff);
+
+      MQTTpublishStatus();
       return true;
     }
     else
@@ -1022,10 +2372,27 @@ boolean MQTTreconnect()
   }
 }
 
+// Fields added in config version 2
+void loadDefaultsV2()
+{
+  memset(cfg.wifi_bssid, 0, sizeof(cfg.wifi_bssid));
+  cfg.wifi_channel = 0;
+  cfg.ip_address = 0;
+  cfg.ip_gateway = 0;
+  cfg.ip_subnet = 0;
+  cfg.ip_dns = 0;
+}
+
+// Fields of the config store only
+void loadDefaultsStore()
+{
+  memset(cfg.ir_emitters, 0, sizeof(cfg.ir_emitters));
+}
+
 void loadDefaults()
 {
 
-  // Config NOT from EEPROM
+  // Config NOT from config store
   configIsDefault = true;
 
   // Valid-Falg to verify config
@@ -1048,21 +2415,157 @@ void loadDefaults()
   cfg.mqtt_port = 1883;
   memcpy(cfg.mqtt_password, "", sizeof(cfg.mqtt_password) / sizeof(*cfg.mqtt_password));
   memcpy(cfg.mqtt_prefix, "irbridge", sizeof(cfg.mqtt_prefix) / sizeof(*cfg.mqtt_prefix));
+
+  loadDefaultsV2();
+  loadDefaultsStore();
 }
 
-void loadConfig()
+// Config struct of older firmware in EEPROM, written once to the config store
+bool migrateEEPROMConfig()
 {
+  configData_t legacy;
   EEPROM.begin(512);
-  EEPROM.get(cfgStart, cfg);
+  EEPROM.get(cfgStart, legacy);
   EEPROM.end();
 
+  if (legacy.configversion == 1)
+  {
+    // Version 2 only appended fields, keep the defaults for them
+    memcpy(&cfg, &legacy, offsetof(configData_t, wifi_bssid));
+  }
+  else if (legacy.configversion == 2)
+  {
+    memcpy(&cfg, &legacy, offsetof(configData_t, ir_emitters));
+  }
+  else
+  {
+    return false;
+  }
+  Serial.printf_P(PSTR("Migrating EEPROM config version %u\n"), legacy.configversion);
+  cfg.configversion = CURRENT_CONFIG_VERSION;
+  saveConfig();
+  return true;
+}
+
+void loadConfig()
+{
+  loadDefaults();
+  memset(&cfgStored, 0xFF, sizeof(cfgStored)); // nothing stored, the first save writes all fields
+
+  if (!configStoreAvailable())
+  {
+    Serial.println(F("No flash for config store, check the FS size of the flash layout"));
+    return;
+  }
+  if (!configStore.begin() || !configStore.read(0, &cfg.configversion, sizeof(cfg.configversion)))
+  {
+    configIsDefault = !migrateEEPROMConfig();
+    return;
+  }
+
+  // Fields without record (added in a later config version) keep their defaults
+  for (const configField_t &field : CONFIG_FIELDS)
+  {
+    uint8_t *value = (uint8_t *)&cfg + field.offset;
+    if (configStore.read(field.key, value, field.size))
+    {
+      memcpy((uint8_t *)&cfgStored + field.offset, value, field.size);
+    }
+  }
+  configIsDefault = false; // Config from config store
+
   if (cfg.configversion != CURRENT_CONFIG_VERSION)
   {
-    loadDefaults();
+    Serial.printf_P(PSTR("Migrating config version %u\n"), cfg.configversion);
+    cfg.configversion = CURRENT_CONFIG_VERSION;
+    saveConfig();
+  }
+}
+
+void applyMQTTPrefix()
+{
+  if (strcmp_P(cfg.mqtt_prefix, PSTR("")) == 0)
+  {
+    strncpy(mqtt_prefix, cfg.mqtt_prefix, sizeof(mqtt_prefix));
   }
   else
   {
-    configIsDefault = false; // Config from EEPROM
+    strncpy(mqtt_prefix, cfg.mqtt_prefix, (sizeof(mqtt_prefix) - 1));
+    strcat(mqtt_prefix, "/");
+  }
+}
+
+void applyLedBrightness()
+{
+  ledBrightness = (PWMRANGE / 100.00) * cfg.led_brightness;
+  Serial.printf("LED brightness: %i/%i (%i%%)\n", ledBrightness, PWMRANGE, cfg.led_brightness);
+}
+
+// Apply changed settings without reboot, only the affected clients are restarted
+void applyConfig(uint8_t apply)
+{
+  if (apply & CONFIG_LED)
+  {
+    applyLedBrightness();
+  }
+  if (apply & CONFIG_ADMIN)
+  {
+    httpUpdater.updateCredentials(cfg.admin_username, cfg.admin_password);
+    Serial.println(F("Admin credentials updated"));
+  }
+  if (apply & CONFIG_MQTT)
+  {
+    if (client.connected())
+    {
+      // Drop the subscriptions of the persistent session, the prefix may change. A clean disconnect
+      // suppresses the LWT, so the old status topic is marked as disconnected here.
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_CMD_TOPIC1, mqtt_prefix);
+      client.unsubscribe(buff);
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_CMD_TOPIC2, mqtt_prefix, WiFi.hostname().c_str());
+      client.unsubscribe(buff);
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_LEARN_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+      client.unsubscribe(buff);
+      snprintf(buff, sizeof(buff), MQTT_SUBSCRIBE_MACRO_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+      client.unsubscribe(buff);
+      snprintf(buff, sizeof(buff), MQTT_PUBLISH_STATUS_TOPIC, mqtt_prefix, WiFi.hostname().c_str());
+      client.publish(buff, MQTT_LWT_MESSAGE, true);
+      client.disconnect();
+    }
+    applyMQTTPrefix();
+    // Reconnect at once, not counted as outage
+    mqttWasConnected = false;
+    mqttBackoff.reset();
+    Serial.println(F("MQTT settings changed, reconnecting"));
+  }
+}
+
+// Called after each WiFi (re)connect
+void WiFiConnected()
+{
+  WiFi.printDiag(Serial);
+  Serial.printf_P(PSTR("IP address: %s\n"), WiFi.localIP().toString().c_str());
+
+  setLed(LedColor::BLUE);
+
+  // Remember AP for a connect without scan on next boot
+  if (cfg.wifi_channel != wifiConnection.currentChannel() || memcmp(cfg.wifi_bssid, wifiConnection.currentBSSID(), sizeof(cfg.wifi_bssid)) != 0)
+  {
+    memcpy(cfg.wifi_bssid, wifiConnection.currentBSSID(), sizeof(cfg.wifi_bssid));
+    cfg.wifi_channel = wifiConnection.currentChannel();
+    saveConfig();
+  }
+
+  if (wifiConnection.reconnects() == 0)
+  {
+    // MDNS responder
+    if (MDNS.begin(cfg.hostname))
+    {
+      Serial.println(F("MDNS responder started"));
+    }
+    bootMDNSTime = millis();
+
+    // SNTP clock
+    timeService.begin(NTP_SERVER, NTP_UPDATE_INTERVAL);
   }
 }
 
@@ -1090,6 +2593,190 @@ void handleButton()
   // previousButtonState = inp;
 }
 
+// ++++++++++++++++++++++++++++++++++++++++
+//
+// TASKS
+//
+// ++++++++++++++++++++++++++++++++++++++++
+
+// Due scheduled commands and IR transmission (one frame per emitter and run), paused while learning since both need timer1
+void taskIR()
+{
+  handleSchedule();
+
+  unsigned long irStart = micros();
+  if (!irLearner.active() && handleIRTransmit(true))
+  {
+    metricIRSendTime.record(micros() - irStart);
+  }
+  if (irLearner.handle() && client.connected())
+  {
+    MQTTpublishLearnResult();
+  }
+}
+
+// taskIR between the chunks of a HTTP response. The handler may be using the code library or the MQTT client, so
+// learning (stores codes) and acknowledgments (publish) wait for taskIR.
+void idleIR()
+{
+  handleSchedule();
+
+  unsigned long irStart = micros();
+  if (!irLearner.active() && handleIRTransmit(false))
+  {
+    metricIRSendTime.record(micros() - irStart);
+  }
+}
+
+// A macro step waits while the queue is full
+bool queueMacroStep(irCommand_t &command)
+{
+  return irQueue.space() > 0 && queueIR(command);
+}
+
+// Queue due macro steps
+void taskMacro()
+{
+  if (macroRunner.handle(queueMacroStep))
+  {
+    Serial.printf_P(PSTR("Macro '%s' finished\n"), macroRunner.current());
+  }
+}
+
+// taskMacro between the chunks of a HTTP response. The handler may be iterating the code library, so steps with a
+// named code wait for taskMacro.
+void idleMacro()
+{
+  if (macroRunner.handle(queueMacroStep, true))
+  {
+    Serial.printf_P(PSTR("Macro '%s' finished\n"), macroRunner.current());
+  }
+}
+
+void taskHTTP()
+{
+  unsigned long httpStart = micros();
+  httpRequestSeen = false;
+  server.handleClient();
+  if (httpRequestSeen)
+  {
+    (httpRequestAPI ? metricAPITime : metricHTTPTime).record(micros() - httpStart);
+  }
+}
+
+// SNTP request state machine, no requests without network
+void taskNTP()
+{
+  if (wifiConnection.connected())
+  {
+    timeService.handle();
+  }
+}
+
+void taskWiFi()
+{
+  if (!configIsDefault && wifiConnection.handle())
+  {
+    WiFiConnected();
+  }
+}
+
+// MQTT connection, messages and periodic publishing
+void taskMQTT()
+{
+  // Outage starts with the lost connection, also if WiFi is lost too
+  if (mqttWasConnected && !client.connected())
+  {
+    Serial.println(F("MQTT connection lost"));
+    mqttWasConnected = false;
+    mqttOutageStart = millis();
+  }
+
+  // Config valid and WiFi connection
+  if (configIsDefault || !wifiConnection.connected())
+  {
+    return;
+  }
+
+  if (!client.connected())
+  {
+    // MQTT connect, retried with backoff
+    if (mqttBackoff.due())
+    {
+      mqttConnectAttempts++;
+
+      // switch off MQTT LED
+      setLed(LedColor::RED);
+
+      // try to reconnect
+      if (MQTTreconnect())
+      {
+        // switch on MQTT LED
+        setLed(LedColor::GREEN);
+
+        mqttBackoff.reset();
+        mqttWasConnected = true;
+        if (mqttOutageStart != 0)
+        {
+          mqttLastOutage = millis() - mqttOutageStart;
+          mqttMaxOutage = max(mqttMaxOutage, mqttLastOutage);
+          mqttReconnects++;
+          mqttOutageStart = 0;
+          Serial.printf_P(PSTR("MQTT outage: %lu ms\n"), mqttLastOutage);
+        }
+      }
+      else
+      {
+        mqttBackoff.failed();
+        Serial.printf_P(PSTR("MQTT retry in %lu ms\n"), mqttBackoff.delay());
+      }
+    }
+    return;
+  }
+
+  // Handle MQTT msgs
+  client.loop();
+
+  // Publish status
+  if ((millis() - lastPublishTime) >= MQTT_STATUS_INTERVAL)
+  {
+    MQTTpublishStatus();
+  }
+
+  // Publish metrics
+  if ((millis() - metricsLastPublish) >= METRICS_PUBLISH_INTERVAL)
+  {
+    MQTTpublishMetrics();
+  }
+}
+
+// LED bookkeeping and button
+void taskLED()
+{
+  // Switch back on WiFi LED after Webserver access
+  if (((millis() - ledOneTime) > LED_WEB_MIN_TIME) &&
+      ledOneLastColor != 0)
+  {
+    // led.clear();
+    // led.setBrightness(cfg.led_brightness);
+    // led.setPixelColor(0, ledOneLastColor);
+    // led.show();
+  }
+
+  // Switch on MQTT LED after MQTT action if we have server connection
+  if (client.connected() && ((millis() - ledTwoTime) > LED_MQTT_MIN_TIME) &&
+      ledTwoLastColor != 0)
+  {
+    // led.clear();
+    // led.setBrightness(cfg.led_brightness);
+    // led.setPixelColor(0, ledTwoLastColor);
+    // led.show();
+  }
+
+  // Handle Button
+  handleButton();
+}
+
 void setup(void)
 {
   // LED Basic Setup
@@ -1101,82 +2788,71 @@ void setup(void)
   // Load Config
   loadConfig();
 
-  if (strcmp_P(cfg.mqtt_prefix, PSTR("")) == 0)
-  {
-    strncpy(mqtt_prefix, cfg.mqtt_prefix, sizeof(mqtt_prefix));
-  }
-  else
-  {
-    strncpy(mqtt_prefix, cfg.mqtt_prefix, (sizeof(mqtt_prefix) - 1));
-    strcat(mqtt_prefix, "/");
-  }
+  // IR
+  encodeNECRepeat(irRepeatFrame);
+
+  applyMQTTPrefix();
 
   Serial.begin(HWSERIAL_BAUD);
   delay(1000);
   Serial.printf_P(PSTR("\n+++ Welcome to IRBridge v%s+++\n"), FIRMWARE_VERSION);
+
+  // IR emitters, the default one if the config is invalid
+  PGM_P emitterError;
+  if (!irEmitters.parse(cfg.ir_emitters, HWPIN_IR_RECEIVER, emitterError))
+  {
+    Serial.printf_P(PSTR("Invalid IR emitters '%s': %S\n"), cfg.ir_emitters, emitterError);
+  }
+  for (uint8_t i = 0; i < irEmitters.size(); i++)
+  {
+    Serial.printf_P(PSTR("IR emitter %s: GPIO%u %s\n"), irEmitters[i].name, irEmitters[i].pin, protocolName(irEmitters[i].protocol));
+  }
+  IrSender.begin(irEmitters[0].pin);
   WiFi.mode(WIFI_OFF);
 
+  // Per device jitter for MQTT reconnects
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  mqttBackoff.seed(mac, sizeof(mac));
+
+  // Code library
+  if (configStoreAvailable() && codeFS.begin() && codeLibrary.begin(codeFS))
+  {
+    Serial.printf_P(PSTR("Code library: %u codes\n"), codeLibrary.count());
+    macroLibrary.begin(codeFS);
+  }
+  else
+  {
+    Serial.println(F("Code library not available"));
+  }
+
   // AP or Infrastucture Mode
   if (configIsDefault)
   {
     // Start AP
     Serial.println(F("Default Config loaded."));
     Serial.println(F("Starting WiFi SoftAP"));
-    WiFi.softAP("IRBridge", "");
+    WiFi.softAP(WIFI_AP_SSID, "");
     setLed(LedColor::BLUE);
   }
   else
   {
 
     // LED brightness
-    ledBrightness = (PWMRANGE / 100.00) * cfg.led_brightness;
-    Serial.printf("LED brightness: %i/%i (%i%%)\n", ledBrightness, PWMRANGE, cfg.led_brightness);
+    applyLedBrightness();
 
-    WiFi.mode(WIFI_STA);
-    if (strcmp(cfg.hostname, "") != 0)
+    // Connect in background, web server and IR are available immediately
+    if (cfg.ip_address != 0)
     {
-      WiFi.hostname(cfg.hostname);
+      WiFi.config(IPAddress(cfg.ip_address), IPAddress(cfg.ip_gateway), IPAddress(cfg.ip_subnet), IPAddress(cfg.ip_dns));
     }
-    WiFi.begin(cfg.wifi_ssid, cfg.wifi_psk);
+    // The DHCP request of the attempt started by begin() carries the hostname
     if (strcmp(cfg.hostname, "") != 0)
     {
       WiFi.hostname(cfg.hostname);
     }
-
-    Serial.printf_P(PSTR("Connecing to '%s'. Please wait"), cfg.wifi_ssid);
-
-    // Wait for connection
-    while (WiFi.status() != WL_CONNECTED)
-    {
-      delay(250);
-      Serial.print(F("."));
-      if (ledOneToggle)
-      {
-        setLed(LedColor::BLACK);
-      }
-      else
-      {
-        setLed(LedColor::BLUE);
-      }
-      ledOneToggle = !ledOneToggle;
-
-      handleButton();
-    }
-
-    Serial.printf_P(PSTR("\nConnected to '%s'\n"), cfg.wifi_ssid);
-    WiFi.printDiag(Serial);
-    Serial.printf_P(PSTR("IP address: %s\n"), WiFi.localIP().toString().c_str());
-
-    setLed(LedColor::BLUE);
-
-    // MDNS responder
-    if (MDNS.begin(cfg.hostname))
-    {
-      Serial.println(F("MDNS responder started"));
-    }
-
-    // NTPClient
-    timeClient.begin();
+    Serial.printf_P(PSTR("Connecting to '%s'\n"), cfg.wifi_ssid);
+    wifiConnection.begin(cfg.wifi_ssid, cfg.wifi_psk, cfg.wifi_bssid, cfg.wifi_channel);
   }
 
   // Arduino OTA Update
@@ -1189,72 +2865,45 @@ void setup(void)
   server.on(F("/send"), handleSend);
   server.on(F("/reboot"), handleReboot);
   server.on(F("/wifiscan"), handleWiFiScan);
+  server.on(F("/style.css"), handleStyle);
+  server.on(F("/api/status"), handleAPIStatus);
+  server.on(F("/api/tasks"), handleAPITasks);
+  server.on(F("/api/send"), handleAPISend);
+  server.on(F("/api/config"), handleAPIConfig);
+  server.on(F("/api/codes"), handleAPICodes);
+  server.on(F("/learn"), handleLearn);
+  server.on(F("/api/macros"), handleAPIMacros);
+  server.on(F("/metrics"), handleMetrics);
   server.onNotFound(handleNotFound);
+  const char *headerKeys[] = {"If-None-Match"};
+  server.collectHeaders(headerKeys, 1);
+  server.addHook([](const String &, const String &url, WiFiClient *, ESP8266WebServer::ContentTypeFunction) {
+    httpRequestSeen = true;
+    httpRequestAPI = url.startsWith("/api/");
+    return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+  });
   server.begin();
 
   Serial.println(F("HTTP server started"));
+
+  // Tasks: name, period (ms), priority, budget (us), idle part. IR and macros are critical, their idle part also runs
+  // between the chunks of long HTTP responses. MQTT is not: client.loop() runs MQTTcallback(), which uses the same
+  // batch buffers as the HTTP API. The broker waits 1.5 keepalive intervals (22 s) before it drops the connection,
+  // longer than a response takes.
+  scheduler.add("ir", taskIR, 0, 0, 2000, idleIR);
+  scheduler.add("macro", taskMacro, 0, 0, 1000, idleMacro);
+  scheduler.add("mqtt", taskMQTT, 0, 1, 5000);
+  scheduler.add("wifi", taskWiFi, 10, 1, 2000);
+  scheduler.add("http", taskHTTP, 0, 2, 10000);
+  scheduler.add("ntp", taskNTP, 10, 2, 1000);
+  scheduler.add("metrics", sampleMetrics, METRICS_SAMPLE_INTERVAL, 3, 1000);
+  scheduler.add("led", taskLED, 20, 3, 500);
+  html.setIdleHandler([]() { scheduler.runIdle(); });
 }
 
 void loop(void)
 {
-
-  // Switch back on WiFi LED after Webserver access
-  if (((millis() - ledOneTime) > LED_WEB_MIN_TIME) &&
-      ledOneLastColor != 0)
-  {
-    // led.clear();
-    // led.setBrightness(cfg.led_brightness);
-    // led.setPixelColor(0, ledOneLastColor);
-    // led.show();
-  }
-
-  // Handle Button
-  handleButton();
-
-  // Handle Webserver
-  server.handleClient();
-
-  // NTPClient Update
-  timeClient.update();
-
-  // Config valid and WiFi connection
-  if (!configIsDefault && WiFi.status() == WL_CONNECTED)
-  {
-
-    if (!client.connected())
-    {
-      // MQTT connect
-      if (mqttLastReconnectAttempt == 0 || (millis() - mqttLastReconnectAttempt) >= MQTT_RECONNECT_INTERVAL)
-      {
-        mqttLastReconnectAttempt = millis();
-
-        // switch off MQTT LED
-        setLed(LedColor::RED);
-
-        // try to reconnect
-        if (MQTTreconnect())
-        {
-          // switch on MQTT LED
-          setLed(LedColor::GREEN);
-
-          mqttLastReconnectAttempt = 0;
-        }
-      }
-    }
-    else
-    {
-      // Switch on MQTT LED after MQTT action if we have server connection
-      if (((millis() - ledTwoTime) > LED_MQTT_MIN_TIME) &&
-          ledTwoLastColor != 0)
-      {
-        // led.clear();
-        // led.setBrightness(cfg.led_brightness);
-        // led.setPixelColor(0, ledTwoLastColor);
-        // led.show();
-      }
-
-      // Handle MQTT msgs
-      client.loop();
-    }
-  }
+  unsigned long loopStart = micros();
+  scheduler.run();
+  metricLoopTime.record(micros() - loopStart);
 }
@@ -0,0 +1,84 @@
+#include <Arduino.h>
+#ifndef metrics_h
+#define metrics_h
+
+// Number of log2 buckets, the last one takes all values >= 2^(METRICS_BUCKETS - 2)
+const uint8_t METRICS_BUCKETS = 24;
+
+/*
+ * Histogram with fixed log2 buckets: bucket 0 counts 0, bucket i counts values in [2^(i-1), 2^i - 1].
+ * Recording is a count-leading-zeros and three additions, so it can be used in hot paths.
+ */
+class Histogram
+{
+public:
+    void record(uint32_t value)
+    {
+        uint8_t bucket = (value == 0) ? 0 : 32 - __builtin_clz(value);
+        if (bucket >= METRICS_BUCKETS)
+        {
+            bucket = METRICS_BUCKETS - 1;
+        }
+        buckets[bucket]++;
+        total += value;
+        if (value > maximum)
+        {
+            maximum = value;
+        }
+    }
+
+    uint32_t count() const
+    {
+        uint32_t sum = 0;
+        for (uint8_t i = 0; i < METRICS_BUCKETS; i++)
+        {
+            sum += buckets[i];
+        }
+        return sum;
+    }
+
+    uint32_t bucketCount(uint8_t bucket) const { return buckets[bucket]; }
+    uint64_t sum() const { return total; }
+    uint32_t max() const { return maximum; }
+
+    // Upper bound of a bucket (inclusive)
+    static uint32_t bucketLimit(uint8_t bucket)
+    {
+        return (bucket == 0) ? 0 : (uint32_t)((1ULL << bucket) - 1);
+    }
+
+    // Estimated percentile (0-100), upper bound of the bucket it falls into, capped at max()
+    uint32_t percentile(uint8_t percent) const
+    {
+        uint32_t samples = count();
+        if (samples == 0)
+        {
+            return 0;
+        }
+        uint32_t rank = ((uint64_t)samples * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i < METRICS_BUCKETS; i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+            {
+                return min(bucketLimit(i), maximum);
+            }
+        }
+        return maximum;
+    }
+
+private:
+    uint32_t buckets[METRICS_BUCKETS] = {};
+    uint64_t total = 0;
+    uint32_t maximum = 0;
+};
+
+typedef struct
+{
+    const char *name; // Prometheus metric name, also key in the MQTT metrics message
+    const char *help;
+    Histogram *histogram;
+} metric_t;
+
+#endif
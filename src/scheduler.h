@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#ifndef scheduler_h
+#define scheduler_h
+
+const uint8_t SCHEDULER_TASKS_MAX = 12;
+const uint32_t SCHEDULER_PASS_BUDGET = 20000; // time of a pass after which tasks only start if overdue (in us)
+const unsigned long SCHEDULER_MAX_DEFER = 100; // max. time a due task waits for the pass budget (in ms)
+
+typedef struct
+{
+    const char *name;
+    void (*run)();
+    void (*idle)();   // part of run that may interrupt other tasks, nullptr: not run by runIdle()
+    uint16_t period;  // min. time between two starts (in ms), 0: every pass
+    uint8_t priority; // 0: critical, runs first and again after every other task
+    uint32_t budget;  // expected max. runtime (in us)
+
+    unsigned long lastStart; // millis()
+    uint32_t runs;
+    uint32_t overruns;       // runs longer than budget
+    uint32_t deferred;       // passes the task was due but didn't fit into the pass budget
+    uint32_t lastTime;       // runtime of the last run (in us)
+    uint32_t maxTime;        // (in us)
+    uint64_t totalTime;      // (in us)
+} task_t;
+
+/*
+ * Cooperative scheduler, one pass per loop(). Tasks run in order of priority when their period is over. The critical
+ * tasks (priority 0) also run after every other task, so a slow task delays them by its own runtime only. From within
+ * a task, e.g. between the chunks of a long HTTP response, runIdle() runs their idle part, which must not touch what
+ * the interrupted task may be using. A task that doesn't fit into the rest of the pass
+ * budget waits for the next pass, but at most SCHEDULER_MAX_DEFER beyond its period. Tasks can't be preempted, the
+ * budget is the runtime they are expected to keep, longer runs are counted as overruns.
+ */
+class Scheduler
+{
+public:
+    // Tasks of the same priority run in the order they were added
+    bool add(const char *name, void (*run)(), uint16_t period, uint8_t priority, uint32_t budget, void (*idle)() = nullptr)
+    {
+        if (count >= SCHEDULER_TASKS_MAX)
+        {
+            return false;
+        }
+        uint8_t index = count++;
+        while (index > 0 && tasks[index - 1].priority > priority)
+        {
+            tasks[index] = tasks[index - 1];
+            index--;
+        }
+        tasks[index] = {name, run, idle, period, priority, budget, 0, 0, 0, 0, 0, 0, 0};
+        return true;
+    }
+
+    // One pass over all tasks
+    void run()
+    {
+        unsigned long passStart = micros();
+        runCritical();
+        for (uint8_t i = 0; i < count; i++)
+        {
+            task_t &task = tasks[i];
+            if (task.priority == 0 || !due(task))
+            {
+                continue;
+            }
+            if ((micros() - passStart) + task.budget > SCHEDULER_PASS_BUDGET && (millis() - task.lastStart) < task.period + SCHEDULER_MAX_DEFER)
+            {
+                task.deferred++;
+                continue;
+            }
+            start(task);
+            runCritical();
+        }
+    }
+
+    // Due critical tasks
+    void runCritical() { runCriticalTasks(false); }
+
+    // Idle part of the due critical tasks, from within another task
+    void runIdle() { runCriticalTasks(true); }
+
+    uint8_t size() const { return count; }
+    const task_t &operator[](uint8_t index) const { return tasks[index]; }
+
+private:
+    // Not from within a critical task
+    void runCriticalTasks(bool idle)
+    {
+        if (inCritical)
+        {
+            return;
+        }
+        inCritical = true;
+        unsigned long criticalStart = micros();
+        for (uint8_t i = 0; i < count && tasks[i].priority == 0; i++)
+        {
+            if (due(tasks[i]) && (!idle || tasks[i].idle != nullptr))
+            {
+                start(tasks[i], idle ? tasks[i].idle : tasks[i].run);
+            }
+        }
+        criticalTime += micros() - criticalStart;
+        inCritical = false;
+    }
+
+    bool due(const task_t &task) const
+    {
+        return task.period == 0 || (millis() - task.lastStart) >= task.period;
+    }
+
+    void start(task_t &task) { start(task, task.run); }
+
+    void start(task_t &task, void (*run)())
+    {
+        task.lastStart = millis();
+        unsigned long taskStart = micros();
+        uint32_t criticalBefore = criticalTime;
+        run();
+        uint32_t time = micros() - taskStart - (criticalTime - criticalBefore); // without critical tasks run in between
+        task.runs++;
+        task.lastTime = time;
+        task.totalTime += time;
+        if (time > task.maxTime)
+        {
+            task.maxTime = time;
+        }
+        if (time > task.budget)
+        {
+            task.overruns++;
+        }
+    }
+
+    task_t tasks[SCHEDULER_TASKS_MAX];
+    uint8_t count = 0;
+    bool inCritical = false;
+    uint32_t criticalTime = 0; // sum of all runCritical() (in us)
+};
+
+#endif
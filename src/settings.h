@@ -24,6 +24,57 @@ typedef struct
 
     uint8_t led_brightness; // in percent
 
+    // since config version 2
+    uint8_t wifi_bssid[6]; // last AP connected to, for connecting without scan
+    uint8_t wifi_channel;  // 0 if unknown
+    uint32_t ip_address;   // static IP config, 0 for DHCP
+    uint32_t ip_gateway;
+    uint32_t ip_subnet;
+    uint32_t ip_dns;
+
+    // config store only
+    char ir_emitters[64]; // "<name>=<pin>[:<proto>],...", empty: one emitter on D5
+
 } configData_t;
 
+// How a changed field is applied, fields without flag are used as they are
+const uint8_t CONFIG_REBOOT = 0x01; // needs a reboot (WiFi and network)
+const uint8_t CONFIG_MQTT = 0x02;   // MQTT reconnect with new topics/credentials
+const uint8_t CONFIG_ADMIN = 0x04;  // admin credentials of the firmware update
+const uint8_t CONFIG_LED = 0x08;    // LED brightness
+
+// One field of configData_t in the config store. Keys must never change or be reused, new fields get new keys.
+typedef struct
+{
+    uint16_t key;
+    uint16_t offset;
+    uint16_t size;
+    uint8_t apply; // CONFIG_REBOOT, CONFIG_MQTT, ...
+} configField_t;
+
+#define CONFIG_FIELD(key, field, apply) {key, offsetof(configData_t, field), sizeof(((configData_t *)nullptr)->field), apply}
+
+const configField_t CONFIG_FIELDS[] = {
+    CONFIG_FIELD(0, configversion, 0),
+    CONFIG_FIELD(1, wifi_ssid, CONFIG_REBOOT),
+    CONFIG_FIELD(2, wifi_psk, CONFIG_REBOOT),
+    CONFIG_FIELD(3, hostname, CONFIG_REBOOT), // also MQTT client id and topics
+    CONFIG_FIELD(4, note, 0),
+    CONFIG_FIELD(5, admin_username, CONFIG_ADMIN),
+    CONFIG_FIELD(6, admin_password, CONFIG_ADMIN),
+    CONFIG_FIELD(7, mqtt_server, CONFIG_MQTT),
+    CONFIG_FIELD(8, mqtt_port, CONFIG_MQTT),
+    CONFIG_FIELD(9, mqtt_user, CONFIG_MQTT),
+    CONFIG_FIELD(10, mqtt_password, CONFIG_MQTT),
+    CONFIG_FIELD(11, mqtt_prefix, CONFIG_MQTT),
+    CONFIG_FIELD(12, led_brightness, CONFIG_LED),
+    CONFIG_FIELD(13, wifi_bssid, 0), // saved by the firmware only, used on next connect
+    CONFIG_FIELD(14, wifi_channel, 0),
+    CONFIG_FIELD(15, ip_address, CONFIG_REBOOT),
+    CONFIG_FIELD(16, ip_gateway, CONFIG_REBOOT),
+    CONFIG_FIELD(17, ip_subnet, CONFIG_REBOOT),
+    CONFIG_FIELD(18, ip_dns, CONFIG_REBOOT),
+    CONFIG_FIELD(19, ir_emitters, CONFIG_REBOOT), // channels of queued commands
+};
+
 #endif
@@ -0,0 +1,424 @@
+#include <Arduino.h>
+#ifndef timeservice_h
+#define timeservice_h
+
+#include <time.h>
+#include <lwip/udp.h>
+#include <lwip/dns.h>
+
+const uint16_t NTP_PORT = 123;
+const uint8_t NTP_PACKET_SIZE = 48;
+const uint32_t NTP_UNIX_OFFSET = 2208988800UL;     // 1900-01-01 to 1970-01-01 (in s)
+const unsigned long NTP_RETRY_MIN = 2000;          // pause after the first failed request, doubles up to the poll interval (in ms)
+const unsigned long NTP_TIMEOUT = 1000;            // max. time of a request including the DNS lookup (in ms)
+const int64_t NTP_STEP_THRESHOLD = 128000;         // larger offsets are stepped instead of slewed (in us)
+const int64_t NTP_MAX_RATE = 2147484;              // max. drift plus slew correction, 500 ppm << 32
+const uint8_t NTP_FREQUENCY_GAIN = 8;              // 1/gain of the offset per interval goes into the drift
+const uint8_t NTP_DELAY_SAMPLES = 8;               // round trip delays kept for the popcorn filter
+const uint32_t NTP_DELAY_MARGIN = 2000;            // accepted round trip above twice the min. of the kept delays (in us)
+const uint64_t NTP_REBASE_INTERVAL = 0x40000000;   // max. local time between two rebases of the clock model (~18 min, in us)
+
+enum class TimeState
+{
+    IDLE,      // waiting for the next poll
+    RESOLVING, // DNS lookup of the server
+    WAITING,   // request sent, waiting for the reply
+};
+
+/*
+ * SNTP client and clock. Requests are sent by a state machine in handle(), the DNS lookup and the reply are
+ * delivered by lwIP callbacks, so nothing waits for the network. The reply is timestamped in the callback.
+ *
+ * The clock is a linear model of micros64(): epoch = base + elapsed + drift and slew correction. The first sample
+ * (and offsets above NTP_STEP_THRESHOLD) set the clock, later ones are slewed: half the offset is corrected until the
+ * next poll, 1/NTP_FREQUENCY_GAIN of the offset per interval goes into the drift. Samples with a round trip far above
+ * the recent minimum are dropped, their offset is mostly queueing. nowEpochMicros() never goes backwards.
+ */
+class TimeService
+{
+public:
+    // server must stay valid. interval: between requests once synced (in ms)
+    void begin(const char *server, unsigned long interval)
+    {
+        this->server = server;
+        this->interval = interval;
+        retryDelay = 0;
+        retryBackoff = 0;
+        if (pcb == nullptr)
+        {
+            pcb = udp_new();
+            if (pcb == nullptr || udp_bind(pcb, IP_ADDR_ANY, 0) != ERR_OK)
+            {
+                Serial.println(F("NTP socket failed"));
+                return;
+            }
+            udp_recv(pcb, &TimeService::received, this);
+        }
+    }
+
+    void handle()
+    {
+        if (pcb == nullptr)
+        {
+            return;
+        }
+        uint64_t local = micros64();
+        if (isSynced && local - baseLocal >= NTP_REBASE_INTERVAL)
+        {
+            rebase(local);
+        }
+
+        unsigned long now = millis();
+        switch (state)
+        {
+        case TimeState::IDLE:
+            if (now - requestStart < retryDelay)
+            {
+                return;
+            }
+            requestStart = now;
+            if (hasAddress)
+            {
+                send();
+                return;
+            }
+            resolved = false;
+            switch (dns_gethostbyname(server, &address, &TimeService::found, this))
+            {
+            case ERR_OK:
+                hasAddress = true;
+                send();
+                break;
+            case ERR_INPROGRESS:
+                state = TimeState::RESOLVING;
+                break;
+            default:
+                failed(PSTR("DNS lookup failed"));
+                break;
+            }
+            break;
+
+        case TimeState::RESOLVING:
+            if (resolved)
+            {
+                state = TimeState::IDLE;
+                if (hasAddress)
+                {
+                    send();
+                }
+                else
+                {
+                    failed(PSTR("DNS lookup failed"));
+                }
+            }
+            else if (now - requestStart >= NTP_TIMEOUT)
+            {
+                state = TimeState::IDLE;
+                failed(PSTR("DNS timeout"));
+            }
+            break;
+
+        case TimeState::WAITING:
+            if (replied)
+            {
+                state = TimeState::IDLE;
+                process();
+            }
+            else if (now - requestStart >= NTP_TIMEOUT)
+            {
+                state = TimeState::IDLE;
+                hasAddress = false; // pool servers come and go, look up another one
+                failed(PSTR("no reply"));
+            }
+            break;
+        }
+    }
+
+    bool synced() const { return isSynced; }
+
+    // Current time in us since 1970-01-01 UTC, 0 until synced. Never smaller than the last result.
+    uint64_t nowEpochMicros()
+    {
+        if (!isSynced)
+        {
+            return 0;
+        }
+        int64_t now = epochAt(micros64());
+        if (now < lastResult)
+        {
+            now = lastResult;
+        }
+        lastResult = now;
+        return now;
+    }
+
+    // Time of a micros() timestamp in us since 1970-01-01 UTC, 0 until synced. Only for timestamps of the last ~71 min.
+    uint64_t epochMicrosAt(uint32_t timestamp) const
+    {
+        if (!isSynced)
+        {
+            return 0;
+        }
+        uint64_t local = micros64();
+        return epochAt(local - (uint32_t)((uint32_t)local - timestamp)); // micros() are the low 32 bits of micros64()
+    }
+
+    // "YYYY-MM-DD hh:mm:ss.mmm" (UTC), "-" until synced
+    void format(char *buffer, size_t size)
+    {
+        uint64_t now = nowEpochMicros();
+        if (now == 0)
+        {
+            snprintf_P(buffer, size, PSTR("-"));
+            return;
+        }
+        time_t seconds = now / 1000000;
+        struct tm parts;
+        gmtime_r(&seconds, &parts);
+        snprintf_P(buffer, size, PSTR("%04d-%02d-%02d %02d:%02d:%02d.%03u"), parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
+                   parts.tm_hour, parts.tm_min, parts.tm_sec, (unsigned)((now / 1000) % 1000));
+    }
+
+    int32_t offset() const { return lastOffset; }                                   // of the last sample (in us)
+    uint32_t roundTrip() const { return lastDelay; }                                // round trip of the last sample (in us)
+    int32_t drift() const { return (int32_t)((driftRate * 1000000000LL) >> 32); } // of micros() (in ppb)
+    uint32_t samples() const { return sampleCount; }                                // accepted samples
+    uint32_t rejected() const { return rejectedCount; }                             // samples dropped by the delay filter
+    uint32_t steps() const { return stepCount; }                                    // clock steps after the first sync
+    uint32_t failures() const { return failureCount; }                              // requests without valid reply
+
+private:
+    void send()
+    {
+        pbuf *packet = pbuf_alloc(PBUF_TRANSPORT, NTP_PACKET_SIZE, PBUF_RAM);
+        if (packet == nullptr)
+        {
+            failed(PSTR("out of memory"));
+            return;
+        }
+        uint8_t *data = (uint8_t *)packet->payload;
+        memset(data, 0, NTP_PACKET_SIZE);
+        data[0] = 0x23; // no leap warning, version 4, client
+        // Transmit timestamp: a nonce, the server returns it as originate timestamp
+        nonce = micros64() ^ ((uint64_t)ESP.getCycleCount() << 32);
+        writeTimestamp(data + 40, nonce);
+
+        replied = false;
+        requestLocal = micros64();
+        err_t result = udp_sendto(pcb, packet, &address, NTP_PORT);
+        pbuf_free(packet);
+        if (result != ERR_OK)
+        {
+            failed(PSTR("send failed"));
+            return;
+        }
+        state = TimeState::WAITING;
+    }
+
+    // lwIP callbacks
+    static void found(const char *, const ip_addr_t *result, void *arg)
+    {
+        TimeService &self = *(TimeService *)arg;
+        if (result != nullptr)
+        {
+            self.address = *result;
+            self.hasAddress = true;
+        }
+        self.resolved = true;
+    }
+
+    static void received(void *arg, udp_pcb *, pbuf *packet, const ip_addr_t *, u16_t)
+    {
+        uint64_t local = micros64();
+        TimeService &self = *(TimeService *)arg;
+        if (self.state == TimeState::WAITING && !self.replied && packet->tot_len >= NTP_PACKET_SIZE &&
+            pbuf_copy_partial(packet, self.reply, NTP_PACKET_SIZE, 0) == NTP_PACKET_SIZE)
+        {
+            self.replyLocal = local;
+            self.replied = true;
+        }
+        pbuf_free(packet);
+    }
+
+    void process()
+    {
+        uint8_t leap = reply[0] >> 6;
+        uint8_t mode = reply[0] & 0x07;
+        uint8_t stratum = reply[1];
+        if (mode != 4 || stratum == 0 || stratum > 15 || leap == 3 || readTimestamp(reply + 24) != nonce)
+        {
+            failed(PSTR("invalid reply"));
+            return;
+        }
+
+        // Server receive and transmit time, local request and reply time
+        int64_t serverReceive = epochMicros(reply + 32);
+        int64_t serverTransmit = epochMicros(reply + 40);
+        int64_t roundTrip = (int64_t)(replyLocal - requestLocal) - (serverTransmit - serverReceive);
+        if (roundTrip < 0)
+        {
+            roundTrip = 0;
+        }
+        retryDelay = interval;
+        retryBackoff = 0;
+        sample(requestLocal + (replyLocal - requestLocal) / 2, serverReceive + (serverTransmit - serverReceive) / 2, roundTrip);
+    }
+
+    // Server time at the middle of the round trip
+    void sample(uint64_t local, int64_t epoch, int64_t roundTrip)
+    {
+        lastDelay = (roundTrip > 0xFFFFFFFF) ? 0xFFFFFFFF : roundTrip;
+        uint32_t minDelay = lastDelay;
+        for (uint8_t i = 0; i < delayCount; i++)
+        {
+            if (delays[i] < minDelay)
+                minDelay = delays[i];
+        }
+        delays[delayIndex] = lastDelay;
+        delayIndex = (delayIndex + 1) % NTP_DELAY_SAMPLES;
+        if (delayCount < NTP_DELAY_SAMPLES)
+        {
+            delayCount++;
+        }
+        if (isSynced && lastDelay > 2 * minDelay + NTP_DELAY_MARGIN)
+        {
+            rejectedCount++;
+            return;
+        }
+        sampleCount++;
+
+        if (!isSynced)
+        {
+            step(local, epoch);
+            isSynced = true;
+            Serial.printf_P(PSTR("NTP synced, delay %u us\n"), lastDelay);
+            return;
+        }
+        int64_t predicted = epochAt(local);
+        int64_t error = epoch - predicted;
+        lastOffset = (error > INT32_MAX) ? INT32_MAX : (error < INT32_MIN) ? INT32_MIN : (int32_t)error;
+        if (error > NTP_STEP_THRESHOLD || error < -NTP_STEP_THRESHOLD)
+        {
+            step(local, epoch);
+            stepCount++;
+            Serial.printf_P(PSTR("NTP clock stepped by %ld us\n"), (long)lastOffset);
+            return;
+        }
+
+        // Continue the model from the sample, so the clock doesn't jump, and correct the rates
+        int64_t elapsed = local - lastSample;
+        baseLocal = local;
+        baseEpoch = predicted;
+        lastSample = local;
+        if (elapsed > 0)
+        {
+            driftRate = clampRate(driftRate + error * 0x100000000LL / elapsed / NTP_FREQUENCY_GAIN);
+        }
+        slewSpan = (int64_t)interval * 1000;
+        // The slew gets what the drift leaves of NTP_MAX_RATE
+        slewRate = clampRate(driftRate + error / 2 * 0x100000000LL / slewSpan) - driftRate;
+    }
+
+    void step(uint64_t local, int64_t epoch)
+    {
+        baseLocal = local;
+        baseEpoch = epoch;
+        lastSample = local;
+        slewRate = 0;
+        slewSpan = 0;
+    }
+
+    // Move the model base to local, keeps the products in epochAt() small
+    void rebase(uint64_t local)
+    {
+        int64_t elapsed = local - baseLocal;
+        baseEpoch = epochAt(local);
+        baseLocal = local;
+        slewSpan = (elapsed >= slewSpan) ? 0 : slewSpan - elapsed;
+    }
+
+    int64_t epochAt(uint64_t local) const
+    {
+        int64_t elapsed = local - baseLocal;
+        int64_t slewed = (elapsed < slewSpan) ? elapsed : slewSpan;
+        return baseEpoch + elapsed + ((elapsed * driftRate) >> 32) + ((slewed * slewRate) >> 32);
+    }
+
+    void failed(PGM_P reason)
+    {
+        failureCount++;
+        retryBackoff = (retryBackoff == 0) ? NTP_RETRY_MIN : min(retryBackoff * 2, interval);
+        retryDelay = retryBackoff;
+        Serial.printf_P(PSTR("NTP request failed: %S, retry in %lu ms\n"), reason, retryDelay);
+    }
+
+    static int64_t clampRate(int64_t rate)
+    {
+        return (rate > NTP_MAX_RATE) ? NTP_MAX_RATE : (rate < -NTP_MAX_RATE) ? -NTP_MAX_RATE : rate;
+    }
+
+    // NTP timestamps are big endian seconds since 1900 and 1/2^32 s, the seconds wrap in 2036
+    static uint64_t readTimestamp(const uint8_t *data)
+    {
+        uint64_t value = 0;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    static void writeTimestamp(uint8_t *data, uint64_t value)
+    {
+        for (int8_t i = 7; i >= 0; i--)
+        {
+            data[i] = value & 0xFF;
+            value >>= 8;
+        }
+    }
+
+    static int64_t epochMicros(const uint8_t *data)
+    {
+        uint64_t timestamp = readTimestamp(data);
+        uint32_t seconds = (uint32_t)(timestamp >> 32) - NTP_UNIX_OFFSET; // valid until 2106
+        return (int64_t)seconds * 1000000 + (((timestamp & 0xFFFFFFFF) * 1000000) >> 32);
+    }
+
+    const char *server = nullptr;
+    unsigned long interval = 60000;
+    udp_pcb *pcb = nullptr;
+    ip_addr_t address;
+    bool hasAddress = false;
+    volatile bool resolved = false;
+    TimeState state = TimeState::IDLE;
+    unsigned long requestStart = 0;
+    unsigned long retryDelay = 0;   // after the last request (in ms)
+    unsigned long retryBackoff = 0; // after the last failed request, 0 after a valid reply (in ms)
+    uint64_t nonce = 0;
+    uint64_t requestLocal = 0;
+    volatile bool replied = false;
+    uint64_t replyLocal = 0;
+    uint8_t reply[NTP_PACKET_SIZE];
+
+    // Clock model
+    bool isSynced = false;
+    uint64_t baseLocal = 0;
+    int64_t baseEpoch = 0;
+    int64_t driftRate = 0; // << 32
+    int64_t slewRate = 0;  // << 32
+    int64_t slewSpan = 0;  // local time from base the slew applies (in us)
+    uint64_t lastSample = 0;
+    int64_t lastResult = 0;
+
+    uint32_t delays[NTP_DELAY_SAMPLES];
+    uint8_t delayIndex = 0;
+    uint8_t delayCount = 0;
+    int32_t lastOffset = 0;
+    uint32_t lastDelay = 0;
+    uint32_t sampleCount = 0;
+    uint32_t rejectedCount = 0;
+    uint32_t stepCount = 0;
+    uint32_t failureCount = 0;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#ifndef webassets_h
+#define webassets_h
+
+// Generated by scripts/embed_web.py from web/, do not edit
+
+// web/style.css, 1257 bytes, 506 bytes gzipped
+const char STYLE_CSS_ETAG[] = "\"96f4827f3ea66211\"";
+const size_t STYLE_CSS_GZ_LENGTH = 506;
+const uint8_t STYLE_CSS_GZ[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x7d, 0x93, 0x3d, 0x6f, 0xdb, 0x30,
+    0x10, 0x86, 0x77, 0xfd, 0x0a, 0x22, 0x5e, 0x5a, 0xc0, 0x0a, 0x24, 0x3b, 0xcd, 0x20, 0x23, 0x43,
+    0xd1, 0xc4, 0xe8, 0x9e, 0xb1, 0xe8, 0x40, 0x91, 0x27, 0xeb, 0x10, 0x9a, 0x14, 0x28, 0xca, 0x89,
+    0x5b, 0xf4, 0xbf, 0x97, 0xa4, 0x48, 0x99, 0x4a, 0xe4, 0x40, 0x80, 0x61, 0xf2, 0xbe, 0x9e, 0xf7,
+    0xee, 0x58, 0x2b, 0x7e, 0x26, 0x7f, 0x33, 0x52, 0x53, 0xf6, 0x72, 0xd0, 0x6a, 0x90, 0x3c, 0x67,
+    0x4a, 0x28, 0x5d, 0x91, 0xd5, 0xd3, 0xa3, 0xfb, 0x76, 0x19, 0x69, 0x94, 0x34, 0x79, 0x43, 0x8f,
+    0x28, 0xce, 0x15, 0xf9, 0xae, 0x91, 0x8a, 0x35, 0xf9, 0x09, 0xe2, 0x04, 0x06, 0x19, 0x5d, 0x93,
+    0x67, 0x2a, 0xfb, 0xfc, 0x19, 0x34, 0x36, 0xd6, 0xf7, 0x47, 0x08, 0xde, 0x6e, 0xb7, 0xbb, 0xec,
+    0x5f, 0x96, 0xb5, 0xa5, 0xcb, 0xbe, 0x94, 0xde, 0x7b, 0x10, 0xc2, 0xb1, 0xef, 0x04, 0xb5, 0x89,
+    0x0d, 0xad, 0x05, 0xe4, 0x0c, 0x84, 0x70, 0xd7, 0x47, 0xaa, 0x0f, 0x28, 0x2b, 0xb2, 0x29, 0xba,
+    0x37, 0x77, 0xee, 0x28, 0xe7, 0x28, 0x0f, 0x97, 0x8b, 0x90, 0xe6, 0xb5, 0x45, 0x03, 0xee, 0x5c,
+    0x2b, 0xcd, 0x41, 0xe7, 0x9a, 0x72, 0x1c, 0xfa, 0x8a, 0x94, 0xd6, 0x6d, 0xfc, 0x29, 0x48, 0xe1,
+    0xec, 0x5e, 0x44, 0x8f, 0x7f, 0x20, 0xa6, 0xb0, 0x70, 0x83, 0xf0, 0x70, 0x02, 0x7b, 0x6b, 0x32,
+    0x67, 0x5b, 0xde, 0x9c, 0x3b, 0xeb, 0x20, 0x95, 0x84, 0x14, 0xa2, 0x98, 0x11, 0xf8, 0x93, 0x3a,
+    0x81, 0x6e, 0x84, 0x7a, 0xad, 0x48, 0x8b, 0x9c, 0x83, 0xdc, 0x7d, 0x2a, 0xf2, 0x1d, 0x5c, 0x91,
+    0xe0, 0x95, 0x11, 0x46, 0xa0, 0x87, 0xb1, 0x49, 0xa9, 0xa9, 0x88, 0x80, 0xc6, 0xc4, 0x6b, 0xea,
+    0x0d, 0x53, 0xa3, 0x6a, 0xa1, 0xd8, 0x4b, 0xd2, 0x82, 0xd5, 0x7e, 0xbf, 0x77, 0x47, 0x03, 0x6f,
+    0x26, 0xa7, 0x02, 0x0f, 0x96, 0x98, 0x81, 0x34, 0xa0, 0x67, 0xd8, 0xe5, 0xfd, 0xd8, 0x38, 0xef,
+    0xc6, 0x81, 0x29, 0x4d, 0x0d, 0x2a, 0x19, 0xd5, 0x86, 0x52, 0x55, 0xeb, 0x94, 0x5d, 0x9b, 0x59,
+    0x59, 0x96, 0xde, 0x73, 0x75, 0xa4, 0x28, 0xbd, 0xd3, 0x87, 0xb9, 0x2c, 0x44, 0x05, 0xbe, 0x85,
+    0x09, 0xa5, 0x4d, 0x1e, 0x87, 0x35, 0xa6, 0x6f, 0x94, 0x32, 0x91, 0x62, 0x39, 0xea, 0x7a, 0xaf,
+    0x2f, 0x82, 0xe7, 0x9b, 0x12, 0x31, 0x92, 0x45, 0x28, 0x37, 0x49, 0x4b, 0xde, 0x75, 0xce, 0x62,
+    0xf8, 0x8d, 0x24, 0x96, 0x22, 0x30, 0xf4, 0x1d, 0x65, 0x71, 0x03, 0x26, 0xb3, 0xe1, 0x6b, 0x12,
+    0xfe, 0xb5, 0xd6, 0x75, 0xaa, 0xfe, 0x2d, 0x8c, 0x35, 0xd8, 0x74, 0x25, 0x4d, 0x9b, 0xb3, 0x16,
+    0x05, 0xff, 0x02, 0x27, 0x90, 0x5f, 0x5d, 0xda, 0x49, 0x43, 0xf2, 0xda, 0x6c, 0x08, 0xca, 0x6e,
+    0x30, 0xbf, 0xdc, 0x2a, 0x3e, 0xdc, 0xf4, 0x43, 0x7d, 0x44, 0x73, 0xf3, 0x7b, 0xe6, 0x3e, 0x97,
+    0x3c, 0xd2, 0xc5, 0x39, 0xce, 0xdf, 0x45, 0x8a, 0x43, 0x36, 0x9e, 0x69, 0x49, 0xec, 0x95, 0x9d,
+    0x98, 0x56, 0x0e, 0xa5, 0x40, 0x09, 0x79, 0xd8, 0xbc, 0xb4, 0x83, 0x7e, 0xa9, 0xe2, 0x08, 0xef,
+    0x5c, 0x11, 0x77, 0xc1, 0x06, 0xdd, 0x3b, 0x8a, 0x4e, 0xe1, 0xd4, 0xcd, 0x25, 0x55, 0xd3, 0xb6,
+    0x7d, 0xd0, 0xb6, 0xba, 0x03, 0xf7, 0x5d, 0x8f, 0xb4, 0x6c, 0xae, 0xb3, 0xdc, 0x06, 0x2b, 0x37,
+    0x17, 0x63, 0x31, 0x8b, 0xdb, 0xfb, 0x4b, 0x6d, 0xa9, 0x9c, 0x4c, 0xfb, 0x44, 0x81, 0xbb, 0x2c,
+    0xff, 0x01, 0xbc, 0x76, 0x7d, 0x68, 0xe9, 0x04, 0x00, 0x00,
+};
+
+#endif
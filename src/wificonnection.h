@@ -0,0 +1,200 @@
+#include <Arduino.h>
+#ifndef wificonnection_h
+#define wificonnection_h
+
+#include <ESP8266WiFi.h>
+
+const unsigned long WIFI_CONNECT_TIMEOUT = 15000; // max. time for one connection attempt (in ms)
+const unsigned long WIFI_FAST_CONNECT_TIMEOUT = 3000; // max. time for an attempt with known BSSID and channel (in ms)
+const unsigned long WIFI_BACKOFF_MIN = 1000;      // pause after the first failed attempt (in ms)
+const unsigned long WIFI_BACKOFF_MAX = 60000;     // max. pause between attempts (in ms)
+const uint8_t WIFI_AP_FALLBACK_FAILURES = 5;      // failed attempts in a row until the fallback SoftAP is started
+const char WIFI_AP_SSID[] = "IRBridge";
+
+enum class WiFiState
+{
+    CONNECTING, // waiting for IP
+    CONNECTED,
+    WAITING, // backoff before next attempt
+};
+
+/*
+ * Non-blocking station connection. If BSSID and channel of the last connection are known, the first attempt
+ * after boot or a connection loss uses them and skips the scan. If it fails, a normal attempt follows at once.
+ * Events of the SDK only set flags, all state changes are made in handle() from loop(). Failed attempts are
+ * retried with exponential backoff. After WIFI_AP_FALLBACK_FAILURES failures in a row a SoftAP is started
+ * additionally, so the web interface stays reachable. It is stopped again on the next successful connection.
+ */
+class WiFiConnection
+{
+public:
+    // ssid and psk must stay valid until the next begin(). bssid/channel: last known AP or nullptr/0.
+    void begin(const char *ssid, const char *psk, const uint8_t *bssid = nullptr, uint8_t channel = 0)
+    {
+        this->ssid = ssid;
+        this->psk = psk;
+        if (bssid != nullptr && channel != 0)
+        {
+            memcpy(this->bssid, bssid, sizeof(this->bssid));
+            this->channel = channel;
+        }
+        associatedHandler = WiFi.onStationModeConnected([this](const WiFiEventStationModeConnected &) {
+            if (firstAssociate == 0)
+                firstAssociate = millis();
+        });
+        gotIPHandler = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP &) { gotIP = true; });
+        disconnectedHandler = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected &) { disconnected = true; });
+        WiFi.setAutoReconnect(false); // reconnects are done here with backoff
+        WiFi.mode(WIFI_STA);
+        connect(true);
+    }
+
+    // Returns true once after each (re)connect
+    bool handle()
+    {
+        switch (state)
+        {
+        case WiFiState::CONNECTING:
+            if (gotIP)
+            {
+                gotIP = false;
+                state = WiFiState::CONNECTED;
+                failureCount = 0;
+                backoff = WIFI_BACKOFF_MIN;
+                if (firstConnect == 0)
+                {
+                    firstConnect = millis();
+                }
+                else
+                {
+                    reconnectCount++;
+                }
+                Serial.printf_P(PSTR("WiFi connected to '%s' after %lu ms%s\n"), ssid, millis() - attemptStart, fastAttempt ? " (fast)" : "");
+                lastFast = fastAttempt;
+                memcpy(bssid, WiFi.BSSID(), sizeof(bssid));
+                channel = WiFi.channel();
+                stopAccessPoint();
+                return true;
+            }
+            if (fastAttempt && (millis() - attemptStart) >= WIFI_FAST_CONNECT_TIMEOUT)
+            {
+                Serial.println(F("WiFi fast connect failed, scanning"));
+                WiFi.disconnect();
+                connect(false);
+            }
+            else if ((millis() - attemptStart) >= WIFI_CONNECT_TIMEOUT)
+            {
+                failed();
+            }
+            break;
+
+        case WiFiState::CONNECTED:
+            if (disconnected || WiFi.status() != WL_CONNECTED)
+            {
+                Serial.println(F("WiFi connection lost"));
+                connect(true);
+            }
+            break;
+
+        case WiFiState::WAITING:
+            if ((millis() - waitStart) >= backoff)
+            {
+                backoff = min(backoff * 2, WIFI_BACKOFF_MAX);
+                connect(false);
+            }
+            break;
+        }
+        return false;
+    }
+
+    bool connected() const { return state == WiFiState::CONNECTED; }
+    bool accessPointActive() const { return accessPoint; }
+    unsigned long firstAssociateTime() const { return firstAssociate; } // millis() of first association, 0 if never
+    unsigned long firstConnectTime() const { return firstConnect; }     // millis() of first IP, 0 if never connected
+    bool lastConnectFast() const { return lastFast; }                   // last connect used BSSID and channel without scan
+    const uint8_t *currentBSSID() const { return bssid; }
+    uint8_t currentChannel() const { return channel; }
+    uint32_t reconnects() const { return reconnectCount; }
+    uint32_t failures() const { return totalFailures; }
+
+private:
+    // fast: use known BSSID and channel, if any
+    void connect(bool fast)
+    {
+        gotIP = false;
+        disconnected = false;
+        attemptStart = millis();
+        state = WiFiState::CONNECTING;
+        fastAttempt = fast && channel != 0;
+        if (fastAttempt)
+        {
+            WiFi.begin(ssid, psk, channel, bssid);
+        }
+        else
+        {
+            WiFi.begin(ssid, psk);
+        }
+    }
+
+    void failed()
+    {
+        failureCount++;
+        totalFailures++;
+        Serial.printf_P(PSTR("WiFi connection to '%s' failed (%u in a row), retry in %lu ms\n"), ssid, failureCount, backoff);
+        WiFi.disconnect();
+        waitStart = millis();
+        state = WiFiState::WAITING;
+        if (failureCount >= WIFI_AP_FALLBACK_FAILURES)
+        {
+            startAccessPoint();
+        }
+    }
+
+    void startAccessPoint()
+    {
+        if (accessPoint)
+        {
+            return;
+        }
+        Serial.printf_P(PSTR("Starting fallback WiFi SoftAP '%s'\n"), WIFI_AP_SSID);
+        WiFi.mode(WIFI_AP_STA);
+        WiFi.softAP(WIFI_AP_SSID, "");
+        accessPoint = true;
+    }
+
+    void stopAccessPoint()
+    {
+        if (!accessPoint)
+        {
+            return;
+        }
+        Serial.println(F("Stopping fallback WiFi SoftAP"));
+        WiFi.softAPdisconnect(true);
+        WiFi.mode(WIFI_STA);
+        accessPoint = false;
+    }
+
+    const char *ssid = "";
+    const char *psk = "";
+    uint8_t bssid[6] = {};
+    uint8_t channel = 0;
+    bool fastAttempt = false;
+    bool lastFast = false;
+    WiFiEventHandler associatedHandler;
+    WiFiEventHandler gotIPHandler;
+    WiFiEventHandler disconnectedHandler;
+    volatile bool gotIP = false;
+    volatile bool disconnected = false;
+    WiFiState state = WiFiState::WAITING;
+    bool accessPoint = false;
+    unsigned long attemptStart = 0;
+    unsigned long waitStart = 0;
+    unsigned long backoff = WIFI_BACKOFF_MIN;
+    unsigned long firstAssociate = 0;
+    unsigned long firstConnect = 0;
+    uint8_t failureCount = 0;
+    uint32_t totalFailures = 0;
+    uint32_t reconnectCount = 0;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef arduino_stub_h
+#define arduino_stub_h
+
+/*
+ * Minimal Arduino/ESP8266 API for the host tests (pio test -e native). Time is simulated: hostNanos only moves when
+ * a test moves it, and timer1 fires from hostRunTimer(). Only what the headers in src/ use is provided.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+#define IRAM_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define FPSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strncpy_P strncpy
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+typedef const char *PGM_P;
+class __FlashStringHelper;
+
+using std::max;
+using std::min;
+
+template <class T>
+T constrain(T value, T low, T high) { return (value < low) ? low : (value > high) ? high : value; }
+
+// Simulated time
+inline uint64_t hostNanos = 0;
+
+inline unsigned long micros() { return (unsigned long)(hostNanos / 1000); }
+inline uint64_t micros64() { return hostNanos / 1000; }
+inline unsigned long millis() { return (unsigned long)(hostNanos / 1000000); }
+inline void delay(unsigned long ms) { hostNanos += (uint64_t)ms * 1000000; }
+inline void delayMicroseconds(unsigned int us) { hostNanos += (uint64_t)us * 1000; }
+inline void yield() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class EspClass
+{
+public:
+    uint32_t getCycleCount() { return (uint32_t)(hostNanos * cpuFreqMHz / 1000); }
+    uint8_t getCpuFreqMHz() { return cpuFreqMHz; }
+    uint32_t getFreeHeap() { return freeHeap; }
+    // No flash, tests give the config store their own simulated flash
+    bool flashRead(uint32_t, uint32_t *, size_t) { return false; }
+    bool flashWrite(uint32_t, const uint32_t *, size_t) { return false; }
+    bool flashEraseSector(uint32_t) { return false; }
+
+    uint8_t cpuFreqMHz = 80;
+    uint32_t freeHeap = 40000;
+};
+inline EspClass ESP;
+
+class HostSerial
+{
+public:
+    template <class... Args>
+    int printf(const char *format, Args... args) { return verbose ? ::printf(format, args...) : 0; }
+    template <class... Args>
+    int printf_P(const char *format, Args... args) { return printf(format, args...); }
+    void print(const char *text) { printf("%s", text); }
+    void println(const char *text = "") { printf("%s\n", text); }
+    void print(const __FlashStringHelper *text) { print(reinterpret_cast<const char *>(text)); }
+    void println(const __FlashStringHelper *text) { println(reinterpret_cast<const char *>(text)); }
+
+    bool verbose = false;
+};
+inline HostSerial Serial;
+
+// Output of the printing functions of libraries is dropped
+enum
+{
+    DEC = 10,
+    HEX = 16,
+    BIN = 2
+};
+
+class Print
+{
+public:
+    template <class... Args>
+    size_t print(Args...) { return 0; }
+    template <class... Args>
+    size_t println(Args...) { return 0; }
+    size_t write(uint8_t) { return 0; }
+};
+
+// Arduino String, only what is passed through the headers in src/
+class String
+{
+public:
+    String(const char *text = "") : text(text) {}
+    const char *c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.length(); }
+    bool concat(char c)
+    {
+        text += c;
+        return true;
+    }
+    bool concat(const char *more)
+    {
+        text += more;
+        return true;
+    }
+
+private:
+    std::string text;
+};
+
+// GPIO, writes to GPOS/GPOC are passed to hostGpioHandler with the simulated time
+enum
+{
+    INPUT = 0,
+    OUTPUT = 1,
+    LOW = 0,
+    HIGH = 1
+};
+inline void (*hostGpioHandler)(uint32_t mask, bool high) = nullptr;
+
+struct HostGpioRegister
+{
+    bool high;
+    HostGpioRegister &operator=(uint32_t mask)
+    {
+        if (hostGpioHandler != nullptr)
+        {
+            hostGpioHandler(mask, high);
+        }
+        return *this;
+    }
+};
+inline HostGpioRegister GPOS = {true};
+inline HostGpioRegister GPOC = {false};
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+/*
+ * Timer1 in single shot mode with 5 MHz ticks (TIM_DIV16). hostIsrLatency is the simulated time from the timer event
+ * until the ISR reads the time or writes the timer, it covers the interrupt entry and the work done before.
+ */
+enum
+{
+    TIM_DIV16 = 1,
+    TIM_EDGE = 0,
+    TIM_SINGLE = 0,
+    TIM_LOOP = 1
+};
+inline void (*hostTimerIsr)() = nullptr;
+inline bool hostTimerEnabled = false;
+inline uint64_t hostTimerEvent = 0; // hostNanos of the next timer event
+inline uint32_t hostIsrLatency = 0; // in ns
+
+inline void timer1_isr_init() {}
+inline void timer1_attachInterrupt(void (*isr)()) { hostTimerIsr = isr; }
+inline void timer1_detachInterrupt() { hostTimerIsr = nullptr; }
+inline void timer1_enable(uint8_t, uint8_t, uint8_t) { hostTimerEnabled = true; }
+inline void timer1_disable() { hostTimerEnabled = false; }
+inline void timer1_write(uint32_t ticks) { hostTimerEvent = hostNanos + (uint64_t)ticks * 200; }
+
+// Run the timer events until time, returns the number of interrupts
+inline uint32_t hostRunTimer(uint64_t time)
+{
+    uint32_t interrupts = 0;
+    while (hostTimerEnabled && hostTimerIsr != nullptr && hostTimerEvent <= time)
+    {
+        uint64_t event = hostTimerEvent;
+        hostNanos = event + hostIsrLatency;
+        hostTimerIsr();
+        interrupts++;
+        if (hostTimerEnabled && hostTimerEvent <= event)
+        {
+            break; // not re-armed, a real single shot timer would stop too
+        }
+    }
+    if (hostNanos < time)
+    {
+        hostNanos = time;
+    }
+    return interrupts;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef esp8266webserver_stub_h
+#define esp8266webserver_stub_h
+
+/*
+ * ESP8266WebServer for the host tests: the chunks of a streamed response are recorded as they would go into the
+ * socket. Only what htmlwriter.h uses is provided.
+ */
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+const size_t CONTENT_LENGTH_UNKNOWN = (size_t)-1;
+
+class ESP8266WebServer
+{
+public:
+    void setContentLength(size_t length) { contentLength = length; }
+
+    void send(int code, const char *contentType, const String &)
+    {
+        this->code = code;
+        this->contentType = contentType;
+        body.clear();
+        chunks.clear();
+        finished = false;
+    }
+
+    // An empty chunk ends the response
+    void sendContent(const char *content, size_t size)
+    {
+        if (size == 0)
+        {
+            finished = true;
+            return;
+        }
+        body.append(content, size);
+        chunks.push_back(size);
+    }
+    void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+    void sendContent_P(PGM_P content, size_t size) { sendContent(content, size); }
+
+    String uri() const { return path.c_str(); }
+
+    std::string path = "/";
+    int code = 0;
+    std::string contentType;
+    size_t contentLength = 0;
+    std::string body;
+    std::vector<size_t> chunks; // size of every chunk sent
+    bool finished = false;
+};
+
+#endif
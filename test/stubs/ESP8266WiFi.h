@@ -0,0 +1,191 @@
+#ifndef esp8266wifi_stub_h
+#define esp8266wifi_stub_h
+
+/*
+ * ESP8266WiFi for the host tests: one simulated AP that a test switches on and off or moves to another channel.
+ * An attempt associates after a scan, or at once with the right BSSID and channel, and gets its IP after DHCP.
+ * The SDK events are delivered by WiFi.run(), which a test calls between two handle() like the SDK between two loop().
+ * Only what wificonnection.h uses is provided.
+ */
+#include <Arduino.h>
+#include <functional>
+#include <memory>
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+struct WiFiEventStationModeConnected
+{
+};
+struct WiFiEventStationModeGotIP
+{
+};
+struct WiFiEventStationModeDisconnected
+{
+};
+typedef std::shared_ptr<void> WiFiEventHandler;
+
+const unsigned long HOST_WIFI_SCAN_TIME = 2200;      // scan of all channels before associating (in ms)
+const unsigned long HOST_WIFI_ASSOCIATE_TIME = 150;  // with known BSSID and channel (in ms)
+const unsigned long HOST_WIFI_DHCP_TIME = 400;       // association to IP (in ms)
+
+class HostWiFi
+{
+public:
+    WiFiEventHandler onStationModeConnected(std::function<void(const WiFiEventStationModeConnected &)> handler)
+    {
+        connectedHandler = handler;
+        return std::make_shared<int>(0);
+    }
+    WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP &)> handler)
+    {
+        gotIPHandler = handler;
+        return std::make_shared<int>(0);
+    }
+    WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected &)> handler)
+    {
+        disconnectedHandler = handler;
+        return std::make_shared<int>(0);
+    }
+
+    void setAutoReconnect(bool) {}
+    bool mode(WiFiMode_t mode)
+    {
+        currentMode = mode;
+        return true;
+    }
+
+    // A scan finds the AP on any channel, a given BSSID and channel only work if the AP is still there
+    wl_status_t begin(const char *, const char *, int32_t channel = 0, const uint8_t *bssid = nullptr)
+    {
+        attempts++;
+        dropConnection();
+        attemptStart = millis();
+        attemptChannel = channel;
+        if (bssid != nullptr)
+        {
+            memcpy(attemptBSSID, bssid, sizeof(attemptBSSID));
+        }
+        associated = false;
+        connecting = true;
+        return WL_DISCONNECTED;
+    }
+
+    bool disconnect(bool = false)
+    {
+        connecting = false;
+        dropConnection();
+        return true;
+    }
+
+    wl_status_t status() const { return hasIP ? WL_CONNECTED : WL_DISCONNECTED; }
+    const uint8_t *BSSID() const { return apBSSID; }
+    int32_t channel() const { return apChannel; }
+
+    bool softAP(const char *, const char *)
+    {
+        softAPActive = true;
+        return true;
+    }
+    bool softAPdisconnect(bool)
+    {
+        softAPActive = false;
+        return true;
+    }
+
+    // Deliver the events due at the current time
+    void run()
+    {
+        if (!apUp)
+        {
+            dropConnection();
+            return;
+        }
+        bool found = attemptChannel == 0 || (attemptChannel == apChannel && memcmp(attemptBSSID, apBSSID, sizeof(apBSSID)) == 0);
+        if (!connecting || !found)
+        {
+            return;
+        }
+        unsigned long associateTime = (attemptChannel != 0) ? HOST_WIFI_ASSOCIATE_TIME : HOST_WIFI_SCAN_TIME;
+        // The AP may have come back during the attempt, the scan then starts over
+        unsigned long start = max(attemptStart, apUpSince);
+        if (!associated && millis() - start >= associateTime)
+        {
+            associated = true;
+            associatedAt = millis();
+            if (connectedHandler)
+                connectedHandler({});
+        }
+        if (associated && !hasIP && millis() - associatedAt >= HOST_WIFI_DHCP_TIME)
+        {
+            hasIP = true;
+            connecting = false;
+            if (gotIPHandler)
+                gotIPHandler({});
+        }
+    }
+
+    void setAccessPoint(bool up)
+    {
+        if (up && !apUp)
+        {
+            apUpSince = millis();
+        }
+        apUp = up;
+    }
+
+    void moveAccessPoint(uint8_t channel, uint8_t lastByte)
+    {
+        apChannel = channel;
+        apBSSID[5] = lastByte;
+        dropConnection();
+    }
+
+    bool apUp = true;
+    unsigned long apUpSince = 0;
+    uint8_t apChannel = 6;
+    uint8_t apBSSID[6] = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+    WiFiMode_t currentMode = WIFI_OFF;
+    bool softAPActive = false;
+    uint32_t attempts = 0; // calls of begin()
+
+private:
+    void dropConnection()
+    {
+        bool wasAssociated = associated;
+        associated = false;
+        hasIP = false;
+        if (wasAssociated && disconnectedHandler)
+        {
+            disconnectedHandler({});
+        }
+    }
+
+    std::function<void(const WiFiEventStationModeConnected &)> connectedHandler;
+    std::function<void(const WiFiEventStationModeGotIP &)> gotIPHandler;
+    std::function<void(const WiFiEventStationModeDisconnected &)> disconnectedHandler;
+    bool connecting = false;
+    bool associated = false;
+    bool hasIP = false;
+    int32_t attemptChannel = 0; // 0: scan
+    uint8_t attemptBSSID[6] = {};
+    unsigned long attemptStart = 0;
+    unsigned long associatedAt = 0;
+};
+inline HostWiFi WiFi;
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef fs_stub_h
+#define fs_stub_h
+
+/*
+ * LittleFS for the host tests: files are byte vectors in memory, shared by all handles of the same path like on
+ * the device. Only what codelibrary.h and macro.h use is provided.
+ */
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs
+{
+typedef std::shared_ptr<std::vector<uint8_t>> HostData;
+
+// Calls of read()/write() and their bytes over all files, a test may reset them
+inline uint32_t hostFileReads = 0;
+inline uint64_t hostFileReadBytes = 0;
+inline uint64_t hostFileWriteBytes = 0;
+
+class File
+{
+public:
+    File() {}
+    explicit File(HostData data) : data(data) {}
+
+    explicit operator bool() const { return data != nullptr; }
+    size_t size() const { return data->size(); }
+    void close() { data = nullptr; }
+
+    bool seek(uint32_t offset)
+    {
+        if (offset > data->size())
+        {
+            return false;
+        }
+        position = offset;
+        return true;
+    }
+
+    size_t read(uint8_t *buffer, size_t length)
+    {
+        length = min(length, data->size() - position);
+        memcpy(buffer, data->data() + position, length);
+        hostFileReads++;
+        hostFileReadBytes += length;
+        position += length;
+        return length;
+    }
+
+    // Appends, files are only written after opening with "w"
+    size_t write(const uint8_t *buffer, size_t length)
+    {
+        data->insert(data->end(), buffer, buffer + length);
+        hostFileWriteBytes += length;
+        return length;
+    }
+
+private:
+    HostData data;
+    size_t position = 0;
+};
+
+struct HostFileName
+{
+    std::string name;
+
+    bool endsWith(const __FlashStringHelper *suffix) const
+    {
+        const char *text = reinterpret_cast<const char *>(suffix);
+        size_t length = strlen(text);
+        return name.size() >= length && name.compare(name.size() - length, length, text) == 0;
+    }
+};
+
+class Dir
+{
+public:
+    explicit Dir(std::map<std::string, HostData> &files) : files(files) {}
+
+    bool next()
+    {
+        current = started ? std::next(current) : files.begin();
+        started = true;
+        return current != files.end();
+    }
+    HostFileName fileName() const { return {current->first}; }
+    File openFile(const char *) const { return File(current->second); }
+
+private:
+    std::map<std::string, HostData> &files;
+    std::map<std::string, HostData>::iterator current;
+    bool started = false;
+};
+
+class FS
+{
+public:
+    File open(const char *path, const char *mode)
+    {
+        if (mode[0] == 'w')
+        {
+            files[path] = std::make_shared<std::vector<uint8_t>>();
+        }
+        auto file = files.find(path);
+        return (file == files.end()) ? File() : File(file->second);
+    }
+
+    bool exists(const char *path) const { return files.count(path) > 0; }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    Dir openDir(const char *) { return Dir(files); }
+
+    bool rename(const char *from, const char *to)
+    {
+        auto file = files.find(from);
+        if (file == files.end())
+        {
+            return false;
+        }
+        HostData data = file->second;
+        files.erase(file);
+        files[to] = data;
+        return true;
+    }
+
+    std::map<std::string, HostData> files;
+};
+} // namespace fs
+
+#endif
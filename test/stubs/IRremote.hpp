@@ -0,0 +1,84 @@
+#ifndef irremote_stub_h
+#define irremote_stub_h
+
+/*
+ * IRremote for the host tests. By default IrSender sends nothing, the protocol numbers, repeat periods and the
+ * RC5/RC6 toggle bit are those of lib/Arduino-IRremote. A test that defines HOST_IRREMOTE_LIBRARY gets the bundled
+ * library with its ESP8266 backend instead, the carrier then goes to core_esp8266_waveform.h.
+ */
+#include <Arduino.h>
+
+#if defined(HOST_IRREMOTE_LIBRARY)
+#define ESP8266
+#include "../../lib/Arduino-IRremote/src/IRremote.hpp"
+
+// Left out by NO_LED_FEEDBACK_CODE, but the aliases in IRremoteInt.h still reference them without optimization
+void enableLEDFeedback() {}
+void disableLEDFeedback() {}
+#else
+
+typedef enum
+{
+    UNKNOWN = 0,
+    PULSE_WIDTH,
+    PULSE_DISTANCE,
+    APPLE,
+    DENON,
+    JVC,
+    LG,
+    LG2,
+    NEC,
+    NEC2,
+    ONKYO,
+    PANASONIC,
+    KASEIKYO,
+    KASEIKYO_DENON,
+    KASEIKYO_SHARP,
+    KASEIKYO_JVC,
+    KASEIKYO_MITSUBISHI,
+    RC5,
+    RC6,
+    SAMSUNG,
+    SAMSUNG48,
+    SAMSUNG_LG,
+    SHARP,
+    SONY
+} decode_type_t;
+
+#define NEC_REPEAT_PERIOD 110000
+#define SONY_REPEAT_PERIOD 45000
+#define RC5_UNIT 889
+#define RC5_REPEAT_PERIOD (128L * RC5_UNIT)
+#define SAMSUNG_REPEAT_PERIOD 110000
+#define LG_REPEAT_PERIOD 110000
+#define JVC_REPEAT_PERIOD 65000
+#define DENON_REPEAT_PERIOD 110000
+#define KASEIKYO_REPEAT_PERIOD 130000
+
+inline uint8_t sLastSendToggleValue = 1; // flipped by every RC5/RC6 frame
+
+class HostIrSender
+{
+public:
+    void begin(uint8_t) {}
+    void setSendPin(uint8_t) {}
+
+    void sendSony(uint16_t, uint8_t, int_fast8_t) {}
+    void sendRC5(uint8_t, uint8_t, int_fast8_t) { sLastSendToggleValue ^= 1; }
+    void sendRC6(uint8_t, uint8_t, int_fast8_t) { sLastSendToggleValue ^= 1; }
+    void sendSamsung(uint16_t, uint16_t, int_fast8_t) {}
+    void sendLG(uint8_t, uint16_t, int_fast8_t) {}
+    void sendJVC(uint8_t, uint8_t, int_fast8_t) {}
+    void sendDenon(uint8_t, uint8_t, int_fast8_t) {}
+    void sendSharp(uint8_t, uint8_t, int_fast8_t) {}
+    void sendPanasonic(uint16_t, uint8_t, int_fast8_t) {}
+    void sendKaseikyo_Denon(uint16_t, uint8_t, int_fast8_t) {}
+    void sendOnkyo(uint16_t, uint16_t, int_fast8_t) {}
+    void sendNEC2(uint16_t, uint8_t, int_fast8_t) {}
+    void sendApple(uint8_t, uint8_t, int_fast8_t) {}
+};
+inline HostIrSender IrSender;
+
+#endif // HOST_IRREMOTE_LIBRARY
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef core_esp8266_waveform_stub_h
+#define core_esp8266_waveform_stub_h
+
+/*
+ * Waveform generator of the ESP8266 core, used by the ESP8266 backend of IRremote for the carrier. The carrier isn't
+ * simulated, hostWaveformHandler gets its start and stop with the simulated time, i.e. the marks of a frame.
+ */
+#include <Arduino.h>
+
+inline void (*hostWaveformHandler)(uint8_t pin, bool on) = nullptr;
+
+inline int startWaveform(uint8_t pin, uint32_t, uint32_t, uint32_t)
+{
+    if (hostWaveformHandler != nullptr)
+    {
+        hostWaveformHandler(pin, true);
+    }
+    return true;
+}
+
+inline int stopWaveform(uint8_t pin)
+{
+    if (hostWaveformHandler != nullptr)
+    {
+        hostWaveformHandler(pin, false);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef lwip_udp_stub_h
+#define lwip_udp_stub_h
+
+/*
+ * lwIP raw UDP for the host tests. Sent packets go to hostUdpSendHandler, hostUdpReceive() delivers a packet to the
+ * receive callback of the last created pcb like the lwIP input does. Only what timeservice.h uses is provided.
+ */
+#include <Arduino.h>
+
+typedef int8_t err_t;
+typedef uint16_t u16_t;
+
+const err_t ERR_OK = 0;
+const err_t ERR_MEM = -1;
+const err_t ERR_INPROGRESS = -5;
+
+typedef struct
+{
+    uint32_t addr;
+} ip_addr_t;
+
+inline const ip_addr_t hostAnyAddress = {0};
+#define IP_ADDR_ANY (&hostAnyAddress)
+
+typedef enum
+{
+    PBUF_TRANSPORT
+} pbuf_layer;
+
+typedef enum
+{
+    PBUF_RAM
+} pbuf_type;
+
+struct pbuf
+{
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+};
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, udp_pcb *pcb, pbuf *p, const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb
+{
+    udp_recv_fn recv;
+    void *recvArg;
+};
+
+inline pbuf *pbuf_alloc(pbuf_layer, u16_t length, pbuf_type)
+{
+    pbuf *packet = new pbuf;
+    packet->payload = new uint8_t[length];
+    packet->tot_len = length;
+    packet->len = length;
+    return packet;
+}
+
+inline uint8_t pbuf_free(pbuf *packet)
+{
+    delete[](uint8_t *) packet->payload;
+    delete packet;
+    return 1;
+}
+
+inline u16_t pbuf_copy_partial(const pbuf *packet, void *data, u16_t length, u16_t offset)
+{
+    if (offset >= packet->len)
+    {
+        return 0;
+    }
+    length = min<u16_t>(length, packet->len - offset);
+    memcpy(data, (const uint8_t *)packet->payload + offset, length);
+    return length;
+}
+
+inline udp_pcb *hostUdpPcb = nullptr;
+inline void (*hostUdpSendHandler)(const uint8_t *data, u16_t length) = nullptr;
+
+inline udp_pcb *udp_new()
+{
+    hostUdpPcb = new udp_pcb();
+    return hostUdpPcb;
+}
+
+inline err_t udp_bind(udp_pcb *, const ip_addr_t *, u16_t) { return ERR_OK; }
+
+inline void udp_recv(udp_pcb *pcb, udp_recv_fn recv, void *arg)
+{
+    pcb->recv = recv;
+    pcb->recvArg = arg;
+}
+
+inline err_t udp_sendto(udp_pcb *, pbuf *packet, const ip_addr_t *, u16_t)
+{
+    if (hostUdpSendHandler != nullptr)
+    {
+        hostUdpSendHandler((const uint8_t *)packet->payload, packet->len);
+    }
+    return ERR_OK;
+}
+
+// A packet from the network at the current simulated time, freed by the receive callback
+inline void hostUdpReceive(const uint8_t *data, u16_t length)
+{
+    if (hostUdpPcb == nullptr || hostUdpPcb->recv == nullptr)
+    {
+        return;
+    }
+    pbuf *packet = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+    memcpy(packet->payload, data, length);
+    hostUdpPcb->recv(hostUdpPcb->recvArg, hostUdpPcb, packet, IP_ADDR_ANY, 123);
+}
+
+#endif
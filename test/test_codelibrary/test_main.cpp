@@ -0,0 +1,192 @@
+/*
+ * Named code library (codelibrary.h) with 5000 codes on the LittleFS stub. Lookups binary search the index in the
+ * file, reported are the file reads and bytes per lookup, the host time of a lookup and the bytes a change rewrites.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <time.h>
+
+#include "codelibrary.h"
+
+const uint32_t CODES = 5000;
+const uint32_t LOOKUPS = 100000;
+const uint16_t TIMINGS_MAX = 300; // longest raw code of the test
+
+fs::FS flash;
+CodeLibrary *library;
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+uint64_t clockNanos()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// "room_3/device_42/key_42"
+uint8_t codeName(uint32_t number, char *name)
+{
+    return snprintf(name, CODE_NAME_SIZE, "room_%u/device_%u/key_%u", number % 13, number % 97, number);
+}
+
+// Every 50th code is raw
+irCode_t makeCode(uint32_t number)
+{
+    irCode_t code = {};
+    code.protocol = (number % 3 == 0) ? 8 : 15;
+    code.address = number & 0xFFFF;
+    code.command = (number * 7) & 0xFF;
+    code.repeats = number % 4;
+    if (number % 50 == 0)
+    {
+        code.khz = 38;
+        code.rawLength = 100 + number % 200;
+    }
+    return code;
+}
+
+uint16_t rawTiming(uint32_t number, uint16_t i)
+{
+    return 300 + (number + i) % 2000;
+}
+
+// The library of CODES codes, built once and copied for every test
+fs::FS *filled;
+
+void fill()
+{
+    fs::FS fs;
+    CodeLibrary builder;
+    builder.begin(fs);
+    uint16_t timings[TIMINGS_MAX];
+    char name[CODE_NAME_SIZE];
+    for (uint32_t number = 0; number < CODES; number++)
+    {
+        irCode_t code = makeCode(number);
+        for (uint16_t i = 0; i < code.rawLength; i++)
+        {
+            timings[i] = rawTiming(number, i);
+        }
+        TEST_ASSERT_TRUE(builder.store(name, codeName(number, name), code, timings));
+    }
+    filled = new fs::FS();
+    for (auto &file : fs.files)
+    {
+        filled->files[file.first] = std::make_shared<std::vector<uint8_t>>(*file.second);
+    }
+}
+
+void setUp()
+{
+    randomState = 1;
+    if (filled == nullptr)
+    {
+        fill();
+    }
+    flash = fs::FS();
+    for (auto &file : filled->files)
+    {
+        flash.files[file.first] = std::make_shared<std::vector<uint8_t>>(*file.second);
+    }
+    library = new CodeLibrary();
+    TEST_ASSERT_TRUE(library->begin(flash));
+}
+
+void tearDown()
+{
+    delete library;
+}
+
+// Every code is found with its values and raw timings, unknown names aren't
+void test_find_all()
+{
+    TEST_ASSERT_EQUAL_UINT32(CODES, library->count());
+    char name[CODE_NAME_SIZE];
+    uint16_t timings[TIMINGS_MAX];
+    for (uint32_t number = 0; number < CODES; number++)
+    {
+        irCode_t expected = makeCode(number);
+        irCode_t code;
+        TEST_ASSERT_TRUE(library->find(name, codeName(number, name), code, timings, TIMINGS_MAX));
+        TEST_ASSERT_EQUAL_MEMORY(&expected, &code, sizeof(code));
+        for (uint16_t i = 0; i < code.rawLength; i++)
+        {
+            TEST_ASSERT_EQUAL_UINT16(rawTiming(number, i), timings[i]);
+        }
+    }
+    irCode_t code;
+    TEST_ASSERT_FALSE(library->find("room_1/nothing", 14, code, timings, TIMINGS_MAX));
+    TEST_ASSERT_FALSE(library->find(name, codeName(CODES, name), code, timings, TIMINGS_MAX));
+}
+
+// File reads and time of random lookups
+void test_lookup_cost()
+{
+    char name[CODE_NAME_SIZE];
+    uint16_t timings[TIMINGS_MAX];
+    irCode_t code;
+    uint32_t maxReads = 0;
+    fs::hostFileReads = 0;
+    fs::hostFileReadBytes = 0;
+    uint64_t totalNanos = 0;
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        uint8_t length = codeName(nextRandom(CODES), name);
+        uint32_t reads = fs::hostFileReads;
+        uint64_t start = clockNanos();
+        TEST_ASSERT_TRUE(library->find(name, length, code, timings, TIMINGS_MAX));
+        totalNanos += clockNanos() - start;
+        maxReads = max(maxReads, fs::hostFileReads - reads);
+    }
+
+    char message[140];
+    snprintf(message, sizeof(message), "%u codes, %u bytes: %u reads (max %u) of %u bytes per lookup, %u ns", CODES,
+             (unsigned)flash.files[CODE_LIBRARY_PATH]->size(), fs::hostFileReads / LOOKUPS, maxReads,
+             (unsigned)(fs::hostFileReadBytes / LOOKUPS), (unsigned)(totalNanos / LOOKUPS));
+    TEST_MESSAGE(message);
+    // log2(5000) = 13 index reads, a few more for a hash run and the record
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(20, maxReads);
+}
+
+// A change rewrites the whole file once, a removed code is gone and the others stay
+void test_change_rewrites_file()
+{
+    char name[CODE_NAME_SIZE];
+    irCode_t code = makeCode(7);
+    code.command = 0x55;
+    uint32_t fileSize = flash.files[CODE_LIBRARY_PATH]->size();
+    fs::hostFileWriteBytes = 0;
+    uint64_t start = clockNanos();
+    TEST_ASSERT_TRUE(library->store(name, codeName(7, name), code, nullptr));
+    uint64_t storeNanos = clockNanos() - start;
+    uint64_t written = fs::hostFileWriteBytes;
+    TEST_ASSERT_EQUAL_UINT32(fileSize, written);
+    TEST_ASSERT_FALSE(flash.exists(CODE_LIBRARY_TEMP_PATH));
+
+    irCode_t found;
+    TEST_ASSERT_TRUE(library->find(name, codeName(7, name), found, nullptr, 0));
+    TEST_ASSERT_EQUAL_UINT16(0x55, found.command);
+    TEST_ASSERT_TRUE(library->remove(name, codeName(8, name)));
+    TEST_ASSERT_FALSE(library->find(name, codeName(8, name), found, nullptr, 0));
+    TEST_ASSERT_EQUAL_UINT32(CODES - 1, library->count());
+    TEST_ASSERT_TRUE(library->find(name, codeName(9, name), found, nullptr, 0));
+
+    char message[100];
+    snprintf(message, sizeof(message), "a change rewrites %u bytes in %u us", (unsigned)written, (unsigned)(storeNanos / 1000));
+    TEST_MESSAGE(message);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_find_all);
+    RUN_TEST(test_lookup_cost);
+    RUN_TEST(test_change_rewrites_file);
+    return UNITY_END();
+}
@@ -0,0 +1,253 @@
+/*
+ * Fuzz test of the payload parser (commandreader.h, ircommand.h): valid payloads of every form are mutated at
+ * random and parsed from a buffer without terminator, like the MQTT payload. Reports the host time per message and
+ * the stack used by a parse. Run with -fsanitize=address to also catch reads past the payload.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <time.h>
+
+#include "ircommand.h"
+
+const uint32_t MUTATIONS = 200000;
+const uint16_t PAYLOAD_MAX = 600;
+const size_t STACK_PAINT = 16384;
+const uint8_t STACK_COLOR = 0xA5;
+
+const char *const SEEDS[] = {
+    "{\"adr\":\"0x80\",\"cmd\":\"0x12\",\"rpt\":2}",
+    "{\n  \"proto\": \"Sony\",\n  \"adr\": \"1\",\n  \"cmd\": \"0x15\",\n  \"id\": \"tv-1\"\n}\n",
+    "80,12,1,200",
+    "[{\"name\":\"power\",\"emitter\":\"ir\"},{\"adr\":\"4\",\"cmd\":\"8\",\"dly\":500,\"at\":1767225600000}]",
+    "{\"adr\":\"80\",\"cmd\":\"12\"}\n80,13\n{\"name\":\"fan\"}\n",
+    "{\"raw\":[9000,4500,560,560,560,1690,560],\"khz\":38,\"skip\":{\"a\":[1,[2,{\"b\":null}]],\"c\":\"x\\\"y\"}}",
+    "{\"pronto\":\"0000 006D 0002 0000 0155 00AA 0015 0040\"}",
+    "{\"proto\":\"RC5\",\"adr\":\"0x1F\",\"cmd\":\"0x3F\",\"rpt\":255,\"id\":\"a.b:c_d\"}",
+};
+const uint8_t SEED_COUNT = sizeof(SEEDS) / sizeof(*SEEDS);
+
+// Characters that move the reader between its states
+const char ALPHABET[] = "{}[]\",:\\ \n0123456789xabcdefABCDEF-.trueflsn";
+
+uint32_t randomState;
+fs::FS flash;
+irBatch_t batch;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+uint64_t clockNanos()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// One random edit: change, insert or delete a character, cut the end or duplicate a part
+uint16_t mutate(char *payload, uint16_t length)
+{
+    uint16_t position = nextRandom(length + 1);
+    switch (nextRandom(5))
+    {
+    case 0:
+        if (position < length)
+            payload[position] = (nextRandom(4) == 0) ? (char)nextRandom(256) : ALPHABET[nextRandom(sizeof(ALPHABET) - 1)];
+        break;
+    case 1:
+        if (length < PAYLOAD_MAX)
+        {
+            memmove(payload + position + 1, payload + position, length - position);
+            payload[position] = ALPHABET[nextRandom(sizeof(ALPHABET) - 1)];
+            length++;
+        }
+        break;
+    case 2:
+        if (position < length)
+        {
+            memmove(payload + position, payload + position + 1, length - position - 1);
+            length--;
+        }
+        break;
+    case 3:
+        length = position;
+        break;
+    default:
+    {
+        uint16_t start = nextRandom(length + 1);
+        uint16_t size = min<uint16_t>(nextRandom(length - start + 1), PAYLOAD_MAX - length);
+        char part[PAYLOAD_MAX];
+        memcpy(part, payload + start, size);
+        memmove(payload + position + size, payload + position, length - position);
+        memcpy(payload + position, part, size);
+        length += size;
+        break;
+    }
+    }
+    return length;
+}
+
+// Parse like MQTTcallback. A rejected payload must not keep the raw frame, an accepted one releases it like after
+// its transmission.
+bool parse(const char *payload, uint16_t length)
+{
+    PGM_P error;
+    bool ok = parseBatch(payload, length, batch, error);
+    TEST_ASSERT_TRUE(ok || !irRawFrame.used);
+    if (ok)
+    {
+        irRawFrame.used = false;
+    }
+    return ok;
+}
+
+uintptr_t paintedStack; // lowest address of the painted stack, kept as a number since the frame is gone
+
+// Fill the stack below the caller with a pattern
+__attribute__((noinline)) void paintStack()
+{
+    volatile uint8_t area[STACK_PAINT];
+    for (size_t i = 0; i < STACK_PAINT; i++)
+    {
+        area[i] = STACK_COLOR;
+    }
+    paintedStack = (uintptr_t)area;
+}
+
+// Part of the painted stack overwritten since, read without a call that would overwrite it again
+inline __attribute__((always_inline)) size_t usedStack(const volatile uint8_t *painted)
+{
+    size_t untouched = 0;
+    while (untouched < STACK_PAINT && painted[untouched] == STACK_COLOR)
+    {
+        untouched++;
+    }
+    return STACK_PAINT - untouched;
+}
+
+void setUp()
+{
+    randomState = 1;
+    irRawFrame.used = false;
+}
+
+void tearDown() {}
+
+// Named codes for the seeds, one protocol and one raw code
+void test_seeds_parse()
+{
+    irCode_t power = {NEC, 0x80, 0x0C, 0, 0, 0, 0, 0};
+    irCode_t fan = {IR_PROTOCOL_RAW, 0, 0, 1, 38, 3, 0, 0};
+    uint16_t fanTimings[] = {1200, 400, 1200};
+    TEST_ASSERT_TRUE(codeLibrary.begin(flash) || codeLibrary.count() == 0);
+    TEST_ASSERT_TRUE(codeLibrary.store("power", 5, power, nullptr));
+    TEST_ASSERT_TRUE(codeLibrary.store("fan", 3, fan, fanTimings));
+
+    for (uint8_t i = 0; i < SEED_COUNT; i++)
+    {
+        TEST_ASSERT_TRUE_MESSAGE(parse(SEEDS[i], strlen(SEEDS[i])), SEEDS[i]);
+        for (uint8_t j = 0; j < batch.count; j++)
+        {
+            TEST_ASSERT_NULL_MESSAGE(batch.errors[j], SEEDS[i]);
+        }
+    }
+}
+
+// Every mutation terminates, results stay within the batch, the parser doesn't depend on a terminator
+void test_mutations()
+{
+    char payload[PAYLOAD_MAX];
+    uint16_t length = 0;
+    uint32_t accepted = 0;
+    uint64_t totalNanos = 0;
+    uint64_t totalBytes = 0;
+
+    for (uint32_t i = 0; i < MUTATIONS; i++)
+    {
+        // Start again from a seed now and then, else mutations pile up
+        if (i % 16 == 0)
+        {
+            const char *seed = SEEDS[nextRandom(SEED_COUNT)];
+            length = strlen(seed);
+            memcpy(payload, seed, length);
+        }
+        length = mutate(payload, length);
+
+        // Copy to the heap with the exact size, a read past the end is found by the address sanitizer
+        char *exact = (char *)malloc(max<uint16_t>(length, 1));
+        memcpy(exact, payload, length);
+        uint64_t start = clockNanos();
+        bool ok = parse(exact, length);
+        uint64_t time = clockNanos() - start;
+        free(exact);
+
+        TEST_ASSERT_LESS_OR_EQUAL_UINT8(IR_BATCH_SIZE, batch.count);
+        if (ok)
+        {
+            accepted++;
+            for (uint8_t j = 0; j < batch.count; j++)
+            {
+                TEST_ASSERT_TRUE(batch.errors[j] != nullptr || batch.commands[j].emitter < irEmitters.size());
+                TEST_ASSERT_TRUE(batch.errors[j] != nullptr || batch.commands[j].id[IR_COMMAND_ID_SIZE - 1] == '\0');
+            }
+        }
+        totalNanos += time;
+        totalBytes += length;
+    }
+
+    char message[120];
+    snprintf(message, sizeof(message), "%u payloads, %u accepted, avg %u bytes, %u ns/message", (unsigned)MUTATIONS, (unsigned)accepted,
+             (unsigned)(totalBytes / MUTATIONS), (unsigned)(totalNanos / MUTATIONS));
+    TEST_MESSAGE(message);
+}
+
+// Deepest nesting, longest arrays and a full raw frame: the stack of a parse stays below the 4 KB of loop()
+void test_stack_use()
+{
+    char payload[4096];
+    const char *deep = "{\"skip\":[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]}";
+    size_t maxStack = 0;
+
+    int length = snprintf(payload, sizeof(payload), "%s", deep);
+    paintStack();
+    parse(payload, length);
+    maxStack = max(maxStack, usedStack((const volatile uint8_t *)paintedStack));
+
+    length = snprintf(payload, sizeof(payload), "[");
+    for (uint8_t i = 0; i < IR_BATCH_SIZE; i++)
+    {
+        length += snprintf(payload + length, sizeof(payload) - length, "%s{\"proto\":\"RC6\",\"adr\":\"%x\",\"cmd\":\"1\",\"id\":\"c%u\"}",
+                           i > 0 ? "," : "", i, i);
+    }
+    length += snprintf(payload + length, sizeof(payload) - length, "]");
+    paintStack();
+    TEST_ASSERT_TRUE(parse(payload, length));
+    maxStack = max(maxStack, usedStack((const volatile uint8_t *)paintedStack));
+
+    length = snprintf(payload, sizeof(payload), "{\"raw\":[");
+    while (length < (int)sizeof(payload) - 16)
+    {
+        length += snprintf(payload + length, sizeof(payload) - length, "560,");
+    }
+    payload[length - 1] = ']';
+    length += snprintf(payload + length, sizeof(payload) - length, "}");
+    paintStack();
+    TEST_ASSERT_TRUE(parse(payload, length));
+    maxStack = max(maxStack, usedStack((const volatile uint8_t *)paintedStack));
+
+    char message[60];
+    snprintf(message, sizeof(message), "max. stack of a parse %u bytes", (unsigned)maxStack);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN_UINT32(4096, maxStack);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_seeds_parse);
+    RUN_TEST(test_mutations);
+    RUN_TEST(test_stack_use);
+    return UNITY_END();
+}
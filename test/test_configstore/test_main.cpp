@@ -0,0 +1,318 @@
+/*
+ * Config store (configstore.h) against a simulated flash: NOR semantics (erase to 0xFF, writes only clear bits) and
+ * a power loss after any number of written words, which may leave the last word half written. After every power
+ * loss the store is opened again like after a reboot and must hold the old or the new value of every key.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "configstore.h"
+
+const uint32_t FIRST_SECTOR = 10;
+const uint8_t SECTORS = 4; // see CONFIG_STORE_SECTORS
+const uint16_t KEYS = 12;
+
+class SimulatedFlash
+{
+public:
+    SimulatedFlash() { memset(data, 0xFF, sizeof(data)); }
+
+    bool read(uint32_t address, uint32_t *buffer, size_t size)
+    {
+        if (!inRange(address, size) || poweredOff)
+        {
+            return false;
+        }
+        memcpy(buffer, data + (address - FIRST_SECTOR * CONFIG_STORE_SECTOR_SIZE), size);
+        return true;
+    }
+
+    bool write(uint32_t address, const uint32_t *buffer, size_t size)
+    {
+        if (!inRange(address, size) || poweredOff)
+        {
+            return false;
+        }
+        uint32_t *words = (uint32_t *)(data + (address - FIRST_SECTOR * CONFIG_STORE_SECTOR_SIZE));
+        for (size_t i = 0; i < size / 4; i++)
+        {
+            if (!spend())
+            {
+                words[i] &= buffer[i] | tornBits; // half written word
+                return false;
+            }
+            words[i] &= buffer[i];
+        }
+        return true;
+    }
+
+    bool erase(uint32_t sector)
+    {
+        if (sector < FIRST_SECTOR || sector >= FIRST_SECTOR + SECTORS || poweredOff)
+        {
+            return false;
+        }
+        uint8_t *start = data + (sector - FIRST_SECTOR) * CONFIG_STORE_SECTOR_SIZE;
+        erases[sector - FIRST_SECTOR]++;
+        if (!spend())
+        {
+            memset(start, 0xFF, CONFIG_STORE_SECTOR_SIZE / 2); // erase stopped half way
+            return false;
+        }
+        memset(start, 0xFF, CONFIG_STORE_SECTOR_SIZE);
+        return true;
+    }
+
+    // Power loss after words more written words (an erase counts as one), -1: never
+    void powerLossAfter(int32_t words, uint32_t bits)
+    {
+        budget = words;
+        tornBits = bits;
+        poweredOff = false;
+    }
+
+    uint8_t data[SECTORS * CONFIG_STORE_SECTOR_SIZE];
+    uint32_t erases[SECTORS] = {};
+    bool poweredOff = false;
+
+private:
+    bool inRange(uint32_t address, size_t size) const
+    {
+        return address >= FIRST_SECTOR * CONFIG_STORE_SECTOR_SIZE && address + size <= (FIRST_SECTOR + SECTORS) * CONFIG_STORE_SECTOR_SIZE &&
+               address % 4 == 0 && size % 4 == 0;
+    }
+
+    bool spend()
+    {
+        if (budget < 0)
+        {
+            return true;
+        }
+        if (budget == 0)
+        {
+            poweredOff = true;
+            return false;
+        }
+        budget--;
+        return true;
+    }
+
+    int32_t budget = -1;
+    uint32_t tornBits = 0;
+};
+
+// Expected content: the value of every key, size 0 if never written
+typedef struct
+{
+    uint8_t value[CONFIG_STORE_MAX_VALUE];
+    uint16_t size;
+} keyValue_t;
+
+SimulatedFlash *flash;
+keyValue_t committed[KEYS];
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+// Fields of different sizes like configData_t, a new value every time
+uint16_t makeValue(uint16_t key, uint8_t *value)
+{
+    uint16_t size = (key % 4 == 0) ? CONFIG_STORE_MAX_VALUE : 1 + key * 3;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        value[i] = nextRandom(256);
+    }
+    return size;
+}
+
+bool holds(ConfigStore<SimulatedFlash> &store, uint16_t key, const keyValue_t &expected)
+{
+    uint8_t value[CONFIG_STORE_MAX_VALUE];
+    if (expected.size == 0)
+    {
+        return !store.read(key, value, 1 + key * 3) && !store.read(key, value, CONFIG_STORE_MAX_VALUE);
+    }
+    return store.read(key, value, expected.size) && memcmp(value, expected.value, expected.size) == 0;
+}
+
+void setUp()
+{
+    flash = new SimulatedFlash();
+    memset(committed, 0, sizeof(committed));
+    randomState = 1;
+}
+
+void tearDown()
+{
+    delete flash;
+}
+
+// Written values are read back, also after a reboot. A changed field only appends its own record.
+void test_write_and_reopen()
+{
+    ConfigStore<SimulatedFlash> store(*flash, FIRST_SECTOR, SECTORS);
+    TEST_ASSERT_FALSE(store.begin());
+    for (uint16_t key = 0; key < KEYS; key++)
+    {
+        committed[key].size = makeValue(key, committed[key].value);
+        TEST_ASSERT_TRUE(store.write(key, committed[key].value, committed[key].size));
+    }
+    uint32_t used = store.used();
+    committed[5].size = makeValue(5, committed[5].value);
+    TEST_ASSERT_TRUE(store.write(5, committed[5].value, committed[5].size));
+    TEST_ASSERT_EQUAL_UINT32(used + sizeof(configRecordHeader_t) + ((committed[5].size + 3) & ~3), store.used());
+
+    ConfigStore<SimulatedFlash> reopened(*flash, FIRST_SECTOR, SECTORS);
+    TEST_ASSERT_TRUE(reopened.begin());
+    for (uint16_t key = 0; key < KEYS; key++)
+    {
+        TEST_ASSERT_TRUE(holds(reopened, key, committed[key]));
+    }
+    uint8_t value[4];
+    TEST_ASSERT_FALSE(reopened.read(1, value, 3)); // size differs
+    TEST_ASSERT_FALSE(reopened.read(KEYS, value, 4));
+}
+
+// 10000 updates rotate through all sectors with even wear, every rotation keeps all keys
+void test_rotation_levels_wear()
+{
+    ConfigStore<SimulatedFlash> store(*flash, FIRST_SECTOR, SECTORS);
+    store.begin();
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        uint16_t key = nextRandom(KEYS);
+        committed[key].size = makeValue(key, committed[key].value);
+        TEST_ASSERT_TRUE(store.write(key, committed[key].value, committed[key].size));
+    }
+    for (uint16_t key = 0; key < KEYS; key++)
+    {
+        TEST_ASSERT_TRUE(holds(store, key, committed[key]));
+    }
+
+    uint32_t minErases = UINT32_MAX;
+    uint32_t maxErases = 0;
+    for (uint8_t i = 0; i < SECTORS; i++)
+    {
+        minErases = min(minErases, flash->erases[i]);
+        maxErases = max(maxErases, flash->erases[i]);
+    }
+    char message[80];
+    snprintf(message, sizeof(message), "%u rotations, erases per sector %u-%u", store.rotations(), minErases, maxErases);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN_UINT32(100, store.rotations());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, maxErases - minErases);
+
+    ConfigStore<SimulatedFlash> reopened(*flash, FIRST_SECTOR, SECTORS);
+    TEST_ASSERT_TRUE(reopened.begin());
+    TEST_ASSERT_EQUAL_UINT32(store.rotations(), reopened.rotations());
+}
+
+// Power loss after every possible number of words over a run of updates that includes rotations
+void test_power_loss_at_every_word()
+{
+    uint32_t losses = 0;
+    uint32_t inRotation = 0;
+    uint32_t newValues = 0;
+    for (int32_t cut = 0; cut < 1500; cut++)
+    {
+        delete flash;
+        flash = new SimulatedFlash();
+        memset(committed, 0, sizeof(committed));
+        randomState = 7;
+
+        // Fill the store until a rotation is near, then lose power somewhere in the following writes
+        ConfigStore<SimulatedFlash> store(*flash, FIRST_SECTOR, SECTORS);
+        store.begin();
+        for (uint32_t i = 0; i < 150; i++)
+        {
+            uint16_t key = nextRandom(KEYS);
+            committed[key].size = makeValue(key, committed[key].value);
+            TEST_ASSERT_TRUE(store.write(key, committed[key].value, committed[key].size));
+        }
+        flash->powerLossAfter(cut, (cut % 3 == 0) ? 0 : nextRandom(0x10000) << (cut % 17));
+
+        uint16_t key = 0;
+        keyValue_t pending = {};
+        while (true)
+        {
+            key = nextRandom(KEYS);
+            pending.size = makeValue(key, pending.value);
+            if (!store.write(key, pending.value, pending.size))
+            {
+                break;
+            }
+            committed[key] = pending;
+        }
+        TEST_ASSERT_TRUE(flash->poweredOff);
+        losses++;
+        inRotation += (store.used() + sizeof(configRecordHeader_t) + ((pending.size + 3) & ~3) > CONFIG_STORE_SECTOR_SIZE) ? 1 : 0;
+
+        // Reboot: every key holds its committed value, the interrupted one may also hold the new value
+        flash->powerLossAfter(-1, 0);
+        ConfigStore<SimulatedFlash> reopened(*flash, FIRST_SECTOR, SECTORS);
+        TEST_ASSERT_TRUE(reopened.begin());
+        for (uint16_t k = 0; k < KEYS; k++)
+        {
+            bool ok = holds(reopened, k, committed[k]);
+            if (!ok && k == key && holds(reopened, k, pending))
+            {
+                ok = true;
+                newValues++;
+            }
+            if (!ok)
+            {
+                char message[60];
+                snprintf(message, sizeof(message), "key %u lost after power loss at word %d", k, (int)cut);
+                TEST_FAIL_MESSAGE(message);
+            }
+        }
+
+        // The store keeps working, also through the next rotations
+        for (uint32_t i = 0; i < 150; i++)
+        {
+            uint16_t k = nextRandom(KEYS);
+            committed[k].size = makeValue(k, committed[k].value);
+            TEST_ASSERT_TRUE(reopened.write(k, committed[k].value, committed[k].size));
+        }
+        for (uint16_t k = 0; k < KEYS; k++)
+        {
+            TEST_ASSERT_TRUE(holds(reopened, k, committed[k]));
+        }
+    }
+    char message[100];
+    snprintf(message, sizeof(message), "%u power losses, %u during a rotation, %u kept the interrupted write", losses, inRotation, newValues);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN_UINT32(100, inRotation);
+}
+
+// A record damaged later (bit flips) is skipped, the previous value of its key is used
+void test_damaged_record_skipped()
+{
+    ConfigStore<SimulatedFlash> store(*flash, FIRST_SECTOR, SECTORS);
+    keyValue_t old;
+    old.size = makeValue(2, old.value);
+    TEST_ASSERT_TRUE(store.write(2, old.value, old.size));
+    uint32_t offset = store.used();
+    committed[2].size = makeValue(2, committed[2].value);
+    TEST_ASSERT_TRUE(store.write(2, committed[2].value, committed[2].size));
+    TEST_ASSERT_TRUE(holds(store, 2, committed[2]));
+
+    flash->data[offset + sizeof(configRecordHeader_t)] ^= 0x01;
+    ConfigStore<SimulatedFlash> reopened(*flash, FIRST_SECTOR, SECTORS);
+    TEST_ASSERT_TRUE(reopened.begin());
+    TEST_ASSERT_TRUE(holds(reopened, 2, old));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_write_and_reopen);
+    RUN_TEST(test_rotation_levels_wear);
+    RUN_TEST(test_power_loss_at_every_word);
+    RUN_TEST(test_damaged_record_skipped);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+/*
+ * Chunked page writer (htmlwriter.h) against the recording web server of test/stubs/ESP8266WebServer.h. The heap is
+ * tracked through operator new and shown by ESP.getFreeHeap(), so the heap use the writer logs per request is the
+ * one measured here.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "htmlwriter.h"
+
+const size_t BUFFER_SIZE = 256; // see HTML_BUFFER_SIZE
+
+// Style sheet and menu are PROGMEM fragments larger than the buffer
+const char PAGE_HEADER[] PROGMEM =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><meta name=\"viewport\" content=\"width=device-width\">"
+    "<link rel=\"stylesheet\" href=\"/style.css\"><title>IRBridge</title></head><body><nav><a href=\"/\">Info</a>"
+    "<a href=\"/send\">Send</a><a href=\"/settings\">Settings</a><a href=\"/fwupdate\">Update</a>"
+    "<a href=\"/reboot\">Reboot</a></nav><main>";
+
+ESP8266WebServer server;
+HTMLWriter<BUFFER_SIZE> *writer;
+uint32_t idleCalls;
+
+void *operator new(size_t size)
+{
+    size_t *block = (size_t *)malloc(sizeof(size_t) + size);
+    *block = size;
+    ESP.freeHeap -= size;
+    return block + 1;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr)
+    {
+        size_t *block = (size_t *)p - 1;
+        ESP.freeHeap += *block;
+        free(block);
+    }
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+// Collects a page like the writer, to compare with what was sent
+class ExpectedPage
+{
+public:
+    ExpectedPage &operator+=(const __FlashStringHelper *text) { return *this += reinterpret_cast<const char *>(text); }
+    ExpectedPage &operator+=(const char *text)
+    {
+        body += text;
+        return *this;
+    }
+    ExpectedPage &operator+=(const String &text) { return *this += text.c_str(); }
+    ExpectedPage &operator+=(unsigned long number)
+    {
+        body += std::to_string(number);
+        return *this;
+    }
+
+    std::string body;
+};
+
+// Settings-like page: a form row per field, text inputs with values and numbers
+template <class Page>
+void renderPage(Page &page, uint16_t rows)
+{
+    page += PAGE_HEADER;
+    page += F("<h1>Settings</h1><form method=\"post\" action=\"/settings\"><table>");
+    for (uint16_t i = 0; i < rows; i++)
+    {
+        page += F("<tr><td><label for=\"f");
+        page += (unsigned long)i;
+        page += F("\">Field ");
+        page += (unsigned long)i;
+        page += F("</label></td><td><input type=\"text\" id=\"f");
+        page += (unsigned long)i;
+        page += F("\" name=\"f");
+        page += (unsigned long)i;
+        page += F("\" maxlength=\"32\" value=\"");
+        page += String("livingroom-irbridge"); // a temporary on the heap, like an address from toString()
+        page += F("\"></td></tr>");
+    }
+    page += F("</table><input type=\"submit\" value=\"Save\"></form></main></body></html>");
+}
+
+void setUp()
+{
+    server = ESP8266WebServer();
+    server.path = "/settings";
+    // Room for the recorded response, so recording doesn't count as heap of the request
+    server.body.reserve(100000);
+    server.chunks.reserve(1000);
+    writer = new HTMLWriter<BUFFER_SIZE>(server);
+    writer->setIdleHandler([]() { idleCalls++; });
+    idleCalls = 0;
+}
+
+void tearDown()
+{
+    delete writer;
+}
+
+// Pages go out in chunks of the buffer size, in order, and the idle handler runs after every chunk
+void test_chunks()
+{
+    ExpectedPage expected;
+    renderPage(expected, 30);
+
+    writer->begin(200);
+    renderPage(*writer, 30);
+    writer->end();
+
+    TEST_ASSERT_TRUE(server.finished);
+    TEST_ASSERT_EQUAL_INT(200, server.code);
+    TEST_ASSERT_EQUAL_STRING("text/html", server.contentType.c_str());
+    TEST_ASSERT_EQUAL_UINT32(CONTENT_LENGTH_UNKNOWN, server.contentLength);
+    TEST_ASSERT_EQUAL_STRING(expected.body.c_str(), server.body.c_str());
+    TEST_ASSERT_EQUAL_UINT32(server.chunks.size(), idleCalls);
+    TEST_ASSERT_EQUAL_UINT32(strlen(PAGE_HEADER), server.chunks[0]); // sent from flash directly
+    for (size_t i = 1; i + 1 < server.chunks.size(); i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(BUFFER_SIZE, server.chunks[i]);
+    }
+}
+
+// JSON strings are quoted and escaped
+void test_json_string()
+{
+    writer->begin(200, "application/json");
+    writer->jsonString("tv \"living\"\\room\n\x01");
+    writer->end();
+    TEST_ASSERT_EQUAL_STRING("\"tv \\\"living\\\"\\\\room\\u000a\\u0001\"", server.body.c_str());
+}
+
+// The heap a request needs doesn't grow with the page: the writer allocates nothing, only the String temporaries
+void test_heap_per_request()
+{
+    char message[160];
+    size_t sizes[2];
+    uint32_t heapUsed[2];
+    uint16_t rows[] = {20, 400};
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        writer->begin(200);
+        renderPage(*writer, rows[i]);
+        writer->end();
+        sizes[i] = server.body.size();
+        heapUsed[i] = writer->heapUsed();
+    }
+
+    snprintf(message, sizeof(message), "pages of %u and %u bytes: max. heap used %u and %u bytes, writer %u bytes static",
+             (unsigned)sizes[0], (unsigned)sizes[1], heapUsed[0], heapUsed[1], (unsigned)sizeof(HTMLWriter<BUFFER_SIZE>));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN_UINT32(40000, sizes[1]);
+    TEST_ASSERT_EQUAL_UINT32(heapUsed[0], heapUsed[1]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(32, heapUsed[1]);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_chunks);
+    RUN_TEST(test_json_string);
+    RUN_TEST(test_heap_per_request);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+/*
+ * LRU cache of expanded frames (ircache.h), used like handleEmitterTransmit(): a hit is replayed as is, a miss is
+ * encoded into the entry. Reports the host time of an encode against a lookup and the hit rate of scene workloads.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <time.h>
+
+#include <IRremote.hpp> // NEC
+
+#include "ircache.h"
+
+const uint32_t BENCHMARK_FRAMES = 1000000;
+
+typedef struct
+{
+    uint16_t address;
+    uint16_t command;
+} code_t;
+
+uint32_t randomState;
+IRFrameCache *cache;
+volatile uint32_t sink; // keeps the benchmark loops from being optimized away
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+uint64_t clockNanos()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Frame of a command like handleEmitterTransmit()
+const irFrame_t &frameOf(const code_t &code)
+{
+    irFrame_t *frame = cache->get(NEC, code.address, code.command);
+    if (frame == nullptr)
+    {
+        frame = cache->insert(NEC, code.address, code.command);
+        encodeNEC(*frame, code.address, code.command);
+    }
+    return *frame;
+}
+
+// Codes of a home: 8 bit addresses of a few devices, 8 and 16 bit commands
+void makeCodes(code_t *codes, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        codes[i].address = (i % 5 == 0) ? 0x7F00 + i : 0x04 + i % 4;
+        codes[i].command = (i % 7 == 0) ? 0x1000 + i : i;
+    }
+}
+
+void setUp()
+{
+    randomState = 1;
+    cache = new IRFrameCache();
+}
+
+void tearDown()
+{
+    delete cache;
+}
+
+// A replayed frame is the frame encodeNEC() would give, also after its entry was reused for another code
+void test_hits_replay_the_encoded_frame()
+{
+    code_t codes[40];
+    makeCodes(codes, 40);
+    irFrame_t expected;
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        const code_t &code = codes[nextRandom(40)];
+        const irFrame_t &frame = frameOf(code);
+        encodeNEC(expected, code.address, code.command);
+        TEST_ASSERT_EQUAL_UINT16(expected.length, frame.length);
+        TEST_ASSERT_EQUAL_UINT8(expected.khz, frame.khz);
+        TEST_ASSERT_EQUAL_MEMORY(expected.timings, frame.timings, expected.length * sizeof(uint16_t));
+    }
+    TEST_ASSERT_EQUAL_UINT32(20000, cache->hits() + cache->misses());
+    TEST_ASSERT_EQUAL_UINT32(cache->misses() - IR_CACHE_SIZE, cache->evictions());
+}
+
+// The least recently used entry is reused, a used entry stays
+void test_least_recently_used_is_evicted()
+{
+    code_t codes[IR_CACHE_SIZE + 1];
+    makeCodes(codes, IR_CACHE_SIZE + 1);
+    for (uint8_t i = 0; i < IR_CACHE_SIZE; i++)
+    {
+        frameOf(codes[i]);
+    }
+    frameOf(codes[0]); // 1 is the oldest now
+    frameOf(codes[IR_CACHE_SIZE]);
+    TEST_ASSERT_EQUAL_UINT32(1, cache->evictions());
+    TEST_ASSERT_NOT_NULL(cache->get(NEC, codes[0].address, codes[0].command));
+    TEST_ASSERT_NULL(cache->get(NEC, codes[1].address, codes[1].command));
+    TEST_ASSERT_NOT_NULL(cache->get(NEC, codes[2].address, codes[2].command));
+}
+
+// Time of an encode against a lookup, and hit rates of scenes that repeat
+void test_encode_against_replay()
+{
+    code_t codes[30];
+    makeCodes(codes, 30);
+    irFrame_t frame;
+
+    uint64_t start = clockNanos();
+    for (uint32_t i = 0; i < BENCHMARK_FRAMES; i++)
+    {
+        const code_t &code = codes[i % 12];
+        encodeNEC(frame, code.address, code.command);
+        sink += frame.timings[2 + i % 64];
+    }
+    uint64_t encodeNanos = clockNanos() - start;
+
+    start = clockNanos();
+    for (uint32_t i = 0; i < BENCHMARK_FRAMES; i++)
+    {
+        sink += frameOf(codes[i % 12]).timings[2 + i % 64];
+    }
+    uint64_t replayNanos = clockNanos() - start;
+    TEST_ASSERT_EQUAL_UINT32(12, cache->misses());
+
+    // A scene of 12 codes fits, a scene of 30 codes cycles through the cache and always misses
+    delete cache;
+    cache = new IRFrameCache();
+    for (uint32_t i = 0; i < 30 * 100; i++)
+    {
+        frameOf(codes[i % 30]);
+    }
+    uint32_t cyclicHits = cache->hits();
+
+    // Scenes of 5-10 codes out of 30, three quarters of them from the 10 most used ones (power, inputs, volume)
+    delete cache;
+    cache = new IRFrameCache();
+    for (uint32_t scene = 0; scene < 1000; scene++)
+    {
+        uint8_t size = 5 + nextRandom(6);
+        for (uint8_t i = 0; i < size; i++)
+        {
+            frameOf(codes[nextRandom(4) == 0 ? nextRandom(30) : nextRandom(10)]);
+        }
+    }
+    uint32_t mixedRate = cache->hits() * 100 / (cache->hits() + cache->misses());
+
+    char message[160];
+    snprintf(message, sizeof(message), "encode %u ns/frame, cached %u ns/frame; hits: 12 code scene %u%%, 30 code scene %u%%, mixed scenes %u%%",
+             (unsigned)(encodeNanos / BENCHMARK_FRAMES), (unsigned)(replayNanos / BENCHMARK_FRAMES),
+             (unsigned)((BENCHMARK_FRAMES - 12) * 100 / BENCHMARK_FRAMES), (unsigned)(cyclicHits * 100 / 3000), (unsigned)mixedRate);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN_UINT64(encodeNanos, replayNanos);
+    TEST_ASSERT_EQUAL_UINT32(0, cyclicHits);
+    TEST_ASSERT_GREATER_THAN_UINT32(70, mixedRate);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hits_replay_the_encoded_frame);
+    RUN_TEST(test_least_recently_used_is_evicted);
+    RUN_TEST(test_encode_against_replay);
+    return UNITY_END();
+}
@@ -0,0 +1,249 @@
+/*
+ * Coalescing of repeated NEC commands and the rate limit per target (ircoalesce.h). A UI sending the same command
+ * every 25 ms (a held volume button) goes through queue and transmit like queueIR() and handleEmitterTransmit(),
+ * reported are the frames sent, their airtime and the commands dropped, without and with both.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include <IRremote.hpp> // NEC
+
+#include "ircoalesce.h"
+
+const uint8_t BURST_COMMANDS = 40;
+const unsigned long BURST_INTERVAL = 25;                     // ms
+const unsigned long FRAME_PERIOD = NEC_REPEAT_PERIOD / 1000; // start to start in ms, see IR_FRAME_PERIOD
+
+typedef struct
+{
+    uint32_t fullFrames;
+    uint32_t repeatFrames;
+    uint32_t airtime; // in us
+    uint32_t dropped;
+    uint32_t limited;
+    uint32_t coalesced;
+} burstResult_t;
+
+irFrame_t repeatFrame;
+
+// Transmit state of the emitter, see irEmitterState_t
+IRQueue *queue;
+irCommand_t current;
+bool active;
+uint8_t repeatsLeft;
+unsigned long lastFrameTime;
+
+irCommand_t makeCommand(uint16_t address, uint16_t command)
+{
+    irCommand_t queued = {};
+    queued.protocol = NEC;
+    queued.address = address;
+    queued.command = command;
+    return queued;
+}
+
+// Like coalesceIR(): into the newest queued command, or into the command in transmission while its next frame isn't due
+bool coalesce(const irCommand_t &command)
+{
+    irCommand_t *newest = queue->newest([&command](const irCommand_t &queued) { return queued.emitter == command.emitter; });
+    if (newest != nullptr)
+    {
+        return coalesceCommand(*newest, command);
+    }
+    if (lastFrameTime == 0 || (!active && (millis() - lastFrameTime) >= FRAME_PERIOD))
+    {
+        return false;
+    }
+    uint8_t repeats = current.repeats;
+    if (!coalesceCommand(current, command))
+    {
+        return false;
+    }
+    repeatsLeft += current.repeats - repeats;
+    active = true;
+    return true;
+}
+
+// One frame per frame period, repeat frames of the active command first, like handleEmitterTransmit()
+void transmit(burstResult_t &result)
+{
+    if (lastFrameTime != 0 && (millis() - lastFrameTime) < FRAME_PERIOD)
+    {
+        return;
+    }
+    if (active && repeatsLeft > 0)
+    {
+        repeatsLeft--;
+        result.repeatFrames++;
+        result.airtime += frameDuration(repeatFrame);
+        lastFrameTime = millis();
+        return;
+    }
+    active = false;
+    if (!queue->pop(current))
+    {
+        return;
+    }
+    result.fullFrames++;
+    result.airtime += frameDurationNEC(current.address, current.command);
+    repeatsLeft = current.repeats;
+    active = true;
+    lastFrameTime = millis();
+}
+
+// The burst, then transmit until all is sent
+burstResult_t runBurst(bool coalescing, bool rateLimit)
+{
+    burstResult_t result = {};
+    IRRateLimiter limiter;
+    queue = new IRQueue();
+    active = false;
+    repeatsLeft = 0;
+    lastFrameTime = 0;
+
+    unsigned long begin = millis();
+    uint8_t received = 0;
+    while (received < BURST_COMMANDS || queue->depth() > 0 || (active && repeatsLeft > 0))
+    {
+        if (received < BURST_COMMANDS && millis() - begin >= received * BURST_INTERVAL)
+        {
+            irCommand_t command = makeCommand(0x04, 0x02);
+            received++;
+            if (rateLimit && !limiter.take(command.emitter, command.address, millis()))
+            {
+                continue;
+            }
+            if (coalescing && coalesce(command))
+            {
+                result.coalesced++;
+            }
+            else
+            {
+                queue->push(command);
+            }
+        }
+        transmit(result);
+        delay(1);
+    }
+    result.dropped = queue->dropped();
+    result.limited = limiter.limited();
+    delete queue;
+    return result;
+}
+
+void setUp()
+{
+    hostNanos = 1000000000;
+    encodeNECRepeat(repeatFrame);
+}
+
+void tearDown() {}
+
+// Only the same NEC code on the same emitter is merged, not over a delay and not two ids
+void test_coalesce_rules()
+{
+    irCommand_t target = makeCommand(0x04, 0x02);
+    irCommand_t command = makeCommand(0x04, 0x02);
+    command.repeats = 2;
+    TEST_ASSERT_TRUE(coalesceCommand(target, command));
+    TEST_ASSERT_EQUAL_UINT8(3, target.repeats);
+
+    irCommand_t other = makeCommand(0x04, 0x03);
+    TEST_ASSERT_FALSE(coalesceCommand(target, other));
+    other = makeCommand(0x04, 0x02);
+    other.emitter = 1;
+    TEST_ASSERT_FALSE(coalesceCommand(target, other));
+    other = makeCommand(0x04, 0x02);
+    other.protocol = NEC + 1;
+    TEST_ASSERT_FALSE(coalesceCommand(target, other));
+
+    // The id moves to the merged command, a second one isn't merged
+    other = makeCommand(0x04, 0x02);
+    strcpy(other.id, "a1");
+    TEST_ASSERT_TRUE(coalesceCommand(target, other));
+    TEST_ASSERT_EQUAL_STRING("a1", target.id);
+    strcpy(other.id, "a2");
+    TEST_ASSERT_FALSE(coalesceCommand(target, other));
+
+    // A delay of the target would come between the frames, the delay of the command is kept
+    other = makeCommand(0x04, 0x02);
+    other.delay = 500;
+    TEST_ASSERT_TRUE(coalesceCommand(target, other));
+    TEST_ASSERT_EQUAL_UINT16(500, target.delay);
+    TEST_ASSERT_FALSE(coalesceCommand(target, makeCommand(0x04, 0x02)));
+
+    // Repeats don't overflow
+    target = makeCommand(0x04, 0x02);
+    target.repeats = 250;
+    command.repeats = 5;
+    TEST_ASSERT_FALSE(coalesceCommand(target, command));
+}
+
+// Bursts of IR_RATE_BURST, then IR_RATE_PER_SECOND per target, other targets aren't affected
+void test_rate_limit()
+{
+    IRRateLimiter limiter;
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < IR_RATE_BURST; i++)
+    {
+        TEST_ASSERT_TRUE(limiter.take(0, 0x04, now));
+    }
+    TEST_ASSERT_FALSE(limiter.take(0, 0x04, now));
+    TEST_ASSERT_TRUE(limiter.take(0, 0x05, now));
+    TEST_ASSERT_TRUE(limiter.take(1, 0x04, now));
+    TEST_ASSERT_TRUE(limiter.take(0, 0x04, now + 1000 / IR_RATE_PER_SECOND));
+    TEST_ASSERT_FALSE(limiter.take(0, 0x04, now + 1000 / IR_RATE_PER_SECOND));
+
+    // More targets than buckets: the fullest bucket is reused, the limited target keeps its bucket
+    for (uint16_t address = 0x10; address < 0x10 + 2 * IR_RATE_BUCKETS; address++)
+    {
+        TEST_ASSERT_TRUE(limiter.take(0, address, now + 1000 / IR_RATE_PER_SECOND));
+    }
+    TEST_ASSERT_FALSE(limiter.take(0, 0x04, now + 1000 / IR_RATE_PER_SECOND));
+    TEST_ASSERT_EQUAL_UINT32(3, limiter.limited());
+}
+
+// Frames, airtime and drops of the burst without and with coalescing and rate limit
+void test_burst_airtime()
+{
+    burstResult_t plain = runBurst(false, false);
+    burstResult_t coalesced = runBurst(true, false);
+    burstResult_t limited = runBurst(true, true);
+
+    char message[120];
+    const char *names[] = {"queue only", "coalescing", "coalescing and rate limit"};
+    burstResult_t *results[] = {&plain, &coalesced, &limited};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        burstResult_t &result = *results[i];
+        snprintf(message, sizeof(message), "%s: %u full and %u repeat frames, %u ms airtime, %u dropped, %u limited", names[i],
+                 result.fullFrames, result.repeatFrames, result.airtime / 1000, result.dropped, result.limited);
+        TEST_MESSAGE(message);
+    }
+
+    // Without coalescing the queue overflows, every command that fits is a full frame
+    TEST_ASSERT_EQUAL_UINT32(BURST_COMMANDS, plain.fullFrames + plain.dropped);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, plain.dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, plain.repeatFrames);
+
+    // Coalesced, every command is sent: one full frame, the rest as repeat frames
+    TEST_ASSERT_EQUAL_UINT32(0, coalesced.dropped);
+    TEST_ASSERT_EQUAL_UINT32(1, coalesced.fullFrames);
+    TEST_ASSERT_EQUAL_UINT32(BURST_COMMANDS - 1, coalesced.repeatFrames);
+    TEST_ASSERT_EQUAL_UINT32(BURST_COMMANDS - 1, coalesced.coalesced);
+    TEST_ASSERT_LESS_THAN_UINT32(plain.airtime / 2, coalesced.airtime);
+
+    // The limit drops what exceeds the rate before it is queued
+    TEST_ASSERT_EQUAL_UINT32(BURST_COMMANDS, limited.fullFrames + limited.repeatFrames + limited.limited);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(IR_RATE_BURST, limited.fullFrames + limited.repeatFrames);
+    TEST_ASSERT_LESS_THAN_UINT32(coalesced.airtime, limited.airtime);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_coalesce_rules);
+    RUN_TEST(test_rate_limit);
+    RUN_TEST(test_burst_airtime);
+    return UNITY_END();
+}
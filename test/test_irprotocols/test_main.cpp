@@ -0,0 +1,390 @@
+/*
+ * Round trip of every enabled protocol (irprotocols.h) through the bundled IRremote library: a parsed command goes
+ * through the dispatch table to the library encoder, the carrier it switches (test/stubs/core_esp8266_waveform.h) is
+ * recorded as marks and spaces and decoded by IrReceiver. The NEC frames of the timer1 player are decoded the same way.
+ */
+#define HOST_IRREMOTE_LIBRARY
+#include <Arduino.h>
+#include <unity.h>
+
+#include <core_esp8266_waveform.h>
+
+#include "ircommand.h"
+#include "irframe.h"
+
+// Address and command bits the encoder of a protocol sends, more are cut off
+typedef struct
+{
+    decode_type_t protocol;
+    uint16_t addressMask;
+    uint16_t commandMask;
+} irProtocolBits_t;
+
+const irProtocolBits_t PROTOCOL_BITS[] = {
+    {SONY, 0x1F, 0x7F}, // 12 bit frame
+    {RC5, 0x1F, 0x7F},
+    {RC6, 0xFF, 0xFF},
+    {SAMSUNG, 0xFFFF, 0xFFFF},
+    {LG, 0xFF, 0xFFFF},
+    {JVC, 0xFF, 0xFF},
+    {DENON, 0x1F, 0xFF},
+    {PANASONIC, 0xFFF, 0xFF},
+    {KASEIKYO_DENON, 0xFFF, 0xFF},
+    {ONKYO, 0xFFFF, 0xFFFF},
+    {NEC2, 0xFFFF, 0xFF},
+    {APPLE, 0xFF, 0xFF},
+    {SHARP, 0x1F, 0xFF},
+};
+
+const irProtocolBits_t *protocolBits(decode_type_t protocol)
+{
+    for (const irProtocolBits_t &bits : PROTOCOL_BITS)
+    {
+        if (bits.protocol == protocol)
+        {
+            return &bits;
+        }
+    }
+    return nullptr;
+}
+
+// Denon and Sharp send every frame a second time with inverted command
+uint8_t framesPerSend(decode_type_t protocol)
+{
+    return (protocol == DENON || protocol == SHARP) ? 2 : 1;
+}
+
+// Marks and spaces in us as the receiver sees them, starting with a mark
+const uint16_t CAPTURE_SIZE = 1000;
+uint32_t capture[CAPTURE_SIZE];
+uint16_t captured;
+uint64_t markStart;
+uint64_t markEnd;
+
+// Carrier switched by the waveform generator. A mark starting where the last one ended continues it, like the
+// Manchester bits of RC5/RC6 reach the receiver.
+void recordCarrier(uint8_t pin, bool on)
+{
+    if (captured >= CAPTURE_SIZE - 1)
+    {
+        return;
+    }
+    if (on)
+    {
+        if (captured > 0 && hostNanos == markEnd)
+        {
+            captured--;
+            return;
+        }
+        if (captured > 0)
+        {
+            capture[captured++] = (hostNanos - markEnd) / 1000;
+        }
+        markStart = hostNanos;
+    }
+    else
+    {
+        capture[captured++] = (hostNanos - markStart) / 1000;
+        markEnd = hostNanos;
+    }
+}
+
+typedef struct
+{
+    decode_type_t protocol;
+    uint16_t address;
+    uint16_t command;
+    uint8_t flags;
+    uint16_t length; // marks and spaces
+} irDecoded_t;
+
+const uint8_t DECODED_MAX = 10;
+irDecoded_t decoded[DECODED_MAX];
+
+// Decode one frame of marks and spaces like the receive ISR hands it over, after a gap of gap us
+void decodeFrame(const uint32_t *timings, uint16_t length, uint32_t gap, irDecoded_t &frame)
+{
+    TEST_ASSERT_LESS_THAN_UINT16(RAW_BUFFER_LENGTH, length + 1);
+    irparams.rawbuf[0] = min<uint32_t>(gap / MICROS_PER_TICK, 0xFFFF);
+    for (uint16_t i = 0; i < length; i++)
+    {
+        irparams.rawbuf[1 + i] = (timings[i] + MICROS_PER_TICK / 2) / MICROS_PER_TICK;
+    }
+    irparams.rawlen = length + 1;
+    irparams.OverflowFlag = false;
+    irparams.StateForISR = IR_REC_STATE_STOP;
+    TEST_ASSERT_TRUE(IrReceiver.decode());
+    frame.protocol = IrReceiver.decodedIRData.protocol;
+    frame.address = IrReceiver.decodedIRData.address;
+    frame.command = IrReceiver.decodedIRData.command;
+    frame.flags = IrReceiver.decodedIRData.flags;
+    frame.length = length;
+    IrReceiver.resume();
+}
+
+// Split the capture into frames at spaces of RECORD_GAP_MICROS like the receive ISR and decode them
+uint8_t decodeCapture()
+{
+    uint8_t count = 0;
+    uint32_t gap = 1000000;
+    uint16_t start = 0;
+    while (start < captured && count < DECODED_MAX)
+    {
+        uint16_t end = start + 1;
+        while (end < captured && capture[end] < RECORD_GAP_MICROS)
+        {
+            end += 2;
+        }
+        end = min(end, captured);
+        decodeFrame(&capture[start], end - start, gap, decoded[count++]);
+        if (end < captured)
+        {
+            gap = capture[end];
+        }
+        start = end + 1;
+    }
+    return count;
+}
+
+// Like sendProtocolFrame(): the first frame, then a repeat every frame period of the protocol
+void sendCommand(const irProtocol_t &protocol, const irCommand_t &command)
+{
+    captured = 0;
+    for (uint8_t f = 0; f <= command.repeats; f++)
+    {
+        uint64_t start = hostNanos;
+        protocol.send(command.address, command.command, f > 0);
+        TEST_ASSERT_LESS_THAN_UINT64(protocol.period * 1000000ULL, hostNanos - start);
+        hostNanos = start + protocol.period * 1000000ULL;
+    }
+    hostNanos += 1000000000; // idle until the next command
+}
+
+// 16 bit values that look like an 8 bit value with inverted byte are decoded as that 8 bit value
+bool looksInverted(uint16_t value)
+{
+    return (value >> 8) == (~value & 0xFF);
+}
+
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+uint16_t randomValue(uint16_t mask)
+{
+    uint16_t value;
+    do
+    {
+        value = nextRandom(0x10000) & mask;
+    } while (mask > 0xFF && (looksInverted(value) || value == APPLE_ADDRESS));
+    return value;
+}
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 1000000000;
+    hostWaveformHandler = recordCarrier;
+}
+
+void tearDown()
+{
+    hostWaveformHandler = nullptr;
+}
+
+// Names and numbers of the table find each other, also in other case, and every protocol has a frame period
+void test_names_and_numbers()
+{
+    TEST_ASSERT_EQUAL_INT(NEC, IR_PROTOCOLS[0].protocol);
+    TEST_ASSERT_NULL(IR_PROTOCOLS[0].send);
+    for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+    {
+        const irProtocol_t &entry = IR_PROTOCOLS[i];
+        char name[20];
+        for (uint8_t j = 0; j <= strlen(entry.name); j++)
+        {
+            name[j] = (j % 2 == 0) ? tolower(entry.name[j]) : toupper(entry.name[j]);
+        }
+        TEST_ASSERT_EQUAL_PTR(&entry, findProtocol(name, strlen(name)));
+        TEST_ASSERT_EQUAL_PTR(&entry, findProtocol(entry.protocol));
+        TEST_ASSERT_EQUAL_STRING(entry.name, protocolName(entry.protocol));
+        TEST_ASSERT_GREATER_THAN_UINT8(0, entry.period);
+        TEST_ASSERT_TRUE_MESSAGE(entry.send == nullptr || protocolBits(entry.protocol) != nullptr, entry.name);
+    }
+    TEST_ASSERT_NULL(findProtocol("NE", 2));
+    TEST_ASSERT_NULL(findProtocol(KASEIKYO_SHARP));
+    TEST_ASSERT_EQUAL_STRING("raw", protocolName(IR_PROTOCOL_RAW));
+}
+
+// A command with "proto" is sent by the encoder of the protocol and decodes to its protocol, address and command. The
+// repeats are flagged as repeat by the decoder or are the full frame again, within their frame period.
+void test_commands_decode_back()
+{
+    for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+    {
+        const irProtocol_t &entry = IR_PROTOCOLS[i];
+        if (entry.send == nullptr)
+        {
+            continue;
+        }
+        const irProtocolBits_t &bits = *protocolBits(entry.protocol);
+        for (uint8_t n = 0; n < 50; n++)
+        {
+            uint16_t address = randomValue(bits.addressMask);
+            uint16_t commandValue = randomValue(bits.commandMask);
+            char payload[100];
+            snprintf(payload, sizeof(payload), "{\"proto\":\"%s\",\"adr\":\"%x\",\"cmd\":\"%x\",\"rpt\":2}", entry.name, address, commandValue);
+
+            irCommand_t command;
+            PGM_P error;
+            TEST_ASSERT_TRUE_MESSAGE(parseCommand(payload, strlen(payload), command, error), payload);
+            const irProtocol_t *protocol = findProtocol(command.protocol);
+            TEST_ASSERT_EQUAL_PTR(&entry, protocol);
+
+            sendCommand(*protocol, command);
+            uint8_t count = decodeCapture();
+            TEST_ASSERT_EQUAL_UINT8_MESSAGE(3 * framesPerSend(entry.protocol), count, payload);
+            for (uint8_t f = 0; f < count; f++)
+            {
+                const irDecoded_t &frame = decoded[f];
+                // The repeat frame of Samsung is the one of the LG and Samsung variant of NEC
+                decode_type_t expected = (f > 0 && entry.protocol == SAMSUNG) ? SAMSUNG_LG : entry.protocol;
+                TEST_ASSERT_EQUAL_STRING_MESSAGE(getProtocolString(expected), getProtocolString(frame.protocol), payload);
+                TEST_ASSERT_EQUAL_HEX16_MESSAGE(address, frame.address, payload);
+                TEST_ASSERT_EQUAL_HEX16_MESSAGE(commandValue, frame.command, payload);
+                if (f >= framesPerSend(entry.protocol))
+                {
+                    bool repeat = (frame.flags & (IRDATA_FLAGS_IS_REPEAT | IRDATA_FLAGS_IS_AUTO_REPEAT)) != 0;
+                    TEST_ASSERT_TRUE_MESSAGE(repeat || frame.length == decoded[0].length, payload);
+                }
+            }
+        }
+    }
+}
+
+// Repeats of RC5/RC6 keep the toggle bit of their first frame, the next command flips it
+void test_toggle_bit_of_repeats()
+{
+    const irProtocol_t *protocols[] = {findProtocol(RC5), findProtocol(RC6)};
+    for (const irProtocol_t *protocol : protocols)
+    {
+        if (protocol == nullptr)
+        {
+            continue;
+        }
+        uint8_t lastToggle = 0xFF;
+        for (uint8_t n = 0; n < 4; n++)
+        {
+            irCommand_t command = {};
+            command.address = 0x1F;
+            command.command = n;
+            command.repeats = 2;
+            sendCommand(*protocol, command);
+            TEST_ASSERT_EQUAL_UINT8(3, decodeCapture());
+            uint8_t toggle = decoded[0].flags & IRDATA_FLAGS_TOGGLE_BIT;
+            TEST_ASSERT_EQUAL_UINT8(toggle, decoded[1].flags & IRDATA_FLAGS_TOGGLE_BIT);
+            TEST_ASSERT_EQUAL_UINT8(toggle, decoded[2].flags & IRDATA_FLAGS_TOGGLE_BIT);
+            TEST_ASSERT_NOT_EQUAL(lastToggle, toggle);
+            lastToggle = toggle;
+        }
+    }
+}
+
+// NEC is encoded for the timer1 player, the frames decode to the sent values and have the computed duration
+void test_nec_frames_decode()
+{
+    irFrame_t frame;
+    uint32_t timings[IR_FRAME_MAX_ENTRIES];
+    irDecoded_t result;
+    for (uint32_t n = 0; n < 10000; n++)
+    {
+        uint16_t sentAddress = (n % 2 == 0) ? nextRandom(0x100) : randomValue(0xFFFF);
+        uint16_t sentCommand = (n % 3 == 0) ? randomValue(0xFFFF) : nextRandom(0x100);
+        encodeNEC(frame, sentAddress, sentCommand);
+        for (uint16_t i = 0; i < frame.length; i++)
+        {
+            timings[i] = frame.timings[i];
+        }
+        decodeFrame(timings, frame.length, 1000000, result);
+        // A 16 bit command is no NEC but its variant Onkyo
+        decode_type_t expected = (sentCommand > 0xFF) ? ONKYO : NEC;
+        TEST_ASSERT_EQUAL_STRING(getProtocolString(expected), getProtocolString(result.protocol));
+        TEST_ASSERT_EQUAL_HEX16(sentAddress, result.address);
+        TEST_ASSERT_EQUAL_HEX16(sentCommand, result.command);
+        TEST_ASSERT_EQUAL_UINT32(frameDuration(frame), frameDurationNEC(sentAddress, sentCommand));
+        TEST_ASSERT_LESS_THAN_UINT32(IR_PROTOCOLS[0].period * 1000, frameDuration(frame));
+    }
+
+    // The repeat frame is decoded as repeat of the last frame
+    encodeNEC(frame, 0x04, 0x02);
+    for (uint16_t i = 0; i < frame.length; i++)
+    {
+        timings[i] = frame.timings[i];
+    }
+    decodeFrame(timings, frame.length, 1000000, result);
+    encodeNECRepeat(frame);
+    for (uint16_t i = 0; i < frame.length; i++)
+    {
+        timings[i] = frame.timings[i];
+    }
+    decodeFrame(timings, frame.length, IR_PROTOCOLS[0].period * 1000 - frameDurationNEC(0x04, 0x02), result);
+    TEST_ASSERT_EQUAL_STRING(getProtocolString(NEC), getProtocolString(result.protocol));
+    TEST_ASSERT_TRUE(result.flags & IRDATA_FLAGS_IS_REPEAT);
+}
+
+// The default protocol of an emitter is used by commands without "proto", also in compact form
+void test_emitter_default_protocol()
+{
+    PGM_P error;
+    irCommand_t command;
+    for (uint8_t i = 0; i < IR_PROTOCOL_COUNT; i++)
+    {
+        char config[40];
+        snprintf(config, sizeof(config), "tv=D5:%s,amp=D1", IR_PROTOCOLS[i].name);
+        TEST_ASSERT_TRUE_MESSAGE(irEmitters.parse(config, 255, error), config);
+        TEST_ASSERT_TRUE(parseCommand("1,2", 3, command, error));
+        TEST_ASSERT_EQUAL_UINT8(IR_PROTOCOLS[i].protocol, command.protocol);
+        const char *object = "{\"emitter\":\"tv\",\"adr\":\"1\",\"cmd\":\"2\"}";
+        TEST_ASSERT_TRUE(parseCommand(object, strlen(object), command, error));
+        TEST_ASSERT_EQUAL_UINT8(IR_PROTOCOLS[i].protocol, command.protocol);
+    }
+    TEST_ASSERT_FALSE(irEmitters.parse("tv=D5:Kaseikyo_Sharp", 255, error));
+    TEST_ASSERT_TRUE(irEmitters.parse("", 255, error));
+}
+
+// Emitter pins are D1-D8 or GPIO numbers the timer1 player can switch, not the serial port, flash or receiver pin
+void test_emitter_pins()
+{
+    PGM_P error;
+    const char *valid[] = {"D1", "d2", "D3", "D4", "D5", "D7", "D8", "0", "2", "4", "5", "13", "14", "15"};
+    for (const char *pin : valid)
+    {
+        char config[20];
+        snprintf(config, sizeof(config), "tv=%s", pin);
+        TEST_ASSERT_TRUE_MESSAGE(irEmitters.parse(config, 12, error), config);
+    }
+    const char *invalid[] = {"D0", "D6", "D9", "1", "3", "6", "11", "12", "16", "D", "x1", "123"};
+    for (const char *pin : invalid)
+    {
+        char config[20];
+        snprintf(config, sizeof(config), "tv=%s", pin);
+        TEST_ASSERT_FALSE_MESSAGE(irEmitters.parse(config, 12, error), config);
+    }
+    TEST_ASSERT_TRUE(irEmitters.parse("", 255, error));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_names_and_numbers);
+    RUN_TEST(test_commands_decode_back);
+    RUN_TEST(test_toggle_bit_of_repeats);
+    RUN_TEST(test_nec_frames_decode);
+    RUN_TEST(test_emitter_default_protocol);
+    RUN_TEST(test_emitter_pins);
+    return UNITY_END();
+}
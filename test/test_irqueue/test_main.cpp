@@ -0,0 +1,148 @@
+/*
+ * IR command queue (irqueue.h) with 1000 commands: order, drops and the time commands wait for transmission,
+ * drained like handleIRTransmit() does, one frame per emitter and NEC frame period.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "irqueue.h"
+
+const uint32_t COMMANDS = 1000;
+const unsigned long FRAME_PERIOD = 108; // ms, see IR_FRAME_PERIOD
+
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+irCommand_t makeCommand(uint16_t sequence, uint8_t emitter)
+{
+    irCommand_t command = {};
+    command.command = sequence;
+    command.emitter = emitter;
+    command.enqueued = millis();
+    return command;
+}
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 0;
+}
+
+void tearDown() {}
+
+// Commands arrive in random gaps of 0-250 ms, slower than the frames on average but in bursts
+void test_order_and_wait_time()
+{
+    IRQueue queue;
+    irCommand_t command;
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    unsigned long nextArrival = 0;
+    unsigned long nextFrame = 0;
+    unsigned long maxWait = 0;
+    uint64_t totalWait = 0;
+
+    while (popped < COMMANDS)
+    {
+        if (pushed < COMMANDS && millis() >= nextArrival)
+        {
+            TEST_ASSERT_TRUE(queue.push(makeCommand(pushed++, 0)));
+            nextArrival = millis() + nextRandom(250);
+        }
+        if (millis() >= nextFrame && queue.pop(command))
+        {
+            TEST_ASSERT_EQUAL_UINT16(popped, command.command);
+            unsigned long wait = millis() - command.enqueued;
+            maxWait = max(maxWait, wait);
+            totalWait += wait;
+            popped++;
+            nextFrame = millis() + FRAME_PERIOD;
+        }
+        delay(1);
+    }
+
+    char message[80];
+    snprintf(message, sizeof(message), "wait avg %lu ms, max %lu ms, max depth %u", (unsigned long)(totalWait / COMMANDS), maxWait,
+             queue.highWater());
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_UINT32(0, queue.dropped());
+    TEST_ASSERT_EQUAL_UINT8(0, queue.depth());
+    // A command waits at most for the frames of the commands queued before it
+    TEST_ASSERT_LESS_OR_EQUAL(queue.highWater() * FRAME_PERIOD, maxWait);
+}
+
+// A burst larger than the queue keeps the first commands and counts the rest as dropped
+void test_burst_drops_newest()
+{
+    IRQueue queue;
+    irCommand_t command;
+    for (uint32_t i = 0; i < COMMANDS; i++)
+    {
+        queue.push(makeCommand(i, 0));
+    }
+    TEST_ASSERT_EQUAL_UINT8(IR_QUEUE_SIZE, queue.depth());
+    TEST_ASSERT_EQUAL_UINT32(COMMANDS - IR_QUEUE_SIZE, queue.dropped());
+    for (uint16_t i = 0; i < IR_QUEUE_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(queue.pop(command));
+        TEST_ASSERT_EQUAL_UINT16(i, command.command);
+    }
+    TEST_ASSERT_FALSE(queue.pop(command));
+}
+
+// Two emitters, one of them often busy: popFirst() lets the other pass, but keeps the order of each emitter
+void test_emitters_keep_their_order()
+{
+    IRQueue queue;
+    irCommand_t command;
+    uint16_t nextPushed[2] = {0, 0};
+    uint16_t nextPopped[2] = {0, 0};
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+
+    while (popped < COMMANDS)
+    {
+        while (pushed < COMMANDS && queue.space() > 0 && nextRandom(2) == 0)
+        {
+            uint8_t emitter = nextRandom(2);
+            queue.push(makeCommand(nextPushed[emitter]++, emitter));
+            pushed++;
+        }
+        bool busy[2] = {nextRandom(4) == 0, nextRandom(2) == 0};
+        for (uint8_t emitter = 0; emitter < 2; emitter++)
+        {
+            bool found = false;
+            auto next = [emitter, &found, &busy](const irCommand_t &queued) {
+                if (found || queued.emitter != emitter)
+                {
+                    return false;
+                }
+                found = true;
+                return !busy[emitter];
+            };
+            if (queue.popFirst(command, next))
+            {
+                TEST_ASSERT_EQUAL_UINT8(emitter, command.emitter);
+                TEST_ASSERT_EQUAL_UINT16(nextPopped[emitter]++, command.command);
+                popped++;
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, queue.dropped());
+    TEST_ASSERT_EQUAL_UINT16(nextPushed[0], nextPopped[0]);
+    TEST_ASSERT_EQUAL_UINT16(nextPushed[1], nextPopped[1]);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_order_and_wait_time);
+    RUN_TEST(test_burst_drops_newest);
+    RUN_TEST(test_emitters_keep_their_order);
+    return UNITY_END();
+}
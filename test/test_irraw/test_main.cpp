@@ -0,0 +1,274 @@
+/*
+ * Raw and Pronto payloads (irraw.h) of 700 entry AC frames from the payload to the timer1 player (irtimer.h).
+ * Reports the host time to parse a payload and to start its playback, and the heap allocations on the way.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <time.h>
+
+#include "ircommand.h"
+#include "irtimer.h"
+
+const uint16_t AC_ENTRIES = 700;
+const uint16_t PRONTO_FREQUENCY = 0x006D; // 38 kHz
+const uint32_t BENCHMARK_RUNS = 2000;
+const size_t PAYLOAD_MAX = 8192;
+
+uint32_t randomState;
+uint16_t timings[IR_RAW_ARENA_SIZE + 1];
+uint32_t allocations; // calls of operator new, e.g. by String
+
+void *operator new(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+uint64_t clockNanos()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// AC remote frame: header, then pulse distance bits with a gap in the middle
+void makeACFrame(uint16_t *frame, uint16_t length)
+{
+    frame[0] = 4400;
+    frame[1] = 4300;
+    for (uint16_t i = 2; i < length; i++)
+    {
+        frame[i] = (i % 2 == 0) ? 550 : (nextRandom(2) ? 1600 : 500);
+    }
+    frame[length / 2 | 1] = 5200;
+}
+
+uint16_t rawPayload(char *payload, const uint16_t *frame, uint16_t length)
+{
+    size_t size = snprintf(payload, PAYLOAD_MAX, "{\"raw\":[");
+    for (uint16_t i = 0; i < length; i++)
+    {
+        size += snprintf(payload + size, PAYLOAD_MAX - size, "%s%u", i > 0 ? "," : "", frame[i]);
+    }
+    size += snprintf(payload + size, PAYLOAD_MAX - size, "],\"khz\":38}");
+    return size;
+}
+
+// Pronto of the frame in carrier periods, once and repeat entries
+uint16_t prontoPayload(char *payload, const uint16_t *frame, uint16_t once, uint16_t repeat)
+{
+    size_t size = snprintf(payload, PAYLOAD_MAX, "{\"pronto\":\"0000 %04X %04X %04X", PRONTO_FREQUENCY, once / 2, repeat / 2);
+    for (uint16_t i = 0; i < once + repeat; i++)
+    {
+        size += snprintf(payload + size, PAYLOAD_MAX - size, " %04X", (unsigned)(frame[i] * 38000UL / 1000000));
+    }
+    size += snprintf(payload + size, PAYLOAD_MAX - size, "\",\"rpt\":2}");
+    return size;
+}
+
+// Parse from an exact-size copy like the MQTT payload
+bool parse(const char *payload, uint16_t length, irCommand_t &command, PGM_P &error)
+{
+    char *exact = (char *)malloc(length);
+    memcpy(exact, payload, length);
+    bool ok = parseCommand(exact, length, command, error);
+    free(exact);
+    return ok;
+}
+
+void resetTimer()
+{
+    memset(irTimerChannels, 0, sizeof(irTimerChannels));
+    irTimerRunning = false;
+    hostTimerEnabled = false;
+}
+
+void setUp()
+{
+    randomState = 1;
+    irRawFrame.used = false;
+    resetTimer();
+    hostNanos = 1000000;
+    hostIsrLatency = 0;
+}
+
+void tearDown() {}
+
+// The timings reach the arena unchanged and are played with their duration
+void test_raw_frame_played()
+{
+    static char payload[PAYLOAD_MAX];
+    makeACFrame(timings, AC_ENTRIES);
+    uint16_t length = rawPayload(payload, timings, AC_ENTRIES);
+    irCommand_t command;
+    PGM_P error;
+    TEST_ASSERT_TRUE(parse(payload, length, command, error));
+    TEST_ASSERT_NULL(error);
+    TEST_ASSERT_EQUAL_UINT8(IR_PROTOCOL_RAW, command.protocol);
+    TEST_ASSERT_TRUE(irRawFrame.used);
+    TEST_ASSERT_EQUAL_UINT16(AC_ENTRIES, irRawFrame.length);
+    TEST_ASSERT_EQUAL_UINT8(38, irRawFrame.khz);
+    TEST_ASSERT_EQUAL_MEMORY(timings, irRawFrame.timings, AC_ENTRIES * sizeof(uint16_t));
+
+    // The next raw command has to wait until the arena is free
+    TEST_ASSERT_FALSE(parse(payload, length, command, error));
+    TEST_ASSERT_EQUAL_STRING("raw frame busy", error);
+
+    TEST_ASSERT_TRUE(IRtimerSend(0, 0, irRawFrame.timings, irRawFrame.length, irRawFrame.khz));
+    for (uint32_t i = 0; i < 100000 && IRtimerIsBusy(); i++)
+    {
+        hostRunTimer(hostNanos + 100000);
+    }
+    // Within a carrier period and the resolution of irTimerPeriodsPerUs (1/65536 of a period per us, 0.02%)
+    uint32_t duration = frameDuration(timings, AC_ENTRIES);
+    TEST_ASSERT_INT_WITHIN(27 + duration / 5000, duration, (int32_t)(IRtimerEndTime(0) - IRtimerStartTime(0)));
+}
+
+// Pronto periods are converted to us, the repeat sequence is played for repeats
+void test_pronto_frame()
+{
+    static char payload[PAYLOAD_MAX];
+    makeACFrame(timings, AC_ENTRIES);
+    uint16_t length = prontoPayload(payload, timings, AC_ENTRIES - 100, 100);
+    irCommand_t command;
+    PGM_P error;
+    TEST_ASSERT_TRUE(parse(payload, length, command, error));
+    TEST_ASSERT_EQUAL_UINT16(AC_ENTRIES, irRawFrame.length);
+    TEST_ASSERT_EQUAL_UINT16(AC_ENTRIES - 100, irRawFrame.repeatStart);
+    TEST_ASSERT_EQUAL_UINT8(38, irRawFrame.khz);
+    TEST_ASSERT_EQUAL_UINT8(2, command.repeats);
+    for (uint16_t i = 0; i < AC_ENTRIES; i++)
+    {
+        // One period of the carrier code is 26.3 us, the payload rounds down
+        TEST_ASSERT_UINT16_WITHIN(27, timings[i], irRawFrame.timings[i]);
+    }
+}
+
+// Frames longer than the arena and broken Pronto codes are rejected and don't keep the arena
+void test_too_long_and_invalid()
+{
+    static char payload[PAYLOAD_MAX];
+    makeACFrame(timings, IR_RAW_ARENA_SIZE + 1);
+    irCommand_t command;
+    PGM_P error;
+    uint16_t length = rawPayload(payload, timings, IR_RAW_ARENA_SIZE + 1);
+    TEST_ASSERT_FALSE(parse(payload, length, command, error));
+    TEST_ASSERT_EQUAL_STRING("raw frame too long", error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    length = prontoPayload(payload, timings, 600, 0);
+    payload[length - 12] = 'X'; // in the last word
+    TEST_ASSERT_FALSE(parse(payload, length, command, error));
+    TEST_ASSERT_EQUAL_STRING("invalid pronto word", error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    const char *mismatch = "{\"pronto\":\"0000 006D 0002 0000 0155 00AA 0015\"}";
+    TEST_ASSERT_FALSE(parse(mismatch, strlen(mismatch), command, error));
+    TEST_ASSERT_EQUAL_STRING("pronto length mismatch", error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+}
+
+// A batch rejected after its raw command doesn't keep the arena, the next raw command is accepted
+void test_rejected_batch_frees_arena()
+{
+    static char payload[PAYLOAD_MAX];
+    static irBatch_t batch;
+    PGM_P error;
+    const char *trailing = "[{\"raw\":[100,200,300]},{\"adr\":\"1\",\"cmd\":\"2\"} x";
+    TEST_ASSERT_FALSE(parseBatch(trailing, strlen(trailing), batch, error));
+    TEST_ASSERT_NOT_NULL(error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    const char *broken = "[{\"raw\":[100,200,300]},{\"adr\":\"1\",\"cmd\":}]";
+    TEST_ASSERT_FALSE(parseBatch(broken, strlen(broken), batch, error));
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    // Too many commands, as array and as newline delimited list
+    size_t length = snprintf(payload, PAYLOAD_MAX, "[{\"raw\":[100,200,300]}");
+    for (uint8_t i = 0; i < IR_BATCH_SIZE; i++)
+    {
+        length += snprintf(payload + length, PAYLOAD_MAX - length, ",{\"adr\":\"1\",\"cmd\":\"%x\"}", i);
+    }
+    length += snprintf(payload + length, PAYLOAD_MAX - length, "]");
+    TEST_ASSERT_FALSE(parseBatch(payload, length, batch, error));
+    TEST_ASSERT_EQUAL_STRING("too many commands", error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    length = snprintf(payload, PAYLOAD_MAX, "{\"raw\":[100,200,300]}\n");
+    for (uint8_t i = 0; i < IR_BATCH_SIZE; i++)
+    {
+        length += snprintf(payload + length, PAYLOAD_MAX - length, "1,%x\n", i);
+    }
+    TEST_ASSERT_FALSE(parseBatch(payload, length, batch, error));
+    TEST_ASSERT_EQUAL_STRING("too many commands", error);
+    TEST_ASSERT_FALSE(irRawFrame.used);
+
+    // The arena of a command still queued isn't released by a rejected batch
+    TEST_ASSERT_TRUE(parseBatch(payload, strlen("{\"raw\":[100,200,300]}"), batch, error));
+    TEST_ASSERT_TRUE(irRawFrame.used);
+    TEST_ASSERT_FALSE(parseBatch(trailing, strlen(trailing), batch, error));
+    TEST_ASSERT_TRUE(irRawFrame.used);
+}
+
+// Time from the payload to the started playback of 700 entry frames, without allocations
+void test_parse_and_start_time()
+{
+    static char raw[PAYLOAD_MAX];
+    static char pronto[PAYLOAD_MAX];
+    makeACFrame(timings, AC_ENTRIES);
+    uint16_t rawLength = rawPayload(raw, timings, AC_ENTRIES);
+    uint16_t prontoLength = prontoPayload(pronto, timings, AC_ENTRIES, 0);
+    irCommand_t command;
+    PGM_P error;
+    uint64_t parseNanos[2] = {};
+    uint64_t startNanos = 0;
+    allocations = 0;
+
+    for (uint32_t i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        bool isPronto = (i % 2 == 1);
+        uint64_t start = clockNanos();
+        TEST_ASSERT_TRUE(parseCommand(isPronto ? pronto : raw, isPronto ? prontoLength : rawLength, command, error));
+        uint64_t parsed = clockNanos();
+        TEST_ASSERT_TRUE(IRtimerSend(0, 0, irRawFrame.timings, irRawFrame.length, irRawFrame.khz));
+        uint64_t started = clockNanos();
+        parseNanos[isPronto] += parsed - start;
+        startNanos += started - parsed;
+        resetTimer();
+        irRawFrame.used = false;
+    }
+
+    char message[160];
+    snprintf(message, sizeof(message), "%u entries: raw %u bytes parsed in %u us, pronto %u bytes in %u us, playback started in %u ns",
+             AC_ENTRIES, rawLength, (unsigned)(parseNanos[0] / (BENCHMARK_RUNS / 2) / 1000), prontoLength,
+             (unsigned)(parseNanos[1] / (BENCHMARK_RUNS / 2) / 1000), (unsigned)(startNanos / BENCHMARK_RUNS));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_raw_frame_played);
+    RUN_TEST(test_pronto_frame);
+    RUN_TEST(test_too_long_and_invalid);
+    RUN_TEST(test_rejected_batch_frees_arena);
+    RUN_TEST(test_parse_and_start_time);
+    return UNITY_END();
+}
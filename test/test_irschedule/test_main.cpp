@@ -0,0 +1,160 @@
+/*
+ * Scheduled commands (irschedule.h): 1000 commands with random start times, pushed out of order, are moved to the
+ * IR queue like handleSchedule() does, polled about every ms against a simulated epoch clock.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "irschedule.h"
+
+const uint32_t COMMANDS = 1000;
+const uint64_t EPOCH_START = 1767225600000ULL; // 2026-01-01 (in ms)
+const unsigned long FRAME_PERIOD = 108;        // ms, see IR_FRAME_PERIOD
+const uint32_t POLL_MAX = 1300;                // max. time between two runs of taskIR (in us)
+
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+// Simulated clock synced at hostNanos 0, like TimeService::nowEpochMicros()
+uint64_t nowEpochMicros()
+{
+    return EPOCH_START * 1000 + micros();
+}
+
+irCommand_t makeCommand(uint16_t sequence, uint64_t at)
+{
+    irCommand_t command = {};
+    command.command = sequence;
+    command.at = at;
+    return command;
+}
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 0;
+}
+
+void tearDown() {}
+
+// Start times 50 ms to 5 s ahead, a quarter of them equal to the previous one. Commands leave the schedule in order
+// of time and arrival, never early and late only by the poll interval while the queue has space.
+void test_order_and_tolerance()
+{
+    IRSchedule schedule;
+    IRQueue queue;
+    irCommand_t command;
+    uint32_t pushed = 0;
+    uint32_t fired = 0;
+    uint32_t sent = 0;
+    uint64_t lastAt = 0;
+    uint16_t lastSequence = 0;
+    uint16_t firedOrder[COMMANDS];
+    uint64_t previousAt = 0;
+    unsigned long nextArrival = 0;
+    unsigned long nextFrame = 0;
+    uint64_t maxLate = 0;
+
+    while (sent < COMMANDS)
+    {
+        if (pushed < COMMANDS && millis() >= nextArrival && schedule.space() > 0)
+        {
+            uint64_t at = (pushed > 0 && nextRandom(4) == 0) ? previousAt : EPOCH_START + millis() + 50 + nextRandom(4950);
+            if (at <= EPOCH_START + millis())
+            {
+                at = EPOCH_START + millis() + 50;
+            }
+            TEST_ASSERT_TRUE(schedule.push(makeCommand(pushed++, at)));
+            previousAt = at;
+            nextArrival = millis() + nextRandom(300);
+        }
+
+        // handleSchedule()
+        uint64_t now = nowEpochMicros();
+        bool queueFull = queue.space() == 0;
+        while (queue.space() > 0 && schedule.pop(now, command))
+        {
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT64(command.at * 1000, now);
+            TEST_ASSERT_TRUE(command.at > lastAt || (command.at == lastAt && command.command > lastSequence) || fired == 0);
+            if (!queueFull)
+            {
+                maxLate = max(maxLate, now - command.at * 1000);
+            }
+            lastAt = command.at;
+            lastSequence = command.command;
+            firedOrder[fired++] = command.command;
+            queue.push(command);
+        }
+
+        // One frame per period, in the order the commands left the schedule
+        if (millis() >= nextFrame && queue.pop(command))
+        {
+            TEST_ASSERT_EQUAL_UINT16(firedOrder[sent++], command.command);
+            nextFrame = millis() + FRAME_PERIOD;
+        }
+        delayMicroseconds(700 + nextRandom(POLL_MAX - 700));
+    }
+
+    char message[80];
+    snprintf(message, sizeof(message), "max. late %lu us, queue depth %u", (unsigned long)maxLate, queue.highWater());
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_UINT32(COMMANDS, fired);
+    TEST_ASSERT_EQUAL_UINT32(0, schedule.dropped());
+    TEST_ASSERT_EQUAL_UINT32(0, queue.dropped());
+    TEST_ASSERT_EQUAL_UINT8(0, schedule.size());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT64(POLL_MAX, maxLate);
+}
+
+// Commands with the same time leave in the order they arrived, also after the heap was reordered many times
+void test_same_time_keeps_arrival_order()
+{
+    IRSchedule schedule;
+    irCommand_t command;
+    uint16_t sequence = 0;
+    for (uint32_t round = 0; round < COMMANDS / IR_SCHEDULE_SIZE; round++)
+    {
+        while (schedule.space() > 0)
+        {
+            schedule.push(makeCommand(sequence++, EPOCH_START + nextRandom(3)));
+        }
+        uint64_t lastAt = 0;
+        int32_t lastSequence = -1;
+        while (schedule.pop(nowEpochMicros() + 3000000, command))
+        {
+            TEST_ASSERT_TRUE(command.at > lastAt || (command.at == lastAt && (int32_t)command.command > lastSequence));
+            lastAt = command.at;
+            lastSequence = command.command;
+        }
+        TEST_ASSERT_EQUAL_UINT8(0, schedule.size());
+    }
+}
+
+// A full schedule rejects and counts new commands, nothing is due before its time
+void test_full_schedule_drops()
+{
+    IRSchedule schedule;
+    irCommand_t command;
+    for (uint32_t i = 0; i < COMMANDS; i++)
+    {
+        schedule.push(makeCommand(i, EPOCH_START + 1000 + nextRandom(1000)));
+    }
+    TEST_ASSERT_EQUAL_UINT8(IR_SCHEDULE_SIZE, schedule.size());
+    TEST_ASSERT_EQUAL_UINT32(COMMANDS - IR_SCHEDULE_SIZE, schedule.dropped());
+    TEST_ASSERT_FALSE(schedule.pop(EPOCH_START * 1000 + 999999, command));
+    TEST_ASSERT_TRUE(schedule.pop(EPOCH_START * 1000 + 2000000, command));
+    TEST_ASSERT_LESS_THAN_UINT16(IR_SCHEDULE_SIZE, command.command);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_order_and_tolerance);
+    RUN_TEST(test_same_time_keeps_arrival_order);
+    RUN_TEST(test_full_schedule_drops);
+    return UNITY_END();
+}
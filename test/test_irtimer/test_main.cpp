@@ -0,0 +1,245 @@
+/*
+ * Timing of the timer1 player (irtimer.h) against the simulated timer1 of test/stubs/Arduino.h. Every interrupt is
+ * served late by hostIsrLatency, like on the ESP8266 where the interrupt entry and the channel loop take a few us.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "irtimer.h"
+
+const uint8_t PINS = 4;
+const uint32_t MAX_EDGES = 4000;
+const uint32_t THROUGHPUT_SECONDS = 10;
+const uint32_t FRAME_PERIOD = NEC_REPEAT_PERIOD / 1000; // start to start in ms, see IR_FRAME_PERIOD
+
+// Carrier edges of every pin (in ns)
+struct
+{
+    uint64_t rise[MAX_EDGES];
+    uint64_t fall[MAX_EDGES];
+    uint32_t rises;
+    uint32_t falls;
+} edges[PINS];
+
+void recordEdge(uint32_t mask, bool high)
+{
+    for (uint8_t pin = 0; pin < PINS; pin++)
+    {
+        if ((mask & (1 << pin)) == 0)
+        {
+            continue;
+        }
+        if (high && edges[pin].rises < MAX_EDGES)
+        {
+            edges[pin].rise[edges[pin].rises++] = hostNanos;
+        }
+        else if (!high && edges[pin].falls < MAX_EDGES)
+        {
+            edges[pin].fall[edges[pin].falls++] = hostNanos;
+        }
+    }
+}
+
+// Advance the simulated time in steps of 100 us until all channels are done
+void runUntilIdle()
+{
+    for (uint32_t i = 0; i < 100000 && IRtimerIsBusy(); i++)
+    {
+        hostRunTimer(hostNanos + 100000);
+    }
+}
+
+void setUp()
+{
+    memset(edges, 0, sizeof(edges));
+    memset(irTimerChannels, 0, sizeof(irTimerChannels));
+    irTimerRunning = false;
+    hostTimerEnabled = false;
+    hostNanos = 1000000;
+    hostIsrLatency = 0;
+    hostGpioHandler = recordEdge;
+    ESP.cpuFreqMHz = 80;
+}
+
+void tearDown()
+{
+    hostGpioHandler = nullptr;
+}
+
+// Mean carrier period during the header mark of a NEC frame (in ns)
+double headerCarrierPeriod(uint8_t pin)
+{
+    uint32_t pulses = 0;
+    while (pulses + 1 < edges[pin].rises && edges[pin].rise[pulses + 1] - edges[pin].rise[0] < NEC_HEADER_MARK * 1000ULL)
+    {
+        pulses++;
+    }
+    return (double)(edges[pin].rise[pulses] - edges[pin].rise[0]) / pulses;
+}
+
+// First rising edge to the end of the carrier period of the last pulse (in us)
+int32_t envelope(uint8_t pin)
+{
+    return (int32_t)((edges[pin].fall[edges[pin].falls - 1] + irTimerLowTicks * 200 - edges[pin].rise[0]) / 1000);
+}
+
+void checkNECFrame(uint32_t latency, uint8_t cpuFreqMHz)
+{
+    irFrame_t frame;
+    encodeNEC(frame, 0x80, 0x12);
+    hostIsrLatency = latency;
+    ESP.cpuFreqMHz = cpuFreqMHz;
+
+    TEST_ASSERT_TRUE(IRtimerSend(0, 0, frame));
+    runUntilIdle();
+    TEST_ASSERT_FALSE(IRtimerIsBusy());
+
+    // 132 ticks of 200 ns at 38 kHz, the latency must not stretch it
+    TEST_ASSERT_FLOAT_WITHIN(5.0, irTimerPeriodTicks * 200.0, headerCarrierPeriod(0));
+
+    // Envelope within one carrier period of the frame, also over the 67 entries
+    int32_t expected = frameDuration(frame);
+    TEST_ASSERT_INT_WITHIN(27, expected, envelope(0));
+    TEST_ASSERT_INT_WITHIN(27, expected, (int32_t)(IRtimerEndTime(0) - IRtimerStartTime(0)));
+
+    // Duty cycle of every pulse: 30% of 26.4 us, the falling edge is served as late as the rising one
+    for (uint32_t i = 0; i < edges[0].falls; i++)
+    {
+        TEST_ASSERT_UINT32_WITHIN(200, irTimerHighTicks * 200, edges[0].fall[i] - edges[0].rise[i]);
+    }
+}
+
+void test_frame_without_latency()
+{
+    checkNECFrame(0, 80);
+}
+
+void test_latency_does_not_add_up()
+{
+    checkNECFrame(3000, 80);
+}
+
+void test_latency_at_160_mhz()
+{
+    checkNECFrame(3000, 160);
+}
+
+// Frames started while others are playing share the carrier edges, each keeps its own envelope
+void test_channels_in_parallel()
+{
+    irFrame_t frame;
+    irFrame_t repeat;
+    encodeNEC(frame, 0x80, 0x12);
+    encodeNECRepeat(repeat);
+    hostIsrLatency = 2000;
+
+    TEST_ASSERT_TRUE(IRtimerSend(0, 0, frame));
+    hostRunTimer(hostNanos + 3000000);
+    TEST_ASSERT_TRUE(IRtimerSend(1, 1, repeat));
+    hostRunTimer(hostNanos + 7000000);
+    TEST_ASSERT_TRUE(IRtimerSend(2, 2, frame));
+    TEST_ASSERT_TRUE(IRtimerSend(3, 3, frame));
+    runUntilIdle();
+
+    TEST_ASSERT_INT_WITHIN(27, frameDuration(frame), envelope(0));
+    TEST_ASSERT_INT_WITHIN(27, frameDuration(repeat), envelope(1));
+    TEST_ASSERT_INT_WITHIN(27, frameDuration(frame), envelope(2));
+    TEST_ASSERT_INT_WITHIN(27, frameDuration(frame), envelope(3));
+
+    // Shared carrier: pulses of channel 2 and 3 start on the same edges
+    TEST_ASSERT_EQUAL_UINT32(edges[2].rises, edges[3].rises);
+    TEST_ASSERT_EQUAL_UINT64(edges[2].rise[0], edges[3].rise[0]);
+    TEST_ASSERT_EQUAL_UINT64(edges[2].rise[edges[2].rises - 1], edges[3].rise[edges[3].rises - 1]);
+}
+
+// A frame with another carrier has to wait until the timer is free
+void test_other_carrier_rejected_while_running()
+{
+    irFrame_t frame;
+    encodeNEC(frame, 0x80, 0x12);
+    uint16_t timings[] = {1000, 1000, 1000};
+
+    TEST_ASSERT_TRUE(IRtimerSend(0, 0, frame));
+    TEST_ASSERT_FALSE(IRtimerSend(1, 1, timings, 3, 36));
+    TEST_ASSERT_FALSE(IRtimerSend(0, 0, frame));
+    runUntilIdle();
+    TEST_ASSERT_TRUE(IRtimerSend(1, 1, timings, 3, 36));
+    runUntilIdle();
+    TEST_ASSERT_INT_WITHIN(28, 3000, envelope(1));
+}
+
+// Frames per second and interrupts of 1-8 emitters sending NEC frames with the frame period, polled every ms like
+// handleEmitterTransmit(). Emitters start 13 ms apart with their own commands, so marks and spaces overlap at random.
+void test_throughput_per_emitter_count()
+{
+    static irFrame_t frames[IR_TIMER_CHANNELS];
+    uint8_t counts[] = {1, 2, 4, 8};
+    uint32_t framesPerSecond[4];
+    hostGpioHandler = nullptr;
+    hostIsrLatency = 3000;
+    char message[140];
+
+    for (uint8_t c = 0; c < 4; c++)
+    {
+        uint8_t emitters = counts[c];
+        uint32_t lastStart[IR_TIMER_CHANNELS];
+        bool started[IR_TIMER_CHANNELS] = {};
+        uint32_t sent = 0;
+        uint32_t maxError = 0;
+        uint64_t interrupts = 0;
+        for (uint8_t i = 0; i < emitters; i++)
+        {
+            encodeNEC(frames[i], 0x80 + i, 0x12 + 17 * i);
+            lastStart[i] = millis() + 13 * i - FRAME_PERIOD;
+        }
+
+        unsigned long begin = millis();
+        while (millis() - begin < THROUGHPUT_SECONDS * 1000)
+        {
+            for (uint8_t i = 0; i < emitters; i++)
+            {
+                if (IRtimerIsBusy(i) || (int32_t)(millis() - lastStart[i]) < (int32_t)FRAME_PERIOD)
+                {
+                    continue;
+                }
+                if (started[i])
+                {
+                    int32_t error = (int32_t)(IRtimerEndTime(i) - IRtimerStartTime(i)) - (int32_t)frameDuration(frames[i]);
+                    maxError = max(maxError, (uint32_t)abs(error));
+                }
+                TEST_ASSERT_TRUE(IRtimerSend(i, i, frames[i]));
+                lastStart[i] = millis();
+                started[i] = true;
+                sent++;
+            }
+            interrupts += hostRunTimer(hostNanos + 1000000);
+        }
+
+        framesPerSecond[c] = sent * 10 / THROUGHPUT_SECONDS; // in 1/10
+        uint32_t interruptsPerSecond = interrupts / THROUGHPUT_SECONDS;
+        snprintf(message, sizeof(message), "%u emitters: %u.%u frames/s, %u interrupts/s, frame length error max %u us", emitters,
+                 framesPerSecond[c] / 10, framesPerSecond[c] % 10, interruptsPerSecond, maxError);
+        TEST_MESSAGE(message);
+
+        // Every emitter keeps its frame period, the frames keep their length
+        TEST_ASSERT_UINT32_WITHIN(emitters * 2, emitters * framesPerSecond[0], framesPerSecond[c]);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(27, maxError);
+        // Two interrupts per carrier period at most, however many emitters are in a mark
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(2 * 38000, interruptsPerSecond);
+
+        runUntilIdle();
+        memset(irTimerChannels, 0, sizeof(irTimerChannels));
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_without_latency);
+    RUN_TEST(test_latency_does_not_add_up);
+    RUN_TEST(test_latency_at_160_mhz);
+    RUN_TEST(test_channels_in_parallel);
+    RUN_TEST(test_other_carrier_rejected_while_running);
+    RUN_TEST(test_throughput_per_emitter_count);
+    return UNITY_END();
+}
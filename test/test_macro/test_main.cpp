@@ -0,0 +1,206 @@
+/*
+ * Step timing of macros (macro.h) run by the scheduler like on the device: taskMacro is critical and its idle part
+ * runs between the chunks of slow HTTP responses, the other tasks take random time. The time every command is queued
+ * is compared with its ideal time, the macro start plus the waits before it.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "macro.h"
+#include "scheduler.h"
+
+const uint8_t BODY_STEPS = 40;  // send + wait steps in the loop body
+const uint8_t LOOPS = 25;       // runs of the body
+const uint32_t STEPS = BODY_STEPS * LOOPS;
+
+uint32_t randomState;
+Scheduler *scheduler;
+MacroRunner macroRunner;
+uint16_t waits[BODY_STEPS];
+uint32_t sent;                 // commands queued so far
+uint64_t sendTime[STEPS];      // hostNanos when a command was queued
+unsigned long blockedUntil;    // millis() until the queue is full
+uint32_t maxMacroGap;          // longest time between two runs of taskMacro (in us)
+uint64_t lastMacroRun;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+bool queueStep(irCommand_t &command)
+{
+    if (millis() < blockedUntil)
+    {
+        return false;
+    }
+    TEST_ASSERT_EQUAL_UINT16(sent % BODY_STEPS, command.command);
+    sendTime[sent++] = hostNanos;
+    return true;
+}
+
+// taskMacro and its idle part like in main.cpp
+void runMacroTask(bool idle)
+{
+    maxMacroGap = max<uint32_t>(maxMacroGap, (hostNanos - lastMacroRun) / 1000);
+    lastMacroRun = hostNanos;
+    macroRunner.handle(queueStep, idle);
+    delayMicroseconds(20);
+}
+
+void taskMacro() { runMacroTask(false); }
+void idleMacro() { runMacroTask(true); }
+
+// 0.2-2 ms per pass, now and then 5-30 ms
+void taskMQTT()
+{
+    delayMicroseconds(nextRandom(8) == 0 ? 5000 + nextRandom(25000) : 200 + nextRandom(1800));
+}
+
+// A slow response now and then: up to 400 ms in chunks of 1-10 ms with the idle handler in between
+void taskHTTP()
+{
+    if (nextRandom(50) != 0)
+    {
+        return;
+    }
+    uint32_t chunks = nextRandom(40);
+    for (uint32_t i = 0; i < chunks; i++)
+    {
+        delayMicroseconds(1000 + nextRandom(9000));
+        scheduler->runIdle();
+    }
+}
+
+// A long flash write or DNS lookup that the idle handler can't interrupt
+void taskBlocking()
+{
+    delay(nextRandom(200) == 0 ? 50 : 0);
+}
+
+// Loop of BODY_STEPS sends with random waits
+void compileTestMacro(uint8_t *code, uint16_t &length)
+{
+    char json[2048];
+    int size = snprintf(json, sizeof(json), "{\"steps\":[{\"loop\":%u,\"steps\":[", LOOPS);
+    for (uint8_t i = 0; i < BODY_STEPS; i++)
+    {
+        waits[i] = nextRandom(300);
+        size += snprintf(json + size, sizeof(json) - size, "%s{\"adr\":\"1\",\"cmd\":\"%x\",\"wait\":%u}", i > 0 ? "," : "", i, waits[i]);
+    }
+    size += snprintf(json + size, sizeof(json) - size, "]}]}");
+    PGM_P error;
+    TEST_ASSERT_TRUE(compileMacro(json, size, code, length, error));
+}
+
+// Run the loop until the macro is finished, returns the macro start (in ns)
+uint64_t runMacro()
+{
+    uint8_t code[MACRO_SIZE];
+    uint16_t length;
+    compileTestMacro(code, length);
+    delay(1);
+    uint64_t start = (uint64_t)millis() * 1000000;
+    TEST_ASSERT_TRUE(macroRunner.start("scene", code, length, 0));
+    lastMacroRun = hostNanos;
+    for (uint32_t i = 0; i < 1000000 && macroRunner.active(); i++)
+    {
+        scheduler->run();
+    }
+    TEST_ASSERT_FALSE(macroRunner.active());
+    TEST_ASSERT_EQUAL_UINT32(STEPS, sent);
+    return start;
+}
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 0;
+    sent = 0;
+    blockedUntil = 0;
+    maxMacroGap = 0;
+    scheduler = new Scheduler();
+    scheduler->add("macro", taskMacro, 0, 0, 1000, idleMacro);
+    scheduler->add("mqtt", taskMQTT, 0, 1, 5000);
+    scheduler->add("http", taskHTTP, 0, 2, 10000);
+    scheduler->add("blocking", taskBlocking, 0, 3, 1000);
+}
+
+void tearDown()
+{
+    delete scheduler;
+}
+
+// Every step is queued at its ideal time or later, late only by the time taskMacro had to wait, not summed up
+void test_step_jitter()
+{
+    uint64_t ideal = runMacro();
+    uint64_t totalLate = 0;
+    uint64_t maxLate = 0;
+    for (uint32_t i = 0; i < STEPS; i++)
+    {
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64(ideal, sendTime[i]);
+        uint64_t late = sendTime[i] - ideal;
+        totalLate += late;
+        maxLate = max(maxLate, late);
+        ideal += (uint64_t)waits[i % BODY_STEPS] * 1000000;
+    }
+
+    char message[100];
+    snprintf(message, sizeof(message), "%u steps, late avg %u us, max %u us, max. gap of taskMacro %u us", (unsigned)STEPS,
+             (unsigned)(totalLate / STEPS / 1000), (unsigned)(maxLate / 1000), (unsigned)maxMacroGap);
+    TEST_MESSAGE(message);
+    // Within the longest time taskMacro waited plus the resolution of millis(), also for the last step
+    TEST_ASSERT_LESS_OR_EQUAL_UINT64((uint64_t)(maxMacroGap + 1000) * 1000, maxLate);
+}
+
+// A full queue holds the macro, the steps after it are back on their ideal times
+void test_full_queue_does_not_shift_later_steps()
+{
+    blockedUntil = 2000;
+    uint64_t ideal = runMacro();
+    uint32_t onTime = 0;
+    for (uint32_t i = 0; i < STEPS; i++)
+    {
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64(ideal, sendTime[i]);
+        if (ideal > 3000000000ULL)
+        {
+            // Well after the queue is free again
+            TEST_ASSERT_LESS_OR_EQUAL_UINT64((uint64_t)(maxMacroGap + 1000) * 1000, sendTime[i] - ideal);
+            onTime++;
+        }
+        ideal += (uint64_t)waits[i % BODY_STEPS] * 1000000;
+    }
+    TEST_ASSERT_GREATER_THAN_UINT32(STEPS / 2, onTime);
+}
+
+// Between the chunks of a HTTP response a step with a named code waits for taskMacro, the code library may be in use
+void test_named_code_waits_for_task()
+{
+    const char *json = "{\"steps\":[{\"adr\":\"1\",\"cmd\":\"0\"},{\"name\":\"tv_on\"},{\"adr\":\"1\",\"cmd\":\"1\"}]}";
+    uint8_t code[MACRO_SIZE];
+    uint16_t length;
+    PGM_P error;
+    TEST_ASSERT_TRUE(compileMacro(json, strlen(json), code, length, error));
+    TEST_ASSERT_TRUE(macroRunner.start("scene", code, length, 0));
+
+    TEST_ASSERT_FALSE(macroRunner.handle(queueStep, true));
+    TEST_ASSERT_EQUAL_UINT32(1, sent);
+    TEST_ASSERT_FALSE(macroRunner.handle(queueStep, true));
+    TEST_ASSERT_EQUAL_UINT32(1, sent);
+    TEST_ASSERT_TRUE(macroRunner.active());
+
+    // The code isn't stored, the step is skipped by the task run
+    TEST_ASSERT_TRUE(macroRunner.handle(queueStep));
+    TEST_ASSERT_EQUAL_UINT32(2, sent);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_step_jitter);
+    RUN_TEST(test_full_queue_does_not_shift_later_steps);
+    RUN_TEST(test_named_code_waits_for_task);
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+/*
+ * Gaps between IR dispatches under the scheduler (scheduler.h) with the tasks of main.cpp: every 20th HTTP request
+ * streams a 100 ms page in 2.5 ms chunks, MQTT takes 0.2-2 ms per pass. The IR task is critical, its idle part runs
+ * between the chunks. Reported is the longest time without an IR dispatch, without and with the idle part.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "scheduler.h"
+
+const uint32_t PASSES = 20000;
+const uint32_t PAGE_TIME = 100000; // streamed page (in us)
+const uint32_t CHUNK_TIME = 2500;  // one chunk of it (in us)
+const uint32_t IR_TIME = 60;       // one IR dispatch (in us)
+
+uint32_t randomState;
+Scheduler *scheduler = nullptr;
+uint32_t httpRuns;
+uint32_t pages;
+uint64_t lastDispatch;
+uint32_t maxGap; // in us
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+void taskIR()
+{
+    maxGap = max<uint32_t>(maxGap, (hostNanos - lastDispatch) / 1000);
+    delayMicroseconds(IR_TIME);
+    lastDispatch = hostNanos;
+}
+
+void taskMacro() { delayMicroseconds(20); }
+
+void taskMQTT() { delayMicroseconds(200 + nextRandom(1800)); }
+
+// Every 20th request a streamed page, the idle handler runs after every chunk like in HTMLWriter
+void taskHTTP()
+{
+    if (++httpRuns % 20 != 0)
+    {
+        delayMicroseconds(100);
+        return;
+    }
+    pages++;
+    for (uint32_t time = 0; time < PAGE_TIME; time += CHUNK_TIME)
+    {
+        delayMicroseconds(CHUNK_TIME);
+        scheduler->runIdle();
+    }
+}
+
+void taskShort() { delayMicroseconds(50 + nextRandom(150)); }
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 0;
+}
+
+void tearDown() {}
+
+// Tasks and priorities of setup() in main.cpp, the idle parts of the critical tasks only if idle, run PASSES passes
+void runPasses(bool idle)
+{
+    httpRuns = 0;
+    pages = 0;
+    lastDispatch = hostNanos;
+    maxGap = 0;
+    delete scheduler;
+    scheduler = new Scheduler();
+    scheduler->add("ir", taskIR, 0, 0, 2000, idle ? taskIR : nullptr);
+    scheduler->add("macro", taskMacro, 0, 0, 1000, idle ? taskMacro : nullptr);
+    scheduler->add("mqtt", taskMQTT, 0, 1, 5000);
+    scheduler->add("wifi", taskShort, 10, 1, 2000);
+    scheduler->add("http", taskHTTP, 0, 2, 10000);
+    scheduler->add("ntp", taskShort, 10, 2, 1000);
+    scheduler->add("metrics", taskShort, 1000, 3, 1000);
+    scheduler->add("led", taskShort, 20, 3, 500);
+    for (uint32_t i = 0; i < PASSES; i++)
+    {
+        scheduler->run();
+    }
+    TEST_ASSERT_GREATER_THAN_UINT32(100, pages);
+}
+
+// With the idle part a page delays IR by one chunk, without it by the whole page
+void test_ir_gap_with_streamed_pages()
+{
+    runPasses(false);
+    uint32_t withoutIdle = maxGap;
+    runPasses(true);
+    uint32_t withIdle = maxGap;
+
+    char message[100];
+    snprintf(message, sizeof(message), "max. gap between IR dispatches %u us without idle part, %u us with it", withoutIdle, withIdle);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(PAGE_TIME, withoutIdle);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(CHUNK_TIME + 200, withIdle);
+}
+
+// The runtime of a task doesn't include the critical tasks run in between
+void test_task_time_without_critical_tasks()
+{
+    runPasses(true);
+    for (uint8_t i = 0; i < scheduler->size(); i++)
+    {
+        const task_t &task = (*scheduler)[i];
+        if (strcmp(task.name, "http") == 0)
+        {
+            TEST_ASSERT_EQUAL_UINT32(PAGE_TIME, task.maxTime);
+        }
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_ir_gap_with_streamed_pages);
+    RUN_TEST(test_task_time_without_critical_tasks);
+    return UNITY_END();
+}
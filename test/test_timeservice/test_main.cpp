@@ -0,0 +1,228 @@
+/*
+ * Clock discipline of the SNTP client (timeservice.h) against a simulated server through the lwIP stubs: 4 h with a
+ * crystal drift of 40, then 55 ppm, 2-5 ms one-way jitter, 10 % delay spikes and 5 % lost replies. Reported are the
+ * mean and max. error of nowEpochMicros() after the first 30 min; drift and slew together correct at most 500 ppm.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "timeservice.h"
+
+const uint64_t EPOCH_START = 1767225600000000ULL;       // 2026-01-01 (in us)
+const unsigned long POLL_INTERVAL = 64000;              // ms, see NTP_UPDATE_INTERVAL
+const uint64_t RUN_TIME = 4ULL * 3600 * 1000000000;     // ns
+const uint64_t SETTLE_TIME = 30ULL * 60 * 1000000000;   // ns
+const uint64_t STEP = 1000000;                          // between two runs of handle() (in ns)
+const uint32_t SERVER_TIME = 100000;                    // between receive and transmit timestamp of the server (in ns)
+
+uint32_t randomState;
+
+uint32_t nextRandom(uint32_t limit)
+{
+    randomState = randomState * 1664525 + 1013904223;
+    return (randomState >> 8) % limit;
+}
+
+// Simulated true time: the local clock (hostNanos) runs fast by drift
+double drift;        // in ppm
+uint64_t driftStart; // hostNanos of the last change
+double trueBase;     // true time at driftStart (in ns)
+
+double trueNanos()
+{
+    return trueBase + (hostNanos - driftStart) / (1 + drift * 1e-6);
+}
+
+void setDrift(double ppm)
+{
+    trueBase = trueNanos();
+    driftStart = hostNanos;
+    drift = ppm;
+}
+
+// Simulated server and network
+bool jitter;
+int64_t serverOffset; // of the server time (in us)
+bool pending;
+uint64_t replyDue; // hostNanos
+uint8_t replyPacket[NTP_PACKET_SIZE];
+uint32_t lostReplies;
+
+int64_t serverMicros(double trueTime)
+{
+    return EPOCH_START + (int64_t)(trueTime / 1000) + serverOffset;
+}
+
+void writeServerTime(uint8_t *data, int64_t epochMicros)
+{
+    uint64_t seconds = epochMicros / 1000000 + NTP_UNIX_OFFSET;
+    uint64_t fraction = ((uint64_t)(epochMicros % 1000000) << 32) / 1000000;
+    uint64_t value = (seconds << 32) | fraction;
+    for (int8_t i = 7; i >= 0; i--)
+    {
+        data[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+// One way through the network: 2-5 ms, 10 % of them with 20-100 ms queueing (in ns)
+uint64_t oneWayDelay()
+{
+    if (!jitter)
+    {
+        return 3000000;
+    }
+    uint64_t delay = 2000000 + nextRandom(3000000);
+    if (nextRandom(100) < 10)
+    {
+        delay += 20000000 + nextRandom(80000000);
+    }
+    return delay;
+}
+
+// The request reaches the server after one delay, its reply the bridge after another, if it isn't lost
+void serveRequest(const uint8_t *data, u16_t length)
+{
+    TEST_ASSERT_EQUAL_UINT16(NTP_PACKET_SIZE, length);
+    uint64_t up = oneWayDelay();
+    uint64_t down = oneWayDelay();
+    if (jitter && nextRandom(100) < 5)
+    {
+        lostReplies++;
+        return;
+    }
+    double receive = trueNanos() + up;
+    memset(replyPacket, 0, sizeof(replyPacket));
+    replyPacket[0] = 0x24; // no leap warning, version 4, server
+    replyPacket[1] = 2;    // stratum
+    memcpy(replyPacket + 24, data + 40, 8); // originate timestamp: the transmit timestamp of the request
+    writeServerTime(replyPacket + 32, serverMicros(receive));
+    writeServerTime(replyPacket + 40, serverMicros(receive + SERVER_TIME));
+    replyDue = hostNanos + (uint64_t)((up + SERVER_TIME + down) * (1 + drift * 1e-6));
+    pending = true;
+}
+
+// Error of the clock against the server (in us)
+int64_t clockError(TimeService &clock)
+{
+    return (int64_t)clock.nowEpochMicros() - serverMicros(trueNanos());
+}
+
+// One run of handle(), then to the next step or the arrival of the reply
+void step(TimeService &clock)
+{
+    clock.handle();
+    uint64_t next = hostNanos + STEP;
+    if (pending && replyDue <= next)
+    {
+        hostNanos = replyDue;
+        pending = false;
+        hostUdpReceive(replyPacket, NTP_PACKET_SIZE);
+        return;
+    }
+    hostNanos = next;
+}
+
+void setUp()
+{
+    randomState = 1;
+    hostNanos = 1000000000;
+    driftStart = hostNanos;
+    trueBase = hostNanos;
+    drift = 0;
+    jitter = true;
+    serverOffset = 0;
+    pending = false;
+    lostReplies = 0;
+    hostUdpSendHandler = serveRequest;
+}
+
+void tearDown()
+{
+    hostUdpSendHandler = nullptr;
+}
+
+// 4 h of drift, jitter, spikes and losses: the clock follows the server without steps and never goes backwards
+void test_clock_discipline()
+{
+    TimeService clock;
+    clock.begin("pool.ntp.org", POLL_INTERVAL);
+    setDrift(40);
+
+    uint64_t start = hostNanos;
+    uint64_t sum = 0;
+    uint32_t count = 0;
+    int64_t maxError = 0;
+    uint64_t last = 0;
+    while (hostNanos - start < RUN_TIME)
+    {
+        if (drift == 40 && hostNanos - start >= RUN_TIME / 2)
+        {
+            setDrift(55);
+        }
+        step(clock);
+        uint64_t now = clock.nowEpochMicros();
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT64(last, now);
+        last = now;
+        if (hostNanos - start >= SETTLE_TIME)
+        {
+            int64_t error = clockError(clock);
+            error = (error < 0) ? -error : error;
+            sum += error;
+            count++;
+            maxError = max(maxError, error);
+        }
+    }
+
+    char message[160];
+    snprintf(message, sizeof(message), "mean error %.2f ms, max. %.2f ms, drift %.1f ppm, %u samples, %u rejected, %u lost",
+             sum / 1000.0 / count, maxError / 1000.0, clock.drift() / 1000.0, clock.samples(), clock.rejected(), lostReplies);
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_TRUE(clock.synced());
+    TEST_ASSERT_EQUAL_UINT32(0, clock.steps());
+    TEST_ASSERT_GREATER_THAN_UINT32(0, clock.rejected());
+    TEST_ASSERT_LESS_THAN_UINT64(1000, sum / count);
+    TEST_ASSERT_LESS_THAN_INT64(3000, maxError);
+    // The drift was learned: the local clock runs fast, the correction is negative
+    TEST_ASSERT_INT32_WITHIN(5000, -55000, clock.drift());
+}
+
+// A 100 ms offset (below the step threshold) is slewed, drift and slew together don't exceed 500 ppm
+void test_correction_rate_limit()
+{
+    jitter = false;
+    for (int8_t direction = 1; direction >= -1; direction -= 2)
+    {
+        TimeService clock;
+        clock.begin("pool.ntp.org", POLL_INTERVAL);
+        serverOffset = 0;
+        while (clock.samples() < 3)
+        {
+            step(clock);
+        }
+        serverOffset = direction * 100000;
+        while (clock.samples() < 4)
+        {
+            step(clock);
+        }
+        uint64_t local = micros64();
+        int64_t epoch = clock.nowEpochMicros();
+        for (uint16_t i = 0; i < 1000; i++)
+        {
+            step(clock);
+        }
+        int64_t elapsed = micros64() - local;
+        int64_t rate = ((int64_t)clock.nowEpochMicros() - epoch - elapsed) * 1000000 / elapsed; // in ppm
+        TEST_ASSERT_INT64_WITHIN(1, direction * 500, rate);
+        TEST_ASSERT_EQUAL_UINT32(0, clock.steps());
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_clock_discipline);
+    RUN_TEST(test_correction_rate_limit);
+    return UNITY_END();
+}
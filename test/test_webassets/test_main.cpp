@@ -0,0 +1,92 @@
+/*
+ * Embedded web assets (webassets.h, generated by scripts/embed_web.py): the gzipped style sheet is the one in web/,
+ * and the bytes a browser loads for the style over a number of page views, inline against /style.css with ETag.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "webassets.h"
+
+const uint8_t PAGE_VIEWS = 20;
+const char STYLE_LINK[] = "<link rel='stylesheet' href='/style.css'>\n"; // see HTMLHeader()
+
+uint8_t source[8192];
+size_t sourceLength;
+
+// web/ of this project, found from the path of this file
+bool readSource(const char *name)
+{
+    char path[512];
+    const char *test = strstr(__FILE__, "test/test_webassets");
+    snprintf(path, sizeof(path), "%.*sweb/%s", (int)(test - __FILE__), __FILE__, name);
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    sourceLength = fread(source, 1, sizeof(source), file);
+    fclose(file);
+    return true;
+}
+
+uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+uint32_t readLE32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// The gzip trailer holds CRC32 and size of the source, so a stale webassets.h is found without unpacking it
+void test_style_matches_source()
+{
+    TEST_ASSERT_TRUE(readSource("style.css"));
+    TEST_ASSERT_EQUAL_UINT8(0x1F, STYLE_CSS_GZ[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x8B, STYLE_CSS_GZ[1]);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(STYLE_CSS_GZ), STYLE_CSS_GZ_LENGTH);
+    TEST_ASSERT_EQUAL_UINT32(sourceLength, readLE32(STYLE_CSS_GZ + STYLE_CSS_GZ_LENGTH - 4));
+    TEST_ASSERT_EQUAL_HEX32(crc32(source, sourceLength), readLE32(STYLE_CSS_GZ + STYLE_CSS_GZ_LENGTH - 8));
+
+    // Strong ETag: quoted, 16 hex digits of the content hash
+    TEST_ASSERT_EQUAL_UINT32(18, strlen(STYLE_CSS_ETAG));
+    TEST_ASSERT_EQUAL_UINT8('"', STYLE_CSS_ETAG[0]);
+    TEST_ASSERT_EQUAL_UINT8('"', STYLE_CSS_ETAG[17]);
+}
+
+// Style bytes of a session: inline in every page, or a link and the gzipped sheet once, then 304 without body
+void test_style_bytes_per_session()
+{
+    TEST_ASSERT_TRUE(readSource("style.css"));
+    uint32_t inlineBytes = PAGE_VIEWS * (strlen("<style>\n</style>") + sourceLength);
+    uint32_t linkedBytes = PAGE_VIEWS * strlen(STYLE_LINK) + STYLE_CSS_GZ_LENGTH;
+
+    char message[120];
+    snprintf(message, sizeof(message), "%u page views: inline style %u bytes, linked %u bytes (%u per page, %u once)", PAGE_VIEWS,
+             inlineBytes, linkedBytes, (unsigned)strlen(STYLE_LINK), (unsigned)STYLE_CSS_GZ_LENGTH);
+    TEST_MESSAGE(message);
+    // Already the first view is smaller
+    TEST_ASSERT_LESS_THAN_UINT32(inlineBytes / PAGE_VIEWS, strlen(STYLE_LINK) + STYLE_CSS_GZ_LENGTH);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_style_matches_source);
+    RUN_TEST(test_style_bytes_per_session);
+    return UNITY_END();
+}
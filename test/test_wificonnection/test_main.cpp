@@ -0,0 +1,224 @@
+/*
+ * WiFi connection manager (wificonnection.h) through outages of the simulated AP in test/stubs/ESP8266WiFi.h.
+ * handle() runs every 10 ms like from loop(), the SDK events are delivered in between.
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "wificonnection.h"
+
+const unsigned long LOOP_PERIOD = 10; // ms
+
+WiFiConnection *connection;
+uint32_t connects;           // handle() returned true
+unsigned long maxAttemptGap; // longest time between the start of two attempts (in ms)
+unsigned long lastAttempt;   // millis() of the last attempt
+uint32_t lastAttempts;
+
+// Run loop() for time ms
+void run(unsigned long time)
+{
+    unsigned long end = millis() + time;
+    while (millis() < end)
+    {
+        WiFi.run();
+        if (connection->handle())
+        {
+            connects++;
+        }
+        if (WiFi.attempts != lastAttempts)
+        {
+            if (lastAttempts > 0)
+            {
+                maxAttemptGap = max(maxAttemptGap, millis() - lastAttempt);
+            }
+            lastAttempts = WiFi.attempts;
+            lastAttempt = millis();
+        }
+        delay(LOOP_PERIOD);
+    }
+}
+
+// Run until connected, returns the time it took (in ms)
+unsigned long runUntilConnected(unsigned long limit)
+{
+    unsigned long start = millis();
+    while (!connection->connected() && millis() - start < limit)
+    {
+        run(LOOP_PERIOD);
+    }
+    return millis() - start;
+}
+
+void setUp()
+{
+    hostNanos = 0;
+    WiFi = HostWiFi();
+    connection = new WiFiConnection();
+    connects = 0;
+    maxAttemptGap = 0;
+    lastAttempt = 0;
+    lastAttempts = 0;
+}
+
+void tearDown()
+{
+    delete connection;
+}
+
+// First boot with a reachable AP: one scan, then connected, the time is recorded
+void test_boot_connects()
+{
+    delay(300); // boot until setup() starts the connection
+    connection->begin("home", "secret");
+    TEST_ASSERT_FALSE(connection->connected()); // begin() doesn't wait
+
+    unsigned long time = runUntilConnected(20000);
+    TEST_ASSERT_TRUE(connection->connected());
+    TEST_ASSERT_EQUAL_UINT32(1, connects);
+    TEST_ASSERT_EQUAL_UINT32(1, WiFi.attempts);
+    TEST_ASSERT_FALSE(connection->lastConnectFast());
+    TEST_ASSERT_UINT32_WITHIN(LOOP_PERIOD, 300 + HOST_WIFI_SCAN_TIME + HOST_WIFI_DHCP_TIME, connection->firstConnectTime());
+    TEST_ASSERT_EQUAL_UINT32(0, connection->reconnects());
+    TEST_ASSERT_EQUAL_UINT8(WiFi.apChannel, connection->currentChannel());
+
+    char message[80];
+    snprintf(message, sizeof(message), "first connect after %lu ms (%lu ms in loop)", connection->firstConnectTime(), time);
+    TEST_MESSAGE(message);
+}
+
+// Boot with known BSSID and channel skips the scan
+void test_boot_fast_connect()
+{
+    connection->begin("home", "secret", WiFi.apBSSID, WiFi.apChannel);
+    runUntilConnected(20000);
+    TEST_ASSERT_TRUE(connection->lastConnectFast());
+    TEST_ASSERT_UINT32_WITHIN(LOOP_PERIOD, HOST_WIFI_ASSOCIATE_TIME + HOST_WIFI_DHCP_TIME, connection->firstConnectTime());
+}
+
+// AP down at boot: retries back off, the fallback SoftAP starts after WIFI_AP_FALLBACK_FAILURES and stops on connect
+void test_ap_down_at_boot()
+{
+    WiFi.setAccessPoint(false);
+    connection->begin("home", "secret");
+
+    // Timeouts of 15 s with pauses of 1, 2, 4, 8 s until the fifth failure
+    run(5 * WIFI_CONNECT_TIMEOUT + 15000 - 1000);
+    TEST_ASSERT_FALSE(connection->accessPointActive());
+    run(2000);
+    TEST_ASSERT_EQUAL_UINT32(WIFI_AP_FALLBACK_FAILURES, connection->failures());
+    TEST_ASSERT_TRUE(connection->accessPointActive());
+    TEST_ASSERT_TRUE(WiFi.softAPActive);
+    TEST_ASSERT_EQUAL_INT(WIFI_AP_STA, WiFi.currentMode);
+    TEST_ASSERT_EQUAL_UINT32(0, connection->firstConnectTime());
+
+    WiFi.setAccessPoint(true);
+    unsigned long time = runUntilConnected(WIFI_BACKOFF_MAX + WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_TRUE(connection->connected());
+    TEST_ASSERT_FALSE(connection->accessPointActive());
+    TEST_ASSERT_FALSE(WiFi.softAPActive);
+    TEST_ASSERT_EQUAL_INT(WIFI_STA, WiFi.currentMode);
+    TEST_ASSERT_EQUAL_UINT32(0, connection->reconnects());
+
+    char message[80];
+    snprintf(message, sizeof(message), "connected %lu ms after the AP came up", time);
+    TEST_MESSAGE(message);
+}
+
+// Short outage: the loss is noticed at once, the first attempt after it uses BSSID and channel
+void test_short_outage()
+{
+    connection->begin("home", "secret");
+    runUntilConnected(20000);
+    run(10000);
+
+    WiFi.setAccessPoint(false);
+    run(100);
+    TEST_ASSERT_FALSE(connection->connected());
+    run(2000);
+    WiFi.setAccessPoint(true);
+    unsigned long time = runUntilConnected(WIFI_CONNECT_TIMEOUT);
+
+    TEST_ASSERT_TRUE(connection->connected());
+    TEST_ASSERT_TRUE(connection->lastConnectFast());
+    TEST_ASSERT_EQUAL_UINT32(1, connection->reconnects());
+    TEST_ASSERT_EQUAL_UINT32(0, connection->failures());
+    TEST_ASSERT_EQUAL_UINT32(2, connects);
+    TEST_ASSERT_UINT32_WITHIN(LOOP_PERIOD * 2, HOST_WIFI_ASSOCIATE_TIME + HOST_WIFI_DHCP_TIME, time);
+    TEST_ASSERT_FALSE(connection->accessPointActive());
+}
+
+// Long outage: an attempt starts at most the max. backoff after the last one failed, the SoftAP covers the outage
+void test_long_outage()
+{
+    connection->begin("home", "secret");
+    runUntilConnected(20000);
+
+    WiFi.setAccessPoint(false);
+    maxAttemptGap = 0;
+    run(30 * 60000UL);
+    TEST_ASSERT_TRUE(connection->accessPointActive());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(WIFI_BACKOFF_MAX + WIFI_CONNECT_TIMEOUT + LOOP_PERIOD, maxAttemptGap);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(WIFI_BACKOFF_MAX, maxAttemptGap - WIFI_CONNECT_TIMEOUT);
+    uint32_t failures = connection->failures();
+    TEST_ASSERT_GREATER_THAN_UINT32(20, failures);
+
+    WiFi.setAccessPoint(true);
+    unsigned long time = runUntilConnected(WIFI_BACKOFF_MAX + WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_TRUE(connection->connected());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(WIFI_BACKOFF_MAX + WIFI_CONNECT_TIMEOUT, time);
+    TEST_ASSERT_FALSE(connection->accessPointActive());
+    TEST_ASSERT_EQUAL_UINT32(1, connection->reconnects());
+
+    // The backoff starts over after a connect: a fast and a normal attempt, then the min. pause
+    WiFi.setAccessPoint(false);
+    run(WIFI_FAST_CONNECT_TIMEOUT + WIFI_CONNECT_TIMEOUT + LOOP_PERIOD);
+    TEST_ASSERT_EQUAL_UINT32(failures + 1, connection->failures());
+    uint32_t attempts = WiFi.attempts;
+    run(WIFI_BACKOFF_MIN + LOOP_PERIOD);
+    TEST_ASSERT_EQUAL_UINT32(attempts + 1, WiFi.attempts);
+
+    char message[128];
+    snprintf(message, sizeof(message), "%u failed attempts in 30 min, max. gap %lu ms, reconnect %lu ms after the AP", failures, maxAttemptGap,
+             time);
+    TEST_MESSAGE(message);
+}
+
+// AP moved to another channel during an outage: the fast attempt fails quickly and a scan finds it
+void test_ap_moved()
+{
+    connection->begin("home", "secret");
+    runUntilConnected(20000);
+
+    WiFi.setAccessPoint(false);
+    run(1000);
+    WiFi.moveAccessPoint(11, 0x66);
+    WiFi.setAccessPoint(true);
+    unsigned long time = runUntilConnected(WIFI_CONNECT_TIMEOUT);
+
+    TEST_ASSERT_TRUE(connection->connected());
+    TEST_ASSERT_FALSE(connection->lastConnectFast());
+    TEST_ASSERT_EQUAL_UINT8(11, connection->currentChannel());
+    TEST_ASSERT_EQUAL_UINT8(0x66, connection->currentBSSID()[5]);
+    TEST_ASSERT_EQUAL_UINT32(0, connection->failures());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(WIFI_FAST_CONNECT_TIMEOUT + HOST_WIFI_SCAN_TIME + HOST_WIFI_DHCP_TIME + 2 * LOOP_PERIOD, time);
+
+    // The next loss uses the new channel
+    WiFi.setAccessPoint(false);
+    run(100);
+    WiFi.setAccessPoint(true);
+    runUntilConnected(WIFI_CONNECT_TIMEOUT);
+    TEST_ASSERT_TRUE(connection->lastConnectFast());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_connects);
+    RUN_TEST(test_boot_fast_connect);
+    RUN_TEST(test_ap_down_at_boot);
+    RUN_TEST(test_short_outage);
+    RUN_TEST(test_long_outage);
+    RUN_TEST(test_ap_moved);
+    return UNITY_END();
+}